@@ -9,10 +9,65 @@
 
 #include "czmucPCH.h"
 #include "crazygaze/muc/ChunkBuffer.h"
+#if CZ_SSE2
+	#include <emmintrin.h>
+#endif
 
 namespace cz
 {
 
+namespace
+{
+	// Maximum number of bytes a 64 bits varint can take
+	constexpr unsigned MaxVarintBytes = 10;
+
+	inline unsigned countTrailingZeros(unsigned v)
+	{
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward(&idx, v);
+		return idx;
+#else
+		return __builtin_ctz(v);
+#endif
+	}
+
+	unsigned encodeVarint(uint64_t val, uint8_t* dst)
+	{
+		unsigned n = 0;
+		while (val >= 0x80)
+		{
+			dst[n++] = static_cast<uint8_t>(val | 0x80);
+			val >>= 7;
+		}
+		dst[n++] = static_cast<uint8_t>(val);
+		return n;
+	}
+
+	// Decodes a varint from contiguous memory.
+	// Returns how many bytes were used, or 0 if the varint doesn't end before "end".
+	unsigned decodeVarint(const uint8_t* ptr, const uint8_t* end, uint64_t& val)
+	{
+		uint64_t res = 0;
+		unsigned shift = 0;
+		const uint8_t* p = ptr;
+		while (p != end)
+		{
+			uint8_t b = *p++;
+			res |= uint64_t(b & 0x7F) << shift;
+			if ((b & 0x80) == 0)
+			{
+				val = res;
+				return static_cast<unsigned>(p - ptr);
+			}
+			shift += 7;
+			if (shift >= MaxVarintBytes * 7)
+				throw std::runtime_error("Malformed varint.");
+		}
+		return 0;
+	}
+}
+
 struct BlockReadInfo
 {
 	char* dst;
@@ -103,6 +158,12 @@ void ChunkBuffer::Block::writeAt(unsigned pos, BlockWriteInfo& info)
 	info.size -= portion;
 }
 
+void ChunkBuffer::Block::skip(unsigned size) const
+{
+	CZ_ASSERT(size <= this->size());
+	m_readPos += size;
+}
+
 const char* ChunkBuffer::Block::getReadPtr() const
 {
 	return m_ptr.get() + m_readPos;
@@ -123,10 +184,7 @@ ChunkBuffer::ChunkBuffer(unsigned initialCapacity, unsigned defaultBlockSize)
 
 unsigned ChunkBuffer::calcSize() const
 {
-	unsigned size = 0;
-	for (auto&& i : m_blocks.container())
-		size += i.size();
-	return size;
+	return m_size;
 }
 
 unsigned ChunkBuffer::getDefaultBlockSize() const
@@ -134,6 +192,16 @@ unsigned ChunkBuffer::getDefaultBlockSize() const
 	return m_defaultBlockSize;
 }
 
+void ChunkBuffer::setEncoding(Encoding encoding)
+{
+	m_encoding = encoding;
+}
+
+ChunkBuffer::Encoding ChunkBuffer::getEncoding() const
+{
+	return m_encoding;
+}
+
 unsigned ChunkBuffer::numBlocks() const
 {
 	return static_cast<unsigned>(m_blocks.size());
@@ -149,6 +217,7 @@ void ChunkBuffer::writeBlock(std::shared_ptr<char[]> data, unsigned capacity, un
 {
 	CZ_ASSERT(capacity && size <= capacity);
 	m_blocks.emplace(std::move(data), capacity, size);
+	m_size += size;
 }
 
 void ChunkBuffer::write(const void* data, unsigned size)
@@ -163,6 +232,7 @@ void ChunkBuffer::write(const void* data, unsigned size)
 			writeBlock(make_shared_array<char>(m_defaultBlockSize), m_defaultBlockSize, 0);
 		m_blocks.back().write(info);
 	}
+	m_size += size;
 }
 
 void ChunkBuffer::read(void* data, unsigned size) const
@@ -177,7 +247,9 @@ void ChunkBuffer::read(void* data, unsigned size) const
 	{
 		if (m_blocks.size() == 0) // no more blocks
 			throw std::runtime_error("No more data left to read.");
+		auto todo = info.size;
 		m_blocks.front().read(info);
+		m_size -= todo - info.size;
 		// Drop the block if no more data to read
 		if (m_blocks.front().size() == 0)
 			m_blocks.pop();
@@ -226,6 +298,7 @@ cz::ChunkBuffer::WritePos ChunkBuffer::writeReserve(unsigned size)
 			writeBlock(make_shared_array<char>(m_defaultBlockSize), m_defaultBlockSize, 0);
 		m_blocks.back().reserveWrite(info);
 	}
+	m_size += size;
 
 	return ret;
 }
@@ -247,21 +320,398 @@ void ChunkBuffer::peek(void* data, unsigned size) const
 
 bool ChunkBuffer::tryRead(std::string& dst) const
 {
-	int bufSize = calcSize();
-	int strSize;
-	if (!peek(strSize))
-		return false;
-	if (bufSize < static_cast<int>(sizeof(strSize)) + strSize)
+	unsigned bufSize = calcSize();
+	unsigned strSize;
+	unsigned headerSize;
+	if (m_encoding == Encoding::Compact)
+	{
+		uint64_t tmp;
+		if (!peekVarint(tmp, headerSize))
+			return false;
+		strSize = static_cast<unsigned>(tmp);
+	}
+	else
+	{
+		if (!peek(strSize))
+			return false;
+		headerSize = sizeof(strSize);
+	}
+
+	if (bufSize < headerSize + strSize)
 		return false;
 
 	dst.clear();
 	dst.reserve(strSize);
 	dst.append(strSize, 0);
-	read<int>(strSize);
-	read(&dst[0], strSize);
+	skip(headerSize);
+	if (strSize)
+		read(&dst[0], strSize);
 	return true;
 }
 
+void ChunkBuffer::skip(unsigned size) const
+{
+	while (size)
+	{
+		if (m_blocks.size() == 0) // no more blocks
+			throw std::runtime_error("No more data left to read.");
+		auto portion = std::min(size, m_blocks.front().size());
+		m_blocks.front().skip(portion);
+		m_size -= portion;
+		size -= portion;
+		// Drop the block if no more data to read
+		if (m_blocks.front().size() == 0)
+			m_blocks.pop();
+	}
+}
+
+void ChunkBuffer::writeVarint(uint64_t val)
+{
+	uint8_t buf[MaxVarintBytes];
+	write(buf, encodeVarint(val, buf));
+}
+
+bool ChunkBuffer::peekVarint(uint64_t& val, unsigned& numBytes) const
+{
+	uint64_t res = 0;
+	unsigned shift = 0;
+	numBytes = 0;
+	for (auto&& block : m_blocks.container())
+	{
+		auto p = reinterpret_cast<const uint8_t*>(block.getReadPtr());
+		auto end = p + block.size();
+		while (p != end)
+		{
+			uint8_t b = *p++;
+			numBytes++;
+			res |= uint64_t(b & 0x7F) << shift;
+			if ((b & 0x80) == 0)
+			{
+				val = res;
+				return true;
+			}
+			shift += 7;
+			if (shift >= MaxVarintBytes * 7)
+				throw std::runtime_error("Malformed varint.");
+		}
+	}
+	return false;
+}
+
+void ChunkBuffer::readVarint(uint64_t& val) const
+{
+#if CZ_DEBUG
+	m_dbgReadCounter++;
+#endif
+
+	// Fast path, for when the varint is fully contained in the front block
+	if (m_blocks.size())
+	{
+		auto p = reinterpret_cast<const uint8_t*>(m_blocks.front().getReadPtr());
+		if (unsigned n = decodeVarint(p, p + m_blocks.front().size(), val))
+		{
+			skip(n);
+			return;
+		}
+	}
+
+	unsigned numBytes;
+	if (!peekVarint(val, numBytes))
+		throw std::runtime_error("No more data left to read.");
+	skip(numBytes);
+}
+
+template<typename T>
+void ChunkBuffer::writeVarintsImpl(const T* src, unsigned count)
+{
+	// Encode into a local buffer, so we don't pay for a write call per element
+	uint8_t buf[1024];
+	unsigned used = 0;
+	while (count--)
+	{
+		if (used + MaxVarintBytes > sizeof(buf))
+		{
+			write(buf, used);
+			used = 0;
+		}
+		used += encodeVarint(details::zigzagEncode(*src++), buf + used);
+	}
+	write(buf, used);
+}
+
+template<typename T>
+void ChunkBuffer::readVarintsImpl(T* dst, unsigned count) const
+{
+#if CZ_DEBUG
+	m_dbgReadCounter++;
+#endif
+	using U = details::VarintType<T>;
+	uint64_t v;
+	while (count)
+	{
+		if (m_blocks.size() == 0) // no more blocks
+			throw std::runtime_error("No more data left to read.");
+
+		const Block& block = m_blocks.front();
+		auto start = reinterpret_cast<const uint8_t*>(block.getReadPtr());
+		auto p = start;
+		auto end = start + block.size();
+
+#if CZ_SSE2
+		// Process 16 bytes at a time, using the continuation bits to find where each varint ends.
+		// Small numbers are the common case, and if all 16 bytes are single byte varints, there is nothing to
+		// do other than widen them.
+		while (count && (end - p) >= 16)
+		{
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+			if (mask == 0)
+			{
+				unsigned todo = std::min(count, 16u);
+				for (unsigned i = 0; i < todo; i++)
+					dst[i] = details::zigzagDecode<T>(static_cast<U>(p[i]));
+				dst += todo;
+				p += todo;
+				count -= todo;
+				continue;
+			}
+
+			unsigned terminators = ~mask & 0xFFFF;
+			unsigned pos = 0;
+			while (terminators && count)
+			{
+				unsigned last = countTrailingZeros(terminators);
+				if (last - pos >= MaxVarintBytes)
+					throw std::runtime_error("Malformed varint.");
+				v = 0;
+				for (unsigned i = pos; i <= last; i++)
+					v |= uint64_t(p[i] & 0x7F) << (7 * (i - pos));
+				*dst++ = details::zigzagDecode<T>(static_cast<U>(v));
+				count--;
+				pos = last + 1;
+				terminators &= terminators - 1;
+			}
+
+			// No varint ends in these 16 bytes, so it's malformed. Let the scalar code deal with it
+			if (pos == 0)
+				break;
+			p += pos;
+		}
+#endif
+
+		// Whatever is left in the block
+		unsigned n;
+		while (count && (n = decodeVarint(p, end, v)) != 0)
+		{
+			*dst++ = details::zigzagDecode<T>(static_cast<U>(v));
+			count--;
+			p += n;
+		}
+
+		block.skip(static_cast<unsigned>(p - start));
+		m_size -= static_cast<unsigned>(p - start);
+		if (block.size() == 0)
+		{
+			m_blocks.pop();
+		}
+		else if (count)
+		{
+			// Varint crossing into the next block
+			readVarint(v);
+			*dst++ = details::zigzagDecode<T>(static_cast<U>(v));
+			count--;
+		}
+	}
+}
+
+void ChunkBuffer::writeVarints(const uint16_t* src, unsigned count) { writeVarintsImpl(src, count); }
+void ChunkBuffer::writeVarints(const int16_t* src, unsigned count) { writeVarintsImpl(src, count); }
+void ChunkBuffer::writeVarints(const uint32_t* src, unsigned count) { writeVarintsImpl(src, count); }
+void ChunkBuffer::writeVarints(const int32_t* src, unsigned count) { writeVarintsImpl(src, count); }
+void ChunkBuffer::writeVarints(const uint64_t* src, unsigned count) { writeVarintsImpl(src, count); }
+void ChunkBuffer::writeVarints(const int64_t* src, unsigned count) { writeVarintsImpl(src, count); }
+void ChunkBuffer::readVarints(uint16_t* dst, unsigned count) const { readVarintsImpl(dst, count); }
+void ChunkBuffer::readVarints(int16_t* dst, unsigned count) const { readVarintsImpl(dst, count); }
+void ChunkBuffer::readVarints(uint32_t* dst, unsigned count) const { readVarintsImpl(dst, count); }
+void ChunkBuffer::readVarints(int32_t* dst, unsigned count) const { readVarintsImpl(dst, count); }
+void ChunkBuffer::readVarints(uint64_t* dst, unsigned count) const { readVarintsImpl(dst, count); }
+void ChunkBuffer::readVarints(int64_t* dst, unsigned count) const { readVarintsImpl(dst, count); }
+
+void ChunkBuffer::writeSize(unsigned size)
+{
+	if (m_encoding == Encoding::Compact)
+		writeVarint(size);
+	else
+		write(size);
+}
+
+unsigned ChunkBuffer::readSize() const
+{
+	if (m_encoding == Encoding::Compact)
+	{
+		uint64_t size;
+		readVarint(size);
+		if (size > std::numeric_limits<unsigned>::max())
+			throw std::runtime_error("Invalid container size.");
+		return static_cast<unsigned>(size);
+	}
+	else
+	{
+		unsigned size;
+		read(size);
+		return size;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+//	ChunkBuffer::ReadCursor
+//
+//////////////////////////////////////////////////////////////////////////
+
+ChunkBuffer::ReadCursor::ReadCursor(const ChunkBuffer& buf)
+	: m_buf(buf)
+{
+#ifndef NDEBUG
+	m_dbgReadCounter = buf.m_dbgReadCounter;
+#endif
+}
+
+bool ChunkBuffer::ReadCursor::read(void* data, unsigned size)
+{
+	if (!require(size))
+		return false;
+
+	auto dst = reinterpret_cast<char*>(data);
+	auto& blocks = m_buf.m_blocks.container();
+	m_consumed += size;
+	while (size)
+	{
+		const Block& block = blocks[m_block];
+		// Only move to the next block when we need more data, since the current block can still receive writes
+		unsigned left = block.size() - m_offset;
+		if (left == 0)
+		{
+			m_block++;
+			m_offset = 0;
+			continue;
+		}
+
+		auto portion = std::min(size, left);
+		if (dst)
+		{
+			memcpy(dst, block.getReadPtr() + m_offset, portion);
+			dst += portion;
+		}
+		m_offset += portion;
+		size -= portion;
+	}
+
+	return true;
+}
+
+bool ChunkBuffer::ReadCursor::skip(unsigned size)
+{
+	return read(nullptr, size);
+}
+
+bool ChunkBuffer::ReadCursor::readVarint(uint64_t& val)
+{
+	if (m_status != Status::Ok)
+		return false;
+
+	auto& blocks = m_buf.m_blocks.container();
+	uint64_t res = 0;
+	unsigned shift = 0;
+	unsigned numBytes = 0;
+	unsigned blockIdx = m_block;
+	unsigned offset = m_offset;
+	while (blockIdx < blocks.size())
+	{
+		const Block& block = blocks[blockIdx];
+		auto p = reinterpret_cast<const uint8_t*>(block.getReadPtr());
+		unsigned size = block.size();
+		while (offset < size)
+		{
+			uint8_t b = p[offset++];
+			numBytes++;
+			res |= uint64_t(b & 0x7F) << shift;
+			if ((b & 0x80) == 0)
+			{
+				val = res;
+				m_block = blockIdx;
+				m_offset = offset;
+				m_consumed += numBytes;
+				return true;
+			}
+			shift += 7;
+			if (shift >= MaxVarintBytes * 7)
+			{
+				m_status = Status::Malformed;
+				return false;
+			}
+		}
+		blockIdx++;
+		offset = 0;
+	}
+
+	m_status = Status::NeedMoreData;
+	return false;
+}
+
+bool ChunkBuffer::ReadCursor::readSize(unsigned& size)
+{
+	if (m_buf.m_encoding == Encoding::Compact)
+	{
+		uint64_t tmp;
+		if (!readVarint(tmp))
+			return false;
+		if (tmp > std::numeric_limits<unsigned>::max())
+		{
+			m_status = Status::Malformed;
+			return false;
+		}
+		size = static_cast<unsigned>(tmp);
+		return true;
+	}
+	else
+	{
+		return read(size);
+	}
+}
+
+void ChunkBuffer::ReadCursor::commit()
+{
+	CZ_ASSERT(m_status == Status::Ok);
+#if CZ_DEBUG
+	// Make sure no reads were made since the cursor was created or last committed
+	CZ_ASSERT(m_dbgReadCounter == m_buf.m_dbgReadCounter);
+	m_dbgReadCounter = ++m_buf.m_dbgReadCounter;
+#endif
+
+	auto& blocks = m_buf.m_blocks;
+	for (; m_block; m_block--)
+		blocks.pop();
+	if (m_offset)
+	{
+		blocks.front().skip(m_offset);
+		// Drop the block if no more data to read
+		if (blocks.front().size() == 0)
+			blocks.pop();
+	}
+
+	m_buf.m_size -= m_consumed;
+	m_offset = 0;
+	m_consumed = 0;
+}
+
+void ChunkBuffer::ReadCursor::rewind()
+{
+	m_block = 0;
+	m_offset = 0;
+	m_consumed = 0;
+	m_status = Status::Ok;
+}
+
 //////////////////////////////////////////////////////////////////////////
 //
 // Write operators
@@ -269,7 +719,7 @@ bool ChunkBuffer::tryRead(std::string& dst) const
 //////////////////////////////////////////////////////////////////////////
 ChunkBuffer& operator<<(ChunkBuffer& stream, const std::string& v)
 {
-	stream.write(static_cast<unsigned>(v.size()));
+	stream.writeSize(static_cast<unsigned>(v.size()));
 	stream.write(v.data(), static_cast<unsigned>(v.size()));
 	return stream;
 }
@@ -277,7 +727,7 @@ ChunkBuffer& operator<<(ChunkBuffer& stream, const std::string& v)
 ChunkBuffer& operator << (ChunkBuffer& stream, const char* v)
 {
 	unsigned len = static_cast<unsigned>(strlen(v));
-	stream.write(len);
+	stream.writeSize(len);
 	stream.write(v, len);
 	return stream;
 }
@@ -290,15 +740,27 @@ ChunkBuffer& operator << (ChunkBuffer& stream, const char* v)
 
 const ChunkBuffer& operator >> (const ChunkBuffer& stream, std::string& v)
 {
-	unsigned size;
-	stream >> size;
+	unsigned size = stream.readSize();
 	v.clear();
 	v.reserve(size);
 	v.append(size, 0);
-	stream.read(&v[0], size);
+	if (size)
+		stream.read(&v[0], size);
 	return stream;
 }
 
+ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, std::string& v)
+{
+	unsigned size;
+	if (!cursor.readSize(size) || !cursor.require(size))
+		return cursor;
+	v.clear();
+	v.append(size, 0);
+	if (size)
+		cursor.read(&v[0], size);
+	return cursor;
+}
+
 void details::ParameterPack::serialize(ChunkBuffer& stream)
 {
 }
@@ -12,9 +12,12 @@
 #pragma once
 
 #include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/Expected.h"
 #include <memory>
 #include <queue>
 #include <functional>
+#include <type_traits>
+#include <cstdint>
 
 namespace cz
 {
@@ -37,8 +40,52 @@ std::shared_ptr<T[]> make_shared_array(size_t size)
 }
 #endif
 
+namespace details
+{
+	// Integer types that the Compact encoding writes as varints.
+	// 1 byte types don't gain anything from it, so they are always written as-is
+	template<typename T>
+	constexpr bool isVarintType = std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) > 1;
+
+	template<typename T>
+	using VarintType = std::make_unsigned_t<T>;
+
+	//! Maps signed integers to unsigned integers so that numbers with a small absolute value
+	// (e.g: -1) have a small varint encoded value too
+	template<typename T>
+	constexpr VarintType<T> zigzagEncode(T v)
+	{
+		if constexpr (std::is_signed_v<T>)
+			return (static_cast<VarintType<T>>(v) << 1) ^ static_cast<VarintType<T>>(v >> (sizeof(T) * 8 - 1));
+		else
+			return v;
+	}
+
+	template<typename T>
+	constexpr T zigzagDecode(VarintType<T> v)
+	{
+		if constexpr (std::is_signed_v<T>)
+			return static_cast<T>((v >> 1) ^ (~(v & 1) + 1));
+		else
+			return v;
+	}
+}
+
 class ChunkBuffer
 {
+public:
+
+	//! Encoding used by the stream operators (<< and >>) for integers and container lengths
+	enum class Encoding : uint8_t
+	{
+		//! Integers are written at full width, and container lengths as a 4 bytes integer
+		Fixed,
+		//! Container lengths and unsigned integers are written as LEB128 varints, and signed integers as zigzag
+		// encoded varints.
+		// 1 byte types and floating point types are still written as-is.
+		Compact
+	};
+
 private:
 
 	class Block
@@ -58,6 +105,8 @@ private:
 		void write(BlockWriteInfo& info);
 		void reserveWrite(BlockReserveWriteInfo& info);
 		void writeAt(unsigned pos, BlockWriteInfo& info);
+		//! Drops the specified number of bytes from the readable data
+		void skip(unsigned size) const;
 		const char* getReadPtr() const;
 	private:
 		std::shared_ptr<char[]> m_ptr;
@@ -80,7 +129,10 @@ private:
 	};
 
 	mutable Queue m_blocks;
+	// Cached number of bytes available to read, so calcSize doesn't need to walk the blocks
+	mutable unsigned m_size = 0;
 	unsigned m_defaultBlockSize=0;
+	Encoding m_encoding = Encoding::Fixed;
 #ifndef NDEBUG
 	mutable unsigned m_dbgReadCounter = 0;
 #endif
@@ -91,11 +143,14 @@ public:
 	ChunkBuffer(ChunkBuffer&) = delete; // Implement this if required
 	ChunkBuffer(ChunkBuffer&& other) noexcept
 		: m_blocks(std::move(other.m_blocks))
+		, m_size(other.m_size)
 		, m_defaultBlockSize(std::move(other.m_defaultBlockSize))
+		, m_encoding(other.m_encoding)
 #ifndef NDEBUG
 		, m_dbgReadCounter(std::move(other.m_dbgReadCounter))
 #endif
 	{
+		other.m_size = 0;
 #ifndef NDEBUG
 		other.m_dbgReadCounter = 0;
 #endif
@@ -105,9 +160,17 @@ public:
 	ChunkBuffer& operator=(ChunkBuffer&&) = delete; // Implement this if required
 
 	//! Returns how many bytes are available to read
+	// This is O(1), since the size is cached
 	unsigned calcSize() const;
 	unsigned getDefaultBlockSize() const;
 
+	//! Sets the encoding used by the stream operators
+	/*! Both ends need to agree on the encoding, since it's not stored in the stream itself.
+	 * writeAt and writeReserve are not affected, and always deal with the full width of the types.
+	 */
+	void setEncoding(Encoding encoding);
+	Encoding getEncoding() const;
+
 	unsigned numBlocks() const;
 	void iterateBlocks(std::function<void(const char*, unsigned)> f);
 
@@ -171,11 +234,255 @@ public:
 
 	bool tryRead(std::string& dst) const;
 
+	//! Writes an unsigned integer as a LEB128 varint
+	void writeVarint(uint64_t val);
+	//! Reads a LEB128 varint.
+	// Throws std::runtime_error if there is not enough data, or the varint is malformed
+	void readVarint(uint64_t& val) const;
+	//! Peeks a LEB128 varint, without consuming it
+	/*!
+	 * \param numBytes
+	 *	How many bytes the encoded varint takes
+	 * 
+	 * \return
+	 *	false if there isn't enough data yet for the entire varint
+	 */
+	bool peekVarint(uint64_t& val, unsigned& numBytes) const;
+
+	//! Bulk varint write/read of integer arrays. Signed types are zigzag encoded
+	void writeVarints(const uint16_t* src, unsigned count);
+	void writeVarints(const int16_t* src, unsigned count);
+	void writeVarints(const uint32_t* src, unsigned count);
+	void writeVarints(const int32_t* src, unsigned count);
+	void writeVarints(const uint64_t* src, unsigned count);
+	void writeVarints(const int64_t* src, unsigned count);
+	void readVarints(uint16_t* dst, unsigned count) const;
+	void readVarints(int16_t* dst, unsigned count) const;
+	void readVarints(uint32_t* dst, unsigned count) const;
+	void readVarints(int32_t* dst, unsigned count) const;
+	void readVarints(uint64_t* dst, unsigned count) const;
+	void readVarints(int64_t* dst, unsigned count) const;
+
+	//! Same as the above, but accepts any integer type (e.g: long), as long as it's size matches one of the
+	// fixed width types
+	template<typename T>
+	void writeVarints(const T* src, unsigned count)
+	{
+		static_assert(details::isVarintType<T>, "Type is not an integer type with more than 1 byte");
+		using Fixed = std::conditional_t<std::is_signed_v<T>, FixedSigned<sizeof(T)>, FixedUnsigned<sizeof(T)>>;
+		writeVarints(reinterpret_cast<const Fixed*>(src), count);
+	}
+
+	template<typename T>
+	void readVarints(T* dst, unsigned count) const
+	{
+		static_assert(details::isVarintType<T>, "Type is not an integer type with more than 1 byte");
+		using Fixed = std::conditional_t<std::is_signed_v<T>, FixedSigned<sizeof(T)>, FixedUnsigned<sizeof(T)>>;
+		readVarints(reinterpret_cast<Fixed*>(dst), count);
+	}
+
+	//! Writes any arithmetic type, taking into account the stream encoding
+	template<typename T>
+	void writeEncoded(const T& val)
+	{
+		if constexpr (details::isVarintType<T>)
+		{
+			if (m_encoding == Encoding::Compact)
+			{
+				writeVarint(details::zigzagEncode(val));
+				return;
+			}
+		}
+		write(val);
+	}
+
+	//! Reads any arithmetic type, taking into account the stream encoding
+	template<typename T>
+	void readEncoded(T& val) const
+	{
+		if constexpr (details::isVarintType<T>)
+		{
+			if (m_encoding == Encoding::Compact)
+			{
+				uint64_t tmp;
+				readVarint(tmp);
+				val = details::zigzagDecode<T>(static_cast<details::VarintType<T>>(tmp));
+				return;
+			}
+		}
+		read(val);
+	}
+
+	//! Writes a container length, taking into account the stream encoding
+	void writeSize(unsigned size);
+	//! Reads a container length, taking into account the stream encoding
+	unsigned readSize() const;
+
+	class ReadCursor;
+
+private:
+
+	template<size_t Size> using FixedUnsigned =
+		std::conditional_t<Size == 2, uint16_t, std::conditional_t<Size == 4, uint32_t, uint64_t>>;
+	template<size_t Size> using FixedSigned =
+		std::conditional_t<Size == 2, int16_t, std::conditional_t<Size == 4, int32_t, int64_t>>;
+
+	//! Drops readable data from the front, across blocks
+	void skip(unsigned size) const;
+
+	template<typename T>
+	void writeVarintsImpl(const T* src, unsigned count);
+	template<typename T>
+	void readVarintsImpl(T* dst, unsigned count) const;
+};
+
+/*!
+ * Transactional reader.
+ * Reads from the buffer without consuming anything until commit() is called, and never throws if there isn't
+ * enough data. Once a read fails, all the following reads fail too, so a whole message can be parsed and checked
+ * at the end. E.g:
+ * \code
+ * ChunkBuffer::ReadCursor cursor(buf);
+ * cursor >> header >> payload;
+ * if (cursor)
+ *     cursor.commit(); // Consumes the message from the buffer
+ * else if (cursor.getStatus() == ChunkBuffer::ReadCursor::Status::NeedMoreData)
+ *     ... try again when more data arrives ...
+ * \endcode
+ * No reads or writes to the buffer are allowed while a cursor is in use, other than appending data.
+ */
+class ChunkBuffer::ReadCursor
+{
+public:
+	enum class Status : uint8_t
+	{
+		Ok,
+		NeedMoreData,
+		Malformed
+	};
+
+	explicit ReadCursor(const ChunkBuffer& buf);
+	ReadCursor(const ReadCursor&) = delete;
+	ReadCursor& operator=(const ReadCursor&) = delete;
+
+	const ChunkBuffer& getBuffer() const
+	{
+		return m_buf;
+	}
+
+	Status getStatus() const
+	{
+		return m_status;
+	}
+
+	//! Used by custom deserialization code to flag invalid data
+	void setMalformed()
+	{
+		m_status = Status::Malformed;
+	}
+
+	explicit operator bool() const
+	{
+		return m_status == Status::Ok;
+	}
+
+	//! Bytes read so far
+	unsigned consumed() const
+	{
+		return m_consumed;
+	}
+
+	//! Bytes available to read past the cursor's position
+	unsigned available() const
+	{
+		return m_buf.m_size - m_consumed;
+	}
+
+	//! Checks if there are at least the specified number of bytes available, and sets the status if not
+	bool require(uint64_t size)
+	{
+		if (m_status != Status::Ok)
+			return false;
+		if (size > available())
+		{
+			m_status = Status::NeedMoreData;
+			return false;
+		}
+		return true;
+	}
+
+	bool read(void* data, unsigned size);
+	bool skip(unsigned size);
+	bool readVarint(uint64_t& val);
+	bool readSize(unsigned& size);
+
+	//! Read any arithmetic type
+	template<typename T>
+	bool read(T& val)
+	{
+		static_assert(std::is_arithmetic<T>::value, "Type is not an arithmetic type");
+		return read(&val, sizeof(val));
+	}
+
+	//! Reads any arithmetic type, taking into account the stream encoding
+	template<typename T>
+	bool readEncoded(T& val)
+	{
+		if constexpr (details::isVarintType<T>)
+		{
+			if (m_buf.m_encoding == Encoding::Compact)
+			{
+				uint64_t tmp;
+				if (!readVarint(tmp))
+					return false;
+				val = details::zigzagDecode<T>(static_cast<details::VarintType<T>>(tmp));
+				return true;
+			}
+		}
+		return read(val);
+	}
+
+	//! Consumes from the buffer everything read so far.
+	/*!
+	 * This doesn't touch the data itself. It only drops the fully read blocks and moves the read position of the
+	 * current block.
+	 */
+	void commit();
+
+	//! Goes back to the start, and clears any errors
+	void rewind();
+
+private:
+	const ChunkBuffer& m_buf;
+	unsigned m_block = 0; // block index
+	unsigned m_offset = 0; // offset within the block's readable data
+	unsigned m_consumed = 0;
+	Status m_status = Status::Ok;
+#ifndef NDEBUG
+	unsigned m_dbgReadCounter = 0;
+#endif
+};
+
+//! Thrown (or set in an Expected) when there is not enough data in the buffer yet
+class NotEnoughDataError : public std::runtime_error
+{
+public:
+	NotEnoughDataError() : std::runtime_error("Not enough data") {}
+};
+
+//! Thrown (or set in an Expected) when the data in the buffer can't be deserialized
+class MalformedDataError : public std::runtime_error
+{
+public:
+	MalformedDataError() : std::runtime_error("Malformed data") {}
 };
 
 template<typename T>
 inline const ChunkBuffer& operator >> (const ChunkBuffer& stream, T& v);
 
+template<typename T>
+inline ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, T& v);
+
 template<typename T>
 inline ChunkBuffer& operator << (ChunkBuffer& stream, T v);
 
@@ -192,7 +499,7 @@ namespace details
 		template<typename Container>
 		static cz::ChunkBuffer& serialize(cz::ChunkBuffer& stream, const Container& v)
 		{
-			stream << static_cast<int>(v.size());
+			stream.writeSize(static_cast<unsigned>(v.size()));
 			for (auto&& i : v)
 				stream << i;
 			return stream;
@@ -201,11 +508,10 @@ namespace details
 		template<typename Container>
 		static const cz::ChunkBuffer& deserialize(const cz::ChunkBuffer& stream, Container& v)
 		{
-			int size;
-			stream >> size;
+			unsigned size = stream.readSize();
 			v.clear();
 			v.reserve(size);
-			int todo = size;
+			unsigned todo = size;
 			while (todo--)
 			{
 				v.emplace_back();
@@ -213,6 +519,23 @@ namespace details
 			}
 			return stream;
 		}
+
+		template<typename Container>
+		static ChunkBuffer::ReadCursor& deserialize(ChunkBuffer::ReadCursor& cursor, Container& v)
+		{
+			unsigned size;
+			if (!cursor.readSize(size))
+				return cursor;
+			v.clear();
+			// Don't trust the size to reserve memory, since we don't have the data yet
+			v.reserve(std::min(size, cursor.available()));
+			while (size-- && cursor)
+			{
+				v.emplace_back();
+				cursor >> v.back();
+			}
+			return cursor;
+		}
 	};
 
 	// This is a specialized version for vector of arithmetic types, to use memory copying
@@ -223,25 +546,75 @@ namespace details
 		template<typename Container>
 		static cz::ChunkBuffer& serialize(cz::ChunkBuffer& stream, const Container& v)
 		{
-			stream << static_cast<int>(v.size());
+			stream.writeSize(static_cast<unsigned>(v.size()));
 			if (v.size())
-				stream.write(&v[0], sizeof(v[0])*static_cast<unsigned>(v.size()));
+			{
+				if (isVarintType<T> && stream.getEncoding() == ChunkBuffer::Encoding::Compact)
+					writeVarints(stream, &v[0], static_cast<unsigned>(v.size()));
+				else
+					stream.write(&v[0], sizeof(v[0])*static_cast<unsigned>(v.size()));
+			}
 			return stream;
 		}
 
 		template<typename Container>
 		static const cz::ChunkBuffer& deserialize(const cz::ChunkBuffer& stream, Container& v)
 		{
-			int size;
-			stream >> size;
+			unsigned size = stream.readSize();
 			v.clear();
 			if (size)
 			{
 				v.resize(size);
-				stream.read(&v[0], sizeof(v[0])*size);
+				if (isVarintType<T> && stream.getEncoding() == ChunkBuffer::Encoding::Compact)
+					readVarints(stream, &v[0], size);
+				else
+					stream.read(&v[0], sizeof(v[0])*size);
 			}
 			return stream;
 		}
+
+		template<typename Container>
+		static ChunkBuffer::ReadCursor& deserialize(ChunkBuffer::ReadCursor& cursor, Container& v)
+		{
+			unsigned size;
+			if (!cursor.readSize(size))
+				return cursor;
+			v.clear();
+			if (isVarintType<T> && cursor.getBuffer().getEncoding() == ChunkBuffer::Encoding::Compact)
+			{
+				// Each element takes at least 1 byte
+				if (!cursor.require(size))
+					return cursor;
+				v.resize(size);
+				for (auto&& i : v)
+				{
+					if (!cursor.readEncoded(i))
+						break;
+				}
+			}
+			else
+			{
+				if (!cursor.require(static_cast<uint64_t>(size) * sizeof(T)))
+					return cursor;
+				v.resize(size);
+				if (size)
+					cursor.read(&v[0], sizeof(v[0]) * size);
+			}
+			return cursor;
+		}
+
+	private:
+		// Only instantiate the varint functions for the types that support it
+		static void writeVarints(cz::ChunkBuffer& stream, const T* src, unsigned count)
+		{
+			if constexpr (isVarintType<T>)
+				stream.writeVarints(src, count);
+		}
+		static void readVarints(const cz::ChunkBuffer& stream, T* dst, unsigned count)
+		{
+			if constexpr (isVarintType<T>)
+				stream.readVarints(dst, count);
+		}
 	};
 
 	//
@@ -256,7 +629,8 @@ namespace details
 			return TupleSerialization<Tuple, N == std::tuple_size<Tuple>::value - 1, N + 1>::serialize(stream, v);
 		}
 
-		static const ChunkBuffer& deserialize(const ChunkBuffer& stream, Tuple& v)
+		template<typename Stream>
+		static Stream& deserialize(Stream& stream, Tuple& v)
 		{
 			stream >> std::get<N>(v);
 			return TupleSerialization<Tuple, N == std::tuple_size<Tuple>::value - 1, N + 1>::deserialize(stream, v);
@@ -270,7 +644,8 @@ namespace details
 		{
 			return stream;
 		}
-		static const ChunkBuffer& deserialize(const ChunkBuffer& stream, Tuple& v)
+		template<typename Stream>
+		static Stream& deserialize(Stream& stream, Tuple& v)
 		{
 			return stream;
 		}
@@ -317,7 +692,7 @@ const ChunkBuffer& deserializeParameterPack(const ChunkBuffer& stream, Args&...
 template<typename T>
 inline ChunkBuffer& operator << (ChunkBuffer& stream, T v)
 {
-	stream.write(v); return stream;
+	stream.writeEncoded(v); return stream;
 }
 ChunkBuffer& operator << (ChunkBuffer& stream, const std::string& v);
 ChunkBuffer& operator << (ChunkBuffer& stream, const char* v);
@@ -337,8 +712,8 @@ ChunkBuffer& operator << (ChunkBuffer& stream, const std::pair<A,B>& v)
 template<typename... Elements>
 ChunkBuffer& operator << (ChunkBuffer& stream, const std::tuple<Elements...>& v)
 {
-	typedef std::remove_reference<decltype(v)>::type TupleType;
-	return details::TupleSerialization<std::decay<decltype(v)>::type, std::tuple_size<TupleType>::value==0, 0>::serialize(stream, v);
+	typedef typename std::remove_reference<decltype(v)>::type TupleType;
+	return details::TupleSerialization<typename std::decay<decltype(v)>::type, std::tuple_size<TupleType>::value==0, 0>::serialize(stream, v);
 }
 
 //
@@ -348,7 +723,7 @@ ChunkBuffer& operator << (ChunkBuffer& stream, const std::tuple<Elements...>& v)
 // 
 template<typename T>
 inline const ChunkBuffer& operator >> (const ChunkBuffer& stream, T& v) {
-	stream.read(v);
+	stream.readEncoded(v);
 	return stream;
 }
 const ChunkBuffer& operator >> (const ChunkBuffer& stream, std::string& v);
@@ -372,6 +747,60 @@ const ChunkBuffer& operator >> (const ChunkBuffer& stream, std::tuple<Elements..
 	return details::TupleSerialization<TupleType, std::tuple_size<TupleType>::value == 0, 0>::deserialize(stream, v);
 }
 
+//
+// ReadCursor operations
+//
+template<typename T>
+inline ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, T& v)
+{
+	cursor.readEncoded(v);
+	return cursor;
+}
+ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, std::string& v);
+
+template<typename T>
+ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, std::vector<T>& v)
+{
+	return details::VectorSerialization<T>::deserialize(cursor, v);
+}
+template<typename A, typename B>
+ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, std::pair<A,B>& v)
+{
+	cursor >> v.first;
+	cursor >> v.second;
+	return cursor;
+}
+template<typename... Elements>
+ChunkBuffer::ReadCursor& operator >> (ChunkBuffer::ReadCursor& cursor, std::tuple<Elements...>& v)
+{
+	using TupleType = std::tuple<Elements...>;
+	return details::TupleSerialization<TupleType, std::tuple_size<TupleType>::value == 0, 0>::deserialize(cursor, v);
+}
+
+//! Tries to deserialize a T from the buffer, only consuming the data if successful.
+/*!
+ * If there isn't enough data yet, it returns a NotEnoughDataError, and the buffer is left untouched, so the caller
+ * can try again once more data arrives.
+ * If the data is invalid, it returns a MalformedDataError.
+ */
+template<typename T>
+Expected<T> tryDeserialize(const ChunkBuffer& stream)
+{
+	ChunkBuffer::ReadCursor cursor(stream);
+	T v{};
+	cursor >> v;
+	switch (cursor.getStatus())
+	{
+	case ChunkBuffer::ReadCursor::Status::Ok:
+		cursor.commit();
+		return Expected<T>(std::move(v));
+	case ChunkBuffer::ReadCursor::Status::NeedMoreData:
+		return Expected<T>::from_exception(NotEnoughDataError());
+	default:
+		return Expected<T>::from_exception(MalformedDataError());
+	}
+}
+
 } // namespace cz
 
 
@@ -0,0 +1,264 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/ConfigStore.h"
+#include "crazygaze/muc/Logging.h"
+#include "crazygaze/muc/StringUtils.h"
+#include <fstream>
+
+#if CZ_PLATFORM != CZ_PLATFORM_WIN32
+	#include <poll.h>
+	#include <sys/eventfd.h>
+	#include <sys/inotify.h>
+	#include <unistd.h>
+#endif
+
+namespace cz
+{
+
+//////////////////////////////////////////////////////////////////////////
+// ConfigSnapshot
+//////////////////////////////////////////////////////////////////////////
+
+bool ConfigSnapshot::load(const char* filename)
+{
+	// Read the whole file into memory instead of mapping it, so the file can be replaced or changed in place while
+	// the snapshot is alive, and the snapshot is not affected.
+	std::string text;
+	{
+		std::ifstream f(filename, std::ios::binary);
+		if (!f.is_open())
+		{
+			CZ_LOG(logDefault, Warning, "Error opening config file %s", filename);
+			return false;
+		}
+		f.seekg(0, std::ios::end);
+		std::streamoff size = f.tellg();
+		if (size > 0)
+		{
+			text.resize(static_cast<size_t>(size));
+			f.seekg(0);
+			f.read(&text[0], size);
+		}
+		if (!f)
+		{
+			CZ_LOG(logDefault, Warning, "Error reading config file %s", filename);
+			return false;
+		}
+	}
+	m_ini.parse(filename, text);
+
+	for (int s = 0; s < m_ini.getNumSections(); s++)
+	{
+		IniFile::Section* section = m_ini.getSection(s);
+		Entries& entries = m_index[section->getName()];
+		for (auto&& e : *section)
+			entries.emplace(e.getName(), &e);
+	}
+	return true;
+}
+
+const IniFile::Entry* ConfigSnapshot::find(std::string_view section, std::string_view name) const
+{
+	auto s = m_index.find(section);
+	if (s == m_index.end())
+		return nullptr;
+	auto e = s->second.find(name);
+	return e == s->second.end() ? nullptr : e->second;
+}
+
+const IniFile::Entry* ConfigSnapshot::findNonEmpty(std::string_view section, std::string_view name) const
+{
+	const IniFile::Entry* e = find(section, name);
+	return (e && e->asStringView().size()) ? e : nullptr;
+}
+
+std::string_view ConfigSnapshot::getString(std::string_view section, std::string_view name,
+                                           std::string_view defaultVal) const
+{
+	const IniFile::Entry* e = findNonEmpty(section, name);
+	return e ? e->asStringView() : defaultVal;
+}
+
+int ConfigSnapshot::getInt(std::string_view section, std::string_view name, int defaultVal) const
+{
+	const IniFile::Entry* e = findNonEmpty(section, name);
+	return e ? e->asInt() : defaultVal;
+}
+
+float ConfigSnapshot::getFloat(std::string_view section, std::string_view name, float defaultVal) const
+{
+	const IniFile::Entry* e = findNonEmpty(section, name);
+	return e ? e->asFloat() : defaultVal;
+}
+
+bool ConfigSnapshot::getBool(std::string_view section, std::string_view name, bool defaultVal) const
+{
+	const IniFile::Entry* e = findNonEmpty(section, name);
+	return e ? e->asBoolean() : defaultVal;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ConfigStore
+//////////////////////////////////////////////////////////////////////////
+
+ConfigStore::ConfigStore(const char* filename, bool watch)
+	: m_filename(filename)
+{
+	m_snapshot = std::shared_ptr<const ConfigSnapshot>(new ConfigSnapshot(0));
+	// If this fails, it's already logged
+	reload();
+
+	if (!watch)
+		return;
+
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+	m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+#else
+	m_stopFd = eventfd(0, EFD_CLOEXEC);
+#endif
+	m_thread = std::thread([this] { watchThread(); });
+	m_watchReady.wait();
+}
+
+ConfigStore::~ConfigStore()
+{
+	if (m_thread.joinable())
+	{
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+		SetEvent(m_stopEvent);
+		m_thread.join();
+		CloseHandle(m_stopEvent);
+#else
+		uint64_t one = 1;
+		CZ_CHECK(write(m_stopFd, &one, sizeof(one)) == sizeof(one));
+		m_thread.join();
+		::close(m_stopFd);
+#endif
+	}
+}
+
+bool ConfigStore::reload()
+{
+	std::lock_guard<std::mutex> lk(m_reloadMtx);
+	uint64_t version = m_version.load(std::memory_order_relaxed) + 1;
+	std::shared_ptr<ConfigSnapshot> snapshot(new ConfigSnapshot(version));
+	if (!snapshot->load(m_filename.c_str()))
+		return false;
+
+	std::atomic_store(&m_snapshot, std::shared_ptr<const ConfigSnapshot>(std::move(snapshot)));
+	m_version.store(version, std::memory_order_release);
+	return true;
+}
+
+namespace
+{
+	// Splits a path into the folder and filename, so the folder can be watched
+	void splitPath(const std::string& path, std::string& folder, std::string& name)
+	{
+		size_t pos = path.find_last_of("/\\");
+		if (pos == std::string::npos)
+		{
+			folder = ".";
+			name = path;
+		}
+		else
+		{
+			folder = path.substr(0, pos + 1);
+			name = path.substr(pos + 1);
+		}
+	}
+}
+
+void ConfigStore::watchThread()
+{
+	// The folder is watched instead of the file, since replacing the file (e.g: by renaming another file over it)
+	// creates a new file that an existing watch wouldn't see.
+	std::string folder, name;
+	splitPath(m_filename, folder, name);
+
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+	HANDLE change = FindFirstChangeNotificationW(widen(folder).c_str(), FALSE,
+	                                             FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (change == INVALID_HANDLE_VALUE)
+	{
+		m_watchReady.notify();
+		CZ_LOG(logDefault, Warning, "Could not watch config file %s", m_filename.c_str());
+		return;
+	}
+
+	// The notifications don't say which file changed, so it compares the file's time and size with the last load
+	auto getFileInfo = [this](WIN32_FILE_ATTRIBUTE_DATA& data) {
+		if (!GetFileAttributesExW(widen(m_filename).c_str(), GetFileExInfoStandard, &data))
+			memset(&data, 0, sizeof(data));
+	};
+	WIN32_FILE_ATTRIBUTE_DATA last;
+	getFileInfo(last);
+	m_watchReady.notify();
+
+	HANDLE handles[2] = {m_stopEvent, change};
+	while (WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA current;
+		getFileInfo(current);
+		if (memcmp(&current.ftLastWriteTime, &last.ftLastWriteTime, sizeof(FILETIME)) != 0 ||
+		    current.nFileSizeLow != last.nFileSizeLow || current.nFileSizeHigh != last.nFileSizeHigh)
+		{
+			last = current;
+			reload();
+		}
+		FindNextChangeNotification(change);
+	}
+	FindCloseChangeNotification(change);
+#else
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	// Only events for complete files, so it doesn't load something still being written
+	bool ok = fd != -1 && inotify_add_watch(fd, folder.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) != -1;
+	m_watchReady.notify();
+	if (!ok)
+	{
+		CZ_LOG(logDefault, Warning, "Could not watch config file %s", m_filename.c_str());
+		if (fd != -1)
+			::close(fd);
+		return;
+	}
+
+	alignas(struct inotify_event) char buf[4096];
+	while (true)
+	{
+		struct pollfd fds[2] = {{m_stopFd, POLLIN, 0}, {fd, POLLIN, 0}};
+		if (poll(fds, 2, -1) == -1)
+			continue;
+		if (fds[0].revents)
+			break;
+
+		// Reads all the queued events, so several changes in a row cause only one reload
+		bool changed = false;
+		ssize_t len;
+		while ((len = read(fd, buf, sizeof(buf))) > 0)
+		{
+			for (char* p = buf; p < buf + len;)
+			{
+				auto event = reinterpret_cast<struct inotify_event*>(p);
+				if (event->len && name == event->name)
+					changed = true;
+				p += sizeof(struct inotify_event) + event->len;
+			}
+		}
+
+		if (changed)
+			reload();
+	}
+	::close(fd);
+#endif
+}
+
+} // namespace cz
+
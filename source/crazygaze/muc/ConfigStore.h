@@ -0,0 +1,158 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Configuration loaded from an INI file, reloaded automatically when the file changes, with lock free reads.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/IniFile.h"
+#include "crazygaze/muc/Semaphore.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace cz
+{
+
+/*!
+Immutable view of the configuration at some point in time.
+Lookups don't lock or allocate, so they can be used from any thread at the same time.
+*/
+class ConfigSnapshot
+{
+public:
+	//! Increases by one every time the file is reloaded successfully. 0 is the empty snapshot used before that.
+	uint64_t getVersion() const
+	{
+		return m_version;
+	}
+
+	/*! Finds an entry.
+	If a section appears more than once in the file, they are merged, and for duplicated entries the first one is used.
+	*/
+	const IniFile::Entry* find(std::string_view section, std::string_view name) const;
+
+	bool has(std::string_view section, std::string_view name) const
+	{
+		return find(section, name) != nullptr;
+	}
+
+	//
+	// Typed lookups, which return the default if the entry doesn't exist or is empty.
+	//
+	std::string_view getString(std::string_view section, std::string_view name,
+	                           std::string_view defaultVal = std::string_view()) const;
+	int getInt(std::string_view section, std::string_view name, int defaultVal = 0) const;
+	float getFloat(std::string_view section, std::string_view name, float defaultVal = 0) const;
+	bool getBool(std::string_view section, std::string_view name, bool defaultVal = false) const;
+
+private:
+	friend class ConfigStore;
+	ConfigSnapshot(uint64_t version) : m_version(version)
+	{
+	}
+	bool load(const char* filename);
+	const IniFile::Entry* findNonEmpty(std::string_view section, std::string_view name) const;
+
+	uint64_t m_version;
+	// Parsed from a copy of the file read into memory, so nothing points into the file
+	IniFile m_ini;
+	// The keys point to the section names and entry names, which are kept alive by m_ini
+	using Entries = std::unordered_map<std::string_view, const IniFile::Entry*>;
+	std::unordered_map<std::string_view, Entries> m_index;
+};
+
+/*!
+Keeps the latest ConfigSnapshot of an INI file, and optionally watches the file for changes, reloading it in a
+background thread.
+
+A new snapshot is built completely before being published with an atomic pointer swap (RCU style), so readers never
+see a partially loaded file. Old snapshots are destroyed when the last reader lets go of them.
+If reloading fails (e.g: the file was deleted), the previous snapshot is kept.
+
+For hot paths, use a ConfigStore::Reader per thread. It keeps a reference to the snapshot it's using, and checking
+for a new one is just an atomic load.
+
+NOTE: Replace the file by renaming a new one over it (as most editors do), so a reload never sees a partially written
+file.
+*/
+class ConfigStore
+{
+public:
+	explicit ConfigStore(const char* filename, bool watch = true);
+	~ConfigStore();
+	ConfigStore(const ConfigStore&) = delete;
+	ConfigStore& operator=(const ConfigStore&) = delete;
+
+	/*! Latest snapshot. Thread safe.
+	Depending on the platform, copying a shared_ptr atomically can use a lock internally, so this is not meant for hot
+	paths. Use a Reader for that.
+	*/
+	std::shared_ptr<const ConfigSnapshot> getSnapshot() const
+	{
+		return std::atomic_load(&m_snapshot);
+	}
+
+	uint64_t getVersion() const
+	{
+		return m_version.load(std::memory_order_acquire);
+	}
+
+	//! Reloads the file in the calling thread. Returns false if it failed, in which case the snapshot is not changed
+	bool reload();
+
+	/*!
+	Per thread access to the latest snapshot.
+	*/
+	class Reader
+	{
+	public:
+		explicit Reader(const ConfigStore& store)
+			: m_store(store)
+		{
+			m_snapshot = store.getSnapshot();
+		}
+
+		//! Returns the latest snapshot. Unless a new one was published, this is just an atomic load.
+		const ConfigSnapshot& get()
+		{
+			if (m_store.getVersion() != m_snapshot->getVersion())
+				m_snapshot = m_store.getSnapshot();
+			return *m_snapshot;
+		}
+
+	private:
+		const ConfigStore& m_store;
+		std::shared_ptr<const ConfigSnapshot> m_snapshot;
+	};
+
+private:
+	void watchThread();
+
+	std::string m_filename;
+	// Only accessed with the std::atomic_* functions
+	std::shared_ptr<const ConfigSnapshot> m_snapshot;
+	// Version of m_snapshot, set after it's published
+	std::atomic<uint64_t> m_version{0};
+	// Serializes reloads
+	std::mutex m_reloadMtx;
+
+	std::thread m_thread;
+	// Signaled by the watch thread once it's watching the file, so changes made after the constructor aren't missed
+	Semaphore m_watchReady;
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+	void* m_stopEvent = nullptr;
+#else
+	int m_stopFd = -1;
+#endif
+};
+
+} // namespace cz
+
@@ -0,0 +1,71 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/CpuFeatures.h"
+
+#if CZ_SSE2 && defined(_MSC_VER)
+	#include <intrin.h>
+	#include <immintrin.h>
+#endif
+
+namespace cz
+{
+
+namespace
+{
+
+CpuFeatures detectCpuFeatures()
+{
+	CpuFeatures res;
+#if CZ_SSE2
+	#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxId = info[0];
+
+		__cpuid(info, 1);
+		const int ecx = info[2];
+		const int edx = info[3];
+		res.sse2 = (edx & (1 << 26)) != 0;
+		res.ssse3 = (ecx & (1 << 9)) != 0;
+		res.sse41 = (ecx & (1 << 19)) != 0;
+		res.sse42 = (ecx & (1 << 20)) != 0;
+
+		// AVX registers can only be used if the OS saves them on context switches
+		const bool osxsave = (ecx & (1 << 27)) != 0;
+		const bool avx = (ecx & (1 << 28)) != 0;
+		if (maxId >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+		{
+			__cpuidex(info, 7, 0);
+			res.avx2 = (info[1] & (1 << 5)) != 0;
+		}
+	#else
+		// GCC/Clang builtins already take OS support into account
+		__builtin_cpu_init();
+		res.sse2 = __builtin_cpu_supports("sse2");
+		res.ssse3 = __builtin_cpu_supports("ssse3");
+		res.sse41 = __builtin_cpu_supports("sse4.1");
+		res.sse42 = __builtin_cpu_supports("sse4.2");
+		res.avx2 = __builtin_cpu_supports("avx2");
+	#endif
+#endif
+	return res;
+}
+
+}
+
+const CpuFeatures& CpuFeatures::get()
+{
+	static CpuFeatures features = detectCpuFeatures();
+	return features;
+}
+
+} // namespace cz
+
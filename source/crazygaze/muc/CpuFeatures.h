@@ -0,0 +1,47 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Runtime detection of CPU features, so SIMD code paths can be picked at runtime.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+
+//
+// Allows compiling individual functions for an instruction set not enabled for the whole build.
+// Those functions should only be called after checking CpuFeatures.
+// Visual Studio doesn't need this, since it allows the use of any intrinsics anywhere.
+//
+#if defined(__GNUC__) || defined(__clang__)
+	#define CZ_TARGET_SSSE3 __attribute__((target("ssse3")))
+	#define CZ_TARGET_SSE42 __attribute__((target("sse4.2")))
+	#define CZ_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define CZ_TARGET_SSSE3
+	#define CZ_TARGET_SSE42
+	#define CZ_TARGET_AVX2
+#endif
+
+namespace cz
+{
+
+struct CpuFeatures
+{
+	bool sse2 = false;
+	bool ssse3 = false;
+	bool sse41 = false;
+	bool sse42 = false;
+	//! AVX2 support. Only set if the OS also supports saving the AVX registers
+	bool avx2 = false;
+
+	//! Returns the features of the CPU we are running on. Detected on the first call
+	static const CpuFeatures& get();
+};
+
+} // namespace cz
+
@@ -2,53 +2,291 @@
 	CrazyGaze (http://www.crazygaze.com)
 	Author : Rui Figueira
 	Email  : rui@crazygaze.com
-	
+
 	purpose:
 	File logging output
-	
+
 *********************************************************************/
 
 #include "czmucPCH.h"
 #include "FileLogOutput.h"
+#include "Gzip.h"
+#include <cstdio>
+#include <algorithm>
+
+#if CZ_PLATFORM != CZ_PLATFORM_WIN32
+	#include <sys/resource.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
 
 namespace cz
 {
 
+static void lowerCurrentThreadPriority()
+{
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#else
+	// On Linux, the nice value is per thread
+	setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 10);
+#endif
+}
+
 FileLogOutput::FileLogOutput(const char* filename)
+	: FileLogOutput(filename, Rotation())
+{
+}
+
+FileLogOutput::FileLogOutput(const char* filename, const Rotation& rotation)
 	: m_filename(filename)
+	, m_rotation(rotation)
 {
 	m_file.open(filename, std::ios::out | std::ios::trunc);
+	m_openTime = std::chrono::steady_clock::now();
+
+	// Don't overwrite segments left by previous runs
+	while (fileExists(m_filename + "." + std::to_string(m_nextSegmentIndex)) ||
+	       fileExists(m_filename + "." + std::to_string(m_nextSegmentIndex) + ".gz"))
+		m_nextSegmentIndex++;
+
+	m_compressQ.send([] { lowerCurrentThreadPriority(); });
 }
 
 FileLogOutput::~FileLogOutput()
 {
+	detach();
+	flush();
+}
+
+bool FileLogOutput::fileExists(const std::string& name) const
+{
+	std::ifstream f(name);
+	return f.is_open();
 }
 
 void FileLogOutput::log(const char* /*file*/, int /*line*/, const LogCategoryBase* /*category*/, LogVerbosity /*verbosity*/, const char* msg)
 {
-	m_q.send([this, msg = std::string(msg)]()
-	{
-		m_file << msg << std::endl;
-	});
+	std::unique_lock<std::mutex> lk(m_mtx);
+	m_buffer += msg;
+	m_buffer += '\n';
 }
 
-std::string FileLogOutput::getContents()
+void FileLogOutput::append(const char* data, size_t size)
 {
-	std::promise<std::string> pr;
-	m_q.send([&]()
+	std::unique_lock<std::mutex> lk(m_mtx);
+	m_buffer.append(data, size);
+}
+
+void FileLogOutput::flush()
+{
+	std::unique_lock<std::mutex> lk(m_mtx);
+	if (m_buffer.empty())
+		return;
+
+	if (m_size)
 	{
-		// reopen for reading
-		m_file.close();
-		std::ifstream ifs(m_filename);
-		std::string str;
-		str.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
-		pr.set_value(str);
+		if ((m_rotation.maxSize && m_size + m_buffer.size() > m_rotation.maxSize) ||
+		    (m_rotation.maxAge.count() && std::chrono::steady_clock::now() - m_openTime >= m_rotation.maxAge))
+			rotateImpl();
+	}
+
+	m_file.write(m_buffer.data(), m_buffer.size());
+	m_file.flush();
+	m_size += m_buffer.size();
+	// Keeps the memory, so the next batches don't need to allocate
+	m_buffer.clear();
+}
+
+void FileLogOutput::rotate()
+{
+	flushAll();
+	std::unique_lock<std::mutex> lk(m_mtx);
+	if (m_size)
+		rotateImpl();
+}
 
-		// Reopen for writing
+void FileLogOutput::rotateImpl()
+{
+	std::string name = m_filename + "." + std::to_string(m_nextSegmentIndex);
+	m_file.close();
+	if (std::rename(m_filename.c_str(), name.c_str()) != 0)
+	{
+		// This can happen on Windows if something else has the file open (e.g: a TailReader in the middle of a
+		// read), so keep using the same file, and try again next time.
 		m_file.open(m_filename, std::ios::out | std::ios::app);
-	});
+		return;
+	}
+
+	m_nextSegmentIndex++;
+	m_segments.push_back({m_generation, name, false});
+	m_generation++;
+	m_file.open(m_filename, std::ios::out | std::ios::trunc);
+	m_size = 0;
+	m_openTime = std::chrono::steady_clock::now();
+
+	if (m_rotation.compress)
+	{
+		m_pendingCompressions.increment();
+		m_compressQ.send([this, segment = m_segments.back()] { compress(segment); });
+	}
+	else
+	{
+		removeOldSegments();
+	}
+}
+
+void FileLogOutput::compress(Segment segment)
+{
+	std::string gzName = segment.name + ".gz";
+	if (gzipCompressFile(segment.name, gzName))
+	{
+		std::unique_lock<std::mutex> lk(m_mtx);
+		// The segment might have been removed meanwhile, if there are too many
+		auto it = std::find_if(m_segments.begin(), m_segments.end(),
+		                       [&](const Segment& s) { return s.generation == segment.generation; });
+		if (it != m_segments.end())
+		{
+			std::remove(segment.name.c_str());
+			it->name = gzName;
+			it->compressed = true;
+		}
+		else
+		{
+			std::remove(gzName.c_str());
+		}
+	}
+	else
+	{
+		std::remove(gzName.c_str());
+	}
+
+	{
+		std::unique_lock<std::mutex> lk(m_mtx);
+		removeOldSegments();
+	}
+	m_pendingCompressions.decrement();
+}
+
+void FileLogOutput::removeOldSegments()
+{
+	if (m_rotation.maxSegments == 0)
+		return;
+	while (m_segments.size() > static_cast<size_t>(m_rotation.maxSegments))
+	{
+		// If the segment is still being compressed, the compression will fail or its result will be deleted
+		std::remove(m_segments.front().name.c_str());
+		m_segments.pop_front();
+	}
+}
+
+std::vector<std::string> FileLogOutput::getSegments()
+{
+	std::unique_lock<std::mutex> lk(m_mtx);
+	std::vector<std::string> res;
+	for (auto&& s : m_segments)
+		res.push_back(s.name);
+	return res;
+}
+
+void FileLogOutput::waitForCompression()
+{
+	m_pendingCompressions.wait();
+}
+
+FileLogOutput::TailReader FileLogOutput::createTailReader(bool fromEnd)
+{
+	std::unique_lock<std::mutex> lk(m_mtx);
+	return TailReader(*this, m_generation, fromEnd ? m_size : 0);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// FileLogOutput::TailReader
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	/*! Reads from "offset" up to "end", or the end of the file if "end" is -1
+	\return false if the file couldn't be opened
+	*/
+	bool readFileRange(const std::string& name, uint64_t offset, uint64_t end, std::string& dst, size_t& done)
+	{
+		done = 0;
+		std::ifstream f(name, std::ios::binary);
+		if (!f.is_open())
+			return false;
+		if (end == uint64_t(-1))
+		{
+			f.seekg(0, std::ios::end);
+			end = static_cast<uint64_t>(f.tellg());
+		}
+		if (end <= offset)
+			return true;
+
+		size_t todo = static_cast<size_t>(end - offset);
+		size_t pos = dst.size();
+		dst.resize(pos + todo);
+		f.seekg(offset);
+		f.read(&dst[pos], todo);
+		done = static_cast<size_t>(f.gcount());
+		dst.resize(pos + done);
+		return true;
+	}
+}
+
+size_t FileLogOutput::TailReader::read(std::string& dst)
+{
+	size_t total = 0;
+	while (true)
+	{
+		// Only hold the lock while getting the state, so the logging is not blocked while reading the file
+		std::string name;
+		uint64_t end;
+		bool rotated;
+		{
+			std::unique_lock<std::mutex> lk(m_owner->m_mtx);
+			rotated = m_generation != m_owner->m_generation;
+			if (rotated)
+			{
+				auto it = std::find_if(m_owner->m_segments.begin(), m_owner->m_segments.end(),
+				                       [this](const Segment& s) { return s.generation == m_generation; });
+				if (it != m_owner->m_segments.end() && !it->compressed)
+					name = it->name;
+				end = uint64_t(-1);
+			}
+			else
+			{
+				name = m_owner->m_filename;
+				end = m_owner->m_size;
+			}
+		}
+
+		size_t pos = dst.size();
+		size_t done = 0;
+		bool ok = !name.empty() && readFileRange(name, m_offset, end, dst, done);
+		if (!rotated)
+		{
+			// The file was opened by name, so if it was rotated meanwhile, we might have read the new file.
+			// Discard what was read, and try again, which will read from the rotated segment instead.
+			std::unique_lock<std::mutex> lk(m_owner->m_mtx);
+			if (m_generation != m_owner->m_generation)
+			{
+				dst.resize(pos);
+				continue;
+			}
+		}
+		total += done;
+		m_offset += done;
+		if (!rotated)
+			break;
 
-	return pr.get_future().get();
+		// Moving to the next segment
+		if (!ok)
+			m_skipped++;
+		m_generation++;
+		m_offset = 0;
+	}
+	return total;
 }
 
 }
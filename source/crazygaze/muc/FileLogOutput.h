@@ -2,10 +2,10 @@
 	CrazyGaze (http://www.crazygaze.com)
 	Author : Rui Figueira
 	Email  : rui@crazygaze.com
-	
+
 	purpose:
 	File logging output
-	
+
 *********************************************************************/
 
 #pragma once
@@ -15,29 +15,124 @@
 #include "crazygaze/muc/AsyncCommandQueue.h"
 #include "crazygaze/muc/Semaphore.h"
 #include <fstream>
+#include <mutex>
+#include <deque>
 
 namespace cz
 {
 
+/*! Logs to a file.
+Messages are appended to a buffer, and written to the file in one go when the logging backend flushes the outputs
+(see LogSettings::flushInterval).
+
+The file can be rotated by size and/or time. Rotated segments are renamed to "<filename>.<N>", with N increasing,
+and optionally compressed to "<filename>.<N>.gz" in a low priority thread.
+*/
 class FileLogOutput : public LogOutput
 {
 public:
-	FileLogOutput(const char* filename);
+
+	struct Rotation
+	{
+		//! Rotate when the file would grow beyond this size, in bytes. 0 disables size based rotation
+		uint64_t maxSize = 0;
+		//! Rotate when the file has been in use for longer than this. 0 disables time based rotation
+		std::chrono::milliseconds maxAge{0};
+		//! How many rotated segments to keep. Older segments are deleted. 0 keeps all.
+		//! Only segments created by this instance are tracked.
+		int maxSegments = 0;
+		//! If true, rotated segments are compressed with gzip
+		bool compress = true;
+	};
+
+	/*! Reads the log as it's being written, without blocking the logging.
+	Only data already flushed to the file is read.
+	If the file is rotated, the reader first finishes the rotated segment if it is still available uncompressed.
+	Otherwise the rest of that segment is skipped, and counted by getSkippedSegments.
+	*/
+	class TailReader
+	{
+	public:
+		/*! Appends anything written since the last call to "dst"
+		\return Number of bytes appended
+		*/
+		size_t read(std::string& dst);
+
+		//! Number of rotated segments not read to the end, because they were no longer available uncompressed
+		int getSkippedSegments() const
+		{
+			return m_skipped;
+		}
+
+	private:
+		friend class FileLogOutput;
+		TailReader(FileLogOutput& owner, int generation, uint64_t offset)
+			: m_owner(&owner), m_generation(generation), m_offset(offset)
+		{
+		}
+		FileLogOutput* m_owner;
+		int m_generation;
+		uint64_t m_offset;
+		int m_skipped = 0;
+	};
+
+	explicit FileLogOutput(const char* filename);
+	FileLogOutput(const char* filename, const Rotation& rotation);
 	~FileLogOutput();
 	void log(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, const char* msg) override;
 
 	/**
-	* Gets the entire contents of the file.
-	* The file is closed, it's contents read to the string, and then reopened.
-	* This allows us to get the contents to say... upload somewhere, while keeping the file open.
+	* Creates a reader for the file.
+	* \param fromEnd If false, the reader starts at the beginning of the current file. If true, it only reads what is
+	* written from now on.
 	*/
-	std::string getContents();
+	TailReader createTailReader(bool fromEnd = false);
+
+	//! Rotates the file now, unless it's empty
+	void rotate();
+
+	//! Rotated segments still on disk, oldest first
+	std::vector<std::string> getSegments();
+
+	//! Blocks until all rotated segments are compressed
+	void waitForCompression();
+
+protected:
+	void flush() override;
+
+	//! Appends data to be written in the next flush, for derived classes that write something other than the lines
+	void append(const char* data, size_t size);
 
 private:
-	AsyncCommandQueueAutomatic m_q;
-	ZeroSemaphore m_getContents;
+	struct Segment
+	{
+		// Value of m_generation the segment was written with
+		int generation;
+		std::string name;
+		bool compressed;
+	};
+
+	bool fileExists(const std::string& name) const;
+	void rotateImpl();
+	void compress(Segment segment);
+	void removeOldSegments();
+
+	std::mutex m_mtx;
+	std::string m_buffer;
 	std::ofstream m_file;
 	std::string m_filename;
+	Rotation m_rotation;
+	// Bytes written to the current file
+	uint64_t m_size = 0;
+	std::chrono::steady_clock::time_point m_openTime;
+	// Incremented every time the file is rotated
+	int m_generation = 0;
+	int m_nextSegmentIndex = 1;
+	std::deque<Segment> m_segments;
+
+	ZeroSemaphore m_pendingCompressions;
+	// Declared last, so the compression thread finishes before anything else is destroyed
+	AsyncCommandQueueAutomatic m_compressQ;
 };
 
 
@@ -94,4 +94,9 @@ namespace cz
 		return to_json(v.toString());
 	}
 
+	void to_json(std::string& dst, const Guid& v)
+	{
+		to_json(dst, v.toString());
+	}
+
 } // namespace cz
@@ -71,6 +71,7 @@ namespace cz
 	ChunkBuffer& operator << (ChunkBuffer& stream, const cz::Guid& v);
 
 	std::string to_json(const Guid& v);
+	void to_json(std::string& dst, const Guid& v);
 
 	/*!
 		@}
@@ -0,0 +1,591 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/Gzip.h"
+#include <fstream>
+#include <stdexcept>
+
+namespace cz
+{
+
+namespace
+{
+
+//////////////////////////////////////////////////////////////////////////
+// Tables shared by the compressor and decompressor
+//////////////////////////////////////////////////////////////////////////
+
+const uint16_t gLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                  31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t gLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t gDistBase[30] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const uint8_t gDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+struct Crc32Table
+{
+	Crc32Table()
+	{
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+	uint32_t table[256];
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Compression
+//////////////////////////////////////////////////////////////////////////
+
+class BitWriter
+{
+public:
+	explicit BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+	//! Writes bits, least significant first
+	void write(uint32_t bits, int count)
+	{
+		m_buf |= static_cast<uint64_t>(bits) << m_count;
+		m_count += count;
+		while (m_count >= 8)
+		{
+			m_out.push_back(static_cast<uint8_t>(m_buf));
+			m_buf >>= 8;
+			m_count -= 8;
+		}
+	}
+
+	//! Writes a Huffman code, which are stored most significant bit first
+	void writeCode(uint32_t code, int count)
+	{
+		uint32_t reversed = 0;
+		for (int i = 0; i < count; i++)
+			reversed |= ((code >> i) & 1) << (count - 1 - i);
+		write(reversed, count);
+	}
+
+	void finish()
+	{
+		if (m_count)
+			m_out.push_back(static_cast<uint8_t>(m_buf));
+		m_buf = 0;
+		m_count = 0;
+	}
+
+private:
+	std::vector<uint8_t>& m_out;
+	uint64_t m_buf = 0;
+	int m_count = 0;
+};
+
+void writeFixedLiteral(BitWriter& bw, int v)
+{
+	if (v < 144)
+		bw.writeCode(0x30 + v, 8);
+	else if (v < 256)
+		bw.writeCode(0x190 + v - 144, 9);
+	else if (v < 280)
+		bw.writeCode(v - 256, 7);
+	else
+		bw.writeCode(0xC0 + v - 280, 8);
+}
+
+void writeMatch(BitWriter& bw, int len, int dist)
+{
+	int l = 28;
+	while (gLengthBase[l] > len)
+		l--;
+	writeFixedLiteral(bw, 257 + l);
+	bw.write(len - gLengthBase[l], gLengthExtra[l]);
+
+	int d = 29;
+	while (gDistBase[d] > dist)
+		d--;
+	bw.writeCode(d, 5);
+	bw.write(dist - gDistBase[d], gDistExtra[d]);
+}
+
+/*! LZ77 compressor writing a single deflate block with the fixed Huffman codes.
+Input can be given in several parts, so big files don't need to be loaded in memory all at once. Positions are
+absolute (counted from the start of the input), so the hash chains work across parts.
+*/
+class FixedDeflater
+{
+public:
+	static constexpr int WINDOW_SIZE = 32768;
+	static constexpr int MIN_MATCH = 3;
+	static constexpr int MAX_MATCH = 258;
+	static constexpr int HASH_BITS = 15;
+	static constexpr int MAX_CHAIN = 32;
+
+	explicit FixedDeflater(std::vector<uint8_t>& out)
+		: m_bw(out)
+		, m_head(size_t(1) << HASH_BITS, -1)
+		, m_prev(WINDOW_SIZE, -1)
+	{
+		// Single final block, with the fixed Huffman codes
+		m_bw.write(1, 1);
+		m_bw.write(1, 2);
+	}
+
+	/*! Compresses all of the input in one go
+	"data" must contain the whole input
+	*/
+	void compress(const uint8_t* data, size_t size)
+	{
+		encode(data, 0, size, size);
+		finish();
+	}
+
+	/*! Adds more input
+	Only the last WINDOW_SIZE bytes already compressed (plus what can't be compressed yet) are kept.
+	\param last True if this is the last part of the input
+	*/
+	void compressPart(const uint8_t* data, size_t size, bool last)
+	{
+		m_buf.insert(m_buf.end(), data, data + size);
+		size_t end = m_bufStart + m_buf.size();
+		// Unless this is the last part, leave enough data behind for the longest possible match, so splitting the
+		// input doesn't affect the compression
+		size_t limit = last ? end : (end > MAX_MATCH ? end - MAX_MATCH : 0);
+		encode(m_buf.data(), m_bufStart, end, limit);
+		if (last)
+		{
+			finish();
+			return;
+		}
+
+		if (m_pos > m_bufStart + WINDOW_SIZE)
+		{
+			size_t drop = m_pos - WINDOW_SIZE - m_bufStart;
+			m_buf.erase(m_buf.begin(), m_buf.begin() + drop);
+			m_bufStart += drop;
+		}
+	}
+
+private:
+
+	/*!
+	\param data Input, starting at the absolute position "dataStart"
+	\param end Absolute position where the available input ends
+	\param limit Absolute position where to stop. Matches can still go past it, up to "end".
+	*/
+	void encode(const uint8_t* data, size_t dataStart, size_t end, size_t limit)
+	{
+		auto at = [&](size_t pos) { return data + (pos - dataStart); };
+		auto hash = [&](size_t pos) {
+			const uint8_t* p = at(pos);
+			uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+			return (v * 2654435761u) >> (32 - HASH_BITS);
+		};
+		auto insert = [&](size_t pos) {
+			if (pos + MIN_MATCH > end)
+				return;
+			uint32_t h = hash(pos);
+			m_prev[pos & (WINDOW_SIZE - 1)] = m_head[h];
+			m_head[h] = static_cast<int64_t>(pos);
+		};
+
+		size_t pos = m_pos;
+		while (pos < limit)
+		{
+			int bestLen = 0;
+			size_t bestDist = 0;
+			if (pos + MIN_MATCH <= end)
+			{
+				int64_t candidate = m_head[hash(pos)];
+				int maxLen = static_cast<int>(std::min<size_t>(MAX_MATCH, end - pos));
+				for (int chain = 0; chain < MAX_CHAIN && candidate >= 0; chain++)
+				{
+					size_t dist = pos - static_cast<size_t>(candidate);
+					if (dist > WINDOW_SIZE)
+						break;
+					const uint8_t* a = at(static_cast<size_t>(candidate));
+					const uint8_t* b = at(pos);
+					if (a[bestLen] == b[bestLen])
+					{
+						int len = 0;
+						while (len < maxLen && a[len] == b[len])
+							len++;
+						if (len > bestLen)
+						{
+							bestLen = len;
+							bestDist = dist;
+							if (len == maxLen)
+								break;
+						}
+					}
+					int64_t next = m_prev[candidate & (WINDOW_SIZE - 1)];
+					// Entries in "prev" get overwritten as the window moves, so make sure we keep going backwards
+					if (next >= candidate)
+						break;
+					candidate = next;
+				}
+			}
+
+			if (bestLen >= MIN_MATCH)
+			{
+				writeMatch(m_bw, bestLen, static_cast<int>(bestDist));
+				for (int i = 0; i < bestLen; i++)
+					insert(pos + i);
+				pos += bestLen;
+			}
+			else
+			{
+				writeFixedLiteral(m_bw, *at(pos));
+				insert(pos);
+				pos++;
+			}
+		}
+		m_pos = pos;
+	}
+
+	void finish()
+	{
+		writeFixedLiteral(m_bw, 256);
+		m_bw.finish();
+	}
+
+	BitWriter m_bw;
+	std::vector<int64_t> m_head;
+	std::vector<int64_t> m_prev;
+	// Next position to compress
+	size_t m_pos = 0;
+	// Input kept by compressPart, starting at the absolute position m_bufStart
+	std::vector<uint8_t> m_buf;
+	size_t m_bufStart = 0;
+};
+
+void writeLE32(std::vector<uint8_t>& out, uint32_t v)
+{
+	for (int i = 0; i < 4; i++)
+		out.push_back(static_cast<uint8_t>(v >> (i * 8)));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Decompression
+//////////////////////////////////////////////////////////////////////////
+
+[[noreturn]] void throwInvalid()
+{
+	throw std::runtime_error("Invalid gzip data");
+}
+
+class BitReader
+{
+public:
+	BitReader(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+	uint32_t read(int count)
+	{
+		uint32_t v = 0;
+		for (int i = 0; i < count; i++)
+		{
+			if (m_pos >= m_size)
+				throwInvalid();
+			v |= ((m_data[m_pos] >> m_bit) & 1) << i;
+			if (++m_bit == 8)
+			{
+				m_bit = 0;
+				m_pos++;
+			}
+		}
+		return v;
+	}
+
+	void alignToByte()
+	{
+		if (m_bit)
+		{
+			m_bit = 0;
+			m_pos++;
+		}
+	}
+
+	const uint8_t* bytes(size_t count)
+	{
+		if (m_pos + count > m_size)
+			throwInvalid();
+		const uint8_t* p = m_data + m_pos;
+		m_pos += count;
+		return p;
+	}
+
+	size_t pos() const
+	{
+		return m_pos;
+	}
+
+private:
+	const uint8_t* m_data;
+	size_t m_size;
+	size_t m_pos = 0;
+	int m_bit = 0;
+};
+
+// Canonical Huffman decoding, as described in RFC 1951
+struct Huffman
+{
+	uint16_t counts[16];
+	uint16_t symbols[288];
+
+	void build(const uint8_t* lengths, int n)
+	{
+		memset(counts, 0, sizeof(counts));
+		for (int i = 0; i < n; i++)
+			counts[lengths[i]]++;
+		counts[0] = 0;
+		uint16_t offsets[16];
+		offsets[1] = 0;
+		for (int i = 1; i < 15; i++)
+			offsets[i + 1] = offsets[i] + counts[i];
+		for (int i = 0; i < n; i++)
+			if (lengths[i])
+				symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+	}
+
+	int decode(BitReader& br) const
+	{
+		int code = 0;
+		int first = 0;
+		int index = 0;
+		for (int len = 1; len < 16; len++)
+		{
+			code |= br.read(1);
+			int count = counts[len];
+			if (code - count < first)
+				return symbols[index + (code - first)];
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		throwInvalid();
+	}
+};
+
+void inflateBlock(BitReader& br, std::vector<uint8_t>& out, const Huffman& lit, const Huffman& dist)
+{
+	while (true)
+	{
+		int sym = lit.decode(br);
+		if (sym < 256)
+			out.push_back(static_cast<uint8_t>(sym));
+		else if (sym == 256)
+			return;
+		else
+		{
+			sym -= 257;
+			if (sym >= 29)
+				throwInvalid();
+			size_t len = gLengthBase[sym] + br.read(gLengthExtra[sym]);
+			int d = dist.decode(br);
+			if (d >= 30)
+				throwInvalid();
+			size_t distance = gDistBase[d] + br.read(gDistExtra[d]);
+			if (distance > out.size())
+				throwInvalid();
+			size_t from = out.size() - distance;
+			for (size_t i = 0; i < len; i++)
+				out.push_back(out[from + i]);
+		}
+	}
+}
+
+void inflate(BitReader& br, std::vector<uint8_t>& out)
+{
+	bool last;
+	do
+	{
+		last = br.read(1) != 0;
+		uint32_t type = br.read(2);
+		if (type == 0)
+		{
+			br.alignToByte();
+			const uint8_t* p = br.bytes(4);
+			uint16_t len = static_cast<uint16_t>(p[0] | (p[1] << 8));
+			uint16_t nlen = static_cast<uint16_t>(p[2] | (p[3] << 8));
+			if (len != static_cast<uint16_t>(~nlen))
+				throwInvalid();
+			p = br.bytes(len);
+			out.insert(out.end(), p, p + len);
+		}
+		else if (type == 1)
+		{
+			uint8_t lengths[288 + 30];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			memset(lengths + 288, 5, 30);
+			Huffman lit, dist;
+			lit.build(lengths, 288);
+			dist.build(lengths + 288, 30);
+			inflateBlock(br, out, lit, dist);
+		}
+		else if (type == 2)
+		{
+			int nlen = br.read(5) + 257;
+			int ndist = br.read(5) + 1;
+			int ncode = br.read(4) + 4;
+			if (nlen > 286 || ndist > 30)
+				throwInvalid();
+			static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+			uint8_t lengths[288 + 30] = {};
+			for (int i = 0; i < ncode; i++)
+				lengths[order[i]] = static_cast<uint8_t>(br.read(3));
+			Huffman lencode;
+			lencode.build(lengths, 19);
+
+			int index = 0;
+			memset(lengths, 0, sizeof(lengths));
+			while (index < nlen + ndist)
+			{
+				int sym = lencode.decode(br);
+				if (sym < 16)
+				{
+					lengths[index++] = static_cast<uint8_t>(sym);
+					continue;
+				}
+				uint8_t len = 0;
+				int repeat;
+				if (sym == 16)
+				{
+					if (index == 0)
+						throwInvalid();
+					len = lengths[index - 1];
+					repeat = 3 + br.read(2);
+				}
+				else if (sym == 17)
+					repeat = 3 + br.read(3);
+				else
+					repeat = 11 + br.read(7);
+				if (index + repeat > nlen + ndist)
+					throwInvalid();
+				while (repeat--)
+					lengths[index++] = len;
+			}
+
+			Huffman lit, dist;
+			lit.build(lengths, nlen);
+			dist.build(lengths + nlen, ndist);
+			inflateBlock(br, out, lit, dist);
+		}
+		else
+			throwInvalid();
+	} while (!last);
+}
+
+} // anonymous namespace
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc)
+{
+	static const Crc32Table table;
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table.table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+std::vector<uint8_t> gzipCompress(const void* data, size_t size)
+{
+	std::vector<uint8_t> out;
+	out.reserve(size / 3 + 64);
+	// Header: magic, deflate, no flags, no modification time, no extra flags, unknown OS
+	const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+	out.insert(out.end(), header, header + sizeof(header));
+	FixedDeflater(out).compress(static_cast<const uint8_t*>(data), size);
+	writeLE32(out, crc32(data, size));
+	writeLE32(out, static_cast<uint32_t>(size));
+	return out;
+}
+
+std::vector<uint8_t> gzipDecompress(const void* data, size_t size)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	if (size < 18 || p[0] != 0x1F || p[1] != 0x8B || p[2] != 8)
+		throwInvalid();
+
+	BitReader br(p, size);
+	br.bytes(10);
+	uint8_t flags = p[3];
+	if (flags & 4) // FEXTRA
+	{
+		const uint8_t* x = br.bytes(2);
+		br.bytes(x[0] | (x[1] << 8));
+	}
+	if (flags & 8) // FNAME
+		while (*br.bytes(1)) {}
+	if (flags & 16) // FCOMMENT
+		while (*br.bytes(1)) {}
+	if (flags & 2) // FHCRC
+		br.bytes(2);
+
+	std::vector<uint8_t> out;
+	inflate(br, out);
+	br.alignToByte();
+	const uint8_t* trailer = br.bytes(8);
+	uint32_t crc = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint32_t>(trailer[3]) << 24);
+	if (crc != crc32(out.data(), out.size()))
+		throwInvalid();
+	return out;
+}
+
+bool gzipCompressFile(const std::string& src, const std::string& dst)
+{
+	std::ifstream in(src, std::ios::binary);
+	if (!in.is_open())
+		return false;
+	std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+	if (!out.is_open())
+		return false;
+
+	// Compress in chunks, so only the chunk and the deflate window need to be in memory
+	static constexpr size_t CHUNK_SIZE = 64 * 1024;
+	std::vector<char> chunk(CHUNK_SIZE);
+	std::vector<uint8_t> compressed;
+	compressed.reserve(CHUNK_SIZE);
+	const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+	compressed.insert(compressed.end(), header, header + sizeof(header));
+
+	FixedDeflater deflater(compressed);
+	uint32_t crc = 0;
+	uint64_t size = 0;
+	bool last = false;
+	while (!last)
+	{
+		in.read(chunk.data(), chunk.size());
+		if (in.bad())
+			return false;
+		size_t done = static_cast<size_t>(in.gcount());
+		last = in.eof();
+		crc = crc32(chunk.data(), done, crc);
+		size += done;
+		deflater.compressPart(reinterpret_cast<const uint8_t*>(chunk.data()), done, last);
+		if (last)
+		{
+			writeLE32(compressed, crc);
+			writeLE32(compressed, static_cast<uint32_t>(size));
+		}
+		out.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+		if (!out.good())
+			return false;
+		compressed.clear();
+	}
+	return true;
+}
+
+} // namespace cz
+
@@ -0,0 +1,41 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Minimal gzip (RFC 1952 / RFC 1951) compression and decompression, with no external dependencies.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include <vector>
+#include <string>
+
+namespace cz
+{
+
+/*! Compresses data to the gzip format.
+The output can be read by gzip, zlib and any other tool supporting the format.
+The compressor uses LZ77 with the fixed Huffman codes, which is fast and works well for text such as logs, but doesn't
+compress as much as zlib.
+*/
+std::vector<uint8_t> gzipCompress(const void* data, size_t size);
+
+/*! Decompresses gzip data.
+Supports anything compliant with the format, not just what gzipCompress produces.
+Throws std::runtime_error if the data is invalid.
+*/
+std::vector<uint8_t> gzipDecompress(const void* data, size_t size);
+
+/*! Compresses a file to another file.
+\return false if there was an error reading or writing the files
+*/
+bool gzipCompressFile(const std::string& src, const std::string& dst);
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+} // namespace cz
+
@@ -9,14 +9,32 @@
 
 #include "czmucPCH.h"
 #include "crazygaze/muc/IniFile.h"
-#include <sstream>
-#include "crazygaze/muc/File.h"
+#include "crazygaze/muc/MappedFile.h"
+#include <charconv>
 #include "crazygaze/muc/Logging.h"
-#include "crazygaze/muc/StringUtils.h"
 
 namespace cz
 {
 
+	namespace
+	{
+		bool isSpace(char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+		}
+
+		std::string_view trimView(std::string_view str)
+		{
+			size_t begin = 0;
+			size_t end = str.size();
+			while (begin < end && isSpace(str[begin]))
+				begin++;
+			while (end > begin && isSpace(str[end - 1]))
+				end--;
+			return str.substr(begin, end - begin);
+		}
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 	// Entry
 	//////////////////////////////////////////////////////////////////////////
@@ -38,27 +56,34 @@ namespace cz
 
 	void IniFile::Entry::setValue(int val)
 	{
-		std::ostringstream ostr;
-		ostr << val;
-		mValue = ostr.str().c_str();
+		char buf[16];
+		mValue.assign(buf, std::to_chars(buf, buf + sizeof(buf), val).ptr - buf);
 	}
 
 	void IniFile::Entry::setValue(float val)
 	{
-		std::ostringstream ostr;
-		ostr << val;
-		mValue = ostr.str().c_str();
+		// Shortest representation that reads back to the same value
+		char buf[32];
+		mValue.assign(buf, std::to_chars(buf, buf + sizeof(buf), val).ptr - buf);
 	}
 
 	int IniFile::Entry::asInt() const
 	{
-		int val = atoi(mValue.c_str());
+		// Same as atoi, other than overflow: reads as much as it can, and is 0 if there is no number
+		std::string_view str = asStringView();
+		const char* begin = str.data();
+		const char* end = begin + str.size();
+		if (begin != end && *begin == '+')
+			begin++;
+		int val = 0;
+		std::from_chars(begin, end, val);
 		return val;
 	}
 
 	bool IniFile::Entry::asBoolean() const
 	{
-		if (mValue=="1" || mValue=="true" || mValue=="True" || mValue=="TRUE")
+		std::string_view str = asStringView();
+		if (str=="1" || str=="true" || str=="True" || str=="TRUE")
 			return true;
 		else
 			return false;
@@ -66,37 +91,52 @@ namespace cz
 
 	float IniFile::Entry::asFloat() const
 	{
-		return static_cast<float>(atof(mValue.c_str()));
+		std::string_view str = asStringView();
+		const char* begin = str.data();
+		const char* end = begin + str.size();
+		if (begin != end && *begin == '+')
+			begin++;
+		float val = 0;
+		std::from_chars(begin, end, val);
+		return val;
 	}
 
 	//////////////////////////////////////////////////////////////////////////
 	// Section
 	//////////////////////////////////////////////////////////////////////////
 
-	void IniFile::Section::init(const char* name)
+	void IniFile::Section::init(std::string_view name)
 	{
 		mName = name;
 	}
 
+	IniFile::Entry& IniFile::Section::addEntry(std::string_view name)
+	{
+		mIndex.emplace(std::hash<std::string_view>()(name), static_cast<int>(mEntries.size()));
+		mEntries.emplace_back();
+		Entry& entry = mEntries.back();
+		entry.mName = name;
+		return entry;
+	}
+
 	IniFile::Entry* IniFile::Section::getEntry(const char* name, bool bCreate)
 	{
-		for(auto&& e : mEntries)
+		std::string_view key(name);
+		// Several names can have the same hash, and a name can be duplicated, so pick the first entry that matches
+		int found = -1;
+		auto range = mIndex.equal_range(std::hash<std::string_view>()(key));
+		for (auto it = range.first; it != range.second; ++it)
 		{
-			if (e.getName() == name)
-				return &e;
+			if ((found == -1 || it->second < found) && mEntries[it->second].mName == key)
+				found = it->second;
 		}
+		if (found != -1)
+			return &mEntries[found];
 
 		if (bCreate)
-		{
-			mEntries.push_back(IniFile::Entry());
-			mEntries.back().init(name, "");
-			return &mEntries.back();
-		}
+			return &addEntry(key);
 		else
-		{
 			return NULL;
-		}
-
 	}
 
 	/*
@@ -151,20 +191,15 @@ namespace cz
 
 	void IniFile::Section::add(const char* szEntryName, const char* szValue)
 	{
-		mEntries.push_back(IniFile::Entry());
-		mEntries.back().init(szEntryName, szValue);
+		addEntry(szEntryName).setValue(szValue);
 	}
 	void IniFile::Section::add(const char* szEntryName, int val)
 	{
-		mEntries.push_back(IniFile::Entry());
-		mEntries.back().init(szEntryName, "");	
-		mEntries.back().setValue(val);
+		addEntry(szEntryName).setValue(val);
 	}
 	void IniFile::Section::add(const char* szEntryName, float val)
 	{
-		mEntries.push_back(IniFile::Entry());
-		mEntries.back().init(szEntryName, "");	
-		mEntries.back().setValue(val);
+		addEntry(szEntryName).setValue(val);
 	}
 
 	/*
@@ -203,98 +238,88 @@ namespace cz
 
 	bool IniFile::open(const char* filename)
 	{
-		File file;
-		if (!file.try_open(filename, File::FILEMODE_READ))
+		MappedFile file;
+		if (!file.open(filename))
 		{
 			CZ_LOG(logDefault, Warning, "Error opening ini file %s", filename);
 			return false;
 		}
 
-		int size = file.size();
-		auto text = std::make_unique<char[]>(size+1);
-		file.read(text.get(), size);
-		text[size]=0;
-		std::vector<std::string> lines = stringSplitIntoLines(text.get(), size);
+		parse(filename, file.view());
+		return true;
+	}
 
-		std::string tmp1, tmp2, tmp3;
+	void IniFile::parse(const char* filename, std::string_view text)
+	{
+		// Skip the UTF-8 BOM
+		if (text.size() >= 3 && memcmp(text.data(), "\xEF\xBB\xBF", 3) == 0)
+			text.remove_prefix(3);
 
-		mSections.push_back(std::make_unique<Section>());
+		// Values before any section go into an unnamed section
+		Section* section = &addSection(std::string_view());
 
-		for(auto&& line : lines)
+		const char* p = text.data();
+		const char* end = p + text.size();
+		while (p < end)
 		{
-			line = trim(line);
-			std::string::iterator it;
+			const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+			if (!eol)
+				eol = end;
+			std::string_view line = trimView(std::string_view(p, eol - p));
+			p = eol + 1;
 
-			if (line.c_str()[0]==';' || line.c_str()[0]=='#' )
+			if (line.empty() || line[0]==';' || line[0]=='#' )
 			{
-				// Its a comment
+				// Empty line or comment
 			}
-			else if (line.c_str()[0]=='[') // its a section
+			else if (line[0]=='[') // its a section
 			{
-				tmp1 = "";
-				tmp1.append(line.begin()+1, line.end()-1);
-				tmp1 = trim(tmp1);
-				auto section = std::make_unique<Section>();
-				section->init(tmp1.c_str());
-				mSections.push_back(std::move(section));
+				line.remove_prefix(1);
+				if (line.size() && line.back() == ']')
+					line.remove_suffix(1);
+				section = &addSection(trimView(line));
 			}
-			else if ( (it=std::find(line.begin(), line.end(), '='))!=line.end()) // its a value
+			else
 			{
-				if (mSections.size())
+				size_t pos = line.find('=');
+				if (pos != std::string_view::npos) // its a value
 				{
-					tmp1 = "";
-					tmp1.append(line.begin(), it);
-					tmp1 = trim(tmp1);
-					tmp2 = "";
-					tmp2.append(it+1,line.end());
-					tmp2 = trim(tmp2);
-					if (*tmp2.begin()=='"' || *tmp2.begin()=='\'')
-					{
-						tmp3 = "";
-						tmp3.append(tmp2.begin()+1, tmp2.end()-1);
-						mSections.back()->add(tmp1.c_str(), tmp3.c_str());
-					}
-					else
-					{
-						mSections.back()->add(tmp1.c_str(), tmp2.c_str());
-					}
-
+					std::string_view name = trimView(line.substr(0, pos));
+					std::string_view value = trimView(line.substr(pos + 1));
+					if (value.size() >= 2 && (value[0]=='"' || value[0]=='\''))
+						value = value.substr(1, value.size() - 2);
+					section->addEntry(name).mValue = value;
 				}
 				else
 				{
-					CZ_LOG(logDefault, Warning, "Value with no section in INI File (%s) : %s ", filename, line.c_str());
+					// The line points into the mapped file, so it isn't null terminated
+					CZ_LOG(logDefault, Warning, "Invalid line in INI File (%s) : %s ", filename,
+					       std::string(line).c_str());
 				}
 			}
-			else if (line=="")
-			{
-
-			}
-			else
-			{
-				CZ_LOG(logDefault, Warning, "Invalid line in INI File (%s) : %s ", filename, line.c_str());
-			}
 		}
+	}
 
-		return true;
+	IniFile::Section& IniFile::addSection(std::string_view name)
+	{
+		mSections.push_back(std::make_unique<Section>());
+		Section& section = *mSections.back();
+		section.init(name);
+		// If the name is duplicated, the index keeps pointing to the first one
+		mSectionIndex.emplace(std::string_view(section.mName), &section);
+		return section;
 	}
 
 	IniFile::Section* IniFile::getSection(const char* szName, bool bCreate)
 	{
-		for (auto&& s : mSections)
-		{
-			if (s->getName() == szName)
-				return s.get();
-		}
+		auto it = mSectionIndex.find(std::string_view(szName));
+		if (it != mSectionIndex.end())
+			return it->second;
 
 		if (bCreate)
-		{
-			mSections.push_back(std::make_unique<Section>());
-			mSections.back()->init(szName);
-			return mSections.back().get();
-		}
+			return &addSection(szName);
 
 		return NULL;
 	}
 
 } // namespace cz
-
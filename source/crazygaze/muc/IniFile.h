@@ -10,10 +10,19 @@
 #pragma once
 
 #include "crazygaze/muc/czmuc.h"
+#include <string_view>
+#include <unordered_map>
 
 namespace cz
 {
 
+	/*!
+	INI file, with sections and entries.
+
+	The file is memory mapped and parsed in place, without reading it into an intermediate buffer. Entries copy their
+	names and values while parsing, so the file is closed once parsed, and an IniFile can be read from several threads.
+	Sections and entries are indexed by name with hash tables, so lookups don't depend on how many there are.
+	*/
 	class IniFile
 	{
 	public:
@@ -42,7 +51,7 @@ namespace cz
 
 			Entry* begin()
 			{
-				return &(*mEntries.begin());
+				return mEntries.data();
 			}
 
 			Entry* end()
@@ -55,6 +64,7 @@ namespace cz
 				return &mEntries[index];
 			}
 
+			//! Finds an entry by name. If there are duplicated names, it returns the first one
 			Entry* getEntry(const char* name, bool bCreate=true);
 			/*
 			Entry* getEntryWithDefault(const char* name, const char* defaultValue);
@@ -66,7 +76,7 @@ namespace cz
 			Entry* getEntryWithDefault(const char* name, T defaultValue)
 			{
 				auto entry = getEntry(name);
-				if (entry->mValue.size() == 0)
+				if (entry->asStringView().size() == 0)
 					entry->setValue(defaultValue);
 				return entry;
 			}
@@ -94,11 +104,15 @@ namespace cz
 
 		protected:
 			friend class IniFile;
-			void init(const char* name);
+			void init(std::string_view name);
+			Entry& addEntry(std::string_view name);
 
 		private:
 			std::string mName;
 			std::vector<Entry> mEntries;
+			// Hash of the entry name -> Index in mEntries.
+			// Keyed by hash, since mEntries can be reallocated, and so keys can't point to the names
+			std::unordered_multimap<size_t, int> mIndex;
 		};
 
 
@@ -109,11 +123,6 @@ namespace cz
 			{
 			}
 
-			Entry(const Entry& other)
-				: mName(other.mName), mValue(other.mValue)
-			{
-			}
-
 			~Entry()
 			{
 			}
@@ -123,6 +132,11 @@ namespace cz
 				return mName;
 			}
 
+			std::string_view asStringView() const
+			{
+				return mValue;
+			}
+
 			const std::string& asString() const
 			{
 				return mValue;
@@ -132,28 +146,7 @@ namespace cz
 			float asFloat() const;
 			bool asBoolean() const;
 
-			template<typename T> T as();
-			template<> int as()
-			{
-				return asInt();
-			}
-			template<> bool as()
-			{
-				return asBoolean();
-			}
-			template<> float as()
-			{
-				return asFloat();
-			}
-			template<> const char* as()
-			{
-				return asString().c_str();
-			}
-			template<> std::string as()
-			{
-				return asString();
-			}
-
+			template<typename T> T as() const;
 
 			bool operator==(const Entry& other) const
 			{
@@ -162,6 +155,7 @@ namespace cz
 
 		protected:
 			friend class IniFile::Section;
+			friend class IniFile;
 			void init(const char* name, const char* val);
 			void setValue(const char* val);
 			void setValue(bool val);
@@ -177,6 +171,12 @@ namespace cz
 		virtual ~IniFile();
 		bool open(const char* filename);
 
+		/*! Parses INI text that is already in memory.
+		Values are copied, so the text doesn't need to be kept alive.
+		\param filename Only used in error messages
+		*/
+		void parse(const char* filename, std::string_view text);
+
 		int getNumSections() const
 		{
 			return static_cast<int>(mSections.size());
@@ -192,12 +192,37 @@ namespace cz
 		template<typename T>
 		T getValue(const char* szSection, const char* szName, T defaultVal)
 		{
-			return getSection(szSection)->getEntryWithDefault(szName, defaultVal)->as<T>();
+			return getSection(szSection)->getEntryWithDefault(szName, defaultVal)->template as<T>();
 		}
 
 	private:
+		Section& addSection(std::string_view name);
+
 		std::vector<std::unique_ptr<Section>> mSections;
+		// First section with a given name. The keys point to the section names
+		std::unordered_map<std::string_view, Section*> mSectionIndex;
 	};
 
+	template<> inline int IniFile::Entry::as() const
+	{
+		return asInt();
+	}
+	template<> inline bool IniFile::Entry::as() const
+	{
+		return asBoolean();
+	}
+	template<> inline float IniFile::Entry::as() const
+	{
+		return asFloat();
+	}
+	template<> inline const char* IniFile::Entry::as() const
+	{
+		return asString().c_str();
+	}
+	template<> inline std::string IniFile::Entry::as() const
+	{
+		return asString();
+	}
+
 } // namespace cz
 
@@ -0,0 +1,153 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/InternedString.h"
+#include "crazygaze/muc/FNVHash.h"
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace cz
+{
+
+namespace
+{
+	// Key used in the table, pointing to the string owned by the entry, so lookups don't need to allocate
+	struct Key
+	{
+		const char* str;
+		size_t len;
+		uint32_t hash;
+
+		bool operator==(const Key& other) const
+		{
+			return hash == other.hash && len == other.len && memcmp(str, other.str, len) == 0;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key& key) const
+		{
+			return key.hash;
+		}
+	};
+
+	/*
+	The table is split in shards, each with its own lock, so threads interning different strings don't contend
+	with each other.
+	Most calls are for strings already interned, so those only need a shared lock.
+	*/
+	class InternTable
+	{
+	public:
+		static constexpr int NUM_SHARDS = 32;
+
+		using Entry = detail::InternedStringEntry;
+
+		const Entry* intern(const char* str, size_t len, bool create)
+		{
+			Key key{str, len, Hash::fnv_32a_buf(const_cast<char*>(str), len)};
+			Shard& shard = m_shards[key.hash % NUM_SHARDS];
+			{
+				std::shared_lock<std::shared_mutex> lk(shard.mtx);
+				auto it = shard.entries.find(key);
+				if (it != shard.entries.end())
+					return it->second;
+			}
+
+			if (!create)
+				return nullptr;
+
+			std::unique_lock<std::shared_mutex> lk(shard.mtx);
+			// Another thread might have interned the string meanwhile
+			auto it = shard.entries.find(key);
+			if (it != shard.entries.end())
+				return it->second;
+
+			// Entries are never deleted, so InternedString instances can be used safely at any time, even
+			// from static objects destroyed at shutdown.
+			Entry* entry = new Entry{key.hash, std::string(str, len)};
+			key.str = entry->str.c_str();
+			shard.entries.emplace(key, entry);
+			return entry;
+		}
+
+		size_t size()
+		{
+			size_t res = 0;
+			for (auto&& shard : m_shards)
+			{
+				std::shared_lock<std::shared_mutex> lk(shard.mtx);
+				res += shard.entries.size();
+			}
+			return res;
+		}
+
+	private:
+		struct Shard
+		{
+			std::shared_mutex mtx;
+			std::unordered_map<Key, const Entry*, KeyHash> entries;
+		};
+		Shard m_shards[NUM_SHARDS];
+	};
+}
+
+// Function local static initialization is thread safe, and allows use from other static objects (e.g: log categories)
+// regardless of initialization order.
+// Intentionally leaked, so it's still available when static objects using InternedString are destroyed.
+static InternTable& getInternTable()
+{
+	static auto table = new InternTable();
+	return *table;
+}
+
+const InternedString::Entry* InternedString::intern(const char* str, size_t len, bool create)
+{
+	return getInternTable().intern(str, len, create);
+}
+
+InternedString::InternedString()
+{
+	static const Entry* empty = intern("", 0, true);
+	m_entry = empty;
+}
+
+InternedString::InternedString(const char* str)
+	: m_entry(intern(str, strlen(str), true))
+{
+}
+
+InternedString::InternedString(const char* str, size_t len)
+	: m_entry(intern(str, len, true))
+{
+}
+
+InternedString::InternedString(const std::string& str)
+	: m_entry(intern(str.c_str(), str.size(), true))
+{
+}
+
+bool InternedString::find(const char* str, size_t len, InternedString& dst)
+{
+	const Entry* entry = intern(str, len, false);
+	if (!entry)
+		return false;
+	dst.m_entry = entry;
+	return true;
+}
+
+size_t InternedString::getTableSize()
+{
+	return getInternTable().size();
+}
+
+} // namespace cz
+
@@ -0,0 +1,147 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Immutable interned strings, for names and keys that are compared and looked up a lot.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include <string>
+#include <cstring>
+#include <functional>
+#include <ostream>
+
+namespace cz
+{
+
+/*! \addtogroup String handling
+	@{
+*/
+
+namespace detail
+{
+	struct InternedStringEntry
+	{
+		uint32_t hash;
+		std::string str;
+	};
+}
+
+/*! Interned string.
+All instances with the same contents point to the same entry in a global intern table, so:
+- Copies are just a pointer copy
+- Equality is a pointer comparison
+- The hash is calculated only once, when the string is interned
+
+Interning is thread safe. Entries are never removed from the table, so this is meant for names, keys and other
+strings with a limited set of values, and not for arbitrary text.
+*/
+class InternedString
+{
+public:
+	//! Empty string
+	InternedString();
+	InternedString(const char* str);
+	InternedString(const char* str, size_t len);
+	InternedString(const std::string& str);
+
+	/*! Finds an already interned string, without interning it.
+	\return true if found, in which case "dst" is set.
+	This is useful for lookups, since if the string was never interned, it can't match any existing InternedString.
+	*/
+	static bool find(const char* str, size_t len, InternedString& dst);
+	static bool find(const char* str, InternedString& dst)
+	{
+		return find(str, strlen(str), dst);
+	}
+
+	const std::string& str() const
+	{
+		return m_entry->str;
+	}
+
+	const char* c_str() const
+	{
+		return m_entry->str.c_str();
+	}
+
+	size_t size() const
+	{
+		return m_entry->str.size();
+	}
+
+	bool empty() const
+	{
+		return m_entry->str.empty();
+	}
+
+	uint32_t hash() const
+	{
+		return m_entry->hash;
+	}
+
+	bool operator==(const InternedString& other) const
+	{
+		return m_entry == other.m_entry;
+	}
+
+	bool operator!=(const InternedString& other) const
+	{
+		return m_entry != other.m_entry;
+	}
+
+	bool operator==(const char* other) const
+	{
+		return m_entry->str == other;
+	}
+
+	bool operator!=(const char* other) const
+	{
+		return !(*this == other);
+	}
+
+	//! Ordering by contents, so it can be used in sorted containers with deterministic order
+	bool operator<(const InternedString& other) const
+	{
+		return m_entry != other.m_entry && m_entry->str < other.m_entry->str;
+	}
+
+	//! Total number of interned strings. Only useful for diagnostics
+	static size_t getTableSize();
+
+private:
+	using Entry = detail::InternedStringEntry;
+
+	static const Entry* intern(const char* str, size_t len, bool create);
+
+	const Entry* m_entry;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const InternedString& str)
+{
+	return os << str.str();
+}
+
+/*!
+	@}
+*/
+
+} // namespace cz
+
+namespace std
+{
+	template<>
+	struct hash<cz::InternedString>
+	{
+		size_t operator()(const cz::InternedString& str) const
+		{
+			return str.hash();
+		}
+	};
+}
+
@@ -2,43 +2,110 @@
 #include "crazygaze/muc/Json.h"
 #include "crazygaze/muc/StringUtils.h"
 
+#if CZ_SSE2
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <immintrin.h>
+	#endif
+#endif
+
 namespace cz
 {
-	
-std::string to_json(const char* val)
+
+namespace
 {
-	std::string res = "\"";
-	while (*val)
+	inline int firstSetBit(uint32_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward(&idx, v);
+		return static_cast<int>(idx);
+#else
+		return __builtin_ctz(v);
+#endif
+	}
+
+	inline bool needsEscape(uint8_t c)
 	{
-		switch (*val)
+		return c < 0x20 || c == '"' || c == '\\';
+	}
+
+	//! Position of the first character that needs escaping, or size if there are none
+	size_t findEscape(const uint8_t* p, size_t size)
+	{
+		size_t i = 0;
+#if CZ_SSE2
+		// SSE2 is always available on x64, so no runtime dispatching
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i maxControl = _mm_set1_epi8(0x1F);
+		for (; i + 16 <= size; i += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			// There is no unsigned comparison, but min(v, 0x1F) == v is the same as v <= 0x1F
+			__m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, maxControl), v);
+			__m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+			int mask = _mm_movemask_epi8(_mm_or_si128(control, special));
+			if (mask)
+				return i + firstSetBit(mask);
+		}
+#endif
+		for (; i < size; i++)
+		{
+			if (needsEscape(p[i]))
+				return i;
+		}
+		return size;
+	}
+}
+
+void JsonWriter::appendString(std::string& dst, const char* str, size_t size)
+{
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(str);
+	const uint8_t* end = p + size;
+	dst += '"';
+	while (true)
+	{
+		size_t n = findEscape(p, end - p);
+		dst.append(reinterpret_cast<const char*>(p), n);
+		p += n;
+		if (p == end)
+			break;
+
+		uint8_t c = *p++;
+		switch (c)
 		{
 		case '\b':
-			res += "\\b";
+			dst += "\\b";
 			break;
 		case '\f':
-			res += "\\f";
+			dst += "\\f";
 			break;
 		case '\n':
-			res += "\\n";
+			dst += "\\n";
 			break;
 		case '\r':
-			res += "\\r";
+			dst += "\\r";
 			break;
 		case '\t':
-			res += "\\t";
+			dst += "\\t";
 			break;
 		case '"':
-			res += "\\\"";
+			dst += "\\\"";
 			break;
 		case '\\':
-			res += "\\\\";
+			dst += "\\\\";
 			break;
 		default:
-			res += *val;
+		{
+			static const char hex[] = "0123456789abcdef";
+			char buf[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+			dst.append(buf, 6);
+		}
 		}
-		val++;
 	}
-	return  res + "\"";
+	dst += '"';
 }
 
 } // namespace cz
@@ -2,20 +2,220 @@
 	CrazyGaze (http://www.crazygaze.com)
 	Author : Rui Figueira
 	Email  : rui@crazygaze.com
-	
+
 	purpose:
 *********************************************************************/
 #pragma once
 
 #include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/JsonReader.h"
+#include <charconv>
+#include <cmath>
 
 namespace cz
 {
 
+	/*!
+	Writes JSON to a string, appending to whatever is already there, so the caller can reuse the same string (and its
+	memory) for many documents.
+	Commas and colons are added automatically. E.g:
+
+	std::string out;
+	JsonWriter w(out);
+	w.beginObject().field("id", 10).key("tags").beginArray().value("a").value("b").endArray().endObject();
+	// out is: {"id":10,"tags":["a","b"]}
+
+	value() accepts anything there is a to_json overload for.
+	*/
+	class JsonWriter
+	{
+	public:
+		explicit JsonWriter(std::string& dst) : m_dst(dst)
+		{
+		}
+
+		JsonWriter& beginObject()
+		{
+			separator();
+			m_dst += '{';
+			m_needComma = false;
+			return *this;
+		}
+		JsonWriter& endObject()
+		{
+			m_dst += '}';
+			m_needComma = true;
+			return *this;
+		}
+		JsonWriter& beginArray()
+		{
+			separator();
+			m_dst += '[';
+			m_needComma = false;
+			return *this;
+		}
+		JsonWriter& endArray()
+		{
+			m_dst += ']';
+			m_needComma = true;
+			return *this;
+		}
+
+		JsonWriter& key(const char* str, size_t size)
+		{
+			separator();
+			appendString(m_dst, str, size);
+			m_dst += ':';
+			m_needComma = false;
+			return *this;
+		}
+		JsonWriter& key(const char* str)
+		{
+			return key(str, strlen(str));
+		}
+		JsonWriter& key(const std::string& str)
+		{
+			return key(str.c_str(), str.size());
+		}
+
+		JsonWriter& null()
+		{
+			separator();
+			m_dst += "null";
+			m_needComma = true;
+			return *this;
+		}
+
+		template<typename T>
+		JsonWriter& value(const T& v);
+
+		JsonWriter& value(const char* str, size_t size)
+		{
+			separator();
+			appendString(m_dst, str, size);
+			m_needComma = true;
+			return *this;
+		}
+
+		//! Writes something already in JSON
+		JsonWriter& raw(const char* json, size_t size)
+		{
+			separator();
+			m_dst.append(json, size);
+			m_needComma = true;
+			return *this;
+		}
+
+		template<typename T>
+		JsonWriter& field(const char* name, const T& v)
+		{
+			key(name);
+			return value(v);
+		}
+
+		std::string& getOutput()
+		{
+			return m_dst;
+		}
+
+		//! Appends a quoted and escaped string. Bytes that don't need escaping are found with SIMD and copied in bulk
+		static void appendString(std::string& dst, const char* str, size_t size);
+
+		template<typename T>
+		static void appendNumber(std::string& dst, T v)
+		{
+			static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, "Not a number");
+			if constexpr (std::is_floating_point_v<T>)
+			{
+				// JSON doesn't support NaN or infinity
+				if (!std::isfinite(v))
+				{
+					dst += "null";
+					return;
+				}
+			}
+			// Shortest representation that parses back to the same value
+			char buf[32];
+			dst.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+		}
+
+	private:
+		void separator()
+		{
+			if (m_needComma)
+				m_dst += ',';
+		}
+
+		std::string& m_dst;
+		bool m_needComma = false;
+	};
+
+	//
+	// Versions that append to an existing string
+	//
+
+	template< typename T >
+	std::enable_if_t<std::is_arithmetic_v<T>> to_json(std::string& dst, T val)
+	{
+		JsonWriter::appendNumber(dst, val);
+	}
+
+	inline void to_json(std::string& dst, bool val)
+	{
+		dst += val ? "true" : "false";
+	}
+
+	inline void to_json(std::string& dst, const char* val, size_t size)
+	{
+		JsonWriter::appendString(dst, val, size);
+	}
+
+	inline void to_json(std::string& dst, const char* val)
+	{
+		JsonWriter::appendString(dst, val, strlen(val));
+	}
+
+	inline void to_json(std::string& dst, const std::string& val)
+	{
+		JsonWriter::appendString(dst, val.c_str(), val.size());
+	}
+
+	template<typename T>
+	void to_json(std::string& dst, const std::vector<T>& val);
+	template<typename FIRST, typename SECOND>
+	void to_json(std::string& dst, const std::pair<FIRST, SECOND>& val);
+
+	// std::vector of any T that can be converted to json
+	template<typename T>
+	void to_json(std::string& dst, const std::vector<T>& val)
+	{
+		JsonWriter w(dst);
+		w.beginArray();
+		for (auto&& v : val)
+			w.value(v);
+		w.endArray();
+	}
+
+	// std::pair of any FIRST,SECOND that can be converted to json
+	// #RVF : Not sure this is appropriate.
+	// The user might not want fields named 'first' and 'second'
+	template<typename FIRST, typename SECOND>
+	void to_json(std::string& dst, const std::pair<FIRST,SECOND>& val)
+	{
+		JsonWriter w(dst);
+		w.beginObject().field("first", val.first).field("second", val.second).endObject();
+	}
+
+	//
+	// Versions that return a new string
+	//
+
 	template< typename T >
 	std::enable_if_t<std::is_arithmetic_v<T>, std::string> to_json(T val)
 	{
-		return std::to_string(val);
+		std::string res;
+		to_json(res, val);
+		return res;
 	}
 
 	inline std::string to_json(bool val)
@@ -23,38 +223,151 @@ namespace cz
 		return std::string(val ? "true" : "false");
 	}
 
-	std::string to_json(const char* val);
+	inline std::string to_json(const char* val)
+	{
+		std::string res;
+		to_json(res, val);
+		return res;
+	}
 
 	inline std::string to_json(const std::string& val)
 	{
-		return to_json(val.c_str());
+		std::string res;
+		to_json(res, val);
+		return res;
 	}
 
-	// std::vector of any T that can be converted to json
 	template<typename T>
 	std::string to_json(const std::vector<T>& val)
 	{
-		if (val.size() == 0)
-			return "[]";
-
 		std::string res;
-		for (auto&& v : val)
-			res += "," + to_json(v);
-		res += "]";
-		res[0] = '[';
-
+		to_json(res, val);
 		return res;
 	}
 
-	// std::pair of any FIRST,SECOND that can be converted to json
-	// #RVF : Not sure this is appropriate.
-	// The user might not want fields named 'first' and 'second'
 	template<typename FIRST, typename SECOND>
 	std::string to_json(const std::pair<FIRST,SECOND>& val)
 	{
-		std::string res = "{\"first\":" + to_json(val.first);
-		res += ", \"second\":" + to_json(val.second) + "}";
+		std::string res;
+		to_json(res, val);
 		return res;
 	}
 
+	// Defined here, so it sees all the to_json overloads above. Overloads for other types are found by ADL.
+	template<typename T>
+	JsonWriter& JsonWriter::value(const T& v)
+	{
+		separator();
+		to_json(m_dst, v);
+		m_needComma = true;
+		return *this;
+	}
+
 } // namespace cz
+
+//
+// Reflection for structs, generating both to_json and from_json from a list of fields. E.g:
+//
+//	struct Point
+//	{
+//		int x;
+//		int y;
+//		std::string name;
+//	};
+//	CZ_JSON_FIELDS(Point, x, y, name)
+//
+// Use it at namespace scope, in the same namespace as the struct, so the functions are found by ADL. Private fields
+// need the functions to be friends.
+// The keys are the field names, which are identifiers and therefore never need escaping, so each one is baked into a
+// string literal together with the separators (e.g: ",\"x\":"), and to_json writes the object in one pass. The first
+// separator is a ',' which is then replaced with the '{', so there are no branches.
+// from_json goes through the members once, ignores unknown keys, and leaves missing fields untouched.
+// Up to 32 fields are supported.
+//
+
+#define CZ_JSON_EXPAND(x) x
+#define CZ_JSON_FOREACH_1(M, T, a) M(T, a)
+#define CZ_JSON_FOREACH_2(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_1(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_3(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_2(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_4(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_3(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_5(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_4(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_6(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_5(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_7(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_6(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_8(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_7(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_9(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_8(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_10(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_9(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_11(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_10(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_12(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_11(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_13(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_12(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_14(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_13(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_15(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_14(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_16(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_15(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_17(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_16(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_18(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_17(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_19(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_18(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_20(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_19(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_21(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_20(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_22(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_21(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_23(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_22(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_24(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_23(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_25(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_24(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_26(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_25(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_27(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_26(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_28(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_27(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_29(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_28(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_30(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_29(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_31(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_30(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_32(M, T, a, ...) M(T, a) CZ_JSON_EXPAND(CZ_JSON_FOREACH_31(M, T, __VA_ARGS__))
+#define CZ_JSON_FOREACH_PICK(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18,           \
+                             _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, NAME, ...)           \
+	NAME
+#define CZ_JSON_FOREACH(M, T, ...)                                                                                      \
+	CZ_JSON_EXPAND(CZ_JSON_FOREACH_PICK(__VA_ARGS__,                                                                    \
+	    CZ_JSON_FOREACH_32, CZ_JSON_FOREACH_31, CZ_JSON_FOREACH_30, CZ_JSON_FOREACH_29, CZ_JSON_FOREACH_28,             \
+	    CZ_JSON_FOREACH_27, CZ_JSON_FOREACH_26, CZ_JSON_FOREACH_25, CZ_JSON_FOREACH_24, CZ_JSON_FOREACH_23,             \
+	    CZ_JSON_FOREACH_22, CZ_JSON_FOREACH_21, CZ_JSON_FOREACH_20, CZ_JSON_FOREACH_19, CZ_JSON_FOREACH_18,             \
+	    CZ_JSON_FOREACH_17, CZ_JSON_FOREACH_16, CZ_JSON_FOREACH_15, CZ_JSON_FOREACH_14, CZ_JSON_FOREACH_13,             \
+	    CZ_JSON_FOREACH_12, CZ_JSON_FOREACH_11, CZ_JSON_FOREACH_10, CZ_JSON_FOREACH_9, CZ_JSON_FOREACH_8,               \
+	    CZ_JSON_FOREACH_7, CZ_JSON_FOREACH_6, CZ_JSON_FOREACH_5, CZ_JSON_FOREACH_4, CZ_JSON_FOREACH_3,                  \
+	    CZ_JSON_FOREACH_2, CZ_JSON_FOREACH_1)(M, T, __VA_ARGS__))
+
+#define CZ_JSON_WRITE_FIELD(T, field)                                                                                  \
+	dst.append(",\"" #field "\":", sizeof(",\"" #field "\":") - 1);                                                    \
+	to_json(dst, v.field);
+
+#define CZ_JSON_READ_FIELD(T, field)                                                                                   \
+	else if (m.key == std::string_view(#field, sizeof(#field) - 1))                                                    \
+	{                                                                                                                  \
+		ok = from_json(m.value, v.field) && ok;                                                                        \
+	}
+
+#define CZ_JSON_FIELDS(T, ...)                                                                                         \
+	inline void to_json(std::string& dst, const T& v)                                                                  \
+	{                                                                                                                  \
+		using ::cz::to_json;                                                                                           \
+		size_t czJsonStart = dst.size();                                                                               \
+		CZ_JSON_EXPAND(CZ_JSON_FOREACH(CZ_JSON_WRITE_FIELD, T, __VA_ARGS__))                                           \
+		dst[czJsonStart] = '{';                                                                                        \
+		dst += '}';                                                                                                    \
+	}                                                                                                                  \
+	inline std::string to_json(const T& v)                                                                             \
+	{                                                                                                                  \
+		std::string res;                                                                                               \
+		to_json(res, v);                                                                                               \
+		return res;                                                                                                    \
+	}                                                                                                                  \
+	inline bool from_json(const ::cz::JsonValue& j, T& v)                                                              \
+	{                                                                                                                  \
+		using ::cz::from_json;                                                                                         \
+		if (!j.isObject())                                                                                             \
+			return false;                                                                                              \
+		bool ok = true;                                                                                                \
+		for (auto&& m : j.getMembers())                                                                                \
+		{                                                                                                              \
+			if (false)                                                                                                 \
+			{                                                                                                          \
+			}                                                                                                          \
+			CZ_JSON_EXPAND(CZ_JSON_FOREACH(CZ_JSON_READ_FIELD, T, __VA_ARGS__))                                        \
+		}                                                                                                              \
+		return ok;                                                                                                     \
+	}
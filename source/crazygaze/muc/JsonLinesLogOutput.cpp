@@ -0,0 +1,154 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Structured logging to a JSON Lines file
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "JsonLinesLogOutput.h"
+#include "Json.h"
+
+namespace cz
+{
+
+namespace
+{
+	const char* verbosityName(LogVerbosity v)
+	{
+		switch (v)
+		{
+		case LogVerbosity::Fatal  : return "Fatal";
+		case LogVerbosity::Error  : return "Error";
+		case LogVerbosity::Warning: return "Warning";
+		case LogVerbosity::Log    : return "Log";
+		case LogVerbosity::Verbose: return "Verbose";
+		default                   : return "None";
+		}
+	}
+
+	void writeDigits(char* dst, int v, int count)
+	{
+		for (int i = count - 1; i >= 0; i--)
+		{
+			dst[i] = static_cast<char>('0' + v % 10);
+			v /= 10;
+		}
+	}
+}
+
+JsonLinesLogOutput::JsonLinesLogOutput(const char* filename)
+	: FileLogOutput(filename)
+{
+}
+
+JsonLinesLogOutput::JsonLinesLogOutput(const char* filename, const Rotation& rotation)
+	: FileLogOutput(filename, rotation)
+{
+}
+
+JsonLinesLogOutput::~JsonLinesLogOutput()
+{
+	detach();
+}
+
+void JsonLinesLogOutput::appendTime(std::chrono::system_clock::time_point time)
+{
+	int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+	int64_t second = ms / 1000;
+	// The date and time are only calculated once per second
+	if (second != m_second)
+	{
+		m_second = second;
+		time_t t = static_cast<time_t>(second);
+		struct tm d;
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+		gmtime_s(&d, &t);
+#else
+		gmtime_r(&t, &d);
+#endif
+		writeDigits(m_time, d.tm_year + 1900, 4);
+		m_time[4] = '-';
+		writeDigits(m_time + 5, d.tm_mon + 1, 2);
+		m_time[7] = '-';
+		writeDigits(m_time + 8, d.tm_mday, 2);
+		m_time[10] = 'T';
+		writeDigits(m_time + 11, d.tm_hour, 2);
+		m_time[13] = ':';
+		writeDigits(m_time + 14, d.tm_min, 2);
+		m_time[16] = ':';
+		writeDigits(m_time + 17, d.tm_sec, 2);
+		m_time[19] = '.';
+	}
+
+	char buf[26];
+	buf[0] = '"';
+	memcpy(buf + 1, m_time, 20);
+	writeDigits(buf + 21, static_cast<int>(ms % 1000), 3);
+	buf[24] = 'Z';
+	buf[25] = '"';
+	m_json.append(buf, 26);
+}
+
+void JsonLinesLogOutput::logEntry(const LogEntry& entry)
+{
+	m_json.clear();
+	m_json += "{\"time\":";
+	appendTime(entry.time);
+	m_json += ",\"level\":\"";
+	m_json += verbosityName(entry.verbosity);
+	m_json += "\",\"category\":";
+	to_json(m_json, entry.category->getName());
+	m_json += ",\"file\":";
+	to_json(m_json, entry.file);
+	m_json += ",\"line\":";
+	to_json(m_json, entry.line);
+	m_json += ",\"msg\":";
+	to_json(m_json, entry.msg, entry.msgSize);
+
+	LogFieldList fields = entry.fields;
+	LogFieldValue f;
+	bool first = true;
+	while (fields.next(f))
+	{
+		m_json += first ? ",\"fields\":{" : ",";
+		first = false;
+		to_json(m_json, f.key);
+		m_json += ':';
+		switch (f.type)
+		{
+		case LogFieldType::Integer:
+			to_json(m_json, f.i);
+			break;
+		case LogFieldType::Unsigned:
+			to_json(m_json, f.u);
+			break;
+		case LogFieldType::Double:
+			to_json(m_json, f.d);
+			break;
+		case LogFieldType::Bool:
+			to_json(m_json, f.u != 0);
+			break;
+		case LogFieldType::String:
+			to_json(m_json, f.str, f.strSize);
+			break;
+		case LogFieldType::Pointer:
+			// Not something JSON has, and pointers are too big for some parsers as numbers
+			char buf[24];
+			snprintf(buf, sizeof(buf), "\"0x%llx\"", static_cast<unsigned long long>(f.u));
+			m_json += buf;
+			break;
+		}
+	}
+	if (!first)
+		m_json += '}';
+	m_json += "}\n";
+
+	append(m_json.data(), m_json.size());
+}
+
+}
+
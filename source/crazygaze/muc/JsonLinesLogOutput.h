@@ -0,0 +1,45 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Structured logging to a JSON Lines file
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/FileLogOutput.h"
+
+namespace cz
+{
+
+/*! Logs to a file in the JSON Lines format (one JSON object per line), so log shippers don't need to parse the text.
+Each line looks like:
+{"time":"2026-10-18T20:15:30.123Z","level":"Warning","category":"logNet","file":"Net.cpp","line":10,"msg":"Timeout","fields":{"port":80}}
+"time" is in UTC, and "fields" is only present if the message has fields (see cz::logField).
+
+Lines are serialized to a buffer that is reused, and written in batches, the same way as FileLogOutput, so there are no
+allocations per message. Rotation works the same way as FileLogOutput.
+*/
+class JsonLinesLogOutput : public FileLogOutput
+{
+public:
+	explicit JsonLinesLogOutput(const char* filename);
+	JsonLinesLogOutput(const char* filename, const Rotation& rotation);
+	~JsonLinesLogOutput();
+
+private:
+	void logEntry(const LogEntry& entry) override;
+	void appendTime(std::chrono::system_clock::time_point time);
+
+	// The outputs are called with the logging lock held, so these don't need a lock
+	std::string m_json;
+	int64_t m_second = -1;
+	// "yyyy-mm-ddThh:mm:ss." for m_second
+	char m_time[20];
+};
+
+}
+
@@ -0,0 +1,835 @@
+#include "czmucPCH.h"
+#include "crazygaze/muc/JsonReader.h"
+#include "crazygaze/muc/UTF8Utils.h"
+#include <charconv>
+
+#if CZ_SSE2
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <immintrin.h>
+	#endif
+#endif
+
+namespace cz
+{
+
+namespace
+{
+	inline int firstSetBit(uint64_t v)
+	{
+#if defined(_MSC_VER)
+		unsigned long idx;
+		_BitScanForward64(&idx, v);
+		return static_cast<int>(idx);
+#else
+		return __builtin_ctzll(v);
+#endif
+	}
+
+	inline bool isWhitespace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	//! Characters that can follow a number or literal
+	inline bool isTerminator(char c)
+	{
+		switch (c)
+		{
+		case ' ': case '\t': case '\n': case '\r':
+		case ',': case ':': case ']': case '}': case '[': case '{':
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	inline bool isDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+
+	//
+	// First pass
+	//
+
+	//! Bit masks for a block of 64 bytes, with bit N set if byte N is of that class
+	struct BlockMasks
+	{
+		uint64_t backslash;
+		uint64_t quote;
+		uint64_t control;
+		uint64_t whitespace;
+		//! {}[]:,
+		uint64_t op;
+	};
+
+	void classifyBlock(const uint8_t* p, BlockMasks& m)
+	{
+#if CZ_SSE2
+		const __m128i backslash = _mm_set1_epi8('\\');
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i maxControl = _mm_set1_epi8(0x1F);
+		const __m128i space = _mm_set1_epi8(' ');
+		const __m128i tab = _mm_set1_epi8('\t');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		const __m128i lowerBit = _mm_set1_epi8(0x20);
+		const __m128i openBrace = _mm_set1_epi8('{');
+		const __m128i closeBrace = _mm_set1_epi8('}');
+		const __m128i colon = _mm_set1_epi8(':');
+		const __m128i comma = _mm_set1_epi8(',');
+		m = BlockMasks{};
+		for (int i = 0; i < 4; i++)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i * 16));
+			auto toMask = [i](__m128i cmp) {
+				return uint64_t(uint16_t(_mm_movemask_epi8(cmp))) << (i * 16);
+			};
+			m.backslash |= toMask(_mm_cmpeq_epi8(v, backslash));
+			m.quote |= toMask(_mm_cmpeq_epi8(v, quote));
+			// min(v, 0x1F) == v is the same as v <= 0x1F, since there is no unsigned comparison
+			m.control |= toMask(_mm_cmpeq_epi8(_mm_min_epu8(v, maxControl), v));
+			m.whitespace |= toMask(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+			                                    _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr))));
+			// '[' and ']' are '{' and '}' without bit 5 set
+			__m128i lower = _mm_or_si128(v, lowerBit);
+			m.op |= toMask(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, openBrace), _mm_cmpeq_epi8(lower, closeBrace)),
+			                            _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma))));
+		}
+#else
+		m = BlockMasks{};
+		for (int i = 0; i < 64; i++)
+		{
+			uint8_t c = p[i];
+			uint64_t bit = uint64_t(1) << i;
+			if (c == '\\')
+				m.backslash |= bit;
+			else if (c == '"')
+				m.quote |= bit;
+			else if (isWhitespace(c))
+				m.whitespace |= bit;
+			else if (c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',')
+				m.op |= bit;
+			if (c < 0x20)
+				m.control |= bit;
+		}
+#endif
+	}
+
+	/*!
+	Finds the characters escaped by a backslash, taking into account runs of backslashes, with no branches.
+	A run starting at an even position escapes the character after it if the run ends at an even position, and the same
+	for odd positions. The addition propagates each run start to the end of the run.
+	\param prevEscaped
+		In: If the first character of the block is escaped by the previous block.
+		Out: Same for the next block.
+	*/
+	inline uint64_t findEscaped(uint64_t backslash, uint64_t& prevEscaped)
+	{
+		const uint64_t evenBits = 0x5555555555555555ull;
+		backslash &= ~prevEscaped;
+		uint64_t followsEscape = (backslash << 1) | prevEscaped;
+		uint64_t oddSequenceStarts = backslash & ~evenBits & ~followsEscape;
+		uint64_t sequencesStartingOnEvenBits = oddSequenceStarts + backslash;
+		prevEscaped = sequencesStartingOnEvenBits < oddSequenceStarts ? 1 : 0;
+		uint64_t invertMask = sequencesStartingOnEvenBits << 1;
+		return (evenBits ^ invertMask) & followsEscape;
+	}
+
+	//! Bit N is the xor of all bits up to N. Turns a mask of quotes into a mask of what is inside strings.
+	inline uint64_t prefixXor(uint64_t v)
+	{
+		v ^= v << 1;
+		v ^= v << 2;
+		v ^= v << 4;
+		v ^= v << 8;
+		v ^= v << 16;
+		v ^= v << 32;
+		return v;
+	}
+
+	//
+	// Second pass
+	//
+
+	//! Position of the first '"' or '\\' in [p, end), or end if not found
+	inline char* findQuoteOrBackslash(char* p, char* end)
+	{
+#if CZ_SSE2
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i backslash = _mm_set1_epi8('\\');
+		for (; p + 16 <= end; p += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)));
+			if (mask)
+				return p + firstSetBit(mask);
+		}
+#endif
+		while (p != end && *p != '"' && *p != '\\')
+			p++;
+		return p;
+	}
+
+	inline int hexDigit(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		c |= 0x20;
+		if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		return -1;
+	}
+
+	//! Reads the 4 hex digits of a \u escape
+	inline bool readHex4(const char* p, uint32_t& v)
+	{
+		v = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			int d = hexDigit(p[i]);
+			if (d < 0)
+				return false;
+			v = (v << 4) | d;
+		}
+		return true;
+	}
+
+	inline char* encodeUTF8(uint32_t cp, char* dst)
+	{
+		if (cp < 0x80)
+		{
+			*dst++ = static_cast<char>(cp);
+		}
+		else if (cp < 0x800)
+		{
+			*dst++ = static_cast<char>(0xC0 | (cp >> 6));
+			*dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			*dst++ = static_cast<char>(0xE0 | (cp >> 12));
+			*dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			*dst++ = static_cast<char>(0xF0 | (cp >> 18));
+			*dst++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			*dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		return dst;
+	}
+
+	template<typename Handler>
+	class JsonParser
+	{
+	public:
+		JsonParser(char* buf, size_t size, const std::vector<uint32_t>& index, Handler& handler, JsonError& error,
+		           int maxDepth)
+		    : m_buf(buf)
+		    , m_end(buf + size)
+		    , m_index(index.data())
+		    , m_count(index.size())
+		    , m_handler(handler)
+		    , m_error(error)
+		    , m_maxDepth(maxDepth)
+		{
+		}
+
+		bool parseDocument()
+		{
+			if (m_count == 0)
+				return fail("Empty document", 0);
+			if (!parseValue(0))
+				return false;
+			if (m_next != m_count)
+				return fail("Unexpected content after the root value", m_index[m_next]);
+			return true;
+		}
+
+	private:
+		bool fail(const char* message, size_t offset)
+		{
+			m_error.message = message;
+			m_error.offset = offset;
+			return false;
+		}
+
+		bool stopped(size_t offset)
+		{
+			return fail("Stopped by the handler", offset);
+		}
+
+		//! Moves to the next structural character, returning its offset
+		bool next(size_t& offset)
+		{
+			if (m_next == m_count)
+				return fail("Unexpected end of document", m_end - m_buf);
+			offset = m_index[m_next++];
+			return true;
+		}
+
+		bool parseValue(int depth)
+		{
+			size_t offset;
+			if (!next(offset))
+				return false;
+
+			switch (m_buf[offset])
+			{
+			case '{':
+				return parseObject(offset, depth + 1);
+			case '[':
+				return parseArray(offset, depth + 1);
+			case '"':
+			{
+				std::string_view str;
+				if (!parseString(offset, str))
+					return false;
+				return m_handler.onString(str) || stopped(offset);
+			}
+			case 't':
+				if (!parseLiteral(offset, "true", 4))
+					return false;
+				return m_handler.onBool(true) || stopped(offset);
+			case 'f':
+				if (!parseLiteral(offset, "false", 5))
+					return false;
+				return m_handler.onBool(false) || stopped(offset);
+			case 'n':
+				if (!parseLiteral(offset, "null", 4))
+					return false;
+				return m_handler.onNull() || stopped(offset);
+			case '-': case '0': case '1': case '2': case '3': case '4':
+			case '5': case '6': case '7': case '8': case '9':
+				return parseNumber(offset);
+			default:
+				return fail("Unexpected character", offset);
+			}
+		}
+
+		bool parseObject(size_t offset, int depth)
+		{
+			if (depth > m_maxDepth)
+				return fail("Maximum depth exceeded", offset);
+			if (!m_handler.onBeginObject())
+				return stopped(offset);
+
+			size_t count = 0;
+			if (m_next != m_count && m_buf[m_index[m_next]] == '}')
+			{
+				m_next++;
+				return m_handler.onEndObject(0) || stopped(offset);
+			}
+
+			while (true)
+			{
+				if (!next(offset))
+					return false;
+				if (m_buf[offset] != '"')
+					return fail("Expected a key", offset);
+				std::string_view key;
+				if (!parseString(offset, key))
+					return false;
+				if (!m_handler.onKey(key))
+					return stopped(offset);
+
+				if (!next(offset))
+					return false;
+				if (m_buf[offset] != ':')
+					return fail("Expected ':'", offset);
+
+				if (!parseValue(depth))
+					return false;
+				count++;
+
+				if (!next(offset))
+					return false;
+				if (m_buf[offset] == '}')
+					return m_handler.onEndObject(count) || stopped(offset);
+				if (m_buf[offset] != ',')
+					return fail("Expected ',' or '}'", offset);
+			}
+		}
+
+		bool parseArray(size_t offset, int depth)
+		{
+			if (depth > m_maxDepth)
+				return fail("Maximum depth exceeded", offset);
+			if (!m_handler.onBeginArray())
+				return stopped(offset);
+
+			size_t count = 0;
+			if (m_next != m_count && m_buf[m_index[m_next]] == ']')
+			{
+				m_next++;
+				return m_handler.onEndArray(0) || stopped(offset);
+			}
+
+			while (true)
+			{
+				if (!parseValue(depth))
+					return false;
+				count++;
+
+				if (!next(offset))
+					return false;
+				if (m_buf[offset] == ']')
+					return m_handler.onEndArray(count) || stopped(offset);
+				if (m_buf[offset] != ',')
+					return fail("Expected ',' or ']'", offset);
+			}
+		}
+
+		bool parseLiteral(size_t offset, const char* literal, size_t len)
+		{
+			const char* p = m_buf + offset;
+			if (size_t(m_end - p) < len || memcmp(p, literal, len) != 0 || (p + len != m_end && !isTerminator(p[len])))
+				return fail("Invalid literal", offset);
+			return true;
+		}
+
+		/*!
+		Unescapes the string in place, and null terminates it.
+		The unescaped string is never longer than the original, so the terminator can take the place of the closing quote.
+		The first pass already made sure the string is closed and there are no control characters.
+		*/
+		bool parseString(size_t offset, std::string_view& str)
+		{
+			char* const start = m_buf + offset + 1;
+			char* src = start;
+			char* dst = start;
+			while (true)
+			{
+				char* p = findQuoteOrBackslash(src, m_end);
+				CZ_ASSERT(p != m_end);
+				if (dst != src)
+					memmove(dst, src, p - src);
+				dst += p - src;
+				src = p;
+
+				if (*src == '"')
+				{
+					*dst = 0;
+					str = std::string_view(start, dst - start);
+					return true;
+				}
+
+				// Escape sequence. There is always something after the backslash (at least the closing quote)
+				switch (src[1])
+				{
+				case '"': *dst++ = '"'; break;
+				case '\\': *dst++ = '\\'; break;
+				case '/': *dst++ = '/'; break;
+				case 'b': *dst++ = '\b'; break;
+				case 'f': *dst++ = '\f'; break;
+				case 'n': *dst++ = '\n'; break;
+				case 'r': *dst++ = '\r'; break;
+				case 't': *dst++ = '\t'; break;
+				case 'u':
+				{
+					uint32_t cp;
+					if (m_end - src < 6 || !readHex4(src + 2, cp))
+						return fail("Invalid \\u escape", src - m_buf);
+					if (cp >= 0xD800 && cp <= 0xDBFF)
+					{
+						// High surrogate, which needs to be followed by a low surrogate
+						uint32_t low;
+						if (m_end - src < 12 || src[6] != '\\' || src[7] != 'u' || !readHex4(src + 8, low) ||
+						    low < 0xDC00 || low > 0xDFFF)
+							return fail("Invalid surrogate pair", src - m_buf);
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+						src += 6;
+					}
+					else if (cp >= 0xDC00 && cp <= 0xDFFF)
+					{
+						return fail("Invalid surrogate pair", src - m_buf);
+					}
+					dst = encodeUTF8(cp, dst);
+					src += 6;
+					continue;
+				}
+				default:
+					return fail("Invalid escape sequence", src - m_buf);
+				}
+				src += 2;
+			}
+		}
+
+		bool parseNumber(size_t offset)
+		{
+			const char* const start = m_buf + offset;
+			const char* p = start;
+			bool negative = false;
+			if (*p == '-')
+			{
+				negative = true;
+				p++;
+			}
+
+			const char* digits = p;
+			uint64_t v = 0;
+			if (p == m_end || !isDigit(*p))
+				return fail("Invalid number", offset);
+			if (*p == '0')
+			{
+				p++;
+				if (p != m_end && isDigit(*p))
+					return fail("Leading zeros are not allowed", offset);
+			}
+			else
+			{
+				while (p != m_end && isDigit(*p))
+					v = v * 10 + (*p++ - '0');
+			}
+			size_t numDigits = p - digits;
+
+			bool isInteger = true;
+			if (p != m_end && *p == '.')
+			{
+				isInteger = false;
+				p++;
+				if (p == m_end || !isDigit(*p))
+					return fail("Invalid number", offset);
+				while (p != m_end && isDigit(*p))
+					p++;
+			}
+			if (p != m_end && (*p == 'e' || *p == 'E'))
+			{
+				isInteger = false;
+				p++;
+				if (p != m_end && (*p == '+' || *p == '-'))
+					p++;
+				if (p == m_end || !isDigit(*p))
+					return fail("Invalid number", offset);
+				while (p != m_end && isDigit(*p))
+					p++;
+			}
+			if (p != m_end && !isTerminator(*p))
+				return fail("Invalid number", offset);
+
+			if (isInteger)
+			{
+				// Up to 19 digits can't overflow an uint64_t
+				if (numDigits <= 19)
+				{
+					if (!negative)
+					{
+						if (v <= uint64_t(std::numeric_limits<int64_t>::max()))
+							return m_handler.onInt(static_cast<int64_t>(v)) || stopped(offset);
+						return m_handler.onUint(v) || stopped(offset);
+					}
+					else if (v <= uint64_t(std::numeric_limits<int64_t>::max()) + 1)
+					{
+						return m_handler.onInt(static_cast<int64_t>(0 - v)) || stopped(offset);
+					}
+				}
+				else if (numDigits == 20 && !negative)
+				{
+					auto res = std::from_chars(digits, p, v);
+					if (res.ec == std::errc())
+						return m_handler.onUint(v) || stopped(offset);
+				}
+				// Too big for an integer, so falls through to double
+			}
+
+			double d;
+			auto res = std::from_chars(start, p, d);
+			if (res.ec != std::errc())
+				return fail("Number out of range", offset);
+			return m_handler.onDouble(d) || stopped(offset);
+		}
+
+		char* m_buf;
+		char* m_end;
+		const uint32_t* m_index;
+		size_t m_count;
+		size_t m_next = 0;
+		Handler& m_handler;
+		JsonError& m_error;
+		int m_maxDepth;
+	};
+
+} // anonymous namespace
+
+//////////////////////////////////////////////////////////////////////////
+// JsonReader
+//////////////////////////////////////////////////////////////////////////
+
+JsonReader::JsonReader()
+{
+}
+
+JsonReader::~JsonReader()
+{
+}
+
+bool JsonReader::buildIndex(const char* buf, size_t size)
+{
+	m_index.clear();
+	if (size >= std::numeric_limits<uint32_t>::max())
+	{
+		m_error.message = "Document too big";
+		m_error.offset = 0;
+		return false;
+	}
+
+	if (!utf8Validate(buf, size))
+	{
+		m_error.message = "Invalid UTF-8";
+		m_error.offset = 0;
+		return false;
+	}
+
+	uint64_t prevEscaped = 0;
+	uint64_t prevInString = 0;
+	uint64_t prevScalar = 0;
+	size_t count = 0;
+	for (size_t pos = 0; pos < size; pos += 64)
+	{
+		BlockMasks m;
+		if (size - pos >= 64)
+		{
+			classifyBlock(reinterpret_cast<const uint8_t*>(buf + pos), m);
+		}
+		else
+		{
+			// Whitespace padding doesn't introduce anything new
+			uint8_t tmp[64];
+			memset(tmp, ' ', sizeof(tmp));
+			memcpy(tmp, buf + pos, size - pos);
+			classifyBlock(tmp, m);
+		}
+
+		uint64_t escaped = findEscaped(m.backslash, prevEscaped);
+		uint64_t quote = m.quote & ~escaped;
+		// Includes the opening quote, but not the closing one
+		uint64_t inString = prefixXor(quote) ^ prevInString;
+		prevInString = uint64_t(int64_t(inString) >> 63);
+
+		if (m.control & inString)
+		{
+			m_error.message = "Control character in string";
+			m_error.offset = pos + firstSetBit(m.control & inString);
+			return false;
+		}
+
+		// Everything that is not an operator or whitespace is part of a scalar (or a string), and the start of a scalar is
+		// structural, so the second pass knows where to find numbers and literals.
+		uint64_t stringTail = inString ^ quote;
+		uint64_t scalar = ~(m.op | m.whitespace);
+		uint64_t nonQuoteScalar = scalar & ~quote;
+		uint64_t followsNonQuoteScalar = (nonQuoteScalar << 1) | prevScalar;
+		prevScalar = nonQuoteScalar >> 63;
+		uint64_t structurals = (m.op | (scalar & ~followsNonQuoteScalar)) & ~stringTail;
+
+		if (count + 64 > m_index.size())
+			m_index.resize(std::max(m_index.size() * 2, count + 64));
+		uint32_t* out = m_index.data() + count;
+		while (structurals)
+		{
+			*out++ = static_cast<uint32_t>(pos + firstSetBit(structurals));
+			structurals &= structurals - 1;
+		}
+		count = out - m_index.data();
+	}
+	m_index.resize(count);
+
+	if (prevInString)
+	{
+		m_error.message = "Unterminated string";
+		m_error.offset = size;
+		return false;
+	}
+
+	return true;
+}
+
+template<typename Handler>
+bool JsonReader::parseImpl(char* buf, size_t size, Handler& handler)
+{
+	m_error = JsonError();
+	if (!buildIndex(buf, size))
+		return false;
+	JsonParser<Handler> parser(buf, size, m_index, handler, m_error, m_maxDepth);
+	return parser.parseDocument();
+}
+
+bool JsonReader::parse(char* buf, size_t size, JsonHandler& handler)
+{
+	return parseImpl(buf, size, handler);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// JsonValue
+//////////////////////////////////////////////////////////////////////////
+
+const JsonValue* JsonValue::find(std::string_view key) const
+{
+	if (m_type != Type::Object)
+		return nullptr;
+	for (uint32_t i = 0; i < m_size; i++)
+	{
+		if (m_members[i].key == key)
+			return &m_members[i].value;
+	}
+	return nullptr;
+}
+
+const JsonValue& JsonValue::operator[](std::string_view key) const
+{
+	static const JsonValue null;
+	const JsonValue* v = find(key);
+	return v ? *v : null;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// JsonDocument
+//////////////////////////////////////////////////////////////////////////
+
+/*!
+Builds the tree for a JsonDocument.
+Values are pushed to a stack, and when a container ends, its elements are popped and copied to the arena, so each
+container is one contiguous allocation of the exact size.
+Not virtual, since the parser is instantiated for this type.
+*/
+class JsonDomBuilder
+{
+public:
+	JsonDomBuilder(MonotonicArena& arena, std::vector<JsonValue>& values, std::vector<std::string_view>& keys)
+	    : m_arena(arena)
+	    , m_values(values)
+	    , m_keys(keys)
+	{
+	}
+
+	bool onNull()
+	{
+		push(JsonValue::Type::Null);
+		return true;
+	}
+	bool onBool(bool v)
+	{
+		push(JsonValue::Type::Bool).m_bool = v;
+		return true;
+	}
+	bool onInt(int64_t v)
+	{
+		push(JsonValue::Type::Int).m_int = v;
+		return true;
+	}
+	bool onUint(uint64_t v)
+	{
+		push(JsonValue::Type::Uint).m_uint = v;
+		return true;
+	}
+	bool onDouble(double v)
+	{
+		push(JsonValue::Type::Double).m_double = v;
+		return true;
+	}
+	bool onString(std::string_view v)
+	{
+		JsonValue& j = push(JsonValue::Type::String);
+		j.m_str = v.data();
+		j.m_size = static_cast<uint32_t>(v.size());
+		return true;
+	}
+	bool onBeginObject()
+	{
+		return true;
+	}
+	bool onKey(std::string_view key)
+	{
+		m_keys.push_back(key);
+		return true;
+	}
+	bool onEndObject(size_t count)
+	{
+		JsonMember* members = nullptr;
+		if (count)
+		{
+			members = m_arena.allocate<JsonMember>(count);
+			const JsonValue* values = m_values.data() + m_values.size() - count;
+			const std::string_view* keys = m_keys.data() + m_keys.size() - count;
+			for (size_t i = 0; i < count; i++)
+				new (&members[i]) JsonMember{keys[i], values[i]};
+			m_values.resize(m_values.size() - count);
+			m_keys.resize(m_keys.size() - count);
+		}
+		JsonValue& j = push(JsonValue::Type::Object);
+		j.m_members = members;
+		j.m_size = static_cast<uint32_t>(count);
+		return true;
+	}
+	bool onBeginArray()
+	{
+		return true;
+	}
+	bool onEndArray(size_t count)
+	{
+		JsonValue* elements = nullptr;
+		if (count)
+		{
+			elements = m_arena.allocate<JsonValue>(count);
+			memcpy(elements, m_values.data() + m_values.size() - count, count * sizeof(JsonValue));
+			m_values.resize(m_values.size() - count);
+		}
+		JsonValue& j = push(JsonValue::Type::Array);
+		j.m_elements = elements;
+		j.m_size = static_cast<uint32_t>(count);
+		return true;
+	}
+
+private:
+	JsonValue& push(JsonValue::Type type)
+	{
+		m_values.emplace_back();
+		JsonValue& j = m_values.back();
+		j.m_type = type;
+		return j;
+	}
+
+	MonotonicArena& m_arena;
+	std::vector<JsonValue>& m_values;
+	std::vector<std::string_view>& m_keys;
+};
+
+static_assert(sizeof(JsonValue) == 16, "JsonValue is supposed to be 16 bytes");
+
+JsonDocument::JsonDocument(size_t arenaBlockSize)
+    : m_arena(arenaBlockSize)
+{
+}
+
+JsonDocument::~JsonDocument()
+{
+}
+
+bool JsonDocument::parseInSitu(char* buf, size_t size)
+{
+	m_arena.reset();
+	m_root = JsonValue();
+	m_values.clear();
+	m_keys.clear();
+
+	JsonDomBuilder builder(m_arena, m_values, m_keys);
+	if (!m_reader.parseImpl(buf, size, builder))
+		return false;
+	CZ_ASSERT(m_values.size() == 1 && m_keys.empty());
+	m_root = m_values.back();
+	return true;
+}
+
+bool JsonDocument::parse(const char* str, size_t size)
+{
+	m_copy.assign(str, str + size);
+	return parseInSitu(m_copy.data(), size);
+}
+
+} // namespace cz
+
@@ -0,0 +1,379 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	JSON parsing, with a SAX interface, and a compact DOM allocated from a MonotonicArena.
+
+	Parsing is done in-situ: strings are unescaped in place, and the handler/DOM strings point into the input buffer.
+	It works in two passes, similar to simdjson:
+	- The first pass uses SIMD to find the structural characters ({}[]:, and the start of every value) outside of
+	strings, 64 bytes at a time, and validates UTF-8.
+	- The second pass walks those positions, only looking at the bytes of strings and numbers.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/ArrayView.h"
+#include "crazygaze/muc/MonotonicArena.h"
+#include <string_view>
+
+namespace cz
+{
+
+struct JsonError
+{
+	//! Description of the error. Points to a string literal
+	const char* message = nullptr;
+	//! Position in the input where the error was detected
+	size_t offset = 0;
+};
+
+/*!
+Receives the events from JsonReader.
+Any method can return false to stop the parsing.
+Strings point into the buffer being parsed, and are also null terminated there.
+*/
+class JsonHandler
+{
+public:
+	virtual ~JsonHandler() {}
+	virtual bool onNull() { return true; }
+	virtual bool onBool(bool /*v*/) { return true; }
+	virtual bool onInt(int64_t /*v*/) { return true; }
+	//! Only used for integers that don't fit in an int64_t
+	virtual bool onUint(uint64_t /*v*/) { return true; }
+	//! Numbers with a fraction or exponent, or integers too big for an uint64_t
+	virtual bool onDouble(double /*v*/) { return true; }
+	virtual bool onString(std::string_view /*v*/) { return true; }
+	virtual bool onBeginObject() { return true; }
+	virtual bool onKey(std::string_view /*key*/) { return true; }
+	virtual bool onEndObject(size_t /*memberCount*/) { return true; }
+	virtual bool onBeginArray() { return true; }
+	virtual bool onEndArray(size_t /*elementCount*/) { return true; }
+};
+
+class JsonReader
+{
+public:
+	JsonReader();
+	~JsonReader();
+	JsonReader(const JsonReader&) = delete;
+	JsonReader& operator=(const JsonReader&) = delete;
+
+	/*! Parses "buf" in-situ, calling the handler for every value.
+	The buffer is modified (strings are unescaped and null terminated).
+	\return false if there was an error (see getError) or the handler stopped the parsing
+	*/
+	bool parse(char* buf, size_t size, JsonHandler& handler);
+
+	const JsonError& getError() const
+	{
+		return m_error;
+	}
+
+	//! Maximum nesting of objects and arrays. The default is 1024
+	void setMaxDepth(int maxDepth)
+	{
+		m_maxDepth = maxDepth;
+	}
+
+private:
+	friend class JsonDocument;
+	template<typename Handler>
+	bool parseImpl(char* buf, size_t size, Handler& handler);
+	bool buildIndex(const char* buf, size_t size);
+
+	// Position of each structural character, from the first pass. Reused between documents.
+	std::vector<uint32_t> m_index;
+	JsonError m_error;
+	int m_maxDepth = 1024;
+};
+
+class JsonMember;
+
+/*!
+A value in a JsonDocument. 16 bytes.
+Arrays and objects point to their elements/members, which are allocated from the document's arena.
+*/
+class JsonValue
+{
+public:
+	enum class Type : uint8_t
+	{
+		Null,
+		Bool,
+		Int,
+		Uint,
+		Double,
+		String,
+		Array,
+		Object
+	};
+
+	JsonValue() : m_int(0)
+	{
+	}
+
+	Type getType() const
+	{
+		return m_type;
+	}
+	bool isNull() const
+	{
+		return m_type == Type::Null;
+	}
+	bool isBool() const
+	{
+		return m_type == Type::Bool;
+	}
+	//! True for Int, Uint and Double
+	bool isNumber() const
+	{
+		return m_type == Type::Int || m_type == Type::Uint || m_type == Type::Double;
+	}
+	bool isString() const
+	{
+		return m_type == Type::String;
+	}
+	bool isArray() const
+	{
+		return m_type == Type::Array;
+	}
+	bool isObject() const
+	{
+		return m_type == Type::Object;
+	}
+
+	bool getBool() const
+	{
+		CZ_ASSERT(isBool());
+		return m_bool;
+	}
+	//! Integers are returned as is. Doubles are truncated
+	int64_t getInt() const
+	{
+		CZ_ASSERT(isNumber());
+		return m_type == Type::Double ? static_cast<int64_t>(m_double) : m_int;
+	}
+	uint64_t getUint() const
+	{
+		CZ_ASSERT(isNumber());
+		return m_type == Type::Double ? static_cast<uint64_t>(m_double) : m_uint;
+	}
+	double getDouble() const
+	{
+		CZ_ASSERT(isNumber());
+		return m_type == Type::Int ? static_cast<double>(m_int)
+		                           : (m_type == Type::Uint ? static_cast<double>(m_uint) : m_double);
+	}
+	std::string_view getString() const
+	{
+		CZ_ASSERT(isString());
+		return std::string_view(m_str, m_size);
+	}
+	//! The string is null terminated in the parsed buffer
+	const char* c_str() const
+	{
+		CZ_ASSERT(isString());
+		return m_str;
+	}
+
+	//! Number of elements for arrays, or members for objects. 0 for anything else
+	size_t size() const
+	{
+		return (m_type == Type::Array || m_type == Type::Object) ? m_size : 0;
+	}
+
+	ArrayView<const JsonValue> getElements() const
+	{
+		CZ_ASSERT(isArray());
+		return ArrayView<const JsonValue>(m_elements, m_size);
+	}
+	inline ArrayView<const JsonMember> getMembers() const;
+
+	const JsonValue& operator[](size_t index) const
+	{
+		CZ_ASSERT(isArray() && index < m_size);
+		return m_elements[index];
+	}
+
+	//! Finds an object's member, or returns nullptr if not found (or this is not an object).
+	const JsonValue* find(std::string_view key) const;
+
+	//! Finds an object's member, returning a null value if not found, so lookups can be chained
+	const JsonValue& operator[](std::string_view key) const;
+
+private:
+	friend class JsonDocument;
+	friend class JsonDomBuilder;
+
+	Type m_type = Type::Null;
+	uint32_t m_size = 0;
+	union
+	{
+		bool m_bool;
+		int64_t m_int;
+		uint64_t m_uint;
+		double m_double;
+		const char* m_str;
+		const JsonValue* m_elements;
+		const JsonMember* m_members;
+	};
+};
+
+class JsonMember
+{
+public:
+	std::string_view key;
+	JsonValue value;
+};
+
+ArrayView<const JsonMember> JsonValue::getMembers() const
+{
+	CZ_ASSERT(isObject());
+	return ArrayView<const JsonMember>(m_members, m_size);
+}
+
+/*!
+Parses a document into a tree of JsonValue.
+Everything is allocated from an arena, which is reused if the document is reused for parsing something else, so once
+warmed up, parsing doesn't allocate from the heap.
+*/
+class JsonDocument
+{
+public:
+	explicit JsonDocument(size_t arenaBlockSize = 64 * 1024);
+	~JsonDocument();
+
+	/*! Parses "buf" in-situ. The buffer is modified, and needs to stay alive as long as the values are used.
+	Invalidates any values from a previous parse.
+	*/
+	bool parseInSitu(char* buf, size_t size);
+
+	//! Same as parseInSitu, but parses a copy of the input, kept by the document
+	bool parse(const char* str, size_t size);
+	bool parse(const std::string& str)
+	{
+		return parse(str.c_str(), str.size());
+	}
+
+	const JsonValue& getRoot() const
+	{
+		return m_root;
+	}
+
+	const JsonError& getError() const
+	{
+		return m_reader.getError();
+	}
+
+	JsonReader& getReader()
+	{
+		return m_reader;
+	}
+
+private:
+	MonotonicArena m_arena;
+	JsonReader m_reader;
+	JsonValue m_root;
+	std::vector<char> m_copy;
+	// Temporary stacks used while building the tree
+	std::vector<JsonValue> m_values;
+	std::vector<std::string_view> m_keys;
+};
+
+//
+// Reading values into C++ types. They return false if the value is not of the expected type (or out of range for
+// integers), but carry on with what they can, so the result is as complete as possible.
+//
+
+//! Integers need to be in range of T. Floating point accepts any number
+template<typename T>
+std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, bool> from_json(const JsonValue& j, T& v)
+{
+	if constexpr (std::is_floating_point_v<T>)
+	{
+		if (!j.isNumber())
+			return false;
+		v = static_cast<T>(j.getDouble());
+		return true;
+	}
+	else
+	{
+		if (j.getType() == JsonValue::Type::Int)
+		{
+			int64_t i = j.getInt();
+			if constexpr (std::is_signed_v<T>)
+			{
+				if (i < int64_t(std::numeric_limits<T>::min()) || i > int64_t(std::numeric_limits<T>::max()))
+					return false;
+			}
+			else
+			{
+				if (i < 0 || uint64_t(i) > uint64_t(std::numeric_limits<T>::max()))
+					return false;
+			}
+			v = static_cast<T>(i);
+			return true;
+		}
+		else if (j.getType() == JsonValue::Type::Uint)
+		{
+			// Only used for values bigger than what fits in an int64_t
+			if constexpr (std::is_unsigned_v<T> && sizeof(T) == sizeof(uint64_t))
+			{
+				v = static_cast<T>(j.getUint());
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+inline bool from_json(const JsonValue& j, bool& v)
+{
+	if (!j.isBool())
+		return false;
+	v = j.getBool();
+	return true;
+}
+
+inline bool from_json(const JsonValue& j, std::string& v)
+{
+	if (!j.isString())
+		return false;
+	v.assign(j.getString());
+	return true;
+}
+
+template<typename T>
+bool from_json(const JsonValue& j, std::vector<T>& v);
+template<typename FIRST, typename SECOND>
+bool from_json(const JsonValue& j, std::pair<FIRST, SECOND>& v);
+
+template<typename T>
+bool from_json(const JsonValue& j, std::vector<T>& v)
+{
+	if (!j.isArray())
+		return false;
+	v.resize(j.size());
+	bool ok = true;
+	for (size_t i = 0; i < v.size(); i++)
+		ok = from_json(j[i], v[i]) && ok;
+	return ok;
+}
+
+//! Same format as the std::pair to_json
+template<typename FIRST, typename SECOND>
+bool from_json(const JsonValue& j, std::pair<FIRST, SECOND>& v)
+{
+	if (!j.isObject())
+		return false;
+	bool ok = from_json(j["first"], v.first);
+	return from_json(j["second"], v.second) && ok;
+}
+
+} // namespace cz
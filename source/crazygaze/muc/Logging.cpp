@@ -9,7 +9,11 @@
 
 #include "czmucPCH.h"
 #include "Logging.h"
-#include "StringUtils.h"
+#include <condition_variable>
+#include <memory>
+#include <charconv>
+#include <limits>
+#include <cctype>
 
 #define LOG_TIME 1
 #define LOG_VERBOSITY 1
@@ -23,51 +27,727 @@ namespace cz
 LogCategoryLogNone logNone;
 #endif
 
+bool logVerbosityFromString(const char* str, size_t size, LogVerbosity& dst)
+{
+	static const struct
+	{
+		const char* name;
+		const char* code;
+		LogVerbosity verbosity;
+	} names[] = {
+		{"Fatal", "FTL", LogVerbosity::Fatal},
+		{"Error", "ERR", LogVerbosity::Error},
+		{"Warning", "WRN", LogVerbosity::Warning},
+		{"Log", "LOG", LogVerbosity::Log},
+		{"Verbose", "VER", LogVerbosity::Verbose},
+	};
+
+	auto equalsNoCase = [str, size](const char* other) {
+		if (strlen(other) != size)
+			return false;
+		for (size_t i = 0; i < size; i++)
+		{
+			if (tolower(static_cast<unsigned char>(str[i])) != tolower(static_cast<unsigned char>(other[i])))
+				return false;
+		}
+		return true;
+	};
+
+	for (auto&& n : names)
+	{
+		if (equalsNoCase(n.name) || equalsNoCase(n.code))
+		{
+			dst = n.verbosity;
+			return true;
+		}
+	}
+	return false;
+}
+
 LogCategoryBase::LogCategoryBase(const char* name, LogVerbosity verbosity, LogVerbosity compileTimeVerbosity) : m_name(name)
 , m_verbosity(verbosity)
 , m_compileTimeVerbosity(compileTimeVerbosity)
 {
-	if (ms_first==nullptr)
-		ms_first = this;
-	else
+	// Append to the list, keeping the registration order.
+	// Claiming the tail is a single exchange, so concurrent registrations don't need to retry. Until the previous
+	// category's m_next is set, iterations will stop before this category, which is fine.
+	std::atomic<LogCategoryBase*>* prev = ms_tail.exchange(&m_next, std::memory_order_acq_rel);
+	prev->store(this, std::memory_order_release);
+
+	// Push to the front of the bucket
+	std::atomic<LogCategoryBase*>& bucket = ms_buckets[m_name.hash() & (NumBuckets - 1)];
+	m_nextInBucket = bucket.load(std::memory_order_relaxed);
+	while (!bucket.compare_exchange_weak(m_nextInBucket, this, std::memory_order_release, std::memory_order_relaxed))
 	{
-		// Find the last category
-		LogCategoryBase* ptr = ms_first;
-		while(ptr->m_next)
-			ptr = ptr->m_next;
-		ptr->m_next = this;
 	}
 }
 
 void LogCategoryBase::setVerbosity(LogVerbosity verbosity)
 {
 	// Take into considering the minimum compiled verbosity
-	m_verbosity = LogVerbosity( std::min((int)m_compileTimeVerbosity, (int)verbosity) );
+	m_verbosity.store(LogVerbosity(std::min((int)m_compileTimeVerbosity, (int)verbosity)), std::memory_order_relaxed);
 }
 
 cz::LogCategoryBase* LogCategoryBase::getNext()
 {
-	return m_next;
+	return m_next.load(std::memory_order_acquire);
 }
 
 cz::LogCategoryBase* LogCategoryBase::getFirst()
 {
-	return ms_first;
+	return ms_first.load(std::memory_order_acquire);
 }
 
 cz::LogCategoryBase* LogCategoryBase::find(const char* name)
 {
-	LogCategoryBase* ptr = ms_first;
+	// If the name was never interned, there is no category with that name
+	InternedString key;
+	if (!InternedString::find(name, key))
+		return nullptr;
+
+	LogCategoryBase* ptr = ms_buckets[key.hash() & (NumBuckets - 1)].load(std::memory_order_acquire);
 	while(ptr)
 	{
-		if (ptr->m_name==name)
+		if (ptr->m_name==key)
 			return ptr;
-		ptr = ptr->m_next;
+		ptr = ptr->m_nextInBucket;
 	};
 
 	return nullptr;
 }
 
+namespace
+{
+	// Glob matching, with '*' and '?'.
+	// Backtracks only to the last '*', which is enough since a later '*' can match anything an earlier one could.
+	bool matchesPattern(const char* str, const char* pattern, const char* patternEnd)
+	{
+		const char* star = nullptr;
+		const char* starStr = nullptr;
+		while (*str)
+		{
+			if (pattern != patternEnd && (*pattern == '?' || *pattern == *str))
+			{
+				str++;
+				pattern++;
+			}
+			else if (pattern != patternEnd && *pattern == '*')
+			{
+				star = pattern++;
+				starStr = str;
+			}
+			else if (star)
+			{
+				pattern = star + 1;
+				str = ++starStr;
+			}
+			else
+			{
+				return false;
+			}
+		}
+
+		while (pattern != patternEnd && *pattern == '*')
+			pattern++;
+		return pattern == patternEnd;
+	}
+
+	bool isSpecSeparator(char ch)
+	{
+		return ch == ',' || ch == ';' || isspace(static_cast<unsigned char>(ch));
+	}
+}
+
+int LogCategoryBase::setVerbosityFromSpec(const char* spec)
+{
+	struct Rule
+	{
+		const char* pattern;
+		const char* patternEnd;
+		LogVerbosity verbosity;
+	};
+
+	// Parse everything first, so nothing is changed if the spec is invalid
+	std::vector<Rule> rules;
+	const char* p = spec;
+	while (true)
+	{
+		while (isSpecSeparator(*p))
+			p++;
+		if (*p == 0)
+			break;
+
+		Rule rule;
+		rule.pattern = p;
+		while (*p && *p != '=' && !isSpecSeparator(*p))
+			p++;
+		rule.patternEnd = p;
+		if (*p != '=' || rule.pattern == rule.patternEnd)
+			return -1;
+
+		const char* verbosity = ++p;
+		while (*p && !isSpecSeparator(*p))
+			p++;
+		if (!logVerbosityFromString(verbosity, p - verbosity, rule.verbosity))
+			return -1;
+		rules.push_back(rule);
+	}
+
+	int count = 0;
+	for (LogCategoryBase* c = getFirst(); c; c = c->getNext())
+	{
+		const char* name = c->getName().c_str();
+		for (auto it = rules.rbegin(); it != rules.rend(); ++it)
+		{
+			if (matchesPattern(name, it->pattern, it->patternEnd))
+			{
+				c->setVerbosity(it->verbosity);
+				count++;
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+namespace detail
+{
+
+/*
+Single producer, single consumer ring of variable sized records.
+The producer is the thread that owns it, and the consumer is the writer thread.
+Positions increase monotonically and are masked to get the offset in the buffer.
+Records are always contiguous, so if a record doesn't fit at the end of the buffer, the producer marks the rest of
+the buffer as unused, and puts the record at the start.
+*/
+class LogRing
+{
+public:
+	struct Record
+	{
+		// Total size of the record, including this header and padding. WRAP_MARKER if the rest of the buffer is unused
+		uint32_t size;
+		// Size of the data following the header
+		uint32_t dataSize;
+		std::chrono::system_clock::time_point time;
+		// If set, the data is the arguments for deferred formatting, and the fields below are not used
+		const LogSite* site;
+		LogVerbosity verbosity;
+		int line;
+		const char* file;
+		const LogCategoryBase* category;
+
+		// Followed by the null terminated message, or the arguments
+		char* data()
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
+		const char* data() const
+		{
+			return reinterpret_cast<const char*>(this + 1);
+		}
+	};
+
+	static constexpr uint32_t WRAP_MARKER = 0xFFFFFFFF;
+	static constexpr size_t ALIGNMENT = alignof(Record);
+
+	explicit LogRing(size_t capacity)
+	{
+		m_capacity = 4096;
+		while (m_capacity < capacity)
+			m_capacity *= 2;
+		m_buf.reset(new uint64_t[m_capacity / sizeof(uint64_t)]);
+	}
+
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+
+	//! Size of a record with the specified data size
+	static size_t calcRecordSize(size_t dataSize)
+	{
+		return (sizeof(Record) + dataSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+
+	//
+	// Producer
+	//
+
+	/*! Reserves space for a record
+	\return The record to fill, or nullptr if there is not enough room
+	*/
+	Record* beginWrite(size_t size)
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		size_t tail = m_tail.load(std::memory_order_acquire);
+		size_t offset = head & (m_capacity - 1);
+		size_t contiguous = m_capacity - offset;
+		size_t needed = contiguous < size ? contiguous + size : size;
+		if (m_capacity - (head - tail) < needed)
+			return nullptr;
+
+		if (contiguous < size)
+		{
+			at(offset)->size = WRAP_MARKER;
+			m_pendingWrap = contiguous;
+			offset = 0;
+		}
+		return at(offset);
+	}
+
+	void endWrite(size_t size)
+	{
+		m_head.store(m_head.load(std::memory_order_relaxed) + m_pendingWrap + size, std::memory_order_release);
+		m_pendingWrap = 0;
+	}
+
+	size_t used() const
+	{
+		return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed);
+	}
+
+	//
+	// Consumer
+	//
+
+	//! Calls f for all the records available, without releasing them.
+	//! \return The new position to pass to release once the records are processed
+	template<typename F>
+	size_t read(F&& f)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		size_t head = m_head.load(std::memory_order_acquire);
+		while (tail != head)
+		{
+			size_t offset = tail & (m_capacity - 1);
+			const Record* r = at(offset);
+			if (r->size == WRAP_MARKER)
+			{
+				tail += m_capacity - offset;
+				continue;
+			}
+			f(r);
+			tail += r->size;
+		}
+		return tail;
+	}
+
+	void release(size_t tail)
+	{
+		m_tail.store(tail, std::memory_order_release);
+	}
+
+	bool empty() const
+	{
+		return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_relaxed);
+	}
+
+private:
+	Record* at(size_t offset)
+	{
+		return reinterpret_cast<Record*>(reinterpret_cast<char*>(m_buf.get()) + offset);
+	}
+
+	std::unique_ptr<uint64_t[]> m_buf;
+	size_t m_capacity;
+	size_t m_pendingWrap = 0;
+	alignas(64) std::atomic<size_t> m_head{0};
+	alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+struct ThreadLogBuffer
+{
+	explicit ThreadLogBuffer(size_t capacity) : ring(capacity) {}
+	LogRing ring;
+	std::atomic<bool> threadExited{false};
+};
+
+/*
+Formats the prefix of log lines.
+The time part is cached, so localtime is only called once per second.
+*/
+class LogLineFormatter
+{
+public:
+	//! Appends the time, category and verbosity prefix to "dst"
+	void appendPrefix(std::string& dst, std::chrono::system_clock::time_point time, const LogCategoryBase* category,
+	                  LogVerbosity verbosity)
+	{
+#if LOG_TIME
+		int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+		int64_t second = ms / 1000;
+		if (second != m_second)
+		{
+			m_second = second;
+			time_t t = static_cast<time_t>(second);
+			struct tm d;
+			localtime_s(&d, &t);
+			writeDigits(m_time, d.tm_hour);
+			m_time[2] = ':';
+			writeDigits(m_time + 3, d.tm_min);
+			m_time[5] = ':';
+			writeDigits(m_time + 6, d.tm_sec);
+			m_time[8] = '.';
+		}
+
+		char buf[16];
+		memcpy(buf, m_time, 9);
+		int msPart = static_cast<int>(ms % 1000);
+		buf[9] = static_cast<char>('0' + msPart / 100);
+		writeDigits(buf + 10, msPart % 100);
+		buf[12] = ':';
+		buf[13] = ' ';
+		dst.append(buf, 14);
+		#if LOG_VERBOSITY
+			dst += category->getName();
+			dst += ": ";
+			dst += logVerbosityToString(verbosity);
+			dst += ": ";
+		#endif
+#else
+		dst += logVerbosityToString(verbosity);
+		dst += ": ";
+#endif
+	}
+
+	//! Formats a message recorded with deferred formatting to "dst", and sets "entry" to point to it
+	void formatDeferred(std::string& dst, std::chrono::system_clock::time_point time, const LogSite& site,
+	                    const char* args, size_t argsSize, LogEntry& entry)
+	{
+		dst.clear();
+		appendPrefix(dst, time, site.category, site.verbosity);
+		size_t msgStart = dst.size();
+		formatLogArgs(dst, site.fmt, args, argsSize);
+		size_t msgSize = dst.size() - msgStart;
+		appendLogFields(dst, args, argsSize);
+		entry = {time, site.file, site.line, site.category, site.verbosity, dst.c_str(), dst.c_str() + msgStart,
+		         msgSize, LogFieldList(args, argsSize)};
+	}
+
+	//! Adds the prefix to an already formatted message, and sets "entry" to point to it
+	void formatText(std::string& dst, std::chrono::system_clock::time_point time, const char* file, int line,
+	                const LogCategoryBase* category, LogVerbosity verbosity, const char* msg, size_t msgSize,
+	                LogEntry& entry)
+	{
+		dst.clear();
+		appendPrefix(dst, time, category, verbosity);
+		size_t msgStart = dst.size();
+		dst.append(msg, msgSize);
+		entry = {time, file, line, category, verbosity, dst.c_str(), dst.c_str() + msgStart, msgSize, LogFieldList()};
+	}
+
+private:
+	static void writeDigits(char* dst, int v)
+	{
+		dst[0] = static_cast<char>('0' + v / 10);
+		dst[1] = static_cast<char>('0' + v % 10);
+	}
+
+	int64_t m_second = std::numeric_limits<int64_t>::min();
+	// "hh:mm:ss."
+	char m_time[9];
+};
+
+//! printf style formatting, appending to "dst", without any size limit
+static void appendFormattedVA(std::string& dst, const char* fmt, va_list args)
+{
+	size_t pos = dst.size();
+	size_t avail = std::max(dst.capacity() - pos, size_t(256));
+	va_list args2;
+	va_copy(args2, args);
+	dst.resize(pos + avail);
+	int n = vsnprintf(&dst[pos], avail + 1, fmt, args);
+	if (n < 0)
+		n = 0;
+	dst.resize(pos + n);
+	if (static_cast<size_t>(n) > avail)
+		vsnprintf(&dst[pos], n + 1, fmt, args2);
+	va_end(args2);
+}
+
+/*
+Background thread that drains all the threads' buffers
+*/
+class LogWriter
+{
+public:
+	LogWriter()
+	{
+		// Makes sure the shared data is constructed first, so it's destroyed after the writer
+		m_data = LogOutput::getSharedData();
+		m_thread = std::thread([this]() { run(); });
+		ms_state = State::Running;
+	}
+
+	~LogWriter()
+	{
+		{
+			std::unique_lock<std::mutex> lk(m_mtx);
+			m_finish = true;
+		}
+		m_cv.notify_one();
+		m_thread.join();
+		// Anything logged from now on (e.g: from other static objects being destroyed) is done synchronously
+		ms_state = State::Destroyed;
+	}
+
+	static LogWriter& get()
+	{
+		static LogWriter writer;
+		return writer;
+	}
+
+	static bool isWriterThread()
+	{
+		return ms_isWriterThread;
+	}
+
+	static bool isRunning()
+	{
+		return ms_state == State::Running;
+	}
+
+	static bool isDestroyed()
+	{
+		return ms_state == State::Destroyed;
+	}
+
+	std::shared_ptr<ThreadLogBuffer> createBuffer()
+	{
+		auto buf = std::make_shared<ThreadLogBuffer>(m_data->threadBufferSize.load());
+		std::unique_lock<std::mutex> lk(m_mtx);
+		m_buffers.push_back(buf);
+		return buf;
+	}
+
+	//! Whether messages should be handed to the outputs in the calling thread
+	static bool isSync(LogOutput::SharedData* data)
+	{
+		return !data->async.load(std::memory_order_relaxed) || isDestroyed();
+	}
+
+	//! Whether a record of the specified size can ever fit in the ring
+	static bool fits(const LogRing& ring, size_t size)
+	{
+		return size <= ring.capacity() / 2;
+	}
+
+	/*! Reserves a record in the calling thread's buffer, applying LogSettings::blockWhenFull if it's full.
+	The record size needs to pass the "fits" test.
+	\return The record, or nullptr if the message was dropped
+	*/
+	LogRing::Record* reserve(LogRing& ring, size_t size)
+	{
+		LogRing::Record* r = ring.beginWrite(size);
+		if (r)
+			return r;
+
+		// The writer thread can't wait for itself
+		if (!m_data->blockWhenFull.load(std::memory_order_relaxed) || ms_isWriterThread)
+		{
+			m_data->dropped.fetch_add(1, std::memory_order_relaxed);
+			wakeup();
+			return nullptr;
+		}
+
+		m_data->blocked.fetch_add(1, std::memory_order_relaxed);
+		do
+		{
+			wakeup();
+			std::this_thread::yield();
+			r = ring.beginWrite(size);
+		} while (!r);
+		return r;
+	}
+
+	void commit(LogRing& ring, size_t size, LogVerbosity verbosity)
+	{
+		ring.endWrite(size);
+		if (verbosity == LogVerbosity::Fatal)
+			flush();
+		else if (ring.used() > ring.capacity() / 2)
+			wakeup();
+	}
+
+	//! Wakes up the writer without waiting for the flush interval
+	void wakeup()
+	{
+		if (!m_wakeup.exchange(true))
+			m_cv.notify_one();
+	}
+
+	void flush()
+	{
+		// The writer can't wait for itself
+		if (ms_isWriterThread)
+			return;
+
+		std::unique_lock<std::mutex> lk(m_mtx);
+		uint64_t target = ++m_flushRequested;
+		m_wakeup = true;
+		m_cv.notify_one();
+		m_flushedCv.wait(lk, [&] { return m_flushed >= target; });
+	}
+
+private:
+	struct Pending
+	{
+		const LogRing::Record* record;
+		size_t seq;
+	};
+
+	void run()
+	{
+		ms_isWriterThread = true;
+		bool finish = false;
+		while (!finish)
+		{
+			uint64_t requested;
+			{
+				std::unique_lock<std::mutex> lk(m_mtx);
+				m_cv.wait_for(lk, std::chrono::milliseconds(m_data->flushIntervalMs.load()),
+				              [this] { return m_wakeup.load() || m_finish; });
+				m_wakeup = false;
+				requested = m_flushRequested;
+				finish = m_finish;
+				m_snapshot = m_buffers;
+			}
+
+			drain(requested != m_flushed);
+			m_snapshot.clear();
+
+			{
+				std::unique_lock<std::mutex> lk(m_mtx);
+				m_flushed = requested;
+				// Remove the buffers of threads that finished, once everything they logged was written
+				m_buffers.erase(std::remove_if(m_buffers.begin(), m_buffers.end(),
+				                               [](const std::shared_ptr<ThreadLogBuffer>& b) {
+					                               return b->threadExited.load() && b->ring.empty();
+				                               }),
+				                m_buffers.end());
+			}
+			m_flushedCv.notify_all();
+		}
+	}
+
+	void drain(bool forceFlush)
+	{
+		m_pending.clear();
+		m_tails.clear();
+		for (auto&& buf : m_snapshot)
+		{
+			m_tails.push_back(buf->ring.read([this](const LogRing::Record* r) {
+				m_pending.push_back({r, m_pending.size()});
+			}));
+		}
+
+		if (m_pending.empty() && !forceFlush)
+			return;
+
+		// Merge the messages from all threads, by time. Messages from the same thread keep their order
+		std::sort(m_pending.begin(), m_pending.end(), [](const Pending& a, const Pending& b) {
+			return a.record->time == b.record->time ? a.seq < b.seq : a.record->time < b.record->time;
+		});
+
+		{
+			std::unique_lock<std::mutex> lk(m_data->mtx);
+			for (auto&& p : m_pending)
+			{
+				const LogRing::Record* r = p.record;
+				LogEntry entry;
+				if (const LogSite* site = r->site)
+					m_formatter.formatDeferred(m_line, r->time, *site, r->data(), r->dataSize, entry);
+				else
+					m_formatter.formatText(m_line, r->time, r->file, r->line, r->category, r->verbosity, r->data(),
+					                       r->dataSize - 1, entry);
+				LogOutput::logToOutputs(m_data, entry);
+			}
+			for (auto&& out : m_data->outputs)
+				out->flush();
+		}
+
+		for (size_t i = 0; i < m_snapshot.size(); i++)
+			m_snapshot[i]->ring.release(m_tails[i]);
+		m_data->written.fetch_add(m_pending.size(), std::memory_order_relaxed);
+	}
+
+	LogOutput::SharedData* m_data;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+	std::condition_variable m_flushedCv;
+	std::atomic<bool> m_wakeup{false};
+	bool m_finish = false;
+	uint64_t m_flushRequested = 0;
+	uint64_t m_flushed = 0;
+	std::vector<std::shared_ptr<ThreadLogBuffer>> m_buffers;
+	std::thread m_thread;
+
+	// Only used by the writer thread. Kept as members to reuse the memory
+	std::vector<std::shared_ptr<ThreadLogBuffer>> m_snapshot;
+	std::vector<Pending> m_pending;
+	std::vector<size_t> m_tails;
+	LogLineFormatter m_formatter;
+	std::string m_line;
+
+	enum class State
+	{
+		None,
+		Running,
+		Destroyed
+	};
+
+	static thread_local bool ms_isWriterThread;
+	static std::atomic<State> ms_state;
+};
+
+thread_local bool LogWriter::ms_isWriterThread = false;
+std::atomic<LogWriter::State> LogWriter::ms_state{LogWriter::State::None};
+
+} // namespace detail
+
+namespace
+{
+	// Owns the calling thread's buffer, and lets the writer know when the thread finishes, so it can delete the
+	// buffer once it's empty.
+	struct ThreadLogBufferHolder
+	{
+		~ThreadLogBufferHolder()
+		{
+			if (buf)
+				buf->threadExited = true;
+		}
+		std::shared_ptr<detail::ThreadLogBuffer> buf;
+	};
+
+	thread_local ThreadLogBufferHolder tlsLogBuffer;
+
+	// Per thread state for LogOutput::logToAll and LogOutput::beginDeferred/endDeferred.
+	struct ThreadLogState
+	{
+		// Record being written by beginDeferred/endDeferred.
+		// nullptr if logging synchronously, in which case the arguments are written to syncArgs
+		detail::LogRing::Record* pendingRecord = nullptr;
+		size_t pendingSize = 0;
+		std::vector<uint64_t> syncArgs;
+		size_t syncArgsSize = 0;
+		std::chrono::system_clock::time_point syncTime;
+
+		// Reused for formatting, so logging doesn't need to allocate memory
+		detail::LogLineFormatter formatter;
+		std::string line;
+	};
+	thread_local ThreadLogState tlsLogState;
+
+	detail::ThreadLogBuffer& getThreadLogBuffer()
+	{
+		if (!tlsLogBuffer.buf)
+			tlsLogBuffer.buf = detail::LogWriter::get().createBuffer();
+		return *tlsLogBuffer.buf;
+	}
+}
+
 LogOutput::SharedData* LogOutput::getSharedData()
 {
 	// This is thread safe, according to C++11 (aka: Magic Statics)
@@ -84,48 +764,163 @@ LogOutput::LogOutput()
 
 LogOutput::~LogOutput()
 {
+	// The derived parts are already destroyed, so we can't deliver anything still pending (see detach).
+	// Outputs are only used while holding the lock, so once removed nothing else reaches this object.
+	auto data = getSharedData();
+	auto lk = std::unique_lock<std::mutex>(data->mtx);
+	auto it = std::find(data->outputs.begin(), data->outputs.end(), this);
+	if (it != data->outputs.end())
+		data->outputs.erase(it);
+}
+
+void LogOutput::detach()
+{
+	flushAll();
 	auto data = getSharedData();
 	auto lk = std::unique_lock<std::mutex>(data->mtx);
-	data->outputs.erase(std::find(data->outputs.begin(), data->outputs.end(), this));
+	auto it = std::find(data->outputs.begin(), data->outputs.end(), this);
+	if (it != data->outputs.end())
+		data->outputs.erase(it);
+}
+
+void LogOutput::logToOutputs(SharedData* data, const LogEntry& entry)
+{
+	if (data->logToDebugger)
+	{
+		OutputDebugStringA(entry.text);
+		OutputDebugStringA("\n");
+	}
+	for (auto&& out : data->outputs)
+	{
+		out->logEntry(entry);
+	}
 }
 
 void LogOutput::logToAll(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, _Printf_format_string_ const char* fmt, ...)
 {
+	auto time = std::chrono::system_clock::now();
+	auto data = getSharedData();
+	ThreadLogState& state = tlsLogState;
+	std::string& str = state.line;
+	str.clear();
+
 	va_list args;
 	va_start(args, fmt);
+	if (detail::LogWriter::isSync(data))
+	{
+		state.formatter.appendPrefix(str, time, category, verbosity);
+		size_t msgStart = str.size();
+		detail::appendFormattedVA(str, fmt, args);
+		va_end(args);
+		LogEntry entry = {time, file, line, category, verbosity, str.c_str(), str.c_str() + msgStart,
+		                  str.size() - msgStart, LogFieldList()};
+		logLine(data, entry);
+		return;
+	}
 
-	const char* prefix = "";
-#if LOG_TIME	
+	// The prefix is added by the writer
+	detail::appendFormattedVA(str, fmt, args);
+	va_end(args);
+
+	detail::LogWriter& writer = detail::LogWriter::get();
+	detail::LogRing& ring = getThreadLogBuffer().ring;
+	size_t msgSize = str.size() + 1;
+	size_t size = detail::LogRing::calcRecordSize(msgSize);
+	if (!writer.fits(ring, size))
 	{
-		time_t t = time(nullptr);
-		struct tm d;
-		localtime_s(&d, &t);
-		#if LOG_VERBOSITY
-			prefix = formatString("%02d:%02d:%02d: %s: %s: ", d.tm_hour, d.tm_min, d.tm_sec, category->getName().c_str(), logVerbosityToString(verbosity));
-		#else
-			prefix = formatString("%02d:%02d:%02d: ", d.tm_hour, d.tm_min, d.tm_sec);
-		#endif
+		// Too big for the buffer, so flush everything and log synchronously, to keep the order
+		if (writer.isWriterThread())
+		{
+			data->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		writer.flush();
+		std::string msg = std::move(str);
+		LogEntry entry;
+		state.formatter.formatText(str, time, file, line, category, verbosity, msg.c_str(), msg.size(), entry);
+		logLine(data, entry);
+		return;
 	}
-#else
-	prefix = formatString("%s: ", logVerbosityToString(verbosity));
-#endif
 
-	auto msg = formatStringVA(fmt, args);
-	char buf[1024];
-	_snprintf_s(buf, _countof(buf), _TRUNCATE, "%s%s", prefix, msg);
+	detail::LogRing::Record* r = writer.reserve(ring, size);
+	if (!r)
+		return;
 
-	auto data = getSharedData();
+	r->size = static_cast<uint32_t>(size);
+	r->dataSize = static_cast<uint32_t>(msgSize);
+	r->time = time;
+	r->site = nullptr;
+	r->verbosity = verbosity;
+	r->line = line;
+	r->file = file;
+	r->category = category;
+	memcpy(r->data(), str.c_str(), msgSize);
+	writer.commit(ring, size, verbosity);
+}
+
+void LogOutput::logLine(SharedData* data, const LogEntry& entry)
+{
 	auto lk = std::unique_lock<std::mutex>(data->mtx);
+	logToOutputs(data, entry);
+	for (auto&& out : data->outputs)
+		out->flush();
+}
 
-	if (data->logToDebugger)
+char* LogOutput::beginDeferred(const LogSite& site, size_t argsSize)
+{
+	auto time = std::chrono::system_clock::now();
+	ThreadLogState& state = tlsLogState;
+	auto data = getSharedData();
+	size_t size = detail::LogRing::calcRecordSize(argsSize);
+	bool sync = detail::LogWriter::isSync(data);
+	if (!sync)
 	{
-		OutputDebugStringA(buf);
-		OutputDebugStringA("\n");
+		detail::LogWriter& writer = detail::LogWriter::get();
+		detail::LogRing& ring = getThreadLogBuffer().ring;
+		if (writer.fits(ring, size))
+		{
+			detail::LogRing::Record* r = writer.reserve(ring, size);
+			if (!r)
+				return nullptr;
+			r->size = static_cast<uint32_t>(size);
+			r->dataSize = static_cast<uint32_t>(argsSize);
+			r->time = time;
+			r->site = &site;
+			state.pendingRecord = r;
+			state.pendingSize = size;
+			return r->data();
+		}
+
+		// Too big for the buffer, so flush everything and log synchronously, to keep the order
+		if (writer.isWriterThread())
+		{
+			data->dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		writer.flush();
 	}
-	for (auto&& out : data->outputs)
+
+	state.pendingRecord = nullptr;
+	state.syncArgs.resize(argsSize / sizeof(uint64_t) + 1);
+	state.syncArgsSize = argsSize;
+	state.syncTime = time;
+	return reinterpret_cast<char*>(state.syncArgs.data());
+}
+
+void LogOutput::endDeferred(const LogSite& site)
+{
+	ThreadLogState& state = tlsLogState;
+	if (state.pendingRecord)
 	{
-		out->log(file, line, category, verbosity, buf);
+		state.pendingRecord = nullptr;
+		detail::LogWriter::get().commit(getThreadLogBuffer().ring, state.pendingSize, site.verbosity);
+		return;
 	}
+
+	LogEntry entry;
+	state.formatter.formatDeferred(state.line, state.syncTime, site,
+	                               reinterpret_cast<const char*>(state.syncArgs.data()), state.syncArgsSize, entry);
+	logLine(getSharedData(), entry);
 }
 
 void LogOutput::setLogToDebugger(bool enabled)
@@ -135,5 +930,403 @@ void LogOutput::setLogToDebugger(bool enabled)
 	data->logToDebugger = enabled;
 }
 
+void LogOutput::setSettings(const LogSettings& settings)
+{
+	auto data = getSharedData();
+	// Anything logged asynchronously so far needs to reach the outputs before switching to synchronous logging, so
+	// messages keep their order
+	if (data->async && !settings.async)
+		flushAll();
+
+	auto lk = std::unique_lock<std::mutex>(data->mtx);
+	data->settings = settings;
+	data->async = settings.async;
+	data->blockWhenFull = settings.blockWhenFull;
+	data->threadBufferSize = settings.threadBufferSize;
+	data->flushIntervalMs = settings.flushInterval.count();
+}
+
+LogSettings LogOutput::getSettings()
+{
+	auto data = getSharedData();
+	auto lk = std::unique_lock<std::mutex>(data->mtx);
+	return data->settings;
+}
+
+LogStats LogOutput::getStats()
+{
+	auto data = getSharedData();
+	LogStats stats;
+	stats.written = data->written.load(std::memory_order_relaxed);
+	stats.dropped = data->dropped.load(std::memory_order_relaxed);
+	stats.blocked = data->blocked.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void LogOutput::flushAll()
+{
+	if (detail::LogWriter::isRunning())
+		detail::LogWriter::get().flush();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Deferred formatting
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	struct LogArg
+	{
+		detail::LogArgType type;
+		uint64_t u;
+		double d;
+		const char* str;
+	};
+
+	//! Reads the next argument, including field keys
+	bool readRawLogArg(const char*& p, const char* end, LogArg& arg)
+	{
+		if (p == end)
+			return false;
+		arg.type = static_cast<detail::LogArgType>(*p++);
+		if (arg.type == detail::LogArgType::String)
+		{
+			uint32_t len;
+			memcpy(&len, p, sizeof(len));
+			arg.str = p + sizeof(len);
+			arg.u = len;
+			p = arg.str + len + 1;
+		}
+		else if (arg.type == detail::LogArgType::Double)
+		{
+			memcpy(&arg.d, p, sizeof(arg.d));
+			p += sizeof(arg.d);
+		}
+		else if (arg.type == detail::LogArgType::Bool)
+		{
+			arg.u = *p++ ? 1 : 0;
+		}
+		else
+		{
+			memcpy(&arg.u, p, sizeof(arg.u));
+			p += sizeof(arg.u);
+		}
+		return true;
+	}
+
+	//! Reads the next argument for the format string, skipping fields
+	bool readLogArg(const char*& p, const char* end, LogArg& arg)
+	{
+		while (readRawLogArg(p, end, arg))
+		{
+			if (arg.type != detail::LogArgType::Field)
+				return true;
+			// Skip the value
+			readRawLogArg(p, end, arg);
+		}
+		return false;
+	}
+
+	template<typename T>
+	void appendFormatted(std::string& dst, const char* spec, T v)
+	{
+		char buf[128];
+		int n = snprintf(buf, sizeof(buf), spec, v);
+		if (n < 0)
+			return;
+		if (n < static_cast<int>(sizeof(buf)))
+		{
+			dst.append(buf, n);
+			return;
+		}
+		size_t pos = dst.size();
+		dst.resize(pos + n + 1);
+		snprintf(&dst[pos], n + 1, spec, v);
+		dst.resize(pos + n);
+	}
+}
+
+bool LogFieldList::next(LogFieldValue& dst)
+{
+	LogArg arg;
+	while (readRawLogArg(m_pos, m_end, arg))
+	{
+		if (arg.type != detail::LogArgType::Field)
+			continue;
+		dst.key = reinterpret_cast<const char*>(static_cast<uintptr_t>(arg.u));
+		if (!readRawLogArg(m_pos, m_end, arg))
+			return false;
+
+		dst.i = static_cast<int64_t>(arg.u);
+		dst.u = arg.u;
+		dst.d = arg.d;
+		dst.str = nullptr;
+		dst.strSize = 0;
+		switch (arg.type)
+		{
+		case detail::LogArgType::Integer:
+			dst.type = LogFieldType::Integer;
+			break;
+		case detail::LogArgType::Unsigned:
+			dst.type = LogFieldType::Unsigned;
+			break;
+		case detail::LogArgType::Double:
+			dst.type = LogFieldType::Double;
+			break;
+		case detail::LogArgType::Bool:
+			dst.type = LogFieldType::Bool;
+			break;
+		case detail::LogArgType::String:
+			dst.type = LogFieldType::String;
+			dst.str = arg.str;
+			dst.strSize = static_cast<size_t>(arg.u);
+			break;
+		default:
+			dst.type = LogFieldType::Pointer;
+		}
+		return true;
+	}
+	return false;
+}
+
+void appendLogFields(std::string& dst, const char* args, size_t argsSize)
+{
+	LogFieldList fields(args, argsSize);
+	LogFieldValue f;
+	while (fields.next(f))
+	{
+		dst += ' ';
+		dst += f.key;
+		dst += '=';
+		char buf[32];
+		switch (f.type)
+		{
+		case LogFieldType::Integer:
+			dst.append(buf, std::to_chars(buf, buf + sizeof(buf), f.i).ptr);
+			break;
+		case LogFieldType::Unsigned:
+			dst.append(buf, std::to_chars(buf, buf + sizeof(buf), f.u).ptr);
+			break;
+		case LogFieldType::Double:
+			appendFormatted(dst, "%g", f.d);
+			break;
+		case LogFieldType::Bool:
+			dst += f.u ? "true" : "false";
+			break;
+		case LogFieldType::String:
+			dst += '"';
+			dst.append(f.str, f.strSize);
+			dst += '"';
+			break;
+		case LogFieldType::Pointer:
+			appendFormatted(dst, "%p", reinterpret_cast<const void*>(static_cast<uintptr_t>(f.u)));
+			break;
+		}
+	}
+}
+
+void formatLogArgs(std::string& dst, const char* fmt, const char* args, size_t argsSize)
+{
+	const char* argsEnd = args + argsSize;
+	const char* p = fmt;
+	while (*p)
+	{
+		const char* pct = strchr(p, '%');
+		if (!pct)
+		{
+			dst.append(p);
+			break;
+		}
+		dst.append(p, pct);
+		p = pct + 1;
+		if (*p == '%')
+		{
+			dst += '%';
+			p++;
+			continue;
+		}
+
+		// Rebuild the conversion specification, with any '*' replaced by the respective argument, and using our own
+		// length modifier, since the arguments are stored as 64 bits values.
+		// Worst case is the '%', up to 39 characters copied from the format (flags and digits), the '.', up to 11
+		// characters for each of the two '*' expansions, and up to 4 for the length modifier, conversion and the 0.
+		char spec[1 + 39 + 1 + 2 * 11 + 4];
+		int specLen = 0;
+		spec[specLen++] = '%';
+		bool bad = false;
+		auto copySpec = [&](auto&& pred)
+		{
+			while (*p && pred(*p))
+			{
+				if (specLen < 40)
+					spec[specLen++] = *p;
+				p++;
+			}
+		};
+		auto starOrDigits = [&](bool precision)
+		{
+			if (*p == '*')
+			{
+				p++;
+				LogArg arg;
+				if (!readLogArg(args, argsEnd, arg) || arg.type != detail::LogArgType::Integer)
+					bad = true;
+				else if (precision && static_cast<int>(arg.u) < 0)
+					specLen--; // A negative precision is the same as no precision, so remove the '.'
+				else
+					specLen += snprintf(spec + specLen, 12, "%d", static_cast<int>(arg.u));
+			}
+			else
+				copySpec([](char c) { return c >= '0' && c <= '9'; });
+		};
+
+		copySpec([](char c) { return strchr("-+ #0", c) != nullptr; });
+		starOrDigits(false);
+		if (*p == '.')
+		{
+			spec[specLen++] = *p++;
+			starOrDigits(true);
+		}
+
+		// Length modifier, as the number of bits
+		const char* lengthStart = p;
+		int bits = 32;
+		if (p[0] == 'h' && p[1] == 'h')
+			bits = 8, p += 2;
+		else if (p[0] == 'h')
+			bits = 16, p++;
+		else if (p[0] == 'l' && p[1] == 'l')
+			bits = 64, p += 2;
+		else if (p[0] == 'l')
+			bits = sizeof(long) * 8, p++;
+		else if (p[0] == 'j' || p[0] == 'q')
+			bits = 64, p++;
+		else if (p[0] == 'z' || p[0] == 't')
+			bits = sizeof(size_t) * 8, p++;
+		else if (p[0] == 'I' && p[1] == '6' && p[2] == '4')
+			bits = 64, p += 3;
+		else if (p[0] == 'I' && p[1] == '3' && p[2] == '2')
+			bits = 32, p += 3;
+		else if (p[0] == 'I')
+			bits = sizeof(size_t) * 8, p++;
+		else if (p[0] == 'L')
+			p++;
+
+		bool hasLength = p != lengthStart;
+		char conv = *p;
+		if (!conv)
+			break;
+		p++;
+
+		LogArg arg;
+		if (bad)
+		{
+			dst += "<bad arg>";
+			continue;
+		}
+		if (!readLogArg(args, argsEnd, arg))
+		{
+			dst += "<missing arg>";
+			continue;
+		}
+
+		bool isInteger = arg.type == detail::LogArgType::Integer || arg.type == detail::LogArgType::Pointer;
+
+		// Fast paths for the most common cases, without flags, width or precision
+		if (specLen == 1 && !hasLength)
+		{
+			if (conv == 's' && arg.type == detail::LogArgType::String)
+			{
+				dst += arg.str;
+				continue;
+			}
+			else if (conv == 'd' && arg.type == detail::LogArgType::Integer)
+			{
+				char buf[16];
+				auto res = std::to_chars(buf, buf + sizeof(buf), static_cast<int>(arg.u));
+				dst.append(buf, res.ptr);
+				continue;
+			}
+		}
+
+		switch (conv)
+		{
+		case 'd':
+		case 'i':
+			if (isInteger)
+			{
+				int64_t v = bits == 64 ? static_cast<int64_t>(arg.u)
+				                       : static_cast<int64_t>(arg.u << (64 - bits)) >> (64 - bits);
+				memcpy(spec + specLen, "lld", 4);
+				appendFormatted(dst, spec, static_cast<long long>(v));
+				continue;
+			}
+			break;
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			if (isInteger)
+			{
+				uint64_t v = bits == 64 ? arg.u : arg.u & ((uint64_t(1) << bits) - 1);
+				spec[specLen++] = 'l';
+				spec[specLen++] = 'l';
+				spec[specLen++] = conv;
+				spec[specLen] = 0;
+				appendFormatted(dst, spec, static_cast<unsigned long long>(v));
+				continue;
+			}
+			break;
+		case 'c':
+			if (isInteger)
+			{
+				memcpy(spec + specLen, "c", 2);
+				appendFormatted(dst, spec, static_cast<int>(arg.u));
+				continue;
+			}
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (arg.type == detail::LogArgType::Double)
+			{
+				spec[specLen++] = conv;
+				spec[specLen] = 0;
+				appendFormatted(dst, spec, arg.d);
+				continue;
+			}
+			break;
+		case 's':
+			if (!hasLength && arg.type == detail::LogArgType::String)
+			{
+				memcpy(spec + specLen, "s", 2);
+				appendFormatted(dst, spec, arg.str);
+				continue;
+			}
+			else if (!hasLength && arg.type == detail::LogArgType::Pointer && arg.u == 0)
+			{
+				memcpy(spec + specLen, "s", 2);
+				appendFormatted(dst, spec, "(null)");
+				continue;
+			}
+			break;
+		case 'p':
+			if (isInteger)
+			{
+				memcpy(spec + specLen, "p", 2);
+				appendFormatted(dst, spec, reinterpret_cast<const void*>(static_cast<uintptr_t>(arg.u)));
+				continue;
+			}
+			break;
+		}
+
+		dst += "<bad arg>";
+	}
+}
 
 }
@@ -10,8 +10,14 @@
 
 #pragma once
 
+#include "crazygaze/muc/InternedString.h"
 #include <mutex>
 #include <vector>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <type_traits>
+#include <cstring>
 
 namespace cz
 {
@@ -43,19 +49,45 @@ static inline const char* logVerbosityToString(LogVerbosity v)
 // Globally sets maximum compile time verbosity
 #define CZ_LOG_MAXIMUM_VERBOSITY Verbose
 
+/*
+If 1, CZ_LOG behaves as CZ_LOG_DEFERRED: it doesn't format messages in the calling thread. Instead it records the call
+site, a timestamp and the arguments, and the background writer does the formatting.
+This requires the format string to be a string literal, and the arguments to be of types printf accepts. Mismatches
+between the format string and the arguments are not caught at compile time, but logged as "<bad arg>".
+Off by default, so CZ_LOG keeps the compiler's printf format checks. CZ_LOG_DEFERRED can be used for specific call
+sites instead.
+*/
+#ifndef CZ_LOG_DEFERRED_FORMAT
+	#define CZ_LOG_DEFERRED_FORMAT 0
+#endif
+
+//! Parses a verbosity name ("Verbose", "Log", ...) or its 3 letter code ("VER", "LOG", ...). Case insensitive
+bool logVerbosityFromString(const char* str, size_t size, LogVerbosity& dst);
+
+/*!
+Categories register themselves when constructed, in a registry that is lock free and never shrinks (categories are
+expected to be global objects that live until the process exits).
+The runtime verbosity is atomic, so it can be changed from any thread while others are logging. Loads use relaxed
+ordering, so checking if a message is suppressed is still just a single load.
+*/
 class LogCategoryBase
 {
 public:
 	LogCategoryBase(const char* name, LogVerbosity verbosity, LogVerbosity compileTimeVerbosity);
 	__forceinline const std::string& getName() const
 	{
-		return m_name;
+		return m_name.str();
 	}
 	__forceinline bool isSuppressed(LogVerbosity verbosity) const
 	{
-		return verbosity > m_verbosity;
+		return verbosity > m_verbosity.load(std::memory_order_relaxed);
+	}
+	__forceinline LogVerbosity getVerbosity() const
+	{
+		return m_verbosity.load(std::memory_order_relaxed);
 	}
 	void setVerbosity(LogVerbosity verbosity);
+	//! Categories are iterated in the order they were registered
 	LogCategoryBase* getNext();
 	static LogCategoryBase* getFirst();
 	static LogCategoryBase* find(const char* name);
@@ -64,12 +96,32 @@ public:
 		return find(name.c_str());
 	}
 
+	/*!
+	Sets the verbosity of all categories matching the patterns in "spec", in one pass over the categories.
+	The format is a list of "pattern=verbosity", separated by ',', ';' or whitespace. E.g: "net.*=Verbose,logDefault=Warning"
+	Patterns can use '*' (any sequence of characters) and '?' (any character), and are case sensitive.
+	If a category matches more than one pattern, the last one wins.
+	\return The number of categories that matched a pattern, or -1 if "spec" is invalid, in which case nothing is changed.
+	*/
+	static int setVerbosityFromSpec(const char* spec);
+
 protected:
-	LogVerbosity m_verbosity;
+	enum
+	{
+		// Must be a power of 2
+		NumBuckets = 256
+	};
+	std::atomic<LogVerbosity> m_verbosity;
 	LogVerbosity m_compileTimeVerbosity;
-	std::string m_name;
-	LogCategoryBase* m_next = nullptr;
-	inline static LogCategoryBase* ms_first = nullptr;
+	InternedString m_name;
+	std::atomic<LogCategoryBase*> m_next{nullptr};
+	LogCategoryBase* m_nextInBucket = nullptr;
+
+	// These are all constant initialized, so categories can register during dynamic initialization in any order
+	inline static std::atomic<LogCategoryBase*> ms_first{nullptr};
+	// Where to link the next category to register
+	inline static std::atomic<std::atomic<LogCategoryBase*>*> ms_tail{&ms_first};
+	inline static std::atomic<LogCategoryBase*> ms_buckets[NumBuckets] = {};
 };
 
 template<LogVerbosity DEFAULT, LogVerbosity COMPILETIME>
@@ -89,6 +141,280 @@ public:
 private:
 };
 
+//! Static information about a CZ_LOG call site, used for deferred formatting
+struct LogSite
+{
+	const LogCategoryBase* category;
+	LogVerbosity verbosity;
+	const char* file;
+	int line;
+	const char* fmt;
+};
+
+namespace detail
+{
+	/*
+	Arguments for deferred formatting are stored as a sequence of [type][value], where the value is:
+	- Integer, Double, Pointer : 8 bytes
+	- String : 4 bytes length, followed by the characters and a null terminator
+	- Unsigned : 8 bytes. Bool : 1 byte. Only used for field values, since fields keep the type.
+	- Field : 8 bytes with a pointer to the key (a string literal), followed by the value as another argument
+	Integers are stored sign extended to 64 bits, and the formatter converts them to whatever the format string
+	specifies, so the encoding doesn't depend on the platform's printf length modifiers.
+	*/
+	enum class LogArgType : uint8_t
+	{
+		Integer,
+		Double,
+		Pointer,
+		String,
+		Unsigned,
+		Bool,
+		Field
+	};
+
+	struct LogStringArg
+	{
+		explicit LogStringArg(const char* str) : str(str), len(str ? static_cast<uint32_t>(strlen(str)) : 0)
+		{
+		}
+		LogStringArg(const char* str, size_t len) : str(str), len(static_cast<uint32_t>(len))
+		{
+		}
+		const char* str;
+		uint32_t len;
+	};
+
+	struct LogUnsignedArg
+	{
+		uint64_t v;
+	};
+
+	struct LogBoolArg
+	{
+		bool v;
+	};
+
+	template<typename T>
+	struct LogFieldArg
+	{
+		const char* key;
+		T value;
+	};
+
+	template<typename T>
+	struct IsLogFieldArg : std::false_type {};
+	template<typename T>
+	struct IsLogFieldArg<LogFieldArg<T>> : std::true_type {};
+
+	template<typename T>
+	auto toLogArg(const T& v)
+	{
+		using D = std::decay_t<T>;
+		if constexpr (IsLogFieldArg<D>::value)
+			return v;
+		else if constexpr (std::is_same_v<D, char*> || std::is_same_v<D, const char*>)
+			return LogStringArg(v);
+		else if constexpr (std::is_integral_v<D> || std::is_enum_v<D>)
+			return static_cast<uint64_t>(v);
+		else if constexpr (std::is_floating_point_v<D>)
+			return static_cast<double>(v);
+		else if constexpr (std::is_pointer_v<D> || std::is_null_pointer_v<D>)
+			return static_cast<const void*>(v);
+		else
+			static_assert(sizeof(T) == 0, "Type not supported by CZ_LOG. Only types that can be passed to printf are supported.");
+	}
+
+	//! Same as toLogArg, but keeps the signedness and bools, and accepts std::string, since the value is not
+	//! passed to printf.
+	template<typename T>
+	auto toLogFieldValue(const T& v)
+	{
+		using D = std::decay_t<T>;
+		if constexpr (std::is_same_v<D, bool>)
+			return LogBoolArg{v};
+		else if constexpr (std::is_same_v<D, std::string>)
+			return LogStringArg(v.c_str(), v.size());
+		else if constexpr (std::is_integral_v<D> && std::is_unsigned_v<D>)
+			return LogUnsignedArg{v};
+		else
+			return toLogArg(v);
+	}
+
+	inline size_t logArgSize(uint64_t) { return 1 + sizeof(uint64_t); }
+	inline size_t logArgSize(double) { return 1 + sizeof(double); }
+	inline size_t logArgSize(const void*) { return 1 + sizeof(uint64_t); }
+	inline size_t logArgSize(const LogStringArg& v)
+	{
+		return v.str ? 1 + sizeof(uint32_t) + v.len + 1 : logArgSize(static_cast<const void*>(nullptr));
+	}
+	inline size_t logArgSize(LogUnsignedArg) { return 1 + sizeof(uint64_t); }
+	inline size_t logArgSize(LogBoolArg) { return 1 + 1; }
+	template<typename T>
+	size_t logArgSize(const LogFieldArg<T>& v)
+	{
+		return 1 + sizeof(uint64_t) + logArgSize(v.value);
+	}
+
+	inline void writeLogArg(char*& dst, LogArgType type, const void* src, size_t size)
+	{
+		*dst++ = static_cast<char>(type);
+		memcpy(dst, src, size);
+		dst += size;
+	}
+	inline void writeLogArg(char*& dst, uint64_t v) { writeLogArg(dst, LogArgType::Integer, &v, sizeof(v)); }
+	inline void writeLogArg(char*& dst, double v) { writeLogArg(dst, LogArgType::Double, &v, sizeof(v)); }
+	inline void writeLogArg(char*& dst, const void* v)
+	{
+		uint64_t u = reinterpret_cast<uintptr_t>(v);
+		writeLogArg(dst, LogArgType::Pointer, &u, sizeof(u));
+	}
+	inline void writeLogArg(char*& dst, const LogStringArg& v)
+	{
+		if (!v.str)
+			return writeLogArg(dst, static_cast<const void*>(nullptr));
+		writeLogArg(dst, LogArgType::String, &v.len, sizeof(v.len));
+		memcpy(dst, v.str, v.len);
+		dst[v.len] = 0;
+		dst += v.len + 1;
+	}
+	inline void writeLogArg(char*& dst, LogUnsignedArg v) { writeLogArg(dst, LogArgType::Unsigned, &v.v, sizeof(v.v)); }
+	inline void writeLogArg(char*& dst, LogBoolArg v) { writeLogArg(dst, LogArgType::Bool, &v.v, 1); }
+	template<typename T>
+	void writeLogArg(char*& dst, const LogFieldArg<T>& v)
+	{
+		uint64_t key = reinterpret_cast<uintptr_t>(v.key);
+		writeLogArg(dst, LogArgType::Field, &key, sizeof(key));
+		writeLogArg(dst, v.value);
+	}
+}
+
+/*! Attaches a typed key/value field to a CZ_LOG message. E.g:
+CZ_LOG(logNet, Log, "Connected to %s", host, cz::logField("port", port), cz::logField("secure", true));
+
+Fields can be passed anywhere in the argument list, and are not matched to the format string. Text outputs show them
+after the message as " key=value", and structured outputs (see LogOutput::logEntry) get them with their type.
+The key must be a string literal. Supported values are integers, floating point, bool, strings (including
+std::string) and pointers.
+Fields require deferred formatting, so they can only be used with CZ_LOG_DEFERRED, or with CZ_LOG if
+CZ_LOG_DEFERRED_FORMAT is set to 1. E.g:
+CZ_LOG_DEFERRED(logNet, Log, "Connected to %s", host, cz::logField("port", port));
+*/
+template<typename T, size_t N>
+auto logField(const char (&key)[N], const T& value)
+{
+	using V = decltype(detail::toLogFieldValue(value));
+	return detail::LogFieldArg<V>{key, detail::toLogFieldValue(value)};
+}
+
+enum class LogFieldType
+{
+	Integer,
+	Unsigned,
+	Double,
+	Bool,
+	String,
+	Pointer
+};
+
+//! A field attached to a message. Depending on "type", the value is in "i", "u" (also used for Bool and Pointer), "d",
+//! or "str"/"strSize"
+struct LogFieldValue
+{
+	const char* key;
+	LogFieldType type;
+	int64_t i;
+	uint64_t u;
+	double d;
+	const char* str;
+	size_t strSize;
+};
+
+//! Iterates the fields attached to a message
+class LogFieldList
+{
+public:
+	LogFieldList() {}
+	LogFieldList(const char* args, size_t argsSize) : m_pos(args), m_end(args + argsSize)
+	{
+	}
+
+	//! Gets the next field. Returns false if there are no more
+	bool next(LogFieldValue& dst);
+
+private:
+	const char* m_pos = nullptr;
+	const char* m_end = nullptr;
+};
+
+/*! Appends the fields in the recorded arguments as " key=value" to "dst".
+Strings are quoted
+*/
+void appendLogFields(std::string& dst, const char* args, size_t argsSize);
+
+/*! Formats arguments recorded for deferred formatting, appending the result to "dst".
+Arguments are matched to the printf style format string, and any mismatches are shown in the output, instead of
+causing undefined behaviour.
+*/
+void formatLogArgs(std::string& dst, const char* fmt, const char* args, size_t argsSize);
+
+/*! Settings for the logging backend.
+
+By default, logging is asynchronous. Each thread writes its messages to its own lock free buffer, and a background
+writer thread drains all buffers and hands the messages to the outputs in batches. Logging threads never take a lock
+or wait for the outputs.
+*/
+struct LogSettings
+{
+	//! If false, outputs are called from the logging thread, under a global lock
+	bool async = true;
+
+	//! Size in bytes of each thread's buffer. Rounded up to a power of 2.
+	//! Only affects buffers created afterwards (buffers are created the first time a thread logs something)
+	size_t threadBufferSize = 256 * 1024;
+
+	//! Maximum time a message sits in a thread's buffer before the writer hands it to the outputs and flushes them.
+	//! The writer also wakes up earlier if a buffer is getting full.
+	std::chrono::milliseconds flushInterval{50};
+
+	//! What to do when a thread's buffer is full.
+	//! If true, the thread waits for the writer to make room. If false, the message is dropped.
+	bool blockWhenFull = true;
+};
+
+//! Counters for the asynchronous logging. See LogOutput::getStats
+struct LogStats
+{
+	//! Messages handed to the outputs
+	uint64_t written = 0;
+	//! Messages dropped because a thread's buffer was full
+	uint64_t dropped = 0;
+	//! Messages that had to wait for room in a thread's buffer
+	uint64_t blocked = 0;
+};
+
+//! Everything about a logged message, as given to LogOutput::logEntry
+struct LogEntry
+{
+	std::chrono::system_clock::time_point time;
+	const char* file;
+	int line;
+	const LogCategoryBase* category;
+	LogVerbosity verbosity;
+	//! The full line given to LogOutput::log, with the prefix and any fields
+	const char* text;
+	//! Just the message, without prefix or fields. Not null terminated
+	const char* msg;
+	size_t msgSize;
+	//! Fields attached with cz::logField
+	LogFieldList fields;
+};
+
+namespace detail
+{
+	class LogWriter;
+}
+
 class LogOutput
 {
 public:
@@ -96,23 +422,178 @@ public:
 	virtual ~LogOutput();
 	static void logToAll(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, _Printf_format_string_ const char* fmt, ...);
 
+	/**
+	* Logs the arguments without formatting them. The formatting is done later, by the background writer.
+	* This is what CZ_LOG_DEFERRED uses, and CZ_LOG if CZ_LOG_DEFERRED_FORMAT is 1
+	*/
+	template<typename... Args>
+	static void logDeferred(const LogSite& site, const Args&... args)
+	{
+		logDeferredImpl(site, detail::toLogArg(args)...);
+	}
+
 	/**
 	* Enables/disables outputting the log strings to any attached debugger.
 	* E.g: On windows. it makes calls to OutputDebugString
 	*/
 	static void setLogToDebugger(bool enabled);
+
+	static void setSettings(const LogSettings& settings);
+	static LogSettings getSettings();
+	static LogStats getStats();
+
+	/**
+	* Blocks until all messages logged so far (by any thread) are handed to the outputs, and the outputs flushed.
+	* Fatal messages do this automatically.
+	*/
+	static void flushAll();
+
+protected:
+	/**
+	* Called after a batch of messages was handed to the output.
+	* Outputs that buffer messages should write them here.
+	*/
+	virtual void flush() {}
+
+	/**
+	* Hands everything logged so far to this output, and then stops it from receiving any more messages.
+	* Derived classes should call this at the start of their destructors, since messages are delivered from the
+	* background writer, and the output must still be fully constructed to receive them.
+	* Calling it more than once is harmless.
+	*/
+	void detach();
+
 private:
+	friend class detail::LogWriter;
 	virtual void log(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, const char* msg) = 0;
 
+	/**
+	* Called for every message. The default implementation calls "log" with the formatted line.
+	* Outputs that need the message's parts or the fields (e.g: to serialize them) override this instead.
+	*/
+	virtual void logEntry(const LogEntry& entry)
+	{
+		log(entry.file, entry.line, entry.category, entry.verbosity, entry.text);
+	}
+
 	struct SharedData
 	{
 		std::mutex mtx;
 		std::vector<LogOutput*> outputs;
 		bool logToDebugger = true;
+		LogSettings settings;
+		// Copies of the settings used by the logging threads and the writer, so they don't need the lock
+		std::atomic<bool> async{true};
+		std::atomic<bool> blockWhenFull{true};
+		std::atomic<size_t> threadBufferSize{LogSettings().threadBufferSize};
+		std::atomic<int64_t> flushIntervalMs{LogSettings().flushInterval.count()};
+		std::atomic<uint64_t> written{0};
+		std::atomic<uint64_t> dropped{0};
+		std::atomic<uint64_t> blocked{0};
 	};
 	static SharedData* getSharedData();
+
+	template<typename... Args>
+	static void logDeferredImpl(const LogSite& site, const Args&... args)
+	{
+		size_t argsSize = (size_t(0) + ... + detail::logArgSize(args));
+		char* dst = beginDeferred(site, argsSize);
+		if (!dst)
+			return;
+		(detail::writeLogArg(dst, args), ...);
+		endDeferred(site);
+	}
+	//! Returns where to write the arguments, or nullptr if the message was dropped
+	static char* beginDeferred(const LogSite& site, size_t argsSize);
+	static void endDeferred(const LogSite& site);
+
+	//! Hands a message to the outputs. Must be called with the SharedData lock held
+	static void logToOutputs(SharedData* data, const LogEntry& entry);
+	//! Hands a message to the outputs and flushes them, from the calling thread
+	static void logLine(SharedData* data, const LogEntry& entry);
+};
+
+
+namespace detail
+{
+
+//! Fast per thread random numbers for CZ_LOG_SAMPLED (xorshift64*)
+inline uint32_t logRandom()
+{
+	thread_local uint64_t state = 0;
+	if (state == 0)
+	{
+		// Seed with the state's address, which is different for each thread
+		state = reinterpret_cast<uintptr_t>(&state) * 0x9E3779B97F4A7C15ULL | 1;
+	}
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return static_cast<uint32_t>((state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+//
+// Per call site state for the rate limited logging macros.
+// They are constant initialized, so the static variables in the macros don't need a guard.
+// "check" returns true if the message should be logged, and in that case sets "suppressed" to the number of
+// messages suppressed since the last one logged.
+//
+
+struct LogEveryN
+{
+	bool check(uint64_t n, uint32_t& suppressed)
+	{
+		// N can be a runtime value, so guard against 0 here. It logs everything, same as N == 1
+		if (n <= 1)
+		{
+			suppressed = 0;
+			return true;
+		}
+		uint64_t c = count.fetch_add(1, std::memory_order_relaxed);
+		if (c % n)
+			return false;
+		suppressed = c ? static_cast<uint32_t>(n - 1) : 0;
+		return true;
+	}
+	std::atomic<uint64_t> count{0};
+};
+
+struct LogEveryMs
+{
+	bool check(int64_t ms, uint32_t& suppressed)
+	{
+		int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		                  std::chrono::steady_clock::now().time_since_epoch()).count();
+		int64_t next = nextTime.load(std::memory_order_relaxed);
+		// If another thread wins the race, this one is suppressed
+		if (now < next || !nextTime.compare_exchange_strong(next, now + ms, std::memory_order_relaxed))
+		{
+			suppressedCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		suppressed = suppressedCount.exchange(0, std::memory_order_relaxed);
+		return true;
+	}
+	std::atomic<int64_t> nextTime{0};
+	std::atomic<uint32_t> suppressedCount{0};
 };
 
+struct LogSampled
+{
+	bool check(double probability, uint32_t& suppressed)
+	{
+		if (logRandom() >= probability * 4294967296.0)
+		{
+			suppressedCount.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		suppressed = suppressedCount.exchange(0, std::memory_order_relaxed);
+		return true;
+	}
+	std::atomic<uint32_t> suppressedCount{0};
+};
+
+} // namespace detail
 
 #if CZ_NO_LOGGING
 
@@ -132,6 +613,10 @@ extern LogCategoryLogNone logNone;
 			::cz::_doAssert(__FILE__, __LINE__, fmt, ##__VA_ARGS__);    \
 		}                                                               \
 	}
+#define CZ_LOG_DEFERRED(NAME, VERBOSITY, fmt, ...) CZ_LOG(NAME, VERBOSITY, fmt, ##__VA_ARGS__)
+#define CZ_LOG_EVERY_N(NAME, VERBOSITY, N, fmt, ...) {}
+#define CZ_LOG_EVERY_MS(NAME, VERBOSITY, MS, fmt, ...) {}
+#define CZ_LOG_SAMPLED(NAME, VERBOSITY, PROBABILITY, fmt, ...) {}
 
 #else
 
@@ -152,6 +637,45 @@ extern LogCategoryLogNone logNone;
 	(((int)::cz::LogVerbosity::VERBOSITY <= LogCategory##NAME::CompileTimeVerbosity) && \
 	 ((int)::cz::LogVerbosity::VERBOSITY <= (int)::cz::LogVerbosity::CZ_LOG_MAXIMUM_VERBOSITY))
 
+/*
+Logs with deferred formatting (see CZ_LOG_DEFERRED_FORMAT), regardless of what CZ_LOG uses.
+The format string is concatenated with "" so using something other than a string literal fails to compile.
+*/
+#define CZ_LOG_DEFERRED(NAME, VERBOSITY, fmt, ...)                                                       \
+	{                                                                                                    \
+		if (CZ_LOG_CHECK_COMPILETIME_VERBOSITY(NAME, VERBOSITY))                                         \
+		{                                                                                                \
+			if (!NAME.isSuppressed(::cz::LogVerbosity::VERBOSITY))                                       \
+			{                                                                                            \
+				static const ::cz::LogSite czLogSite = {&NAME, ::cz::LogVerbosity::VERBOSITY, __FILE__,  \
+				                                        __LINE__, "" fmt};                               \
+				::cz::LogOutput::logDeferred(czLogSite, ##__VA_ARGS__);                                  \
+				if (::cz::LogVerbosity::VERBOSITY == ::cz::LogVerbosity::Fatal)                          \
+				{                                                                                        \
+					::cz::_doAssert(__FILE__, __LINE__, fmt, ##__VA_ARGS__);                             \
+				}                                                                                        \
+			}                                                                                            \
+		}                                                                                                \
+	}
+
+#if CZ_LOG_DEFERRED_FORMAT
+#define CZ_LOG(NAME, VERBOSITY, fmt, ...) CZ_LOG_DEFERRED(NAME, VERBOSITY, fmt, ##__VA_ARGS__)
+
+// Used by the rate limited macros. If any messages were suppressed, their number is added to the message
+#define CZ_LOG_LIMITED_EMIT(NAME, VERBOSITY, SUPPRESSED, fmt, ...)                                      \
+	if (SUPPRESSED == 0)                                                                                 \
+	{                                                                                                    \
+		static const ::cz::LogSite czLogSite = {&NAME, ::cz::LogVerbosity::VERBOSITY, __FILE__, __LINE__, \
+		                                        "" fmt};                                                 \
+		::cz::LogOutput::logDeferred(czLogSite, ##__VA_ARGS__);                                          \
+	}                                                                                                    \
+	else                                                                                                 \
+	{                                                                                                    \
+		static const ::cz::LogSite czLogSite = {&NAME, ::cz::LogVerbosity::VERBOSITY, __FILE__, __LINE__, \
+		                                        "" fmt " (%u similar messages suppressed)"};             \
+		::cz::LogOutput::logDeferred(czLogSite, ##__VA_ARGS__, SUPPRESSED);                              \
+	}
+#else
 #define CZ_LOG(NAME, VERBOSITY, fmt, ...)                                                                \
 	{                                                                                                    \
 		if (CZ_LOG_CHECK_COMPILETIME_VERBOSITY(NAME, VERBOSITY))                                         \
@@ -168,6 +692,55 @@ extern LogCategoryLogNone logNone;
 		}                                                                                                \
 	}
 
+#define CZ_LOG_LIMITED_EMIT(NAME, VERBOSITY, SUPPRESSED, fmt, ...)                                      \
+	if (SUPPRESSED == 0)                                                                                 \
+	{                                                                                                    \
+		::cz::LogOutput::logToAll(__FILE__, __LINE__, &NAME, ::cz::LogVerbosity::VERBOSITY, "" fmt,      \
+		                          ##__VA_ARGS__);                                                        \
+	}                                                                                                    \
+	else                                                                                                 \
+	{                                                                                                    \
+		::cz::LogOutput::logToAll(__FILE__, __LINE__, &NAME, ::cz::LogVerbosity::VERBOSITY,              \
+		                          "" fmt " (%u similar messages suppressed)", ##__VA_ARGS__, SUPPRESSED); \
+	}
+
+#endif
+
+/*
+Rate limited logging, for messages that can happen in bursts (e.g: under fault conditions).
+Each call site keeps its own state, which is checked after the verbosity with one or two relaxed atomic operations.
+The first message logged after some were suppressed says how many were suppressed.
+As with the deferred CZ_LOG, the format string must be a string literal.
+Fatal messages can't be rate limited.
+*/
+#define CZ_LOG_LIMITED(NAME, VERBOSITY, LIMITER, LIMIT, fmt, ...)                                        \
+	{                                                                                                    \
+		static_assert(::cz::LogVerbosity::VERBOSITY != ::cz::LogVerbosity::Fatal,                        \
+		              "Fatal messages can't be rate limited");                                           \
+		if (CZ_LOG_CHECK_COMPILETIME_VERBOSITY(NAME, VERBOSITY))                                         \
+		{                                                                                                \
+			if (!NAME.isSuppressed(::cz::LogVerbosity::VERBOSITY))                                       \
+			{                                                                                            \
+				static ::cz::detail::LIMITER czLogLimiter;                                               \
+				uint32_t czLogSuppressed;                                                                \
+				if (czLogLimiter.check(LIMIT, czLogSuppressed))                                          \
+				{                                                                                        \
+					CZ_LOG_LIMITED_EMIT(NAME, VERBOSITY, czLogSuppressed, fmt, ##__VA_ARGS__)            \
+				}                                                                                        \
+			}                                                                                            \
+		}                                                                                                \
+	}
+
+//! Logs the 1st, N+1th, 2N+1th, ... messages. N of 0 or 1 logs every message
+#define CZ_LOG_EVERY_N(NAME, VERBOSITY, N, fmt, ...) \
+	CZ_LOG_LIMITED(NAME, VERBOSITY, LogEveryN, N, fmt, ##__VA_ARGS__)
+//! Logs at most one message every MS milliseconds
+#define CZ_LOG_EVERY_MS(NAME, VERBOSITY, MS, fmt, ...) \
+	CZ_LOG_LIMITED(NAME, VERBOSITY, LogEveryMs, MS, fmt, ##__VA_ARGS__)
+//! Logs each message with the specified probability (0 to 1)
+#define CZ_LOG_SAMPLED(NAME, VERBOSITY, PROBABILITY, fmt, ...) \
+	CZ_LOG_LIMITED(NAME, VERBOSITY, LogSampled, PROBABILITY, fmt, ##__VA_ARGS__)
+
 #endif
 
 } // namespace cz
@@ -0,0 +1,116 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/MappedFile.h"
+#include "crazygaze/muc/StringUtils.h"
+
+#if CZ_PLATFORM != CZ_PLATFORM_WIN32
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace cz
+{
+
+MappedFile::MappedFile()
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* filename)
+{
+	close();
+
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+	// Sharing everything, so the file can still be replaced while mapped
+	HANDLE file = CreateFileW(widen(filename).c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                          NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	if (size.QuadPart)
+	{
+		// The view keeps the mapping and file alive, so the handles can be closed right away
+		HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(file);
+		if (!mapping)
+			return false;
+		m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+		if (!m_data)
+			return false;
+		m_size = static_cast<size_t>(size.QuadPart);
+	}
+	else
+	{
+		CloseHandle(file);
+	}
+#else
+	int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	if (st.st_size)
+	{
+		// The mapping keeps the file alive, so the descriptor can be closed right away
+		void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			return false;
+		m_data = static_cast<const char*>(data);
+		m_size = static_cast<size_t>(st.st_size);
+	}
+	else
+	{
+		::close(fd);
+	}
+#endif
+
+	m_open = true;
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (m_data)
+	{
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+		UnmapViewOfFile(m_data);
+#else
+		munmap(const_cast<char*>(m_data), m_size);
+#endif
+	}
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+}
+
+} // namespace cz
+
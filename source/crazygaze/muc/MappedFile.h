@@ -0,0 +1,67 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Read only memory mapping of a whole file
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include <string_view>
+
+namespace cz
+{
+
+/*!
+Maps a file to memory, read only.
+The file contents are paged in on demand, so nothing is copied or allocated to access it.
+
+NOTE: The contents are undefined if another process modifies the file in place while it is mapped (and on Linux,
+truncating it makes accessing the missing pages crash). Files that can change should be replaced by writing a new file
+and renaming it over the old one, which is what editors and most tools do anyway.
+*/
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	//! Opens a file, given its UTF-8 name. Any previously opened file is closed first.
+	bool open(const char* filename);
+	void close();
+
+	bool isOpen() const
+	{
+		return m_open;
+	}
+
+	//! Empty files are not mapped, in which case this is nullptr
+	const char* data() const
+	{
+		return m_data;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	std::string_view view() const
+	{
+		return std::string_view(m_data, m_size);
+	}
+
+private:
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+	bool m_open = false;
+};
+
+} // namespace cz
+
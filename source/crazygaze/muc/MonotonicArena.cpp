@@ -0,0 +1,84 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+	
+	purpose:
+	
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/MonotonicArena.h"
+
+namespace cz
+{
+
+MonotonicArena::MonotonicArena(size_t blockSize)
+	: m_blockSize(blockSize)
+{
+}
+
+MonotonicArena::~MonotonicArena()
+{
+	Block* block = m_first;
+	while (block)
+	{
+		Block* next = block->next;
+		std::free(block);
+		block = next;
+	}
+}
+
+void MonotonicArena::setCurrent(Block* block)
+{
+	m_current = block;
+	m_ptr = reinterpret_cast<uintptr_t>(block->data());
+	m_end = m_ptr + block->size;
+}
+
+void* MonotonicArena::allocate(size_t size, size_t alignment)
+{
+	CZ_ASSERT(alignment && (alignment & (alignment - 1)) == 0);
+
+	while (true)
+	{
+		if (m_current)
+		{
+			uintptr_t ptr = (m_ptr + alignment - 1) & ~(uintptr_t(alignment) - 1);
+			if (ptr + size <= m_end)
+			{
+				m_ptr = ptr + size;
+				return reinterpret_cast<void*>(ptr);
+			}
+
+			// Reuse blocks we had before a reset
+			if (m_current->next)
+			{
+				setCurrent(m_current->next);
+				continue;
+			}
+		}
+
+		// Need a new block. Oversized allocations get a block of their own, which will be reused after a reset
+		size_t blockSize = std::max(m_blockSize, size + alignment);
+		auto block = reinterpret_cast<Block*>(std::malloc(sizeof(Block) + blockSize));
+		if (!block)
+			throw std::bad_alloc();
+		block->next = nullptr;
+		block->size = blockSize;
+		m_capacity += blockSize;
+		if (m_current)
+			m_current->next = block;
+		else
+			m_first = block;
+		setCurrent(block);
+	}
+}
+
+void MonotonicArena::reset()
+{
+	if (m_first)
+		setCurrent(m_first);
+}
+
+} // namespace cz
@@ -0,0 +1,112 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+	
+	purpose:
+	Bump pointer allocator, for when lots of small allocations are all
+	thrown away together (e.g: at the end of processing a request)
+	
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/QuickVector.h"
+
+namespace cz
+{
+
+/*!
+ * Hands out memory by bumping a pointer, and never frees individual allocations.
+ * All the memory is reclaimed at once with reset(), which is O(1). The blocks are kept around after a reset, so
+ * once the arena is warmed up, it doesn't allocate from the heap anymore.
+ * Not thread safe.
+ */
+class MonotonicArena
+{
+public:
+	explicit MonotonicArena(size_t blockSize = 64 * 1024);
+	~MonotonicArena();
+	MonotonicArena(const MonotonicArena&) = delete;
+	MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+	//! Allocates memory. Alignment needs to be a power of 2
+	void* allocate(size_t size, size_t alignment);
+
+	template<typename T>
+	T* allocate(size_t count)
+	{
+		return reinterpret_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	//! Makes all the memory available again, invalidating any previous allocations.
+	// No destructors are called.
+	void reset();
+
+	//! Total bytes of all the blocks allocated from the heap
+	size_t capacity() const
+	{
+		return m_capacity;
+	}
+
+private:
+	struct Block
+	{
+		Block* next;
+		size_t size; // usable bytes after the header
+		char* data()
+		{
+			return reinterpret_cast<char*>(this + 1);
+		}
+	};
+
+	void setCurrent(Block* block);
+
+	size_t m_blockSize;
+	size_t m_capacity = 0;
+	Block* m_first = nullptr;
+	Block* m_current = nullptr;
+	uintptr_t m_ptr = 0;
+	uintptr_t m_end = 0;
+};
+
+//! Allocator for containers such as QuickVector.
+// Deallocating is a no-op, and the memory is only reclaimed when the arena is reset
+class ArenaAllocator
+{
+public:
+	ArenaAllocator(MonotonicArena& arena)
+		: m_arena(&arena)
+	{
+	}
+
+	void* allocate(size_t size, size_t alignment)
+	{
+		return m_arena->allocate(size, alignment);
+	}
+
+	void deallocate(void* /*ptr*/, size_t /*size*/)
+	{
+	}
+
+	bool operator==(const ArenaAllocator& other) const
+	{
+		return m_arena == other.m_arena;
+	}
+
+private:
+	MonotonicArena* m_arena;
+};
+
+/*!
+ * QuickVector that takes it's heap memory from a MonotonicArena.
+ * \code
+ * MonotonicArena arena;
+ * ArenaQuickVector<int, 4> v(arena);
+ * \endcode
+ */
+template<typename T, unsigned int N>
+using ArenaQuickVector = QuickVector<T, N, ArenaAllocator>;
+
+} // namespace cz
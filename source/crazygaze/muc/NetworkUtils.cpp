@@ -212,7 +212,7 @@ std::vector<NetworkAdapterInfo> getAdaptersAddresses(bool onlyStatusUp, bool inc
 	dwRetVal = GetAdaptersAddresses(family, flags, NULL, pAddresses, &outBufLen);
 	if (dwRetVal != NO_ERROR)
 	{
-		CZ_LOG(logDefault, Error, cz::getWin32Error(dwRetVal, "GetAdaptersAddresses").c_str());
+		CZ_LOG(logDefault, Error, "%s", cz::getWin32Error(dwRetVal, "GetAdaptersAddresses").c_str());
 		return {};
 	}
 
@@ -9,22 +9,12 @@
 
 #include "czmucPCH.h"
 #include "crazygaze/muc/Parameters.h"
-#include "crazygaze/muc/StringUtils.h"
+#include "crazygaze/muc/UTF8Utils.h"
+#include <charconv>
 
 namespace cz
 {
 
-namespace
-{
-	bool isEqual(const UTF8String& a, const UTF8String& b, bool caseSensitive)
-	{
-		if (caseSensitive)
-			return a==b ? true : false;
-		else
-			return ci_equals(a.toUtf32(),b.toUtf32());
-	}
-}
-
 cz::UTF8String Parameters::ms_empty;
 Parameters::Parameters()
 {
@@ -44,11 +34,13 @@ void Parameters::set(int argc, char* argv[])
 		if (seperator==nullptr)
 		{
 			m_args.emplace_back(arg, "");
+			m_names.emplace_back(arg);
 		}
 		else
 		{
 			cz::UTF8String name(arg, seperator);
 			cz::UTF8String value(++seperator);
+			m_names.emplace_back(name.c_str(), name.sizeBytes());
 			m_args.emplace_back(std::move(name), std::move(value));
 		}
 	}
@@ -67,16 +59,42 @@ const Parameters::Param* Parameters::end() const
 	return begin() + m_args.size();
 }
 
-bool Parameters::has( const char* name, bool caseSensitive) const
+template<typename F>
+void Parameters::forEachMatch(const char* name, bool caseSensitive, F&& f) const
 {
-	for(auto &i: m_args)
+	if (caseSensitive)
 	{
-		if (isEqual(i.name, name, caseSensitive))
+		// Parameter names are interned, so if the name was never interned, there is no such parameter
+		InternedString key;
+		if (!InternedString::find(name, key))
+			return;
+		for (size_t i = 0; i < m_args.size(); i++)
 		{
-			return true;
+			if (m_names[i] == key && !f(m_args[i]))
+				return;
+		}
+	}
+	else
+	{
+		// Compares ASCII in bulk, and only decodes code points if there are non-ASCII differences
+		size_t nameSize = strlen(name);
+		for (auto &i: m_args)
+		{
+			if (utf8EqualsNoCase(i.name.c_str(), i.name.sizeBytes(), name, nameSize) && !f(i))
+				return;
 		}
 	}
-	return false;
+}
+
+bool Parameters::has( const char* name, bool caseSensitive) const
+{
+	bool found = false;
+	forEachMatch(name, caseSensitive, [&](const Param&)
+	{
+		found = true;
+		return false;
+	});
+	return found;
 }
 
 bool Parameters::has( const cz::UTF8String& name, bool caseSensitive ) const
@@ -86,26 +104,340 @@ bool Parameters::has( const cz::UTF8String& name, bool caseSensitive ) const
 
 const cz::UTF8String& Parameters::get( const char *name, bool caseSensitive) const
 {
-	for (auto &i: m_args)
+	const cz::UTF8String* res = &ms_empty;
+	forEachMatch(name, caseSensitive, [&](const Param& p)
 	{
-		if (isEqual(i.name, name, caseSensitive))
-			return i.value;
-	}
-	return ms_empty;
+		res = &p.value;
+		return false;
+	});
+	return *res;
 }
 
 const std::vector<UTF8String> Parameters::getMultiple(const char* name, bool caseSensitive) const
 {
 	std::vector<UTF8String> res;
-	for (auto &i: m_args)
+	forEachMatch(name, caseSensitive, [&](const Param& p)
+	{
+		res.push_back(p.value);
+		return true;
+	});
+	return res;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ParameterOption
+//////////////////////////////////////////////////////////////////////////
+
+ParameterOption& ParameterOption::setRange(double minVal, double maxVal)
+{
+	CZ_ASSERT(m_type != Type::Bool && m_type != Type::String && m_type != Type::StringList);
+	CZ_ASSERT(minVal <= maxVal);
+	m_hasRange = true;
+	m_min = minVal;
+	m_max = maxVal;
+	return *this;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ParameterSchemaBase
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+	bool parseBool(std::string_view str, bool& v)
 	{
-		if (isEqual(i.name, name, caseSensitive))
-			res.push_back(i.value);
+		// Just the name, without a value, is true
+		if (str.empty())
+		{
+			v = true;
+			return true;
+		}
+
+		for (const char* s : {"1", "true", "yes", "on"})
+		{
+			if (utf8EqualsNoCase(str.data(), str.size(), s, strlen(s)))
+			{
+				v = true;
+				return true;
+			}
+		}
+		for (const char* s : {"0", "false", "no", "off"})
+		{
+			if (utf8EqualsNoCase(str.data(), str.size(), s, strlen(s)))
+			{
+				v = false;
+				return true;
+			}
+		}
+		return false;
 	}
+
+	//! The whole string needs to be a number
+	template<typename N>
+	bool parseNumber(std::string_view str, N& v)
+	{
+		const char* begin = str.data();
+		const char* end = begin + str.size();
+		if (begin != end && *begin == '+')
+			begin++;
+		auto res = std::from_chars(begin, end, v);
+		return res.ec == std::errc() && res.ptr == end;
+	}
+
+	template<typename N>
+	void appendNumber(std::string& dst, N v)
+	{
+		char buf[32];
+		dst.append(buf, std::to_chars(buf, buf + sizeof(buf), v).ptr);
+	}
+}
+
+ParameterSchemaBase::ParameterSchemaBase(const char* description)
+	: m_description(description)
+{
+}
+
+std::string ParameterSchemaBase::normalize(std::string_view name) const
+{
+	std::string res(name);
+	if (!m_caseSensitive)
+		asciiToLower(res.data(), res.size(), res.data());
 	return res;
 }
 
-} // namespace cz
+void ParameterSchemaBase::setCaseSensitive(bool caseSensitive)
+{
+	m_caseSensitive = caseSensitive;
+	m_index.clear();
+	for (size_t i = 0; i < m_options.size(); i++)
+		m_index[normalize(m_options[i].m_name)] = i;
+}
+
+ParameterOption& ParameterSchemaBase::addOption(const char* name, ParameterOption::Type type, const char* help,
+                                                std::function<void*(void*)> field)
+{
+	bool inserted = m_index.emplace(normalize(name), m_options.size()).second;
+	CZ_ASSERT_F(inserted, "Option '%s' registered more than once", name);
+	(void)inserted;
+	m_options.emplace_back();
+	ParameterOption& opt = m_options.back();
+	opt.m_name = name;
+	opt.m_help = help;
+	opt.m_type = type;
+	opt.m_field = std::move(field);
+	return opt;
+}
+
+void ParameterSchemaBase::beginParse()
+{
+	m_error.clear();
+	m_used.assign(m_options.size(), false);
+}
+
+bool ParameterSchemaBase::parseOption(std::string_view name, std::string_view value, void* obj)
+{
+	auto it = m_index.find(normalize(name));
+	if (it == m_index.end())
+	{
+		if (m_allowUnknown)
+			return true;
+		m_error = "Unknown option '" + std::string(name) + "'";
+		return false;
+	}
+
+	ParameterOption& opt = m_options[it->second];
+	void* field = opt.m_field(obj);
+	bool firstUse = !m_used[it->second];
+	m_used[it->second] = true;
+
+	bool ok = true;
+	double number = 0;
+	switch (opt.m_type)
+	{
+	case ParameterOption::Type::Bool:
+		ok = parseBool(value, *static_cast<bool*>(field));
+		break;
+	case ParameterOption::Type::Int:
+		ok = parseNumber(value, *static_cast<int*>(field));
+		number = *static_cast<int*>(field);
+		break;
+	case ParameterOption::Type::Int64:
+		ok = parseNumber(value, *static_cast<int64_t*>(field));
+		number = static_cast<double>(*static_cast<int64_t*>(field));
+		break;
+	case ParameterOption::Type::Float:
+		ok = parseNumber(value, *static_cast<float*>(field));
+		number = *static_cast<float*>(field);
+		break;
+	case ParameterOption::Type::Double:
+		ok = parseNumber(value, *static_cast<double*>(field));
+		number = *static_cast<double*>(field);
+		break;
+	case ParameterOption::Type::String:
+		static_cast<std::string*>(field)->assign(value);
+		break;
+	case ParameterOption::Type::StringList:
+	{
+		// The defaults are replaced, not appended to
+		auto& list = *static_cast<std::vector<std::string>*>(field);
+		if (firstUse)
+			list.clear();
+		list.emplace_back(value);
+		break;
+	}
+	}
+
+	if (!ok)
+	{
+		m_error = "Invalid value '" + std::string(value) + "' for option '" + opt.m_name + "'";
+		return false;
+	}
+
+	if (opt.m_hasRange && (number < opt.m_min || number > opt.m_max))
+	{
+		m_error = "Value '" + std::string(value) + "' for option '" + opt.m_name + "' is out of range [";
+		appendNumber(m_error, opt.m_min);
+		m_error += ", ";
+		appendNumber(m_error, opt.m_max);
+		m_error += "]";
+		return false;
+	}
+
+	return true;
+}
+
+bool ParameterSchemaBase::endParse()
+{
+	for (size_t i = 0; i < m_options.size(); i++)
+	{
+		if (m_options[i].m_required && !m_used[i])
+		{
+			m_error = "Missing required option '" + m_options[i].m_name + "'";
+			return false;
+		}
+	}
+	return true;
+}
+
+bool ParameterSchemaBase::parseImpl(int argc, char* argv[], void* obj)
+{
+	beginParse();
+	for (int i = 1; i < argc; i++)
+	{
+		// Same syntax as Parameters::set
+		std::string_view arg = argv[i];
+		if (arg.size() && arg[0] == '-')
+			arg.remove_prefix(1);
 
+		size_t separator = arg.find('=');
+		bool ok = separator == std::string_view::npos
+		              ? parseOption(arg, std::string_view(), obj)
+		              : parseOption(arg.substr(0, separator), arg.substr(separator + 1), obj);
+		if (!ok)
+			return false;
+	}
+	return endParse();
+}
 
+bool ParameterSchemaBase::parseImpl(const Parameters& params, void* obj)
+{
+	beginParse();
+	for (auto&& p : params)
+	{
+		if (!parseOption(std::string_view(p.name.c_str(), p.name.sizeBytes()),
+		                 std::string_view(p.value.c_str(), p.value.sizeBytes()), obj))
+			return false;
+	}
+	return endParse();
+}
+
+std::string ParameterSchemaBase::getHelpImpl(const char* program, const void* defaults) const
+{
+	std::string res = "Usage: ";
+	res += program;
+	res += " [options]\n";
+	if (m_description.size())
+		res += m_description + "\n";
+	if (m_options.empty())
+		return res;
+	res += "\nOptions:\n";
+
+	// The option syntax goes on the left, with the descriptions aligned in a column
+	std::vector<std::string> syntax;
+	size_t width = 0;
+	for (auto&& opt : m_options)
+	{
+		std::string str = "  -" + opt.m_name;
+		if (opt.m_type != ParameterOption::Type::Bool)
+		{
+			static const char* typeNames[] = {"", "int", "int", "number", "number", "string", "string"};
+			str += "=<";
+			str += opt.m_valueName.size() ? opt.m_valueName.c_str() : typeNames[static_cast<int>(opt.m_type)];
+			str += ">";
+		}
+		width = std::max(width, str.size());
+		syntax.push_back(std::move(str));
+	}
 
+	void* obj = const_cast<void*>(defaults);
+	for (size_t i = 0; i < m_options.size(); i++)
+	{
+		const ParameterOption& opt = m_options[i];
+		res += syntax[i];
+		res.append(width - syntax[i].size() + 2, ' ');
+		res += opt.m_help;
+
+		std::string notes;
+		void* field = opt.m_field(obj);
+		switch (opt.m_type)
+		{
+		case ParameterOption::Type::Bool:
+			if (*static_cast<bool*>(field))
+				notes += "default: true";
+			break;
+		case ParameterOption::Type::Int:
+			notes += "default: ";
+			appendNumber(notes, *static_cast<int*>(field));
+			break;
+		case ParameterOption::Type::Int64:
+			notes += "default: ";
+			appendNumber(notes, *static_cast<int64_t*>(field));
+			break;
+		case ParameterOption::Type::Float:
+			notes += "default: ";
+			appendNumber(notes, *static_cast<float*>(field));
+			break;
+		case ParameterOption::Type::Double:
+			notes += "default: ";
+			appendNumber(notes, *static_cast<double*>(field));
+			break;
+		case ParameterOption::Type::String:
+			if (static_cast<std::string*>(field)->size())
+				notes += "default: \"" + *static_cast<std::string*>(field) + "\"";
+			break;
+		case ParameterOption::Type::StringList:
+			notes += "can be repeated";
+			break;
+		}
+
+		if (opt.m_hasRange)
+		{
+			if (notes.size())
+				notes += ", ";
+			notes += "range: ";
+			appendNumber(notes, opt.m_min);
+			notes += "..";
+			appendNumber(notes, opt.m_max);
+		}
+
+		if (opt.m_required)
+			notes = notes.size() ? "required, " + notes : "required";
+
+		if (notes.size())
+			res += (opt.m_help.size() ? " (" : "(") + notes + ")";
+		res += "\n";
+	}
+	return res;
+}
+
+} // namespace cz
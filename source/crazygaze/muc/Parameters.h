@@ -11,7 +11,11 @@
 
 #include "crazygaze/muc/czmuc.h"
 #include "crazygaze/muc/UTF8String.h"
+#include "crazygaze/muc/InternedString.h"
 #include <vector>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
 
 namespace cz
 {
@@ -37,11 +41,200 @@ public:
 	void clear()
 	{
 		m_args.clear();
+		m_names.clear();
 	}
 private:
+	//! Calls f(const Param&) for every parameter with the specified name
+	template<typename F>
+	void forEachMatch(const char* name, bool caseSensitive, F&& f) const;
+
 	static cz::UTF8String ms_empty;
 	std::vector<Param> m_args;
+	// Interned copy of each parameter name, for the case sensitive lookups.
+	// The number of parameters is bounded by the command line, so this doesn't grow the intern table much.
+	std::vector<InternedString> m_names;
 };
 
-} // namespace cz
+/*!
+Option registered in a ParameterSchema. Returned by ParameterSchema::add, so it can be configured further. E.g:
+	schema.add("port", &Options::port, "Port to listen on").setRange(1, 65535).setRequired();
+*/
+class ParameterOption
+{
+public:
+	enum class Type
+	{
+		Bool,
+		Int,
+		Int64,
+		Float,
+		Double,
+		String,
+		//! std::vector<std::string>, where the option can be used several times
+		StringList
+	};
+
+	//! Fails parsing if the option is not used
+	ParameterOption& setRequired(bool required = true)
+	{
+		m_required = required;
+		return *this;
+	}
+
+	//! Numeric options only. Fails parsing if the value is outside [minVal, maxVal]
+	ParameterOption& setRange(double minVal, double maxVal);
+
+	//! Name shown in the help for the value. E.g: "-port=<port>" instead of "-port=<int>"
+	ParameterOption& setValueName(const char* valueName)
+	{
+		m_valueName = valueName;
+		return *this;
+	}
+
+private:
+	friend class ParameterSchemaBase;
+	std::string m_name;
+	std::string m_help;
+	std::string m_valueName;
+	Type m_type;
+	bool m_required = false;
+	bool m_hasRange = false;
+	double m_min = 0;
+	double m_max = 0;
+	//! Given the object being filled, returns the field for this option
+	std::function<void*(void*)> m_field;
+};
+
+/*!
+Non template part of ParameterSchema
+*/
+class ParameterSchemaBase
+{
+public:
+	explicit ParameterSchemaBase(const char* description = "");
+
+	//! By default, option names are case insensitive (ASCII only), the same as Parameters::get
+	void setCaseSensitive(bool caseSensitive);
+
+	//! By default, unknown options fail the parsing
+	void setAllowUnknown(bool allowUnknown)
+	{
+		m_allowUnknown = allowUnknown;
+	}
+
+	//! Error from the last parse
+	const std::string& getError() const
+	{
+		return m_error;
+	}
+
+protected:
+	ParameterOption& addOption(const char* name, ParameterOption::Type type, const char* help,
+	                           std::function<void*(void*)> field);
+	bool parseImpl(int argc, char* argv[], void* obj);
+	bool parseImpl(const Parameters& params, void* obj);
+	std::string getHelpImpl(const char* program, const void* defaults) const;
+
+	template<typename M>
+	static constexpr ParameterOption::Type typeOf()
+	{
+		if constexpr (std::is_same_v<M, bool>)
+			return ParameterOption::Type::Bool;
+		else if constexpr (std::is_same_v<M, int>)
+			return ParameterOption::Type::Int;
+		else if constexpr (std::is_same_v<M, int64_t>)
+			return ParameterOption::Type::Int64;
+		else if constexpr (std::is_same_v<M, float>)
+			return ParameterOption::Type::Float;
+		else if constexpr (std::is_same_v<M, double>)
+			return ParameterOption::Type::Double;
+		else if constexpr (std::is_same_v<M, std::string>)
+			return ParameterOption::Type::String;
+		else
+		{
+			static_assert(std::is_same_v<M, std::vector<std::string>>, "Unsupported option type");
+			return ParameterOption::Type::StringList;
+		}
+	}
+
+private:
+	void beginParse();
+	bool parseOption(std::string_view name, std::string_view value, void* obj);
+	bool endParse();
+	std::string normalize(std::string_view name) const;
+
+	std::string m_description;
+	std::vector<ParameterOption> m_options;
+	// Option names (lower case if not case sensitive) to index in m_options
+	std::unordered_map<std::string, size_t> m_index;
+	// What options were used, during parsing
+	std::vector<bool> m_used;
+	std::string m_error;
+	bool m_caseSensitive = false;
+	bool m_allowUnknown = false;
+};
+
+/*!
+Declarative command line parsing into a struct.
+Options are registered once, with the struct field they map to, and parsing fills the struct, so after that, accessing
+the options is just accessing the fields, with no lookups. E.g:
+
+	struct Options
+	{
+		int port = 8080;
+		bool verbose = false;
+		std::vector<std::string> include;
+	};
+
+	ParameterSchema<Options> schema("My server");
+	schema.add("port", &Options::port, "Port to listen on").setRange(1, 65535);
+	schema.add("verbose", &Options::verbose, "Verbose logging");
+	schema.add("include", &Options::include, "Extra folders");
+	Options opts;
+	if (!schema.parse(argc, argv, opts))
+	{
+		printf("%s\n%s", schema.getError().c_str(), schema.getHelp(argv[0]).c_str());
+		return EXIT_FAILURE;
+	}
+
+The syntax is the same as Parameters: "-name=value", or just "-name" for a bool. The '-' is optional.
+The defaults are whatever values the struct has before parsing, and the help shows the values of a default constructed
+struct.
+Supported field types are bool, int, int64_t, float, double, std::string, and std::vector<std::string> for options
+that can be used more than once. For any other option, if used more than once, the last value is used.
+*/
+template<typename T>
+class ParameterSchema : public ParameterSchemaBase
+{
+public:
+	using ParameterSchemaBase::ParameterSchemaBase;
 
+	template<typename M>
+	ParameterOption& add(const char* name, M T::*member, const char* help = "")
+	{
+		return addOption(name, typeOf<M>(), help, [member](void* obj) -> void* {
+			return &(static_cast<T*>(obj)->*member);
+		});
+	}
+
+	//! Parses argv (ignoring argv[0]). If it fails, getError() has the reason
+	bool parse(int argc, char* argv[], T& out)
+	{
+		return parseImpl(argc, argv, &out);
+	}
+
+	//! Same as the argv version, but from already split parameters
+	bool parse(const Parameters& params, T& out)
+	{
+		return parseImpl(params, &out);
+	}
+
+	//! Help text with the description and all the options, with their types, defaults and constraints
+	std::string getHelp(const char* program) const
+	{
+		T defaults;
+		return getHelpImpl(program, &defaults);
+	}
+};
+
+} // namespace cz
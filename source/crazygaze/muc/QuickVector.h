@@ -1,5 +1,8 @@
 #pragma once
 #include <type_traits>
+#include <cstring>
+#include <cstddef>
+#include <new>
 #if defined(_MSC_VER)
 #else
 	#include <cstdlib>
@@ -32,6 +35,17 @@ namespace detail
 #endif
 	}
 
+	// size needs to be a multiple of alignment
+	inline void* alignedAlloc(size_t size, size_t alignment)
+	{
+		assert(is_powerof2(alignment) && (size % alignment) == 0);
+#if defined(_MSC_VER)
+		return _aligned_malloc(size, alignment);
+#else
+		return std::aligned_alloc(alignment, std::max(alignment, size));
+#endif
+	}
+
 	inline void alignedFree(void* ptr)
 	{
 #if defined(_MSC_VER)
@@ -50,17 +64,95 @@ namespace detail
 	struct is_iterator<T, std::void_t<typename std::iterator_traits<T>::iterator_category>> : std::true_type
 	{
 	};
+
+	template <class A, class = void>
+	struct has_reallocate : std::false_type
+	{
+	};
+
+	template <class A>
+	struct has_reallocate<A, std::void_t<decltype(std::declval<A&>().reallocate(nullptr, size_t(0), size_t(0), size_t(0)))>>
+		: std::true_type
+	{
+	};
 }
 
+/*
+Tells if objects of a type can be moved to a different memory location with a plain memcpy, instead of a move
+constructor followed by a destructor call.
+Trivially copyable types are always trivially relocatable, but this can be specialized for other types known to
+be safe. E.g: Types that only hold a std::unique_ptr.
+*/
+template<typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T>
+{
+};
+
+template<typename T>
+inline constexpr bool is_trivially_relocatable_v = is_trivially_relocatable<T>::value;
+
+/*
+Default QuickVector allocator, using the heap.
+
+Allocators need to provide:
+	void* allocate(size_t size, size_t alignment)
+	void deallocate(void* ptr, size_t size)
+	bool operator==(const Allocator& other) const
+		Two allocators compare equal if memory allocated by one can be deallocated by the other
+Optionally:
+	void* reallocate(void* ptr, size_t oldSize, size_t newSize, size_t alignment)
+		Used to grow the buffer of trivially relocatable types
+*/
+struct HeapAllocator
+{
+	void* allocate(size_t size, size_t alignment)
+	{
+		return detail::alignedAlloc(size, alignment);
+	}
+
+	void* reallocate(void* ptr, size_t oldSize, size_t newSize, size_t alignment)
+	{
+#if defined(_MSC_VER)
+		return _aligned_realloc(ptr, newSize, alignment);
+#else
+		if (alignment <= alignof(std::max_align_t))
+			return std::realloc(ptr, newSize);
+
+		// realloc doesn't keep any alignment above what malloc guarantees
+		void* newPtr = allocate(newSize, alignment);
+		if (newPtr)
+		{
+			::memcpy(newPtr, ptr, oldSize);
+			deallocate(ptr, oldSize);
+		}
+		return newPtr;
+#endif
+	}
+
+	void deallocate(void* ptr, size_t /*size*/)
+	{
+		detail::alignedFree(ptr);
+	}
+
+	bool operator==(const HeapAllocator&) const
+	{
+		return true;
+	}
+};
+
 /*
 Minimalistic vector class, which allocates N items on the stack before growing
 dynamically
 
 The limited interface it provides is compatible with std::vector
+
+The allocator is only used once the vector grows past N items.
+Copy/Move constructors copy the allocator of the source vector. Assignments keep the current allocator.
 */
-template<typename T, unsigned int N>
+template<typename T, unsigned int N, typename Allocator = HeapAllocator>
 //class alignas(alignof(T) > alignof(size_t) ? alignof(T) : alignof(size_t)) QuickVector
-class QuickVector
+// Inheriting from the allocator, so stateless allocators take no space
+class QuickVector : private Allocator
 {
 public:
 	using value_type = T;
@@ -69,8 +161,9 @@ public:
 	using const_iterator = const value_type*;
 	using reference = value_type & ;
 	using const_reference = const value_type&;
+	using allocator_type = Allocator;
 
-	template<typename T, unsigned int N>
+	template<typename TT, unsigned int NN, typename AA>
 	friend class QuickVector;
 
 	//////////////////////////////////////////////////////////////////////////
@@ -80,24 +173,33 @@ public:
 	{
 	}
 
+	explicit QuickVector(const Allocator& alloc)
+		: Allocator(alloc)
+	{
+	}
+
 	QuickVector(const QuickVector& other)
+		: Allocator(other.get_allocator())
 	{
 		copyFrom(other);
 	}
 
 	template<unsigned int NN>
-	QuickVector(const QuickVector<value_type, NN>& other)
+	QuickVector(const QuickVector<value_type, NN, Allocator>& other)
+		: Allocator(other.get_allocator())
 	{
 		copyFrom(other);
 	}
 
 	QuickVector(QuickVector&& other)
+		: Allocator(other.get_allocator())
 	{
 		moveFrom(std::move(other));
 	}
 
 	template<unsigned int NN>
-	QuickVector(QuickVector<value_type, NN>&& other)
+	QuickVector(QuickVector<value_type, NN, Allocator>&& other)
+		: Allocator(other.get_allocator())
 	{
 		moveFrom(std::move(other));
 	}
@@ -120,7 +222,7 @@ public:
 	}
 
 	template<unsigned int NN>
-	QuickVector& operator=(const QuickVector<value_type, NN>& other)
+	QuickVector& operator=(const QuickVector<value_type, NN, Allocator>& other)
 	{
 		copyFrom(other);
 		return *this;
@@ -133,12 +235,17 @@ public:
 	}
 
 	template<unsigned int NN>
-	QuickVector& operator=(QuickVector<value_type, NN>&& other)
+	QuickVector& operator=(QuickVector<value_type, NN, Allocator>&& other)
 	{
 		moveFrom(std::move(other));
 		return *this;
 	}
 
+	const Allocator& get_allocator() const noexcept
+	{
+		return *this;
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 	// Element access
 	//////////////////////////////////////////////////////////////////////////
@@ -350,6 +457,14 @@ public:
 		T* ptr = const_cast<iterator>(pos);
 		T* last = &back();
 
+		if constexpr (is_trivially_relocatable_v<T>)
+		{
+			ptr->~T();
+			::memmove((void*)ptr, ptr + 1, (last - ptr) * sizeof(T));
+			m_size--;
+			return ptr;
+		}
+
 		T* ret = ptr;
 		while (ptr != last)
 		{
@@ -378,6 +493,15 @@ public:
 		T* res = const_cast<iterator>(first);
 
 		T* endPtr = end();
+
+		if constexpr (is_trivially_relocatable_v<T>)
+		{
+			destroyRange(dst, src);
+			::memmove((void*)dst, src, (endPtr - src) * sizeof(T));
+			m_size -= last - first;
+			return res;
+		}
+
 		while (src != endPtr)
 		{
 			*dst = std::move(*src);
@@ -469,11 +593,12 @@ private:
 			}
 			else
 			{
-				if constexpr(std::is_trivial_v<T>)
+				if constexpr(is_trivially_relocatable_v<T>)
 				{
-					::memmove(const_cast<iterator>(pos + count), pos, todo * sizeof(T));
-					res.assignCount = count;
-					res.constructCount = 0;
+					// The slots are left as uninitialized memory
+					::memmove((void*)(pos + count), pos, todo * sizeof(T));
+					res.assignCount = 0;
+					res.constructCount = count;
 				}
 				else
 				{
@@ -544,9 +669,29 @@ private:
 		size_type newcapacity = m_capacity + count;
 		if (newcapacity <= N)
 			return;
-		m_capacity = newcapacity;
 
-		auto newbuf = detail::alignedAlloc<value_type>(m_capacity);
+		if constexpr (is_trivially_relocatable_v<T> && detail::has_reallocate<Allocator>::value)
+		{
+			// If we are already in the heap, the allocator might be able to grow the buffer in place
+			if (m_buf)
+			{
+				size_type emptySlotIdx = emptySlot ? emptySlot - begin() : 0;
+				auto newbuf = Allocator::reallocate(
+					m_buf, sizeof(value_type) * m_capacity, sizeof(value_type) * newcapacity, alignof(value_type));
+				if (!newbuf)
+					throw std::bad_alloc();
+				m_buf = reinterpret_cast<uint8_t*>(newbuf);
+				m_capacity = newcapacity;
+				if (emptySlot)
+				{
+					T* ptr = begin() + emptySlotIdx;
+					::memmove((void*)(ptr + emptySlotCount), ptr, (m_size - emptySlotIdx) * sizeof(T));
+				}
+				return;
+			}
+		}
+
+		auto newbuf = Allocator::allocate(sizeof(value_type) * newcapacity, alignof(value_type));
 		if (!newbuf)
 			throw std::bad_alloc();
 
@@ -564,10 +709,11 @@ private:
 
 		releaseBuffer<false>();
 		m_buf = reinterpret_cast<uint8_t*>(newbuf);
+		m_capacity = newcapacity;
 	}
 
 	template<unsigned int NN>
-	void copyFrom(const QuickVector<T, NN>& other)
+	void copyFrom(const QuickVector<T, NN, Allocator>& other)
 	{
 		if (m_size)
 			clear();
@@ -577,7 +723,7 @@ private:
 	}
 
 	template<unsigned int NN>
-	void moveFrom(QuickVector<T, NN>&& other)
+	void moveFrom(QuickVector<T, NN, Allocator>&& other)
 	{
 		if (m_size)
 			clear();
@@ -593,7 +739,8 @@ private:
 		}
 		else
 		{
-			if (other.m_buf)
+			// We can only steal the buffer if our allocator can release it
+			if (other.m_buf && get_allocator() == other.get_allocator())
 			{
 				releaseBuffer<true>();
 				m_capacity = other.m_capacity;
@@ -621,9 +768,10 @@ private:
 	static void moveConstruct(T* first, T* last, T* dst)
 	{
 		assert(dst < first || dst >= last);
-		if constexpr(std::is_trivial_v<T>)
+		// Relocating this way is only valid if we destroy the source elements
+		if constexpr(destroy && is_trivially_relocatable_v<T>)
 		{
-			::memcpy(dst, first, (last - first) * sizeof(T));
+			::memcpy((void*)dst, first, (last - first) * sizeof(T));
 		}
 		else
 		{
@@ -641,9 +789,9 @@ private:
 	static void copyConstruct(const T* first, const T* last, T* dst)
 	{
 		assert(dst < first || dst >= last);
-		if constexpr(std::is_trivial_v<T>)
+		if constexpr(std::is_trivially_copyable_v<T>)
 		{
-			::memcpy(dst, first, (last - first) * sizeof(T));
+			::memcpy((void*)dst, first, (last - first) * sizeof(T));
 		}
 		else
 		{
@@ -658,7 +806,7 @@ private:
 
 	static void destroyRange(T* first, T* last)
 	{
-		if constexpr(std::is_trivial_v<T>)
+		if constexpr(std::is_trivially_destructible_v<T>)
 		{
 			// Nothing to do
 			first = last; // Just to force VS to consider the parameters used
@@ -701,7 +849,7 @@ private:
 		assert(reset==false || m_size == 0);
 		if (m_buf)
 		{
-			detail::alignedFree(m_buf);
+			Allocator::deallocate(m_buf, sizeof(T) * m_capacity);
 			if constexpr(reset)
 			{
 				m_buf = nullptr;
@@ -43,10 +43,10 @@ public:
 		m_data_cond.notify_one();
 	}
 
-	template<typename T>
-	void push(T&& item){
+	template<typename U>
+	void push(U&& item){
 		std::lock_guard<std::mutex> lock(m_mtx);
-		m_queue.push(std::forward<T>(item));
+		m_queue.push(std::forward<U>(item));
 		m_data_cond.notify_one();
 	}
 
@@ -0,0 +1,598 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Structure-of-arrays container.
+	Each field is kept in its own aligned array, so loops that only touch a couple of fields don't waste cache
+	bandwidth loading the ones they don't need, and are easy for the compiler to vectorize.
+
+*********************************************************************/
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/ArrayView.h"
+#include "crazygaze/muc/QuickVector.h"
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <iterator>
+
+namespace cz
+{
+
+/*!
+Vector where each field of an element is stored in its own array (a column).
+
+Elements are accessed through proxy references (a std::tuple of references to each field), which work with
+structured bindings. Individual columns are accessed as an ArrayView, for tight loops.
+
+\code
+SoAVector<float, float, int> v;
+v.push_back(1.0f, 2.0f, 3);
+auto [x, y, id] = v[0];
+x += 1.0f;
+for (float& f : v.column<1>())
+	f *= 2;
+\endcode
+*/
+template<typename... Fields>
+class SoAVector
+{
+	static_assert(sizeof...(Fields) > 0, "SoAVector needs at least one field");
+
+	template<typename Container, typename Ref>
+	class Iterator;
+
+	// Tells if the arguments are one per field, and not a whole value_type
+	template<typename... Args>
+	static constexpr bool isFieldArgs()
+	{
+		if constexpr (sizeof...(Args) != sizeof...(Fields))
+			return false;
+		else if constexpr (sizeof...(Args) == 1)
+			return !std::is_same_v<std::decay_t<Args>..., std::tuple<Fields...>>;
+		else
+			return true;
+	}
+
+public:
+	using size_type = size_t;
+	using difference_type = ptrdiff_t;
+	using value_type = std::tuple<Fields...>;
+	using reference = std::tuple<Fields&...>;
+	using const_reference = std::tuple<const Fields&...>;
+	using iterator = Iterator<SoAVector, reference>;
+	using const_iterator = Iterator<const SoAVector, const_reference>;
+
+	template<size_t I>
+	using field_type = std::tuple_element_t<I, value_type>;
+
+	//! Alignment of each column. A cache line, which is also enough for any SIMD instruction set
+	static constexpr size_t Alignment = 64;
+
+	SoAVector() noexcept
+	{
+	}
+
+	SoAVector(const SoAVector& other)
+	{
+		reserve(other.m_size);
+		copyConstruct(other, std::index_sequence_for<Fields...>());
+		m_size = other.m_size;
+	}
+
+	SoAVector(SoAVector&& other) noexcept
+	{
+		swap(other);
+	}
+
+	~SoAVector()
+	{
+		clear();
+		freeColumns(std::index_sequence_for<Fields...>());
+	}
+
+	SoAVector& operator=(const SoAVector& other)
+	{
+		if (this != &other)
+		{
+			SoAVector tmp(other);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+	SoAVector& operator=(SoAVector&& other) noexcept
+	{
+		if (this != &other)
+		{
+			clear();
+			swap(other);
+		}
+		return *this;
+	}
+
+	void swap(SoAVector& other) noexcept
+	{
+		std::swap(m_columns, other.m_columns);
+		std::swap(m_size, other.m_size);
+		std::swap(m_capacity, other.m_capacity);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Element access
+	//////////////////////////////////////////////////////////////////////////
+
+	reference operator[](size_type idx)
+	{
+		assert(idx < m_size);
+		return makeRef<reference>(*this, idx, std::index_sequence_for<Fields...>());
+	}
+
+	const_reference operator[](size_type idx) const
+	{
+		assert(idx < m_size);
+		return makeRef<const_reference>(*this, idx, std::index_sequence_for<Fields...>());
+	}
+
+	reference front()
+	{
+		return (*this)[0];
+	}
+
+	const_reference front() const
+	{
+		return (*this)[0];
+	}
+
+	reference back()
+	{
+		return (*this)[m_size - 1];
+	}
+
+	const_reference back() const
+	{
+		return (*this)[m_size - 1];
+	}
+
+	//! Access a single field of an element
+	template<size_t I>
+	field_type<I>& get(size_type idx)
+	{
+		assert(idx < m_size);
+		return std::get<I>(m_columns)[idx];
+	}
+
+	template<size_t I>
+	const field_type<I>& get(size_type idx) const
+	{
+		assert(idx < m_size);
+		return std::get<I>(m_columns)[idx];
+	}
+
+	//! Pointer to the start of a column. Aligned to SoAVector::Alignment
+	template<size_t I>
+	field_type<I>* data() noexcept
+	{
+		return std::get<I>(m_columns);
+	}
+
+	template<size_t I>
+	const field_type<I>* data() const noexcept
+	{
+		return std::get<I>(m_columns);
+	}
+
+	//! View of all the values of a field
+	template<size_t I>
+	ArrayView<field_type<I>> column() noexcept
+	{
+		return ArrayView<field_type<I>>(std::get<I>(m_columns), m_size);
+	}
+
+	template<size_t I>
+	ArrayView<const field_type<I>> column() const noexcept
+	{
+		return ArrayView<const field_type<I>>(std::get<I>(m_columns), m_size);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Iterators
+	//////////////////////////////////////////////////////////////////////////
+
+	iterator begin() noexcept
+	{
+		return iterator(this, 0);
+	}
+
+	const_iterator begin() const noexcept
+	{
+		return const_iterator(this, 0);
+	}
+
+	iterator end() noexcept
+	{
+		return iterator(this, m_size);
+	}
+
+	const_iterator end() const noexcept
+	{
+		return const_iterator(this, m_size);
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Capacity
+	//////////////////////////////////////////////////////////////////////////
+
+	bool empty() const noexcept
+	{
+		return m_size == 0;
+	}
+
+	size_type size() const noexcept
+	{
+		return m_size;
+	}
+
+	size_type capacity() const noexcept
+	{
+		return m_capacity;
+	}
+
+	void reserve(size_type capacity)
+	{
+		if (capacity <= m_capacity)
+			return;
+		reallocate(capacity, std::index_sequence_for<Fields...>());
+	}
+
+	//////////////////////////////////////////////////////////////////////////
+	// Modifiers
+	//////////////////////////////////////////////////////////////////////////
+
+	void clear() noexcept
+	{
+		destroyRange(0, m_size, std::index_sequence_for<Fields...>());
+		m_size = 0;
+	}
+
+	//! Adds an element, constructing each field with the respective argument
+	template<typename... Args, typename = std::enable_if_t<isFieldArgs<Args...>()>>
+	void push_back(Args&&... args)
+	{
+		if (m_size == m_capacity)
+		{
+			// The arguments might be references to our own elements, so we need to copy them before growing
+			value_type tmp(std::forward<Args>(args)...);
+			reserve(m_capacity ? m_capacity * 2 : 16);
+			constructFromTuple(m_size, std::move(tmp), std::index_sequence_for<Fields...>());
+		}
+		else
+		{
+			construct(m_size, std::index_sequence_for<Fields...>(), std::forward<Args>(args)...);
+		}
+		m_size++;
+	}
+
+	void push_back(const value_type& value)
+	{
+		std::apply([this](const Fields&... fields) { push_back(fields...); }, value);
+	}
+
+	void push_back(value_type&& value)
+	{
+		std::apply([this](Fields&... fields) { push_back(std::move(fields)...); }, value);
+	}
+
+	void pop_back()
+	{
+		assert(m_size);
+		destroyRange(m_size - 1, m_size, std::index_sequence_for<Fields...>());
+		m_size--;
+	}
+
+	//! Resizes the container, value-initializing any new elements
+	void resize(size_type count)
+	{
+		if (count < m_size)
+		{
+			destroyRange(count, m_size, std::index_sequence_for<Fields...>());
+			m_size = count;
+		}
+		else
+		{
+			reserve(count);
+			while (m_size < count)
+				push_back(Fields()...);
+		}
+	}
+
+	//! Removes an element, keeping the order of the remaining elements
+	//! \return Index of the element that followed the removed one
+	size_type erase(size_type idx)
+	{
+		return erase(idx, idx + 1);
+	}
+
+	//! Removes the elements in [first, last), keeping the order of the remaining elements
+	//! \return Index of the element that followed the removed ones
+	size_type erase(size_type first, size_type last)
+	{
+		assert(first <= last && last <= m_size);
+		if (first == last)
+			return first;
+		eraseImpl(first, last, std::index_sequence_for<Fields...>());
+		m_size -= last - first;
+		return first;
+	}
+
+	iterator erase(const_iterator pos)
+	{
+		return begin() + erase(pos.index());
+	}
+
+	iterator erase(const_iterator first, const_iterator last)
+	{
+		return begin() + erase(first.index(), last.index());
+	}
+
+	/*!
+	Removes an element by moving the last element into its place.
+	This is O(1), but doesn't keep the order of the elements
+	*/
+	void erase_unordered(size_type idx)
+	{
+		assert(idx < m_size);
+		if (idx != m_size - 1)
+			moveAssign(idx, m_size - 1, std::index_sequence_for<Fields...>());
+		pop_back();
+	}
+
+private:
+
+	template<typename Container, typename Ref>
+	class Iterator
+	{
+	public:
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = typename SoAVector::value_type;
+		using difference_type = ptrdiff_t;
+		using reference = Ref;
+		using pointer = void;
+
+		Iterator() = default;
+		Iterator(Container* owner, size_type idx)
+			: m_owner(owner)
+			, m_idx(idx)
+		{
+		}
+
+		// Allow iterator -> const_iterator conversion
+		template<typename C, typename R, typename = std::enable_if_t<!std::is_same_v<C, Container>>>
+		Iterator(const Iterator<C, R>& other)
+			: m_owner(other.m_owner)
+			, m_idx(other.m_idx)
+		{
+		}
+
+		size_type index() const
+		{
+			return m_idx;
+		}
+
+		Ref operator*() const
+		{
+			return (*m_owner)[m_idx];
+		}
+
+		Ref operator[](difference_type n) const
+		{
+			return (*m_owner)[m_idx + n];
+		}
+
+		Iterator& operator++()
+		{
+			++m_idx;
+			return *this;
+		}
+
+		Iterator operator++(int)
+		{
+			Iterator tmp(*this);
+			++m_idx;
+			return tmp;
+		}
+
+		Iterator& operator--()
+		{
+			--m_idx;
+			return *this;
+		}
+
+		Iterator operator--(int)
+		{
+			Iterator tmp(*this);
+			--m_idx;
+			return tmp;
+		}
+
+		Iterator& operator+=(difference_type n)
+		{
+			m_idx += n;
+			return *this;
+		}
+
+		Iterator& operator-=(difference_type n)
+		{
+			m_idx -= n;
+			return *this;
+		}
+
+		Iterator operator+(difference_type n) const
+		{
+			return Iterator(m_owner, m_idx + n);
+		}
+
+		Iterator operator-(difference_type n) const
+		{
+			return Iterator(m_owner, m_idx - n);
+		}
+
+		difference_type operator-(const Iterator& other) const
+		{
+			return difference_type(m_idx) - difference_type(other.m_idx);
+		}
+
+		bool operator==(const Iterator& other) const
+		{
+			return m_idx == other.m_idx;
+		}
+
+		bool operator!=(const Iterator& other) const
+		{
+			return m_idx != other.m_idx;
+		}
+
+		bool operator<(const Iterator& other) const
+		{
+			return m_idx < other.m_idx;
+		}
+
+	private:
+		template<typename C, typename R>
+		friend class Iterator;
+
+		Container* m_owner = nullptr;
+		size_type m_idx = 0;
+	};
+
+	template<typename Ref, typename Self, size_t... Is>
+	static Ref makeRef(Self& self, size_type idx, std::index_sequence<Is...>)
+	{
+		return Ref(std::get<Is>(self.m_columns)[idx]...);
+	}
+
+	template<typename T>
+	static T* allocColumn(size_type count)
+	{
+		// The aligned allocation size needs to be a multiple of the alignment
+		size_t bytes = (sizeof(T) * count + Alignment - 1) & ~(Alignment - 1);
+		void* ptr = detail::alignedAlloc(bytes, std::max(Alignment, alignof(T)));
+		if (!ptr)
+			throw std::bad_alloc();
+		return reinterpret_cast<T*>(ptr);
+	}
+
+	template<size_t... Is>
+	void freeColumns(std::index_sequence<Is...>) noexcept
+	{
+		((std::get<Is>(m_columns) ? detail::alignedFree(std::get<Is>(m_columns)) : void()), ...);
+	}
+
+	template<size_t... Is>
+	void reallocate(size_type capacity, std::index_sequence<Is...>)
+	{
+		// If any of the allocations fail, the columns already reallocated are left with more capacity than
+		// m_capacity, which is harmless
+		(reallocateColumn<Is>(capacity), ...);
+		m_capacity = capacity;
+	}
+
+	template<size_t I>
+	void reallocateColumn(size_type capacity)
+	{
+		using T = field_type<I>;
+		T*& col = std::get<I>(m_columns);
+		T* newCol = allocColumn<T>(capacity);
+		if (col)
+		{
+			if constexpr (is_trivially_relocatable_v<T>)
+			{
+				::memcpy((void*)newCol, col, m_size * sizeof(T));
+			}
+			else
+			{
+				for (size_type i = 0; i < m_size; i++)
+				{
+					::new((void*)(newCol + i)) T(std::move_if_noexcept(col[i]));
+					col[i].~T();
+				}
+			}
+			detail::alignedFree(col);
+		}
+		col = newCol;
+	}
+
+	template<size_t... Is, typename... Args>
+	void construct(size_type idx, std::index_sequence<Is...>, Args&&... args)
+	{
+		(::new((void*)(std::get<Is>(m_columns) + idx)) Fields(std::forward<Args>(args)), ...);
+	}
+
+	template<size_t... Is>
+	void constructFromTuple(size_type idx, value_type&& value, std::index_sequence<Is...>)
+	{
+		(::new((void*)(std::get<Is>(m_columns) + idx)) Fields(std::move(std::get<Is>(value))), ...);
+	}
+
+	template<size_t... Is>
+	void copyConstruct(const SoAVector& other, std::index_sequence<Is...>)
+	{
+		for (size_type i = 0; i < other.m_size; i++)
+			construct(i, std::index_sequence<Is...>(), std::get<Is>(other.m_columns)[i]...);
+	}
+
+	template<size_t... Is>
+	void moveAssign(size_type dst, size_type src, std::index_sequence<Is...>)
+	{
+		((std::get<Is>(m_columns)[dst] = std::move(std::get<Is>(m_columns)[src])), ...);
+	}
+
+	template<size_t... Is>
+	void destroyRange(size_type first, size_type last, std::index_sequence<Is...>) noexcept
+	{
+		(destroyColumnRange(std::get<Is>(m_columns), first, last), ...);
+	}
+
+	template<typename T>
+	static void destroyColumnRange(T* col, size_type first, size_type last) noexcept
+	{
+		if constexpr (!std::is_trivially_destructible_v<T>)
+		{
+			for (size_type i = first; i < last; i++)
+				col[i].~T();
+		}
+	}
+
+	template<size_t... Is>
+	void eraseImpl(size_type first, size_type last, std::index_sequence<Is...>)
+	{
+		(eraseColumn(std::get<Is>(m_columns), first, last), ...);
+	}
+
+	template<typename T>
+	void eraseColumn(T* col, size_type first, size_type last)
+	{
+		if constexpr (is_trivially_relocatable_v<T>)
+		{
+			destroyColumnRange(col, first, last);
+			::memmove((void*)(col + first), col + last, (m_size - last) * sizeof(T));
+		}
+		else
+		{
+			T* dst = col + first;
+			for (size_type i = last; i < m_size; i++)
+				*dst++ = std::move(col[i]);
+			destroyColumnRange(col, m_size - (last - first), m_size);
+		}
+	}
+
+	std::tuple<Fields*...> m_columns;
+	size_type m_size = 0;
+	size_type m_capacity = 0;
+};
+
+} // namespace cz
+
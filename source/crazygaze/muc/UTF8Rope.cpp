@@ -0,0 +1,465 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/UTF8Rope.h"
+#include "crazygaze/muc/UTF8Utils.h"
+#include "crazygaze/muc/detail/utfcpp/source/utf8.h"
+
+namespace cz
+{
+
+namespace
+{
+	inline bool isContinuation(char c)
+	{
+		return (c & 0xC0) == 0x80;
+	}
+
+	// Byte offset of the specified code point
+	size_t byteOffset(const std::string& text, size_t pos)
+	{
+		const char* ptr = text.c_str();
+		while (pos--)
+		{
+			++ptr;
+			while (isContinuation(*ptr))
+				++ptr;
+		}
+		return ptr - text.c_str();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Tree operations
+//////////////////////////////////////////////////////////////////////////
+
+UTF8Rope::NodePtr UTF8Rope::makeLeaf(const char* start, const char* end, size_t codePoints)
+{
+	CZ_ASSERT(end > start);
+	auto node = std::make_shared<Node>();
+	node->text.assign(start, end);
+	node->bytes = end - start;
+	node->codePoints = codePoints;
+	return node;
+}
+
+UTF8Rope::NodePtr UTF8Rope::makeNode(NodePtr left, NodePtr right)
+{
+	auto node = std::make_shared<Node>();
+	node->bytes = left->bytes + right->bytes;
+	node->codePoints = left->codePoints + right->codePoints;
+	node->height = 1 + std::max(left->height, right->height);
+	node->left = std::move(left);
+	node->right = std::move(right);
+	return node;
+}
+
+UTF8Rope::NodePtr UTF8Rope::build(const char* start, const char* end)
+{
+	std::vector<NodePtr> leaves;
+	while (start < end)
+	{
+		const char* cut = (size_t(end - start) <= CHUNK_SIZE) ? end : start + CHUNK_SIZE;
+		// Don't split code points
+		while (cut > start && cut < end && isContinuation(*cut))
+			--cut;
+		if (cut == start) // Not valid UTF-8, so just cut anywhere
+			cut = start + CHUNK_SIZE;
+		leaves.push_back(makeLeaf(start, cut, utf8CountCodePoints(start, cut - start)));
+		start = cut;
+	}
+	return buildBalanced(leaves, 0, leaves.size());
+}
+
+UTF8Rope::NodePtr UTF8Rope::buildBalanced(const std::vector<NodePtr>& leaves, size_t first, size_t last)
+{
+	if (first == last)
+		return nullptr;
+	if (last - first == 1)
+		return leaves[first];
+	size_t middle = first + (last - first) / 2;
+	return makeNode(buildBalanced(leaves, first, middle), buildBalanced(leaves, middle, last));
+}
+
+// Creates a node from two subtrees whose heights differ by 2 at most
+UTF8Rope::NodePtr UTF8Rope::balance(NodePtr left, NodePtr right)
+{
+	int hl = height(left);
+	int hr = height(right);
+	if (hl > hr + 1)
+	{
+		if (height(left->left) >= height(left->right))
+		{
+			return makeNode(left->left, makeNode(left->right, std::move(right)));
+		}
+		else
+		{
+			const Node& lr = *left->right;
+			return makeNode(makeNode(left->left, lr.left), makeNode(lr.right, std::move(right)));
+		}
+	}
+	else if (hr > hl + 1)
+	{
+		if (height(right->right) >= height(right->left))
+		{
+			return makeNode(makeNode(std::move(left), right->left), right->right);
+		}
+		else
+		{
+			const Node& rl = *right->left;
+			return makeNode(makeNode(std::move(left), rl.left), makeNode(rl.right, right->right));
+		}
+	}
+	else
+	{
+		return makeNode(std::move(left), std::move(right));
+	}
+}
+
+UTF8Rope::NodePtr UTF8Rope::join(NodePtr left, NodePtr right)
+{
+	if (!left)
+		return right;
+	if (!right)
+		return left;
+
+	if (left->isLeaf() && right->isLeaf())
+	{
+		// Merge small chunks, so lots of small edits don't fragment the rope
+		if (left->bytes + right->bytes <= CHUNK_SIZE)
+		{
+			auto node = std::make_shared<Node>();
+			node->text.reserve(left->bytes + right->bytes);
+			node->text.append(left->text).append(right->text);
+			node->bytes = left->bytes + right->bytes;
+			node->codePoints = left->codePoints + right->codePoints;
+			return node;
+		}
+		return makeNode(std::move(left), std::move(right));
+	}
+
+	// If one of the sides is a leaf, we go all the way down to the other side's closest leaf, so we can try to
+	// merge them
+	int hl = height(left);
+	int hr = height(right);
+	if (hl > hr + 1 || (hr == 0))
+		return balance(left->left, join(left->right, std::move(right)));
+	else if (hr > hl + 1 || (hl == 0))
+		return balance(join(std::move(left), right->left), right->right);
+	else
+		return makeNode(std::move(left), std::move(right));
+}
+
+std::pair<UTF8Rope::NodePtr, UTF8Rope::NodePtr> UTF8Rope::split(const NodePtr& node, size_t pos)
+{
+	if (!node)
+		return {};
+	if (pos == 0)
+		return {nullptr, node};
+	if (pos >= node->codePoints)
+		return {node, nullptr};
+
+	if (node->isLeaf())
+	{
+		const char* str = node->text.c_str();
+		size_t offset = byteOffset(node->text, pos);
+		return {makeLeaf(str, str + offset, pos), makeLeaf(str + offset, str + node->bytes, node->codePoints - pos)};
+	}
+
+	if (pos <= node->left->codePoints)
+	{
+		auto [a, b] = split(node->left, pos);
+		return {std::move(a), join(std::move(b), node->right)};
+	}
+	else
+	{
+		auto [a, b] = split(node->right, pos - node->left->codePoints);
+		return {join(node->left, std::move(a)), std::move(b)};
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// UTF8Rope
+//////////////////////////////////////////////////////////////////////////
+
+UTF8Rope::UTF8Rope()
+{
+}
+
+UTF8Rope::UTF8Rope(const char* str)
+	: m_root(build(str, str + strlen(str)))
+{
+}
+
+UTF8Rope::UTF8Rope(const char* start, const char* end)
+	: m_root(build(start, end))
+{
+}
+
+UTF8Rope::UTF8Rope(const UTF8String& str)
+	: m_root(build(str.begin().ptr(), str.end().ptr()))
+{
+}
+
+size_t UTF8Rope::size() const
+{
+	return m_root ? m_root->codePoints : 0;
+}
+
+size_t UTF8Rope::sizeBytes() const
+{
+	return m_root ? m_root->bytes : 0;
+}
+
+void UTF8Rope::clear()
+{
+	m_root.reset();
+}
+
+int UTF8Rope::depth() const
+{
+	return height(m_root) + 1;
+}
+
+void UTF8Rope::checkPos(size_t pos, const char* func) const
+{
+	if (pos > size())
+		throw std::out_of_range(func);
+}
+
+UTF8Rope& UTF8Rope::append(const char* start, const char* end)
+{
+	m_root = join(std::move(m_root), build(start, end));
+	return *this;
+}
+
+UTF8Rope& UTF8Rope::append(const char* str)
+{
+	return append(str, str + strlen(str));
+}
+
+UTF8Rope& UTF8Rope::append(const UTF8String& str)
+{
+	return append(str.begin().ptr(), str.end().ptr());
+}
+
+UTF8Rope& UTF8Rope::append(const UTF8Rope& other)
+{
+	// other can be ourselves
+	NodePtr tmp = other.m_root;
+	m_root = join(std::move(m_root), std::move(tmp));
+	return *this;
+}
+
+UTF8Rope& UTF8Rope::insert(size_t pos, const UTF8Rope& str)
+{
+	checkPos(pos, "UTF8Rope::insert");
+	auto [a, b] = split(m_root, pos);
+	m_root = join(join(std::move(a), str.m_root), std::move(b));
+	return *this;
+}
+
+UTF8Rope& UTF8Rope::insert(size_t pos, const char* str)
+{
+	return insert(pos, UTF8Rope(str));
+}
+
+UTF8Rope& UTF8Rope::insert(size_t pos, const UTF8String& str)
+{
+	return insert(pos, UTF8Rope(str));
+}
+
+UTF8Rope& UTF8Rope::erase(size_t pos, size_t len)
+{
+	checkPos(pos, "UTF8Rope::erase");
+	auto [a, rest] = split(m_root, pos);
+	auto [b, c] = split(rest, len);
+	m_root = join(std::move(a), std::move(c));
+	return *this;
+}
+
+UTF8Rope UTF8Rope::substr(size_t pos, size_t len) const
+{
+	checkPos(pos, "UTF8Rope::substr");
+	UTF8Rope res;
+	auto [a, rest] = split(m_root, pos);
+	res.m_root = split(rest, len).first;
+	return res;
+}
+
+uint32_t UTF8Rope::at(size_t pos) const
+{
+	if (pos >= size())
+		throw std::out_of_range("UTF8Rope::at");
+	return *iteratorAt(pos);
+}
+
+UTF8String UTF8Rope::toString() const
+{
+	UTF8String res;
+	res.reserveBytes(static_cast<int>(sizeBytes()));
+	forEachChunk([&res](const char* data, size_t bytes) { res.append(data, data + bytes); });
+	return res;
+}
+
+UTF8Rope::Iterator UTF8Rope::begin() const
+{
+	return iteratorAt(0);
+}
+
+UTF8Rope::Iterator UTF8Rope::end() const
+{
+	return iteratorAt(size());
+}
+
+UTF8Rope::Iterator UTF8Rope::iteratorAt(size_t pos) const
+{
+	checkPos(pos, "UTF8Rope::iteratorAt");
+	Iterator it;
+	if (!m_root)
+		return it;
+
+	// The end iterator points to the end of the last leaf
+	bool isEnd = pos == m_root->codePoints;
+	if (isEnd)
+		pos--;
+
+	const Node* node = m_root.get();
+	it.m_path.push_back({node, false});
+	while (!node->isLeaf())
+	{
+		if (pos < node->left->codePoints)
+		{
+			node = node->left.get();
+			it.m_path.push_back({node, false});
+		}
+		else
+		{
+			pos -= node->left->codePoints;
+			node = node->right.get();
+			it.m_path.push_back({node, true});
+		}
+	}
+
+	it.m_offset = isEnd ? node->bytes : byteOffset(node->text, pos);
+	return it;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// UTF8Rope::Iterator
+//////////////////////////////////////////////////////////////////////////
+
+uint32_t UTF8Rope::Iterator::operator*() const
+{
+	const char* ptr = leaf()->text.c_str() + m_offset;
+	return utf8::unchecked::next(ptr);
+}
+
+bool UTF8Rope::Iterator::operator==(const Iterator& rhs) const
+{
+	if (leaf() != rhs.leaf() || m_offset != rhs.m_offset)
+		return false;
+	// Since nodes can be shared, the same leaf can show up in different positions of the rope, so we need to
+	// compare the paths too
+	if (m_path.size() != rhs.m_path.size())
+		return false;
+	for (size_t i = 0; i < m_path.size(); i++)
+	{
+		if (m_path[i].node != rhs.m_path[i].node || m_path[i].right != rhs.m_path[i].right)
+			return false;
+	}
+	return true;
+}
+
+bool UTF8Rope::Iterator::nextLeaf()
+{
+	// Climb until we find an ancestor where we came from the left
+	size_t i = m_path.size() - 1;
+	while (i > 0 && m_path[i].right)
+		i--;
+	if (i == 0)
+		return false;
+
+	const Node* node = m_path[i - 1].node->right.get();
+	m_path.resize(i);
+	m_path.push_back({node, true});
+	while (!node->isLeaf())
+	{
+		node = node->left.get();
+		m_path.push_back({node, false});
+	}
+	m_offset = 0;
+	return true;
+}
+
+bool UTF8Rope::Iterator::previousLeaf()
+{
+	size_t i = m_path.size() - 1;
+	while (i > 0 && !m_path[i].right)
+		i--;
+	if (i == 0)
+		return false;
+
+	const Node* node = m_path[i - 1].node->left.get();
+	m_path.resize(i);
+	m_path.push_back({node, false});
+	while (!node->isLeaf())
+	{
+		node = node->right.get();
+		m_path.push_back({node, true});
+	}
+	m_offset = node->bytes;
+	return true;
+}
+
+UTF8Rope::Iterator& UTF8Rope::Iterator::operator++()
+{
+	const std::string& text = leaf()->text;
+	CZ_ASSERT(m_offset < text.size());
+	++m_offset;
+	while (m_offset < text.size() && isContinuation(text[m_offset]))
+		++m_offset;
+	// Only the end iterator can point to the end of a leaf
+	if (m_offset == text.size())
+		nextLeaf();
+	return *this;
+}
+
+UTF8Rope::Iterator UTF8Rope::Iterator::operator++(int)
+{
+	Iterator tmp = *this;
+	++(*this);
+	return tmp;
+}
+
+UTF8Rope::Iterator& UTF8Rope::Iterator::operator--()
+{
+	if (m_offset == 0)
+	{
+		bool res = previousLeaf();
+		CZ_ASSERT(res);
+		(void)res;
+	}
+	const std::string& text = leaf()->text;
+	--m_offset;
+	while (m_offset > 0 && isContinuation(text[m_offset]))
+		--m_offset;
+	return *this;
+}
+
+UTF8Rope::Iterator UTF8Rope::Iterator::operator--(int)
+{
+	Iterator tmp = *this;
+	--(*this);
+	return tmp;
+}
+
+} // namespace cz
+
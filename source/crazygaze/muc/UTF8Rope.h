@@ -0,0 +1,222 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Rope for big UTF-8 texts that are edited a lot.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+#include "crazygaze/muc/UTF8String.h"
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <ostream>
+
+namespace cz
+{
+
+/*! \addtogroup String handling
+	@{
+*/
+
+/*! UTF-8 rope.
+Text is kept in chunks of up to CHUNK_SIZE bytes, in the leaves of a balanced (AVL) tree, where every node caches
+the byte and code point counts of its subtree.
+This makes insert, erase, substr and random access O(log n), instead of having to copy the whole text like with
+UTF8String.
+
+Nodes are immutable and shared, so copies and substrings are cheap, and only the path to the modified leaves is
+recreated on changes.
+
+All positions and lengths are in characters (code points), like in UTF8String.
+*/
+class UTF8Rope
+{
+private:
+	struct Node;
+	using NodePtr = std::shared_ptr<const Node>;
+
+public:
+
+	//! Maximum size of each chunk, in bytes
+	static constexpr size_t CHUNK_SIZE = 1024;
+	static constexpr size_t npos = size_t(-1);
+
+	/*! Bidirectional iterator over the characters of the rope.
+	It has the same interface as UTF8String::Iterator, so it can be used in the same way with STL algorithms.
+	The rope must not be changed while iterating.
+	*/
+	class Iterator
+	{
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type = uint32_t;
+		using difference_type = std::ptrdiff_t;
+		using pointer = uint32_t*;
+		using reference = uint32_t;
+
+		Iterator() {}
+
+		uint32_t operator*() const;
+		bool operator==(const Iterator& rhs) const;
+		bool operator!=(const Iterator& rhs) const
+		{
+			return !(*this == rhs);
+		}
+		Iterator& operator++();
+		Iterator operator++(int);
+		Iterator& operator--();
+		Iterator operator--(int);
+
+	private:
+		friend class UTF8Rope;
+
+		struct Step
+		{
+			const Node* node;
+			bool right; // If this node is the right child of the previous step
+		};
+
+		const Node* leaf() const
+		{
+			return m_path.empty() ? nullptr : m_path.back().node;
+		}
+		bool nextLeaf();
+		bool previousLeaf();
+
+		// Path from the root to the current leaf
+		std::vector<Step> m_path;
+		// Byte offset in the current leaf
+		size_t m_offset = 0;
+	};
+
+	using iterator = Iterator;
+	using const_iterator = Iterator;
+
+	UTF8Rope();
+	UTF8Rope(const char* str);
+	UTF8Rope(const char* start, const char* end);
+	UTF8Rope(const UTF8String& str);
+
+	//! Size in characters (code points)
+	size_t size() const;
+	//! Size in bytes
+	size_t sizeBytes() const;
+	bool empty() const
+	{
+		return !m_root;
+	}
+	void clear();
+
+	UTF8Rope& append(const char* start, const char* end);
+	UTF8Rope& append(const char* str);
+	UTF8Rope& append(const UTF8String& str);
+	UTF8Rope& append(const UTF8Rope& other);
+
+	template<typename T>
+	UTF8Rope& operator+=(const T& other)
+	{
+		return append(other);
+	}
+
+	//! Inserts text at the specified character position. Throws std::out_of_range if pos > size()
+	UTF8Rope& insert(size_t pos, const UTF8Rope& str);
+	UTF8Rope& insert(size_t pos, const char* str);
+	UTF8Rope& insert(size_t pos, const UTF8String& str);
+
+	//! Erases [pos, pos+len). Throws std::out_of_range if pos > size()
+	UTF8Rope& erase(size_t pos, size_t len = npos);
+
+	//! Returns [pos, pos+len), sharing the data with this rope. Throws std::out_of_range if pos > size()
+	UTF8Rope substr(size_t pos, size_t len = npos) const;
+
+	//! Returns the character at the specified position. Throws std::out_of_range if pos >= size()
+	uint32_t at(size_t pos) const;
+
+	Iterator begin() const;
+	Iterator end() const;
+	//! Iterator to the specified character position
+	Iterator iteratorAt(size_t pos) const;
+
+	//! Flattens the rope into a string
+	UTF8String toString() const;
+
+	//! Calls f(const char* data, size_t bytes) for every chunk, in order
+	template<typename F>
+	void forEachChunk(F&& f) const
+	{
+		forEachChunkImpl(m_root.get(), f);
+	}
+
+	//! Height of the tree. Only useful for diagnostics
+	int depth() const;
+
+private:
+
+	struct Node
+	{
+		NodePtr left;
+		NodePtr right;
+		std::string text; // Only used by leaves
+		size_t bytes = 0;
+		size_t codePoints = 0;
+		int height = 0; // Leaves have height 0
+
+		bool isLeaf() const
+		{
+			return !left;
+		}
+	};
+
+	template<typename F>
+	static void forEachChunkImpl(const Node* node, F& f)
+	{
+		if (!node)
+			return;
+		if (node->isLeaf())
+		{
+			f(node->text.data(), node->text.size());
+		}
+		else
+		{
+			forEachChunkImpl(node->left.get(), f);
+			forEachChunkImpl(node->right.get(), f);
+		}
+	}
+
+	static int height(const NodePtr& node)
+	{
+		return node ? node->height : -1;
+	}
+
+	static NodePtr makeLeaf(const char* start, const char* end, size_t codePoints);
+	static NodePtr makeNode(NodePtr left, NodePtr right);
+	static NodePtr build(const char* start, const char* end);
+	static NodePtr buildBalanced(const std::vector<NodePtr>& leaves, size_t first, size_t last);
+	static NodePtr balance(NodePtr left, NodePtr right);
+	static NodePtr join(NodePtr left, NodePtr right);
+	static std::pair<NodePtr, NodePtr> split(const NodePtr& node, size_t pos);
+
+	void checkPos(size_t pos, const char* func) const;
+
+	NodePtr m_root;
+};
+
+template <class traits>
+std::basic_ostream<char, traits>& operator<<(std::basic_ostream<char, traits>& os, const UTF8Rope& rope)
+{
+	rope.forEachChunk([&os](const char* data, size_t bytes) { os.write(data, bytes); });
+	return os;
+}
+
+/*!
+	@}
+*/
+
+} // namespace cz
+
@@ -13,6 +13,7 @@
 
 #include "czmucPCH.h"
 #include "crazygaze/muc/UTF8String.h"
+#include "crazygaze/muc/UTF8Utils.h"
 #include "crazygaze/muc/detail/utfcpp/source/utf8.h"
 
 namespace cz
@@ -25,45 +26,77 @@ namespace cz
 	const size_t UTF8String::npos = -1;
 	const char* UTF8String::msEmptyString = "";
 
-	int UTF8String::_cmp(const char* a, const char* b)
+	namespace
 	{
-		utf8::uint32_t c1, c2;
-		while(*a && *b)
+		// Skips the specified number of code points. Assumes there are enough code points
+		inline const char* skipCodePoints(const char* ptr, size_t count)
 		{
-			c1 = utf8::unchecked::next(a);
-			c2 = utf8::unchecked::next(b);
-			if (c1<c2)
-				return -1;
-			else if (c1>c2)
-				return 1;
-		};
-
-		if (*a==*b) // both are 0, so equal
+			while (count--)
+			{
+				++ptr;
+				while ((*ptr & 0xC0) == 0x80)
+					++ptr;
+			}
+			return ptr;
+		}
+	}
+
+	const char* UTF8String::_ptrAt(size_t pos) const
+	{
+		CZ_ASSERT(pos <= static_cast<size_t>(size()));
+		const char* str = getReadPointer();
+
+		// Pure ASCII strings don't need an index
+		if (sizeBytes() == size())
+			return str + pos;
+
+		if (pos == static_cast<size_t>(size()))
+			return str + sizeBytes();
+
+		if (sizeBytes() < INDEX_MIN_BYTES)
+			return skipCodePoints(str, pos);
+
+		return skipCodePoints(str + mData.getIndexedOffset(pos / INDEX_INTERVAL), pos % INDEX_INTERVAL);
+	}
+
+	int UTF8String::_cmp(const char* a, size_t aBytes, const char* b, size_t bBytes)
+	{
+		int res = memcmp(a, b, std::min(aBytes, bBytes));
+		if (res!=0)
+			return res;
+		else if (aBytes==bBytes)
 			return 0;
-		else if (*a<*b)
-			return -1;
 		else
-			return +1;
+			return aBytes<bBytes ? -1 : 1;
 	}
 
-	std::pair<int,int> UTF8String::_len(const char* str)
+	bool UTF8String::_startsWith(const char* prefix, size_t prefixBytes, bool caseSensitive) const
 	{
-		const char* p = str;
-		utf8::uint32_t points = 0;;
-		while(*p)
-		{
-			utf8::unchecked::next(p);
-			points++;
-		}
+		if (caseSensitive)
+			return prefixBytes<=static_cast<size_t>(sizeBytes()) && memcmp(getReadPointer(), prefix, prefixBytes)==0;
+		else
+			return utf8StartsWithNoCase(getReadPointer(), sizeBytes(), prefix, prefixBytes);
+	}
 
-		Iterator::difference_type distance = p-str;
-		return std::pair<int,int>(static_cast<int>(distance), points);
+	bool UTF8String::equalsNoCase(const UTF8String& str) const
+	{
+		return utf8EqualsNoCase(getReadPointer(), sizeBytes(), str.getReadPointer(), str.sizeBytes());
+	}
+
+	bool UTF8String::equalsNoCase(const char* str) const
+	{
+		return utf8EqualsNoCase(getReadPointer(), sizeBytes(), str, strlen(str));
+	}
+
+	std::pair<int,int> UTF8String::_len(const char* str)
+	{
+		return _len(str, str + strlen(str));
 	}
 
 	std::pair<int,int> UTF8String::_len(const char* start, const char* end)
 	{
-		Iterator::difference_type distanceCodePoints = utf8::unchecked::distance(start, end);
-		Iterator::difference_type distanceBytes = end-start;
+		size_t distanceBytes = end-start;
+		size_t distanceCodePoints = utf8CountCodePoints(start, distanceBytes);
 		return std::pair<int,int>(static_cast<int>(distanceBytes), static_cast<int>(distanceCodePoints));
 	}
 
@@ -98,6 +131,17 @@ namespace cz
 		memcpy(ptr, str, bytes);
 		ptr[bytes] = 0; // Make sure it stays NULL terminated
 		mData.updateStringSize(mData.getSizeBytes()+bytes, mData.getSizeCodePoints()+codepoints);
+		mData.extendIndex();
+	}
+
+	char* UTF8String::_appendUninitialized(int bytes, int codepoints)
+	{
+		char* ptr = getWritePointer(sizeBytes()+bytes+1, true) + sizeBytes();
+		// The new data is only written by the caller, so the index can't be extended
+		mData.dropIndex();
+		ptr[bytes] = 0; // Make sure it stays NULL terminated
+		mData.updateStringSize(mData.getSizeBytes()+bytes, mData.getSizeCodePoints()+codepoints);
+		return ptr;
 	}
 
 	void UTF8String::_setToUtf8(const char* str, int bytes, int codepoints)
@@ -170,27 +214,36 @@ namespace cz
 
 	void UTF8String::_setfromwstring(const std::wstring& other)
 	{
-		std::vector<unsigned char> tmp;
-		if (sizeof(wchar_t)==2)
-			utf8::unchecked::utf16to8(other.begin(), other.end(), back_inserter(tmp));
-		else if (sizeof(wchar_t)==4)
-			utf8::unchecked::utf32to8(other.begin(), other.end(), back_inserter(tmp));
+		static_assert(sizeof(wchar_t)==2 || sizeof(wchar_t)==4, "Unsupported wchar_t size");
+		if constexpr (sizeof(wchar_t)==2)
+			_setfromutf16(reinterpret_cast<const char16_t*>(other.data()), other.size());
 		else
-		{
-			CZ_ASSERT(0);
-		}
-
-		tmp.push_back(0);
+			_setfromutf32(reinterpret_cast<const char32_t*>(other.data()), other.size());
+	}
 
-		_setToUtf8((char*)tmp.data(), (int)tmp.size()-1, _len((char*)tmp.data()).second);
+	void UTF8String::_setfromu16string(const std::u16string& other)
+	{
+		_setfromutf16(other.data(), other.size());
 	}
 
+	void UTF8String::_setfromutf16(const char16_t* str, size_t count)
+	{
+		// Convert directly into our buffer
+		size_t bytes = utf8LengthFromUtf16(str, count);
+		char* ptr = getWritePointer(static_cast<int>(bytes)+1, false);
+		bytes = utf16ToUtf8(str, count, ptr);
+		ptr[bytes] = 0;
+		mData.updateStringSize(static_cast<int>(bytes), static_cast<int>(utf8CountCodePoints(ptr, bytes)));
+	}
 
-	void UTF8String::_setfromu16string(const std::u16string& other)
+	void UTF8String::_setfromutf32(const char32_t* str, size_t count)
 	{
-		std::vector<unsigned char> tmp;
-		utf8::unchecked::utf16to8(other.begin(), other.end(), back_inserter(tmp));
-		_setToUtf8((char*)tmp.data(), (int)tmp.size(), _len((char*)tmp.data()).second);
+		size_t bytes = utf8LengthFromUtf32(str, count);
+		char* ptr = getWritePointer(static_cast<int>(bytes)+1, false);
+		bytes = utf32ToUtf8(str, count, ptr);
+		ptr[bytes] = 0;
+		// Every UTF-32 unit is a code point
+		mData.updateStringSize(static_cast<int>(bytes), static_cast<int>(count));
 	}
 
 	UTF8String& UTF8String::operator=(const std::wstring& other)
@@ -209,29 +262,42 @@ namespace cz
 	std::u16string UTF8String::toUtf16() const
 	{
 		std::u16string s;
-		utf8::unchecked::utf8to16(getReadPointer(),getReadPointer()+sizeBytes(), back_inserter(s)); 
+		s.resize(utf16LengthFromUtf8(getReadPointer(), sizeBytes()));
+		s.resize(utf8ToUtf16(getReadPointer(), sizeBytes(), &s[0]));
 		return s;
 	}
 
 	std::u32string UTF8String::toUtf32() const
 	{
 		std::u32string s;
-		utf8::unchecked::utf8to32(getReadPointer(),getReadPointer()+sizeBytes(), back_inserter(s)); 
+		// We already know the code point count
+		s.resize(size());
+		s.resize(utf8ToUtf32(getReadPointer(), sizeBytes(), &s[0]));
 		return s;
 	}
 
 	std::wstring UTF8String::widen() const
 	{
 		std::wstring s;
-		s.reserve(this->size());
 		static_assert(sizeof(wchar_t)==2 || sizeof(wchar_t)==4, "Unsupported wchar_t size");
-		if (sizeof(wchar_t)==2)
-			utf8::unchecked::utf8to16(getReadPointer(), getReadPointer()+sizeBytes(), back_inserter(s));
+		if constexpr (sizeof(wchar_t)==2)
+		{
+			s.resize(utf16LengthFromUtf8(getReadPointer(), sizeBytes()));
+			s.resize(utf8ToUtf16(getReadPointer(), sizeBytes(), reinterpret_cast<char16_t*>(&s[0])));
+		}
 		else
-			utf8::unchecked::utf8to32(getReadPointer(), getReadPointer()+sizeBytes(), back_inserter(s));
+		{
+			s.resize(size());
+			s.resize(utf8ToUtf32(getReadPointer(), sizeBytes(), reinterpret_cast<char32_t*>(&s[0])));
+		}
 		return s;
 	}
 
+	bool UTF8String::isValid() const
+	{
+		return utf8Validate(getReadPointer(), sizeBytes());
+	}
+
 	//////////////////////////////////////////////////////////////////////////
 	// Capacity
 	//////////////////////////////////////////////////////////////////////////
@@ -247,7 +313,12 @@ namespace cz
 
 	void UTF8String::reserve(int numCharacters)
 	{
-		getWritePointer(numCharacters*4+1, true);
+		mData.reserve(numCharacters*4+1);
+	}
+
+	void UTF8String::reserveBytes(int numBytes)
+	{
+		mData.reserve(numBytes+1);
 	}
 
 	void UTF8String::clear()
@@ -280,25 +351,64 @@ namespace cz
 
 	UTF8String::Data::~Data()
 	{
+		_release();
+	}
+
+	UTF8String::Data::Heap* UTF8String::Data::allocHeap(int capacity)
+	{
+		Heap* heap = new(::operator new(sizeof(Heap) + capacity)) Heap;
+		heap->refs.store(1, std::memory_order_relaxed);
+		heap->capacity = capacity;
+		return heap;
+	}
+
+	void UTF8String::Data::releaseHeap(Heap* heap)
+	{
+		if (heap->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			delete heap->index.load(std::memory_order_relaxed);
+			heap->~Heap();
+			::operator delete(heap);
+		}
 	}
 
 	void UTF8String::Data::_init()
 	{
-		mBuf.reset();
 		mQuickBuf[0] = 0;
+		mQuickBuf[QUICKBUF_SIZE-1] = 0;
 		mStringLengthCodePoints = 0;
 		mStringLengthBytes = 0;
-		mBufferSize = QUICKBUF_SIZE;
+	}
+
+	void UTF8String::Data::_release()
+	{
+		if (isHeap())
+		{
+			releaseHeap(getHeap());
+			mQuickBuf[QUICKBUF_SIZE-1] = 0;
+		}
 	}
 
 	void UTF8String::Data::_docopy(const UTF8String::Data& other)
 	{
 		if (this==&other)
 			return;
-		char* ptr = getWritePointer(other.mStringLengthBytes+1, false);
+
+		if (other.isHeap())
+		{
+			// Share the buffer. Increment first, in case we are already sharing the same buffer
+			Heap* heap = other.getHeap();
+			heap->refs.fetch_add(1, std::memory_order_relaxed);
+			_release();
+			setHeap(heap);
+		}
+		else
+		{
+			_release();
+			memcpy(mQuickBuf, other.mQuickBuf, QUICKBUF_SIZE);
+		}
 		mStringLengthCodePoints = other.mStringLengthCodePoints;
 		mStringLengthBytes = other.mStringLengthBytes;
-		memcpy(ptr, other.getReadPointer(), mStringLengthBytes+1);
 	}
 
 	void UTF8String::Data::_domove(UTF8String::Data&& other)
@@ -306,11 +416,11 @@ namespace cz
 		if (this==&other)
 			CZ_UNEXPECTED();
 
-		mBuf = std::move(other.mBuf);
+		_release();
 		mStringLengthCodePoints = other.mStringLengthCodePoints;
 		mStringLengthBytes = other.mStringLengthBytes;
-		mBufferSize = other.mBufferSize;
-		memcpy(mQuickBuf, other.mQuickBuf, sizeof(mQuickBuf));
+		// Either the string itself, or the heap pointer + marker
+		memcpy(mQuickBuf, other.mQuickBuf, QUICKBUF_SIZE);
 
 		// reset other
 		other._init();
@@ -327,42 +437,137 @@ namespace cz
 		return *this;
 	}
 
-	const char* UTF8String::Data::getReadPointer() const
+	char* UTF8String::Data::_realloc(int bufferSizeBytes, bool keepData)
 	{
-		return (mBuf) ? mBuf.get() : mQuickBuf;
+		if (bufferSizeBytes<=QUICKBUF_SIZE)
+		{
+			// Only happens when we stop sharing a heap buffer, and the string fits in the quick buffer
+			CZ_ASSERT(isHeap());
+			Heap* heap = getHeap();
+			if (keepData)
+				memcpy(mQuickBuf, heap->buf(), mStringLengthBytes+1); // +1 to copy the 0 at the end
+			else
+				mQuickBuf[0] = 0;
+			mQuickBuf[QUICKBUF_SIZE-1] = 0;
+			releaseHeap(heap);
+			return mQuickBuf;
+		}
+
+		Heap* heap = allocHeap(bufferSizeBytes);
+		if (keepData)
+		{
+			memcpy(heap->buf(), getReadPointer(), mStringLengthBytes+1); // +1 to copy the 0 at the end
+			// The index is still valid for the same data, so take it if nobody else is using it
+			if (isHeap() && getHeap()->refs.load(std::memory_order_acquire)==1)
+				heap->index.store(getHeap()->index.exchange(nullptr, std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+		else
+		{
+			heap->buf()[0] = 0;
+		}
+		_release();
+		setHeap(heap);
+		return heap->buf();
 	}
 
-	char* UTF8String::Data::getWritePointer(int writeSizeBytes, bool keepData)
+	void UTF8String::Data::reserve(int bufferSizeBytes)
 	{
-
-		if (writeSizeBytes<=QUICKBUF_SIZE)
+		bufferSizeBytes = std::max(bufferSizeBytes, mStringLengthBytes+1);
+		if (isHeap())
 		{
-			// mBuf size should always be bigger than the quick buffer, otherwise we wouldn't be using it
-			return (mBuf) ? mBuf.get() : mQuickBuf;
+			Heap* heap = getHeap();
+			if (heap->refs.load(std::memory_order_acquire)!=1 || heap->capacity<bufferSizeBytes)
+				_realloc(bufferSizeBytes, true);
 		}
-		else
+		else if (bufferSizeBytes>QUICKBUF_SIZE)
 		{
-			if (mBuf && mBufferSize>=writeSizeBytes)
+			_realloc(bufferSizeBytes, true);
+		}
+	}
+
+	char* UTF8String::Data::getWritePointer(int writeSizeBytes, bool keepData)
+	{
+		int currentCapacity;
+		if (isHeap())
+		{
+			Heap* heap = getHeap();
+			if (heap->refs.load(std::memory_order_acquire)!=1)
 			{
-				return mBuf.get();
+				// Shared, so we need our own copy (Copy-On-Write).
+				return _realloc(writeSizeBytes, keepData);
 			}
-			else
+
+			if (!keepData)
+				dropIndex();
+			if (heap->capacity>=writeSizeBytes)
+				return heap->buf();
+			currentCapacity = heap->capacity;
+		}
+		else
+		{
+			if (writeSizeBytes<=QUICKBUF_SIZE)
+				return mQuickBuf;
+			currentCapacity = QUICKBUF_SIZE;
+		}
+
+		// If keeping the data, it's most likely an append, so grow by 1.5x to keep appends amortized O(1)
+		// without wasting too much memory.
+		if (keepData)
+			writeSizeBytes = std::max(writeSizeBytes, currentCapacity + currentCapacity/2);
+		return _realloc(writeSizeBytes, keepData);
+	}
+
+	void UTF8String::Data::PositionIndex::scan(const char* str, int sizeBytes)
+	{
+		for (int i = scannedBytes; i < sizeBytes; i++)
+		{
+			if ((str[i] & 0xC0) != 0x80)
 			{
-				auto newBuf = std::make_unique<char[]>(writeSizeBytes);
-				if (keepData)
-				{
-					memcpy(newBuf.get(), (mBuf) ? mBuf.get() : mQuickBuf, mStringLengthBytes+1); // +1 to copy the 0 at the end
-				}
-				else
-				{
-					newBuf[0] = 0;
-				}
-
-				mBuf = std::move(newBuf);
-				mBufferSize = writeSizeBytes;
-				return mBuf.get();
+				if (scannedCodePoints % INDEX_INTERVAL == 0)
+					offsets.push_back(i);
+				scannedCodePoints++;
 			}
 		}
+		scannedBytes = sizeBytes;
+	}
+
+	int UTF8String::Data::getIndexedOffset(size_t checkpoint) const
+	{
+		CZ_ASSERT(isHeap());
+		Heap* heap = getHeap();
+		PositionIndex* index = heap->index.load(std::memory_order_acquire);
+		if (!index)
+		{
+			// Build the index for the whole string and publish it. If another thread beats us to it, we use theirs.
+			// Changes to the string after this point either happen with exclusive access (appending, which
+			// extends it) or drop the index, so readers never see it change.
+			auto newIndex = std::make_unique<PositionIndex>();
+			newIndex->scan(heap->buf(), mStringLengthBytes);
+			if (heap->index.compare_exchange_strong(index, newIndex.get(), std::memory_order_acq_rel,
+			                                        std::memory_order_acquire))
+				index = newIndex.release();
+		}
+		CZ_ASSERT(checkpoint < index->offsets.size());
+		return index->offsets[checkpoint];
+	}
+
+	void UTF8String::Data::extendIndex()
+	{
+		if (!isHeap())
+			return;
+		Heap* heap = getHeap();
+		if (PositionIndex* index = heap->index.load(std::memory_order_relaxed))
+			index->scan(heap->buf(), mStringLengthBytes);
+	}
+
+	void UTF8String::Data::dropIndex()
+	{
+		if (!isHeap())
+			return;
+		// Only called when we are the only owner, so no one else is using it
+		Heap* heap = getHeap();
+		CZ_ASSERT(heap->refs.load(std::memory_order_relaxed)==1);
+		delete heap->index.exchange(nullptr, std::memory_order_relaxed);
 	}
 
 	UTF8String::Iterator UTF8String::begin()
@@ -394,8 +599,9 @@ namespace cz
 	{
 		if (static_cast<int>(offset)>=size())
 			return npos;
-		iterator it = std::find(begin()+static_cast<int>(offset), end(), codepoint);
-		return (it==end()) ? npos : it-begin();
+		iterator start(_ptrAt(offset));
+		iterator it = std::find(start, end(), codepoint);
+		return (it==end()) ? npos : offset + utf8CountCodePoints(start.ptr(), it.ptr()-start.ptr());
 	}
 
 	size_t UTF8String::find(const char* str, size_t offset) const
@@ -405,8 +611,9 @@ namespace cz
 		size_t count = strlen(str);
 		if (count==0)
 			return offset;
-		iterator it = std::search(begin()+static_cast<int>(offset), end(), str, str+count);
-		return (it==end()) ? npos : it-begin();
+		iterator start(_ptrAt(offset));
+		iterator it = std::search(start, end(), str, str+count);
+		return (it==end()) ? npos : offset + utf8CountCodePoints(start.ptr(), it.ptr()-start.ptr());
 	}
 	
 	size_t UTF8String::find(const UTF8String& str, size_t offset) const
@@ -415,11 +622,32 @@ namespace cz
 			return npos;
 		if (str.size()==0)
 			return offset;
-		iterator it = std::search(begin()+static_cast<int>(offset), end(), str.begin(), str.end());
-		return (it==end()) ? npos : it-begin();
+		iterator start(_ptrAt(offset));
+		iterator it = std::search(start, end(), str.begin(), str.end());
+		return (it==end()) ? npos : offset + utf8CountCodePoints(start.ptr(), it.ptr()-start.ptr());
+	}
+
+	uint32_t UTF8String::at(size_t pos) const
+	{
+		if (pos>=static_cast<size_t>(size()))
+			throw std::out_of_range("UTF8String::at");
+		return *iterator(_ptrAt(pos));
+	}
+
+	UTF8String UTF8String::substr(size_t pos, size_t len) const
+	{
+		if (pos>static_cast<size_t>(size()))
+			throw std::out_of_range("UTF8String::substr");
+		const char* start = _ptrAt(pos);
+		const char* finish = (len>=static_cast<size_t>(size())-pos) ? end().ptr() : _ptrAt(pos+len);
+		return UTF8String(start, finish);
+	}
+
+	UTF8String::iterator UTF8String::iteratorAt(size_t pos) const
+	{
+		return iterator(_ptrAt(pos));
 	}
 
-	// Highly inefficient
 	UTF8String& UTF8String::replace(size_t pos, size_t len, const UTF8String& to)
 	{
 		if (pos>=static_cast<size_t>(size()))
@@ -428,12 +656,16 @@ namespace cz
 			return *this;
 		}
 
-		auto it = begin() + static_cast<int>(pos);
-		UTF8String endpart;
-		if (pos+len<=static_cast<size_t>(size()))
-			endpart.append(it+static_cast<int>(len), end());
-		
-		*this = UTF8String(begin(), it) + to + endpart;
+		const char* middle = _ptrAt(pos);
+		const char* tail = (len>=static_cast<size_t>(size())-pos) ? end().ptr() : _ptrAt(pos+len);
+
+		// Build the result with one single allocation
+		UTF8String res;
+		res.reserveBytes(static_cast<int>((middle - begin().ptr()) + to.sizeBytes() + (end().ptr() - tail)));
+		res.append(begin().ptr(), middle);
+		res.append(to);
+		res.append(tail, end().ptr());
+		*this = std::move(res);
 
 		return *this;
 	}
@@ -511,16 +743,29 @@ namespace cz
 	}
 
 
-	UTF8String ansiToLower(const cz::UTF8String& s)
+	detail::UTF8ConcatLeaf::UTF8ConcatLeaf(const char* str)
+		: mStr(str)
+		, mBytes(static_cast<int>(strlen(str)))
+		, mCodePoints(static_cast<int>(cz::utf8CountCodePoints(str, mBytes)))
+	{
+	}
+
+	UTF8String UTF8String::_convert(const UTF8String& s, void (*func)(const char*, size_t, char*))
 	{
 		UTF8String res;
-		for(const auto& ch : s)
-		{
-			if (ch>='A' && ch<='Z')
-				res.appendCodepoint( ch + ('a' - 'A') );
-			else
-				res.appendCodepoint( ch );
-		}
+		res.reserveBytes(s.sizeBytes());
+		func(s.c_str(), s.sizeBytes(), res._appendUninitialized(s.sizeBytes(), s.size()));
 		return res;
 	}
+
+	UTF8String ansiToLower(const cz::UTF8String& s)
+	{
+		// Only ASCII characters change, so the size stays the same
+		return UTF8String::_convert(s, &asciiToLower);
+	}
+
+	UTF8String ansiToUpper(const cz::UTF8String& s)
+	{
+		return UTF8String::_convert(s, &asciiToUpper);
+	}
 } // end namespace cz
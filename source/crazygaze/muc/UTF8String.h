@@ -14,11 +14,12 @@
 #include <utility>
 #include <ostream>
 #include <memory>
+#include <vector>
+#include <atomic>
 
 namespace cz
 {
 
-
 /*! \addtogroup String handling
 	@{
 */
@@ -36,6 +37,17 @@ namespace cz
 	a value, and not a reference.
 
 	In most cases, you're better of using methods that deal with iterators, instead of character positions.
+
+	To make random access by character position cheap for big strings (e.g: at, substr), a sparse index of byte
+	offsets (one every INDEX_INTERVAL characters) is lazily built the first time it's needed. The index is kept
+	in the heap buffer, and shared by copies of the string, so it doesn't make the object any bigger. It's published
+	atomically, so concurrent reads of the same string are still thread safe. Appending extends the index, and any
+	other change discards it. Pure ASCII strings and small strings never need an index.
+
+	Memory wise, small strings (up to QUICKBUF_SIZE-1 bytes) are kept inside the object itself, which is the same
+	size as a std::string. Bigger strings are kept in a reference counted buffer, shared by copies until one of them
+	is changed (Copy-On-Write), so copies that are never changed don't cost any extra memory. The reference count is
+	atomic, so copies can be used freely from different threads.
 	*/
 	class UTF8String
 	{
@@ -43,8 +55,14 @@ namespace cz
 
 		enum
 		{
-			/*! Size of the internal quick buffer, used for small strings */
-			QUICKBUF_SIZE = 32
+			/*! Size of the internal quick buffer, used for small strings.
+			The pointer to the heap buffer shares the same space, so this is kept small, to keep the object compact.
+			*/
+			QUICKBUF_SIZE = 16,
+			/*! Number of characters between each entry of the position index */
+			INDEX_INTERVAL = 64,
+			/*! Strings smaller than this (in bytes) don't use a position index */
+			INDEX_MIN_BYTES = 256
 		};
 
 
@@ -172,6 +190,13 @@ namespace cz
 			append(srcStart, srcEnd);
 		}
 
+		/*! Concatenates several strings (UTF8String or const char*), with one single allocation.
+		The total size is calculated first, so this is cheaper than chaining operator+ when building a string from
+		several parts. E.g: UTF8String::concat(dir, "/", name, ".txt")
+		*/
+		template<typename... Args>
+		static UTF8String concat(const Args&... args);
+
 		//////////////////////////////////////////////////////////////////////////
 		// Iterators
 		//////////////////////////////////////////////////////////////////////////
@@ -234,7 +259,8 @@ namespace cz
 		/*! Returns how many characters the string can hold without allocating more memory*/
 		int capacity() const
 		{
-			return mData.getCapacityCodepoints();
+			// Consider that a character can take up to 4 bytes
+			return mData.getCapacityBytes() / 4;
 		}
 
 		/*! Sets the capacity of the string to at least the specified number of characters.
@@ -243,10 +269,22 @@ namespace cz
 			Since a character in UTF8 format can take up to 4 bytes, the amount of memory
 			to guarantee the requested capacity is numCharacters*4, which is what it will be allocated
 			internally. Be aware that it means this method allocates 4 times more memory than a call
-			to the equivalent std::string::reserve method.
+			to the equivalent std::string::reserve method. If you know the size in bytes, use reserveBytes.
 		*/
 		void reserve(int numCharacters);
 
+		/*! Returns how many bytes the string can hold without allocating more memory, like std::string::capacity */
+		int capacityBytes() const
+		{
+			return mData.getCapacityBytes();
+		}
+
+		/*! Sets the capacity of the string to at least the specified number of bytes, like std::string::reserve.
+		\param numBytes
+			Minimum number of bytes to set the capacity to, not counting the terminating 0.
+		*/
+		void reserveBytes(int numBytes);
+
 		/*! Sets the string to empty */
 		void clear();
 
@@ -292,8 +330,9 @@ namespace cz
 		/*! Appends another string */
 		UTF8String& append(const UTF8String& str)
 		{
-			// TODO test this when doing something like a.append(a.a())
-			return append(str.begin().ptr(), str.end().ptr());
+			// No need to count the code points, since we already know it
+			_appendUtf8(str.c_str(), str.sizeBytes(), str.size());
+			return *this;
 		}
 
 		UTF8String& append(const char* str)
@@ -359,25 +398,55 @@ namespace cz
 		/*! Searches for a string and returns where it was found, or npos if not.*/
 		size_t find(const UTF8String& str, size_t offset = 0) const;
 
-		/* Kind of the same thing as std::string::replace, but highly inneficient */
+		/*! Returns the character (unicode codepoint) at the specified character position
+		Throws std::out_of_range if pos is not a valid position
+		*/
+		uint32_t at(size_t pos) const;
+
+		/*! Returns a substring [pos, pos+len), where pos and len are in characters.
+		Throws std::out_of_range if pos > size()
+		*/
+		UTF8String substr(size_t pos = 0, size_t len = npos) const;
+
+		/*! Same as std::string::replace, but with positions in characters */
 		UTF8String& replace(size_t pos, size_t len, const UTF8String& to);
 
 		/*! Compares to another string.
+		Strings are ordered by code point, which with UTF-8 is the same as comparing bytes, so this doesn't need to
+		decode anything.
 		\return returns 0 if strings are equal, a negative value if "this < str", or positive value if "this > str"
 		*/
 		int compare(const UTF8String& str) const
 		{
-			if (this==&str)
-				return 0;
+			if (getReadPointer()==str.getReadPointer())
+				return 0; // Same string, or sharing the same buffer
 			else
-				return _cmp(getReadPointer(), str.getReadPointer());
+				return _cmp(getReadPointer(), sizeBytes(), str.getReadPointer(), str.sizeBytes());
 		}
 
 		int compare(const char* str) const
 		{
-			return _cmp(getReadPointer(), str);
+			return _cmp(getReadPointer(), sizeBytes(), str, strlen(str));
+		}
+
+		/*! Checks if the string starts with the specified prefix.
+		Case insensitive comparison only ignores the case of ASCII characters in bulk, and only falls back to
+		comparing code point by code point if there are non-ASCII differences. See utf8StartsWithNoCase.
+		*/
+		bool startsWith(const UTF8String& prefix, bool caseSensitive = true) const
+		{
+			return _startsWith(prefix.c_str(), prefix.sizeBytes(), caseSensitive);
+		}
+
+		bool startsWith(const char* prefix, bool caseSensitive = true) const
+		{
+			return _startsWith(prefix, strlen(prefix), caseSensitive);
 		}
 
+		/*! Case insensitive equality. Same rules as startsWith */
+		bool equalsNoCase(const UTF8String& str) const;
+		bool equalsNoCase(const char* str) const;
+
 
 		//////////////////////////////////////////////////////////////////////////
 		// Conversion
@@ -393,12 +462,21 @@ namespace cz
 
 		UTF8String& appendCodepoint(uint32_t codepoint);
 
+		/*! Checks if the string contents are valid UTF-8.
+		Strings are assumed to be valid UTF-8 and never checked, so this is useful to check data from untrusted
+		sources.
+		*/
+		bool isValid() const;
+
 		/*! returns the size of the string, in bytes */
 		int sizeBytes() const
 		{
 			return mData.getSizeBytes();
 		}
 
+		/*! Returns an iterator to the specified character position. Faster than begin()+pos for big strings */
+		iterator iteratorAt(size_t pos) const;
+
 		/*! Tells if it's using the same internal data
 		*/
 		bool _same(const UTF8String& other) const
@@ -414,12 +492,22 @@ namespace cz
 
 		bool checkOverlap(const char* src) const;
 
+		friend UTF8String ansiToLower(const cz::UTF8String& s);
+		friend UTF8String ansiToUpper(const cz::UTF8String& s);
+		// Creates a copy with a conversion that doesn't change the size (e.g: ASCII case conversion)
+		static UTF8String _convert(const UTF8String& s, void (*func)(const char*, size_t, char*));
+
+		// Returns a pointer to the specified character position, using the position index if necessary
+		const char* _ptrAt(size_t pos) const;
+
 		// Compares two UTF-8 strings
 		// returns:
 		// <0 : if a<b
 		//  0  : if a==b
 		// >0 : if a>b
-		static int _cmp(const char* a, const char* b);
+		static int _cmp(const char* a, size_t aBytes, const char* b, size_t bBytes);
+
+		bool _startsWith(const char* prefix, size_t prefixBytes, bool caseSensitive) const;
 
 		// Calculates the length in <bytes,codepoints> of the specified string, not counting the terminating 0
 		static std::pair<int,int> _len(const char* str);
@@ -428,12 +516,16 @@ namespace cz
 
 		// Appends valid utf8 data
 		void _appendUtf8(const char* str, int bytes, int codepoints);
+		// Grows the string by the specified size, and returns where to write the new data
+		char* _appendUninitialized(int bytes, int codepoints);
 
 		// Sets the string to the specified utf8 data
 		void _setToUtf8(const char* str, int bytes, int codepoints);
 
 		void _setfromwstring(const std::wstring& other);
 		void _setfromu16string(const std::u16string& other);
+		void _setfromutf16(const char16_t* str, size_t count);
+		void _setfromutf32(const char32_t* str, size_t count);
 
 		class Data
 		{
@@ -461,31 +553,86 @@ namespace cz
 
 			int getCapacityBytes() const
 			{
-				return mBufferSize-1;
+				return (isHeap() ? getHeap()->capacity : QUICKBUF_SIZE) - 1;
 			}
 
-			int getCapacityCodepoints() const
-			{
-				// Consider that a character can take up to 4 bytes
-				return getCapacityBytes() / 4;
-			}
+			//! Makes sure the buffer has at least the specified size (in bytes) and is not shared
+			void reserve(int bufferSizeBytes);
+
+			//! Byte offset of the character at position checkpoint*INDEX_INTERVAL, using the position index.
+			//! The index is built and published atomically if there isn't one yet. Only valid for heap buffers
+			int getIndexedOffset(size_t checkpoint) const;
+			//! Updates the position index (if any) after data was appended
+			void extendIndex();
+			//! Discards the position index (if any)
+			void dropIndex();
 
 		protected:
-			const char* getReadPointer() const;
+			const char* getReadPointer() const
+			{
+				return isHeap() ? getHeap()->buf() : mQuickBuf;
+			}
 			char* getWritePointer(int writeSizeBytes, bool keepData);
 			// Only allow access to internal data with these function, to enforce Copy-On-Write
 			friend const char* UTF8String::getReadPointer() const;
 			friend char* UTF8String::getWritePointer(int writeSizeBytes, bool keepData);
 		private:
+
+			// Byte offsets of every INDEX_INTERVAL characters
+			struct PositionIndex
+			{
+				std::vector<int> offsets;
+				// How far the string was processed, so appending only needs to process the new data
+				int scannedBytes = 0;
+				int scannedCodePoints = 0;
+				void scan(const char* str, int sizeBytes);
+			};
+
+			// Heap buffer header. The string itself follows the header
+			struct Heap
+			{
+				std::atomic<int> refs;
+				int capacity; // size of the buffer, in bytes, including space for the 0 at the end
+				// Lazily created by getIndexedOffset. Once published, only changed by the (single) owner
+				std::atomic<PositionIndex*> index{nullptr};
+				char* buf()
+				{
+					return reinterpret_cast<char*>(this + 1);
+				}
+			};
+
+			// Marks that mQuickBuf has a Heap pointer instead of the string.
+			// When mQuickBuf has the string, the last byte is always 0, since it's either unused or the terminating 0
+			static constexpr char HEAP_MARKER = 1;
+
+			bool isHeap() const
+			{
+				return mQuickBuf[QUICKBUF_SIZE - 1] == HEAP_MARKER;
+			}
+			Heap* getHeap() const
+			{
+				Heap* heap;
+				memcpy(&heap, mQuickBuf, sizeof(heap));
+				return heap;
+			}
+			void setHeap(Heap* heap)
+			{
+				memcpy(mQuickBuf, &heap, sizeof(heap));
+				mQuickBuf[QUICKBUF_SIZE - 1] = HEAP_MARKER;
+			}
+			static Heap* allocHeap(int capacity);
+			static void releaseHeap(Heap* heap);
+
+			// Switches to a new buffer with the specified size, dropping the current one
+			char* _realloc(int bufferSizeBytes, bool keepData);
 			void _init();
+			void _release();
 			void _docopy(const Data& other);
 			void _domove(Data&& other);
-			// Private to avoid use
-			std::unique_ptr<char[]> mBuf; // allocated buffer. If it's NULL, it means we're using the quickBuf
 			int mStringLengthCodePoints; // length of the string, in code points (NOT BYTES), excluding the 0 at the end
 			int mStringLengthBytes; // length of the string, in bytes, excluding the 0 at the end
-			int mBufferSize; // size of the allocated buffer, in bytes
-			char mQuickBuf[QUICKBUF_SIZE];
+			char mQuickBuf[QUICKBUF_SIZE]; // The string itself if it's small enough, or a Heap pointer + HEAP_MARKER
+			static_assert(sizeof(Heap*) < QUICKBUF_SIZE, "Quick buffer too small to hold the heap pointer");
 		};
 
 		Data mData;
@@ -507,7 +654,7 @@ namespace cz
 
 	inline bool operator==(const UTF8String& left, const UTF8String& right)
 	{
-		return (left.compare(right)==0);
+		return left.sizeBytes()==right.sizeBytes() && (left.compare(right)==0);
 	}
 
 	inline bool operator==(const UTF8String& left, const char* right)
@@ -611,20 +758,90 @@ namespace cz
 	}
 
 
+	//////////////////////////////////////////////////////////////////////////
+	// Concatenation
+	//////////////////////////////////////////////////////////////////////////
+
+namespace detail
+{
+	//! Operand of UTF8String::concat
+	class UTF8ConcatLeaf
+	{
+	public:
+		UTF8ConcatLeaf(const UTF8String& str)
+			: mStr(str.c_str()), mBytes(str.sizeBytes()), mCodePoints(str.size())
+		{
+		}
+		UTF8ConcatLeaf(const char* str);
+
+		int sizeBytes() const
+		{
+			return mBytes;
+		}
+		int size() const
+		{
+			return mCodePoints;
+		}
+		char* copyTo(char* dst) const
+		{
+			memcpy(dst, mStr, mBytes);
+			return dst + mBytes;
+		}
+
+	private:
+		const char* mStr;
+		int mBytes;
+		int mCodePoints;
+	};
+}
+
+	template<typename... Args>
+	UTF8String UTF8String::concat(const Args&... args)
+	{
+		static_assert(sizeof...(Args) > 0, "Nothing to concatenate");
+		const detail::UTF8ConcatLeaf leaves[] = {detail::UTF8ConcatLeaf(args)...};
+		int bytes = 0;
+		int codepoints = 0;
+		for (auto&& leaf : leaves)
+		{
+			bytes += leaf.sizeBytes();
+			codepoints += leaf.size();
+		}
+
+		UTF8String res;
+		res.reserveBytes(bytes);
+		char* dst = res._appendUninitialized(bytes, codepoints);
+		for (auto&& leaf : leaves)
+			dst = leaf.copyTo(dst);
+		return res;
+	}
+
 	inline UTF8String operator + (const UTF8String& left, const UTF8String& right)
 	{
-		UTF8String tmp;
-		tmp.append(left);
-		tmp.append(right);
-		return tmp;
+		return UTF8String::concat(left, right);
 	}
 
 	inline UTF8String operator + (const UTF8String& left, const char* right)
 	{
-		UTF8String tmp;
-		tmp.append(left);
-		tmp.append(right);
-		return tmp;
+		return UTF8String::concat(left, right);
+	}
+
+	inline UTF8String operator + (const char* left, const UTF8String& right)
+	{
+		return UTF8String::concat(left, right);
+	}
+
+	// Chained concatenations (e.g: a + "/" + b) append to the temporary, instead of creating a new string each time
+	inline UTF8String operator + (UTF8String&& left, const UTF8String& right)
+	{
+		left.append(right);
+		return std::move(left);
+	}
+
+	inline UTF8String operator + (UTF8String&& left, const char* right)
+	{
+		left.append(right);
+		return std::move(left);
 	}
 
 	/**
@@ -633,6 +850,12 @@ namespace cz
 	*/
 	UTF8String ansiToLower(const cz::UTF8String& s);
 
+	/**
+	* Converts a string to upper case, but _ONLY_ the ansi characters.
+	* Any non ansi characters are left unchanged
+	*/
+	UTF8String ansiToUpper(const cz::UTF8String& s);
+
 /*!
 	@}
 */
@@ -0,0 +1,982 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	The SIMD validation follows the "lookup" algorithm described in
+	"Validating UTF-8 In Less Than One Instruction Per Byte" (John Keiser, Daniel Lemire), also used by simdjson.
+
+*********************************************************************/
+
+#include "czmucPCH.h"
+#include "crazygaze/muc/UTF8Utils.h"
+#include "crazygaze/muc/CpuFeatures.h"
+#include <cwctype>
+
+#if CZ_SSE2
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <immintrin.h>
+	#endif
+#endif
+
+namespace cz
+{
+
+namespace
+{
+
+//////////////////////////////////////////////////////////////////////////
+// Scalar
+//////////////////////////////////////////////////////////////////////////
+
+inline bool isContinuation(uint8_t c)
+{
+	return (c & 0xC0) == 0x80;
+}
+
+bool utf8ValidateScalar(const uint8_t* p, size_t size)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		// Skip ASCII 8 bytes at a time
+		if (i + 8 <= size)
+		{
+			uint64_t v;
+			memcpy(&v, p + i, 8);
+			if ((v & 0x8080808080808080ull) == 0)
+			{
+				i += 8;
+				continue;
+			}
+		}
+
+		uint8_t c = p[i];
+		if (c < 0x80)
+		{
+			i++;
+		}
+		else if (c < 0xC2) // Continuation byte or overlong 2 bytes sequence
+		{
+			return false;
+		}
+		else if (c < 0xE0)
+		{
+			if (i + 1 >= size || !isContinuation(p[i + 1]))
+				return false;
+			i += 2;
+		}
+		else if (c < 0xF0)
+		{
+			if (i + 2 >= size || !isContinuation(p[i + 1]) || !isContinuation(p[i + 2]))
+				return false;
+			if ((c == 0xE0 && p[i + 1] < 0xA0) || // overlong
+				(c == 0xED && p[i + 1] >= 0xA0)) // surrogates
+				return false;
+			i += 3;
+		}
+		else if (c < 0xF5)
+		{
+			if (i + 3 >= size || !isContinuation(p[i + 1]) || !isContinuation(p[i + 2]) ||
+				!isContinuation(p[i + 3]))
+				return false;
+			if ((c == 0xF0 && p[i + 1] < 0x90) || // overlong
+				(c == 0xF4 && p[i + 1] >= 0x90)) // above U+10FFFF
+				return false;
+			i += 4;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+size_t utf8CountCodePointsScalar(const uint8_t* p, size_t size)
+{
+	size_t count = 0;
+	for (size_t i = 0; i < size; i++)
+		count += !isContinuation(p[i]);
+	return count;
+}
+
+// Decodes a multi-byte sequence starting at p[i], advancing i.
+// Invalid, overlong or truncated sequences are decoded as U+FFFD
+inline uint32_t decodeMultiByte(const uint8_t* p, size_t size, size_t& i)
+{
+	uint8_t c = p[i];
+	size_t len;
+	uint32_t cp;
+	uint32_t minCp;
+	if (c < 0xE0)
+	{
+		len = 2;
+		cp = c & 0x1F;
+		minCp = 0x80;
+	}
+	else if (c < 0xF0)
+	{
+		len = 3;
+		cp = c & 0x0F;
+		minCp = 0x800;
+	}
+	else if (c < 0xF5)
+	{
+		len = 4;
+		cp = c & 0x07;
+		minCp = 0x10000;
+	}
+	else
+	{
+		// F5-FF can never start a valid sequence
+		i++;
+		return 0xFFFD;
+	}
+
+	size_t start = i++;
+	while (i < size && (i - start) < len && isContinuation(p[i]))
+		cp = (cp << 6) | (p[i++] & 0x3F);
+
+	if ((i - start) != len || cp < minCp || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+		return 0xFFFD;
+	return cp;
+}
+
+// Converts a code point starting at p[i] (or skips a stray continuation byte), advancing i
+inline void utf8ToUtf16One(const uint8_t* p, size_t size, size_t& i, char16_t*& out)
+{
+	uint8_t c = p[i];
+	if (c < 0x80)
+	{
+		*out++ = c;
+		i++;
+	}
+	else if (isContinuation(c))
+	{
+		i++;
+	}
+	else
+	{
+		uint32_t cp = decodeMultiByte(p, size, i);
+		if (cp >= 0x10000)
+		{
+			cp -= 0x10000;
+			*out++ = static_cast<char16_t>(0xD800 + (cp >> 10));
+			*out++ = static_cast<char16_t>(0xDC00 + (cp & 0x3FF));
+		}
+		else
+		{
+			*out++ = static_cast<char16_t>(cp);
+		}
+	}
+}
+
+inline void utf8ToUtf32One(const uint8_t* p, size_t size, size_t& i, char32_t*& out)
+{
+	uint8_t c = p[i];
+	if (c < 0x80)
+	{
+		*out++ = c;
+		i++;
+	}
+	else if (isContinuation(c))
+	{
+		i++;
+	}
+	else
+	{
+		*out++ = decodeMultiByte(p, size, i);
+	}
+}
+
+inline char* encodeUtf8(uint32_t cp, char* out)
+{
+	if (cp < 0x80)
+	{
+		*out++ = static_cast<char>(cp);
+	}
+	else if (cp < 0x800)
+	{
+		*out++ = static_cast<char>(0xC0 | (cp >> 6));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	}
+	else if (cp < 0x10000)
+	{
+		*out++ = static_cast<char>(0xE0 | (cp >> 12));
+		*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	}
+	else
+	{
+		*out++ = static_cast<char>(0xF0 | (cp >> 18));
+		*out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+		*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+		*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+	}
+	return out;
+}
+
+// Decodes the UTF-16 code point at src[i], advancing i. Unpaired surrogates are decoded as U+FFFD
+inline uint32_t decodeUtf16(const char16_t* src, size_t count, size_t& i)
+{
+	uint32_t c = src[i++];
+	if (c < 0xD800 || c > 0xDFFF)
+		return c;
+	if (c <= 0xDBFF && i < count && src[i] >= 0xDC00 && src[i] <= 0xDFFF)
+		return 0x10000 + ((c - 0xD800) << 10) + (src[i++] - 0xDC00);
+	return 0xFFFD;
+}
+
+inline uint32_t sanitizeUtf32(uint32_t c)
+{
+	return (c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) ? 0xFFFD : c;
+}
+
+inline size_t utf8Length(uint32_t cp)
+{
+	return cp < 0x80 ? 1 : (cp < 0x800 ? 2 : (cp < 0x10000 ? 3 : 4));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// SIMD
+//////////////////////////////////////////////////////////////////////////
+
+#if CZ_SSE2
+
+//
+// Validation tables. Each byte is checked against the previous one, and each possible error sets a bit. A byte
+// pair is invalid if the same bit is set in all the 3 lookups.
+//
+constexpr uint8_t TOO_SHORT = 1 << 0; // Lead byte followed by a lead byte or ASCII
+constexpr uint8_t TOO_LONG = 1 << 1; // ASCII followed by continuation
+constexpr uint8_t OVERLONG_3 = 1 << 2;
+constexpr uint8_t TOO_LARGE = 1 << 3;
+constexpr uint8_t SURROGATE = 1 << 4;
+constexpr uint8_t OVERLONG_2 = 1 << 5;
+constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr uint8_t OVERLONG_4 = 1 << 6;
+constexpr uint8_t TWO_CONTS = 1 << 7; // Two continuation bytes in a row. Checked separately for 3/4 bytes sequences
+constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+#define CZ_UTF8_BYTE1_HIGH \
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+	TOO_SHORT | OVERLONG_2, \
+	TOO_SHORT, \
+	TOO_SHORT | OVERLONG_3 | SURROGATE, \
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define CZ_UTF8_BYTE1_LOW \
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+	CARRY | OVERLONG_2, \
+	CARRY, \
+	CARRY, \
+	CARRY | TOO_LARGE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define CZ_UTF8_BYTE2_HIGH \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+alignas(32) const uint8_t gByte1High[32] = {CZ_UTF8_BYTE1_HIGH, CZ_UTF8_BYTE1_HIGH};
+alignas(32) const uint8_t gByte1Low[32] = {CZ_UTF8_BYTE1_LOW, CZ_UTF8_BYTE1_LOW};
+alignas(32) const uint8_t gByte2High[32] = {CZ_UTF8_BYTE2_HIGH, CZ_UTF8_BYTE2_HIGH};
+// Anything above these values in the last 3 bytes of a block means a sequence continues in the next block
+alignas(32) const uint8_t gIncompleteMax[32] = {
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+
+#undef CZ_UTF8_BYTE1_HIGH
+#undef CZ_UTF8_BYTE1_LOW
+#undef CZ_UTF8_BYTE2_HIGH
+
+struct UTF8CheckerSSE
+{
+	__m128i error;
+	__m128i prevInput;
+	__m128i prevIncomplete;
+};
+
+CZ_TARGET_SSSE3 inline void checkBlockSSSE3(UTF8CheckerSSE& s, __m128i input)
+{
+	if (_mm_movemask_epi8(input) == 0)
+	{
+		// All ASCII, so the only possible error is a sequence not completed in the previous block
+		s.error = _mm_or_si128(s.error, s.prevIncomplete);
+		s.prevIncomplete = _mm_setzero_si128();
+	}
+	else
+	{
+		const __m128i nibble = _mm_set1_epi8(0x0F);
+		__m128i prev1 = _mm_alignr_epi8(input, s.prevInput, 16 - 1);
+		__m128i byte1High = _mm_shuffle_epi8(
+			_mm_load_si128(reinterpret_cast<const __m128i*>(gByte1High)),
+			_mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+		__m128i byte1Low = _mm_shuffle_epi8(
+			_mm_load_si128(reinterpret_cast<const __m128i*>(gByte1Low)), _mm_and_si128(prev1, nibble));
+		__m128i byte2High = _mm_shuffle_epi8(
+			_mm_load_si128(reinterpret_cast<const __m128i*>(gByte2High)),
+			_mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+		__m128i special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+
+		// 3rd and 4th bytes of a sequence must be continuations, which is the only place where TWO_CONTS is allowed
+		__m128i prev2 = _mm_alignr_epi8(input, s.prevInput, 16 - 2);
+		__m128i prev3 = _mm_alignr_epi8(input, s.prevInput, 16 - 3);
+		__m128i isThird = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80)));
+		__m128i isFourth = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80)));
+		__m128i must23 = _mm_and_si128(_mm_or_si128(isThird, isFourth), _mm_set1_epi8(char(0x80)));
+		s.error = _mm_or_si128(s.error, _mm_xor_si128(must23, special));
+
+		s.prevIncomplete =
+			_mm_subs_epu8(input, _mm_loadu_si128(reinterpret_cast<const __m128i*>(gIncompleteMax + 16)));
+	}
+	s.prevInput = input;
+}
+
+CZ_TARGET_SSSE3 bool utf8ValidateSSSE3(const uint8_t* p, size_t size)
+{
+	UTF8CheckerSSE s;
+	s.error = s.prevInput = s.prevIncomplete = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+		checkBlockSSSE3(s, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+
+	if (i < size)
+	{
+		// Pad with zeros, which is ASCII
+		alignas(16) uint8_t tmp[16] = {};
+		memcpy(tmp, p + i, size - i);
+		checkBlockSSSE3(s, _mm_load_si128(reinterpret_cast<const __m128i*>(tmp)));
+	}
+
+	s.error = _mm_or_si128(s.error, s.prevIncomplete);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(s.error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+struct UTF8CheckerAVX2
+{
+	__m256i error;
+	__m256i prevInput;
+	__m256i prevIncomplete;
+};
+
+template<int N>
+CZ_TARGET_AVX2 inline __m256i prevBytesAVX2(__m256i input, __m256i prevInput)
+{
+	// alignr works on each 128 bits lane, so we need to feed it the right lanes
+	return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prevInput, input, 0x21), 16 - N);
+}
+
+CZ_TARGET_AVX2 inline void checkBlockAVX2(UTF8CheckerAVX2& s, __m256i input)
+{
+	if (_mm256_movemask_epi8(input) == 0)
+	{
+		s.error = _mm256_or_si256(s.error, s.prevIncomplete);
+		s.prevIncomplete = _mm256_setzero_si256();
+	}
+	else
+	{
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		__m256i prev1 = prevBytesAVX2<1>(input, s.prevInput);
+		__m256i byte1High = _mm256_shuffle_epi8(
+			_mm256_load_si256(reinterpret_cast<const __m256i*>(gByte1High)),
+			_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+		__m256i byte1Low = _mm256_shuffle_epi8(
+			_mm256_load_si256(reinterpret_cast<const __m256i*>(gByte1Low)), _mm256_and_si256(prev1, nibble));
+		__m256i byte2High = _mm256_shuffle_epi8(
+			_mm256_load_si256(reinterpret_cast<const __m256i*>(gByte2High)),
+			_mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+		__m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+		__m256i prev2 = prevBytesAVX2<2>(input, s.prevInput);
+		__m256i prev3 = prevBytesAVX2<3>(input, s.prevInput);
+		__m256i isThird = _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xE0 - 0x80)));
+		__m256i isFourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xF0 - 0x80)));
+		__m256i must23 = _mm256_and_si256(_mm256_or_si256(isThird, isFourth), _mm256_set1_epi8(char(0x80)));
+		s.error = _mm256_or_si256(s.error, _mm256_xor_si256(must23, special));
+
+		s.prevIncomplete =
+			_mm256_subs_epu8(input, _mm256_load_si256(reinterpret_cast<const __m256i*>(gIncompleteMax)));
+	}
+	s.prevInput = input;
+}
+
+CZ_TARGET_AVX2 bool utf8ValidateAVX2(const uint8_t* p, size_t size)
+{
+	UTF8CheckerAVX2 s;
+	s.error = s.prevInput = s.prevIncomplete = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+		checkBlockAVX2(s, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+
+	if (i < size)
+	{
+		alignas(32) uint8_t tmp[32] = {};
+		memcpy(tmp, p + i, size - i);
+		checkBlockAVX2(s, _mm256_load_si256(reinterpret_cast<const __m256i*>(tmp)));
+	}
+
+	s.error = _mm256_or_si256(s.error, s.prevIncomplete);
+	return _mm256_testz_si256(s.error, s.error) != 0;
+}
+
+size_t utf8CountCodePointsSSE2(const uint8_t* p, size_t size)
+{
+	size_t count = 0;
+	size_t i = 0;
+	const __m128i threshold = _mm_set1_epi8(-65); // Any byte above (signed) 0xBF is not a continuation byte
+	while (i + 16 <= size)
+	{
+		// Per-byte counters can only do 255 iterations before overflowing
+		size_t iterations = std::min<size_t>((size - i) / 16, 255);
+		__m128i acc = _mm_setzero_si128();
+		for (size_t n = 0; n < iterations; n++, i += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, threshold));
+		}
+		__m128i sum = _mm_sad_epu8(acc, _mm_setzero_si128());
+		count += static_cast<size_t>(_mm_cvtsi128_si32(sum)) + _mm_extract_epi16(sum, 4);
+	}
+	return count + utf8CountCodePointsScalar(p + i, size - i);
+}
+
+CZ_TARGET_AVX2 size_t utf8CountCodePointsAVX2(const uint8_t* p, size_t size)
+{
+	size_t count = 0;
+	size_t i = 0;
+	const __m256i threshold = _mm256_set1_epi8(-65);
+	while (i + 32 <= size)
+	{
+		size_t iterations = std::min<size_t>((size - i) / 32, 255);
+		__m256i acc = _mm256_setzero_si256();
+		for (size_t n = 0; n < iterations; n++, i += 32)
+		{
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(v, threshold));
+		}
+		__m256i sad = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+		__m128i sum = _mm_add_epi64(_mm256_castsi256_si128(sad), _mm256_extracti128_si256(sad, 1));
+		count += static_cast<size_t>(_mm_cvtsi128_si32(sum)) + _mm_extract_epi16(sum, 4);
+	}
+	return count + utf8CountCodePointsScalar(p + i, size - i);
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+// Dispatching
+//////////////////////////////////////////////////////////////////////////
+
+struct UTF8Kernels
+{
+	bool (*validate)(const uint8_t*, size_t);
+	size_t (*countCodePoints)(const uint8_t*, size_t);
+};
+
+const UTF8Kernels& getKernels(detail::UTF8Kernel kernel)
+{
+	static const UTF8Kernels scalar = {&utf8ValidateScalar, &utf8CountCodePointsScalar};
+#if CZ_SSE2
+	static const UTF8Kernels sse = {&utf8ValidateSSSE3, &utf8CountCodePointsSSE2};
+	static const UTF8Kernels avx2 = {&utf8ValidateAVX2, &utf8CountCodePointsAVX2};
+	if (kernel == detail::UTF8Kernel::AVX2 && detail::isUTF8KernelSupported(kernel))
+		return avx2;
+	else if (kernel >= detail::UTF8Kernel::SSE && detail::isUTF8KernelSupported(detail::UTF8Kernel::SSE))
+		return sse;
+#endif
+	return scalar;
+}
+
+const UTF8Kernels& getBestKernels()
+{
+	static const UTF8Kernels& kernels = getKernels(detail::UTF8Kernel::AVX2);
+	return kernels;
+}
+
+} // anonymous namespace
+
+namespace detail
+{
+	bool isUTF8KernelSupported(UTF8Kernel kernel)
+	{
+		switch (kernel)
+		{
+		case UTF8Kernel::Scalar:
+			return true;
+		case UTF8Kernel::SSE:
+			return CZ_SSE2 && CpuFeatures::get().ssse3;
+		case UTF8Kernel::AVX2:
+			return CZ_SSE2 && CpuFeatures::get().avx2;
+		default:
+			return false;
+		}
+	}
+
+	bool utf8Validate(UTF8Kernel kernel, const char* str, size_t size)
+	{
+		return getKernels(kernel).validate(reinterpret_cast<const uint8_t*>(str), size);
+	}
+
+	size_t utf8CountCodePoints(UTF8Kernel kernel, const char* str, size_t size)
+	{
+		return getKernels(kernel).countCodePoints(reinterpret_cast<const uint8_t*>(str), size);
+	}
+}
+
+bool utf8Validate(const char* str, size_t size)
+{
+	return getBestKernels().validate(reinterpret_cast<const uint8_t*>(str), size);
+}
+
+size_t utf8CountCodePoints(const char* str, size_t size)
+{
+	return getBestKernels().countCodePoints(reinterpret_cast<const uint8_t*>(str), size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Transcoding
+//
+// These only use SSE2, which is always available on x64, so there is no runtime dispatching.
+// Blocks of ASCII are converted with SIMD, and anything else falls back to scalar code. There are no SSE4/AVX2
+// multibyte transcoding kernels.
+//////////////////////////////////////////////////////////////////////////
+
+size_t utf16LengthFromUtf8(const char* src, size_t size)
+{
+	// One unit per code point, plus another one for 4 bytes sequences (surrogate pairs)
+	size_t res = utf8CountCodePoints(src, size);
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(src);
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i threshold = _mm_set1_epi8(char(0xF0 - 0x80));
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		int mask = _mm_movemask_epi8(_mm_subs_epu8(v, threshold)); // Only >=0xF0 will have the top bit set
+		while (mask)
+		{
+			res++;
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; i < size; i++)
+		res += p[i] >= 0xF0;
+	return res;
+}
+
+size_t utf32LengthFromUtf8(const char* src, size_t size)
+{
+	return utf8CountCodePoints(src, size);
+}
+
+size_t utf8LengthFromUtf16(const char16_t* src, size_t count)
+{
+	size_t res = 0;
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i mask80 = _mm_set1_epi16(static_cast<short>(0xFF80));
+	const __m128i mask800 = _mm_set1_epi16(static_cast<short>(0xF800));
+	const __m128i surrogate = _mm_set1_epi16(static_cast<short>(0xD800));
+	const __m128i three = _mm_set1_epi16(3);
+	while (i + 8 <= count)
+	{
+		// 16 bits counters can hold up to 8192 iterations of 3 bytes
+		__m128i acc = zero;
+		size_t iterations = 0;
+		while (i + 8 <= count && iterations < 8192)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i hi = _mm_and_si128(v, mask800);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(hi, surrogate)))
+			{
+				// Surrogates need to be paired, so let the scalar code deal with this block
+				size_t blockEnd = i + 8;
+				while (i < blockEnd)
+					res += utf8Length(decodeUtf16(src, count, i));
+				continue;
+			}
+			// Each unit is 3 bytes, minus 1 if below 0x800, and minus 1 if below 0x80
+			acc = _mm_add_epi16(acc, three);
+			acc = _mm_add_epi16(acc, _mm_cmpeq_epi16(_mm_and_si128(v, mask80), zero));
+			acc = _mm_add_epi16(acc, _mm_cmpeq_epi16(hi, zero));
+			iterations++;
+			i += 8;
+		}
+		__m128i sum = _mm_madd_epi16(acc, _mm_set1_epi16(1));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+		sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+		res += static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+	}
+#endif
+	while (i < count)
+		res += utf8Length(decodeUtf16(src, count, i));
+	return res;
+}
+
+size_t utf8LengthFromUtf32(const char32_t* src, size_t count)
+{
+	size_t res = 0;
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i signFlip = _mm_set1_epi32(static_cast<int>(0x80000000));
+	const __m128i maxValue = _mm_set1_epi32(static_cast<int>(0x10FFFF ^ 0x80000000));
+	const __m128i surrogateMask = _mm_set1_epi32(static_cast<int>(0xFFFFF800));
+	const __m128i surrogate = _mm_set1_epi32(0xD800);
+	while (i + 4 <= count)
+	{
+		__m128i acc = zero;
+		size_t iterations = 0;
+		while (i + 4 <= count && iterations < 65536)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			__m128i invalid = _mm_or_si128(
+				_mm_cmpgt_epi32(_mm_xor_si128(v, signFlip), maxValue),
+				_mm_cmpeq_epi32(_mm_and_si128(v, surrogateMask), surrogate));
+			if (_mm_movemask_epi8(invalid))
+			{
+				for (size_t blockEnd = i + 4; i < blockEnd; i++)
+					res += utf8Length(sanitizeUtf32(src[i]));
+				continue;
+			}
+			// Each unit is 1 byte, plus 1 for each threshold it passes.
+			acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, _mm_set1_epi32(0x7F)));
+			acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, _mm_set1_epi32(0x7FF)));
+			acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, _mm_set1_epi32(0xFFFF)));
+			res += 4;
+			iterations++;
+			i += 4;
+		}
+		alignas(16) uint32_t lanes[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+		res += size_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+	}
+#endif
+	for (; i < count; i++)
+		res += utf8Length(sanitizeUtf32(src[i]));
+	return res;
+}
+
+size_t utf8ToUtf16(const char* src, size_t size, char16_t* dst)
+{
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(src);
+	char16_t* out = dst;
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 16 <= size)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		if (_mm_movemask_epi8(v) == 0)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpackhi_epi8(v, zero));
+			out += 16;
+			i += 16;
+		}
+		else
+		{
+			// Decode past this block before trying SIMD again
+			size_t blockEnd = i + 16;
+			while (i < blockEnd)
+				utf8ToUtf16One(p, size, i, out);
+		}
+	}
+#endif
+	while (i < size)
+		utf8ToUtf16One(p, size, i, out);
+	return out - dst;
+}
+
+size_t utf8ToUtf32(const char* src, size_t size, char32_t* dst)
+{
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(src);
+	char32_t* out = dst;
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 16 <= size)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		if (_mm_movemask_epi8(v) == 0)
+		{
+			__m128i lo = _mm_unpacklo_epi8(v, zero);
+			__m128i hi = _mm_unpackhi_epi8(v, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), _mm_unpackhi_epi16(hi, zero));
+			out += 16;
+			i += 16;
+		}
+		else
+		{
+			size_t blockEnd = i + 16;
+			while (i < blockEnd)
+				utf8ToUtf32One(p, size, i, out);
+		}
+	}
+#endif
+	while (i < size)
+		utf8ToUtf32One(p, size, i, out);
+	return out - dst;
+}
+
+size_t utf16ToUtf8(const char16_t* src, size_t count, char* dst)
+{
+	char* out = dst;
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i mask = _mm_set1_epi16(static_cast<short>(0xFF80));
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 16 <= count)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), mask), zero)) == 0xFFFF)
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(a, b));
+			out += 16;
+			i += 16;
+		}
+		else
+		{
+			size_t blockEnd = i + 16;
+			while (i < blockEnd)
+				out = encodeUtf8(decodeUtf16(src, count, i), out);
+		}
+	}
+#endif
+	while (i < count)
+		out = encodeUtf8(decodeUtf16(src, count, i), out);
+	return out - dst;
+}
+
+size_t utf32ToUtf8(const char32_t* src, size_t count, char* dst)
+{
+	char* out = dst;
+	size_t i = 0;
+#if CZ_SSE2
+	const __m128i mask = _mm_set1_epi32(static_cast<int>(0xFFFFFF80));
+	const __m128i zero = _mm_setzero_si128();
+	while (i + 16 <= count)
+	{
+		const __m128i* ptr = reinterpret_cast<const __m128i*>(src + i);
+		__m128i a = _mm_loadu_si128(ptr);
+		__m128i b = _mm_loadu_si128(ptr + 1);
+		__m128i c = _mm_loadu_si128(ptr + 2);
+		__m128i d = _mm_loadu_si128(ptr + 3);
+		__m128i all = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(all, mask), zero)) == 0xFFFF)
+		{
+			__m128i ab = _mm_packs_epi32(a, b);
+			__m128i cd = _mm_packs_epi32(c, d);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(ab, cd));
+			out += 16;
+			i += 16;
+		}
+		else
+		{
+			for (size_t blockEnd = i + 16; i < blockEnd; i++)
+				out = encodeUtf8(sanitizeUtf32(src[i]), out);
+		}
+	}
+#endif
+	for (; i < count; i++)
+		out = encodeUtf8(sanitizeUtf32(src[i]), out);
+	return out - dst;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ASCII case folding and comparison
+//
+// Like transcoding, these only use SSE2.
+// Letters are detected with signed comparisons, so any byte >= 0x80 is never considered a letter.
+//////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+inline int firstSetBit(uint32_t v)
+{
+#if defined(_MSC_VER)
+	unsigned long idx;
+	_BitScanForward(&idx, v);
+	return static_cast<int>(idx);
+#else
+	return __builtin_ctz(v);
+#endif
+}
+
+inline uint8_t asciiLower(uint8_t c)
+{
+	return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+inline uint8_t asciiUpper(uint8_t c)
+{
+	return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+#if CZ_SSE2
+// Adds "delta" to the bytes in the [first, last] range
+inline __m128i shiftRange(__m128i v, char first, char last, char delta)
+{
+	__m128i inRange = _mm_and_si128(
+		_mm_cmpgt_epi8(v, _mm_set1_epi8(first - 1)),
+		_mm_cmplt_epi8(v, _mm_set1_epi8(last + 1)));
+	return _mm_add_epi8(v, _mm_and_si128(inRange, _mm_set1_epi8(delta)));
+}
+
+inline __m128i toLowerSSE2(__m128i v)
+{
+	return shiftRange(v, 'A', 'Z', 'a' - 'A');
+}
+#endif
+
+template<bool Lower>
+void asciiConvertCase(const char* src, size_t size, char* dst)
+{
+	const uint8_t* p = reinterpret_cast<const uint8_t*>(src);
+	uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+	size_t i = 0;
+#if CZ_SSE2
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		v = Lower ? shiftRange(v, 'A', 'Z', 'a' - 'A') : shiftRange(v, 'a', 'z', 'A' - 'a');
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+	}
+#endif
+	for (; i < size; i++)
+		out[i] = Lower ? asciiLower(p[i]) : asciiUpper(p[i]);
+}
+
+// Decodes one code point, advancing i
+inline uint32_t nextCodePoint(const uint8_t* p, size_t size, size_t& i)
+{
+	uint8_t c = p[i];
+	if (c < 0x80)
+	{
+		i++;
+		return c;
+	}
+	else if (isContinuation(c))
+	{
+		i++;
+		return 0xFFFD;
+	}
+	return decodeMultiByte(p, size, i);
+}
+
+inline uint32_t foldCase(uint32_t cp)
+{
+	if (cp < 0x80)
+		return asciiLower(static_cast<uint8_t>(cp));
+	// wchar_t is 16 bits on Windows, so anything above that is left as-is
+	if (cp <= static_cast<uint32_t>(std::numeric_limits<wchar_t>::max()))
+		return static_cast<uint32_t>(std::towlower(static_cast<wint_t>(cp)));
+	return cp;
+}
+
+// Compares code point by code point. If "prefix" is true, it's a match if all of b matches the start of a
+bool utf8EqualsNoCaseScalar(const uint8_t* a, size_t aSize, const uint8_t* b, size_t bSize, bool prefix)
+{
+	size_t ia = 0, ib = 0;
+	while (ia < aSize && ib < bSize)
+	{
+		if (foldCase(nextCodePoint(a, aSize, ia)) != foldCase(nextCodePoint(b, bSize, ib)))
+			return false;
+	}
+	return ib == bSize && (prefix || ia == aSize);
+}
+
+bool utf8CompareNoCase(const char* a, size_t aSize, const char* b, size_t bSize, bool prefix)
+{
+	size_t size = std::min(aSize, bSize);
+	size_t i = asciiMismatchNoCase(a, b, size);
+	const uint8_t* pa = reinterpret_cast<const uint8_t*>(a);
+	const uint8_t* pb = reinterpret_cast<const uint8_t*>(b);
+	if (i == size)
+		return prefix ? (bSize <= aSize) : (aSize == bSize);
+
+	// Two different ASCII characters is a definitive mismatch
+	if ((pa[i] | pb[i]) < 0x80)
+		return false;
+
+	// Everything up to the mismatch is the same in both strings (non-ASCII bytes only match if they are exactly
+	// the same), so go back to the start of the code point, and continue from there comparing code points
+	while (i > 0 && (isContinuation(pa[i]) || isContinuation(pb[i])))
+		i--;
+	return utf8EqualsNoCaseScalar(pa + i, aSize - i, pb + i, bSize - i, prefix);
+}
+
+} // anonymous namespace
+
+void asciiToLower(const char* src, size_t size, char* dst)
+{
+	asciiConvertCase<true>(src, size, dst);
+}
+
+void asciiToUpper(const char* src, size_t size, char* dst)
+{
+	asciiConvertCase<false>(src, size, dst);
+}
+
+size_t asciiMismatchNoCase(const char* a, const char* b, size_t size)
+{
+	const uint8_t* pa = reinterpret_cast<const uint8_t*>(a);
+	const uint8_t* pb = reinterpret_cast<const uint8_t*>(b);
+	size_t i = 0;
+#if CZ_SSE2
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i));
+		// Only need to fold the case if the bytes are not exactly the same
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) == 0xFFFF)
+			continue;
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(toLowerSSE2(va), toLowerSSE2(vb)));
+		if (mask != 0xFFFF)
+			return i + firstSetBit(~mask & 0xFFFF);
+	}
+#endif
+	for (; i < size; i++)
+	{
+		if (asciiLower(pa[i]) != asciiLower(pb[i]))
+			return i;
+	}
+	return size;
+}
+
+bool utf8EqualsNoCase(const char* a, size_t aSize, const char* b, size_t bSize)
+{
+	return utf8CompareNoCase(a, aSize, b, bSize, false);
+}
+
+bool utf8StartsWithNoCase(const char* str, size_t strSize, const char* prefix, size_t prefixSize)
+{
+	return utf8CompareNoCase(str, strSize, prefix, prefixSize, true);
+}
+
+} // namespace cz
+
@@ -0,0 +1,105 @@
+/********************************************************************
+	CrazyGaze (http://www.crazygaze.com)
+	Author : Rui Figueira
+	Email  : rui@crazygaze.com
+
+	purpose:
+	Fast UTF-8 validation, counting, transcoding and ASCII case folding.
+	SIMD versions are picked at runtime according to what the CPU supports, with a scalar fallback.
+
+*********************************************************************/
+
+#pragma once
+
+#include "crazygaze/muc/czmuc.h"
+
+namespace cz
+{
+
+/*! \addtogroup String handling
+	@{
+*/
+
+/*! Checks if the specified data is valid UTF-8.
+Overlong encodings, surrogates, code points above U+10FFFF and truncated sequences are all considered invalid.
+*/
+bool utf8Validate(const char* str, size_t size);
+
+/*! Counts the code points in UTF-8 data.
+This only counts the bytes that are not continuation bytes, so the result is only meaningful for valid UTF-8.
+*/
+size_t utf8CountCodePoints(const char* str, size_t size);
+
+//
+// Transcoding
+//
+// The UTF-8 sources are expected to be valid. Invalid, overlong or truncated sequences are replaced with U+FFFD (or
+// skipped, in the case of stray continuation bytes), and never cause writes past the size given by the respective
+// *Length* function.
+//
+// UTF-16 and UTF-32 sources can have unpaired surrogates or invalid code points, which are replaced with U+FFFD.
+//
+// Runs of ASCII are converted with SSE2, but multibyte sequences are decoded/encoded with scalar code.
+//
+
+//! Number of UTF-16 units needed to convert UTF-8 data. Exact for valid UTF-8, and an upper bound otherwise
+size_t utf16LengthFromUtf8(const char* src, size_t size);
+//! Number of UTF-32 units needed to convert UTF-8 data. Exact for valid UTF-8, and an upper bound otherwise
+size_t utf32LengthFromUtf8(const char* src, size_t size);
+//! Exact number of bytes needed to convert UTF-16 data to UTF-8
+size_t utf8LengthFromUtf16(const char16_t* src, size_t count);
+//! Exact number of bytes needed to convert UTF-32 data to UTF-8
+size_t utf8LengthFromUtf32(const char32_t* src, size_t count);
+
+//! Converts UTF-8 to UTF-16, returning the number of units written
+size_t utf8ToUtf16(const char* src, size_t size, char16_t* dst);
+//! Converts UTF-8 to UTF-32, returning the number of units written
+size_t utf8ToUtf32(const char* src, size_t size, char32_t* dst);
+//! Converts UTF-16 to UTF-8, returning the number of bytes written
+size_t utf16ToUtf8(const char16_t* src, size_t count, char* dst);
+//! Converts UTF-32 to UTF-8, returning the number of bytes written
+size_t utf32ToUtf8(const char32_t* src, size_t count, char* dst);
+
+//
+// ASCII case folding and comparison
+//
+// Only ASCII letters are changed. Any other bytes are left untouched, which makes these safe to use with UTF-8,
+// since bytes of multibyte sequences are never in the ASCII range.
+//
+
+//! Converts ASCII letters to lower case. src and dst can be the same
+void asciiToLower(const char* src, size_t size, char* dst);
+//! Converts ASCII letters to upper case. src and dst can be the same
+void asciiToUpper(const char* src, size_t size, char* dst);
+//! Position of the first byte that differs, ignoring ASCII case, or size if there are no differences
+size_t asciiMismatchNoCase(const char* a, const char* b, size_t size);
+
+/*! Case insensitive equality of UTF-8 strings.
+ASCII is compared in bulk, and it only falls back to comparing code point by code point (with towlower) if it
+finds differences in non-ASCII characters.
+*/
+bool utf8EqualsNoCase(const char* a, size_t aSize, const char* b, size_t bSize);
+//! Case insensitive check if a UTF-8 string starts with the specified prefix. Same rules as utf8EqualsNoCase
+bool utf8StartsWithNoCase(const char* str, size_t strSize, const char* prefix, size_t prefixSize);
+
+namespace detail
+{
+	//! UTF-8 validation/counting implementations. Exposed so they can be tested and benchmarked individually
+	enum class UTF8Kernel
+	{
+		Scalar,
+		SSE, // SSSE3
+		AVX2
+	};
+
+	bool isUTF8KernelSupported(UTF8Kernel kernel);
+	bool utf8Validate(UTF8Kernel kernel, const char* str, size_t size);
+	size_t utf8CountCodePoints(UTF8Kernel kernel, const char* str, size_t size);
+}
+
+/*!
+	@}
+*/
+
+} // namespace cz
+
@@ -35,6 +35,8 @@ WindowsConsole::WindowsConsole()
 
 WindowsConsole::~WindowsConsole()
 {
+	// Print anything still pending before freeing the console
+	detach();
 	if (mOwnsConsole && mConsoleHandle!=INVALID_HANDLE_VALUE)
 		FreeConsole();
 }
@@ -36,6 +36,15 @@
 	#define CZ_ARCH CZ_ARCH_32
 #endif
 
+//
+// Find if we can use SSE2 intrinsics (always available on x64)
+//
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+	#define CZ_SSE2 1
+#else
+	#define CZ_SSE2 0
+#endif
+
 //
 // Find if we are building DEBUG or RELEASE
 //
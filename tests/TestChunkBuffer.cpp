@@ -253,4 +253,203 @@ TEST(Reserve_2)
 	CHECK(i == 0x33445566);
 }
 
+
+TEST(CompactEncoding)
+{
+	ChunkBuffer buf(0, 3);
+	buf.setEncoding(ChunkBuffer::Encoding::Compact);
+
+	buf << int(1) << int(-1) << uint32_t(300) << int64_t(-64) << char(0x11) << float(1.5f);
+	CHECK_EQUAL(1 + 1 + 2 + 1 + 1 + 4, buf.calcSize());
+
+	int a, b;
+	uint32_t c;
+	int64_t d;
+	char e;
+	float f;
+	buf >> a >> b >> c >> d >> e >> f;
+	CHECK_EQUAL(1, a);
+	CHECK_EQUAL(-1, b);
+	CHECK_EQUAL(300, c);
+	CHECK_EQUAL(-64, d);
+	CHECK_EQUAL(0x11, e);
+	CHECK_EQUAL(1.5f, f);
+	CHECK_EQUAL(0, buf.calcSize());
+
+	// Limits
+	buf << std::numeric_limits<int64_t>::min() << std::numeric_limits<int64_t>::max()
+		<< std::numeric_limits<uint64_t>::max() << std::numeric_limits<int16_t>::min();
+	int64_t i1, i2;
+	uint64_t u1;
+	int16_t s1;
+	buf >> i1 >> i2 >> u1 >> s1;
+	CHECK(i1 == std::numeric_limits<int64_t>::min());
+	CHECK(i2 == std::numeric_limits<int64_t>::max());
+	CHECK(u1 == std::numeric_limits<uint64_t>::max());
+	CHECK(s1 == std::numeric_limits<int16_t>::min());
+	CHECK_EQUAL(0, buf.calcSize());
+}
+
+template<typename T>
+void testCompactVector(unsigned blockSize, unsigned count)
+{
+	std::vector<T> v1;
+	for (unsigned i = 0; i < count; i++)
+	{
+		// Mostly small numbers, with some big ones in the middle
+		if (i % 7 == 0)
+			v1.push_back(std::numeric_limits<T>::max() - static_cast<T>(i));
+		else if (std::is_signed_v<T> && (i % 3 == 0))
+			v1.push_back(static_cast<T>(-static_cast<int>(i % 100)));
+		else
+			v1.push_back(static_cast<T>(i % 100));
+	}
+
+	ChunkBuffer buf(0, blockSize);
+	buf.setEncoding(ChunkBuffer::Encoding::Compact);
+	buf << v1 << char(0x55);
+	std::vector<T> v2;
+	char c;
+	buf >> v2 >> c;
+	CHECK_EQUAL(v1.size(), v2.size());
+	CHECK(v1 == v2);
+	CHECK_EQUAL(0x55, c);
+	CHECK_EQUAL(0, buf.calcSize());
+}
+
+TEST(CompactVectorSerialization)
+{
+	for (unsigned blockSize : {1, 3, 17, 4096})
+	{
+		for (unsigned count : {0, 1, 15, 16, 17, 100, 1000})
+		{
+			testCompactVector<int16_t>(blockSize, count);
+			testCompactVector<uint16_t>(blockSize, count);
+			testCompactVector<int32_t>(blockSize, count);
+			testCompactVector<uint32_t>(blockSize, count);
+			testCompactVector<int64_t>(blockSize, count);
+			testCompactVector<uint64_t>(blockSize, count);
+		}
+	}
+
+	// Small numbers should take 1 byte each
+	ChunkBuffer buf;
+	buf.setEncoding(ChunkBuffer::Encoding::Compact);
+	std::vector<int> v(100, 5);
+	buf << v;
+	CHECK_EQUAL(1 + 100, buf.calcSize());
+}
+
+TEST(CompactStringSerialization)
+{
+	ChunkBuffer buf(1, 1);
+	buf.setEncoding(ChunkBuffer::Encoding::Compact);
+	buf << "Hello" << std::string(200, 'a');
+	CHECK_EQUAL(1 + 5 + 2 + 200, buf.calcSize());
+	std::string s1, s2;
+	CHECK(buf.tryRead(s1));
+	buf >> s2;
+	CHECK_EQUAL("Hello", s1);
+	CHECK(s2 == std::string(200, 'a'));
+	CHECK(!buf.tryRead(s1));
+}
+
+TEST(MalformedVarint)
+{
+	ChunkBuffer buf;
+	for (int i = 0; i < 11; i++)
+		buf << uint8_t(0xFF);
+	uint64_t v;
+	CHECK_THROW(buf.readVarint(v), std::runtime_error);
+}
+
+
+// Feeds a message one byte at a time, and makes sure the cursor only succeeds once all the data is there
+void testReadCursorStreaming(ChunkBuffer::Encoding encoding)
+{
+	ChunkBuffer src;
+	src.setEncoding(encoding);
+	auto msg = std::make_tuple(int(-5), std::string("Hello"), std::vector<int>{1, 200, -3, 40000});
+	src << msg;
+	unsigned msgSize = src.calcSize();
+
+	ChunkBuffer buf(0, 3);
+	buf.setEncoding(encoding);
+	for (unsigned i = 0; i < msgSize; i++)
+	{
+		decltype(msg) res;
+		ChunkBuffer::ReadCursor cursor(buf);
+		cursor >> res;
+		CHECK(cursor.getStatus() == ChunkBuffer::ReadCursor::Status::NeedMoreData);
+		CHECK_EQUAL(i, buf.calcSize());
+
+		char c;
+		src >> c;
+		buf << c;
+	}
+
+	buf << char(0x55);
+	decltype(msg) res;
+	ChunkBuffer::ReadCursor cursor(buf);
+	cursor >> res;
+	CHECK(cursor.getStatus() == ChunkBuffer::ReadCursor::Status::Ok);
+	CHECK_EQUAL(msgSize, cursor.consumed());
+	CHECK(msg == res);
+	cursor.commit();
+	CHECK_EQUAL(1, buf.calcSize());
+	char c;
+	buf >> c;
+	CHECK_EQUAL(0x55, c);
+	CHECK_EQUAL(0, buf.numBlocks());
+}
+
+TEST(ReadCursor)
+{
+	testReadCursorStreaming(ChunkBuffer::Encoding::Fixed);
+	testReadCursorStreaming(ChunkBuffer::Encoding::Compact);
+
+	// Rewind and failed reads
+	ChunkBuffer buf(0, 2);
+	buf << int(0x11223344);
+	ChunkBuffer::ReadCursor cursor(buf);
+	int64_t i64;
+	int i;
+	CHECK(!cursor.read(i64));
+	CHECK(!cursor.read(i)); // Once failed, all following reads fail
+	cursor.rewind();
+	CHECK(cursor.read(i));
+	CHECK_EQUAL(0x11223344, i);
+	CHECK_EQUAL(4, buf.calcSize());
+	cursor.commit();
+	CHECK_EQUAL(0, buf.calcSize());
+	CHECK_EQUAL(0, buf.numBlocks());
+}
+
+TEST(TryDeserialize)
+{
+	ChunkBuffer buf(0, 4);
+	buf << int(10); // vector size, with no elements yet
+	buf << int(1);
+	auto res = tryDeserialize<std::vector<int>>(buf);
+	CHECK(!res);
+	CHECK(res.exception_is<NotEnoughDataError>());
+	CHECK_EQUAL(8, buf.calcSize());
+
+	for (int i = 2; i <= 10; i++)
+		buf << i;
+	auto res2 = tryDeserialize<std::vector<int>>(buf);
+	CHECK(res2);
+	CHECK_EQUAL(10, res2->size());
+	CHECK_EQUAL(10, (*res2)[9]);
+	CHECK_EQUAL(0, buf.calcSize());
+
+	// Malformed
+	for (int i = 0; i < 11; i++)
+		buf << uint8_t(0xFF);
+	buf.setEncoding(ChunkBuffer::Encoding::Compact);
+	auto res3 = tryDeserialize<uint64_t>(buf);
+	CHECK(res3.exception_is<MalformedDataError>());
+	CHECK_EQUAL(11, buf.calcSize());
+}
+
 }
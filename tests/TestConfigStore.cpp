@@ -0,0 +1,172 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/ConfigStore.h"
+#include "crazygaze/muc/StringUtils.h"
+#include <fstream>
+
+using namespace cz;
+
+SUITE(ConfigStore)
+{
+
+// Writes to a temporary file and renames it, which is how config files are supposed to be replaced
+static void replaceFile(const char* filename, const std::string& contents)
+{
+	std::string tmp = std::string(filename) + ".tmp";
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		f << contents;
+	}
+#if CZ_PLATFORM == CZ_PLATFORM_WIN32
+	// std::rename fails on Windows if the destination exists
+	MoveFileExW(widen(tmp).c_str(), widen(filename).c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+	std::rename(tmp.c_str(), filename);
+#endif
+}
+
+static bool waitForVersion(const ConfigStore& store, uint64_t version)
+{
+	auto start = std::chrono::steady_clock::now();
+	while (store.getVersion() < version)
+	{
+		if (std::chrono::steady_clock::now() - start > std::chrono::seconds(5))
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+TEST(Lookups)
+{
+	const char* filename = "TestConfigStore_Lookups.ini";
+	replaceFile(filename, "top=1\n[Server]\nport=8080\nname=main\nratio=0.5\nenabled=true\nempty=\n"
+	                      "[Client]\ntimeout=30\n[Server]\nextra=1\nport=9000\n");
+	ConfigStore store(filename, false);
+	auto snapshot = store.getSnapshot();
+	CHECK_EQUAL(uint64_t(1), snapshot->getVersion());
+	CHECK_EQUAL(1, snapshot->getInt("", "top"));
+	CHECK_EQUAL(8080, snapshot->getInt("Server", "port"));
+	CHECK_EQUAL("main", snapshot->getString("Server", "name"));
+	CHECK_EQUAL(0.5f, snapshot->getFloat("Server", "ratio"));
+	CHECK(snapshot->getBool("Server", "enabled"));
+	CHECK_EQUAL(30, snapshot->getInt("Client", "timeout"));
+	// Duplicated sections are merged
+	CHECK_EQUAL(1, snapshot->getInt("Server", "extra"));
+	// Defaults
+	CHECK(snapshot->has("Server", "empty"));
+	CHECK_EQUAL(5, snapshot->getInt("Server", "empty", 5));
+	CHECK_EQUAL("def", snapshot->getString("Server", "nothing", "def"));
+	CHECK_EQUAL(7, snapshot->getInt("Nothing", "port", 7));
+	CHECK(!snapshot->has("Client", "port"));
+
+	// Explicit reload
+	replaceFile(filename, "[Server]\nport=1\n");
+	CHECK(store.reload());
+	CHECK_EQUAL(uint64_t(2), store.getVersion());
+	CHECK_EQUAL(1, store.getSnapshot()->getInt("Server", "port"));
+	// Old snapshots are still valid, even if the file is changed in place
+	CHECK_EQUAL(8080, snapshot->getInt("Server", "port"));
+	{
+		std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+		f << "[Server]\nport=2\n";
+	}
+	CHECK_EQUAL(8080, snapshot->getInt("Server", "port"));
+	CHECK_EQUAL(1, store.getSnapshot()->getInt("Server", "port"));
+
+	// If the file can't be loaded, the current snapshot is kept
+	std::remove(filename);
+	CHECK(!store.reload());
+	CHECK_EQUAL(uint64_t(2), store.getSnapshot()->getVersion());
+
+	ConfigStore missing("TestConfigStore_DoesNotExist.ini", false);
+	CHECK_EQUAL(uint64_t(0), missing.getVersion());
+	CHECK_EQUAL(3, missing.getSnapshot()->getInt("Server", "port", 3));
+}
+
+TEST(Watch)
+{
+	const char* filename = "TestConfigStore_Watch.ini";
+	replaceFile(filename, "[Server]\nport=1\n");
+	ConfigStore store(filename);
+	ConfigStore::Reader reader(store);
+	CHECK_EQUAL(1, reader.get().getInt("Server", "port"));
+
+	// Unrelated files in the same folder don't cause a reload
+	replaceFile("TestConfigStore_Other.ini", "[Server]\nport=100\n");
+	std::remove("TestConfigStore_Other.ini");
+
+	replaceFile(filename, "[Server]\nport=2\n");
+	CHECK(waitForVersion(store, 2));
+	CHECK_EQUAL(2, reader.get().getInt("Server", "port"));
+
+	// Writing in place also works, as long as it's not read halfway through
+	{
+		std::ofstream f(filename, std::ios::binary | std::ios::app);
+		f << "extra=3\n";
+	}
+	CHECK(waitForVersion(store, 3));
+	CHECK_EQUAL(3, reader.get().getInt("Server", "extra"));
+	CHECK_EQUAL(uint64_t(3), reader.get().getVersion());
+	std::remove(filename);
+}
+
+TEST(Threads)
+{
+	const char* filename = "TestConfigStore_Threads.ini";
+	replaceFile(filename, "[A]\nx=0\ny=0\n");
+	ConfigStore store(filename, false);
+	std::atomic<bool> finish{false};
+	std::atomic<int> errors{0};
+
+	// Readers always see x and y from the same file
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t++)
+	{
+		readers.emplace_back([&] {
+			ConfigStore::Reader reader(store);
+			while (!finish)
+			{
+				const ConfigSnapshot& s = reader.get();
+				if (s.getInt("A", "x") != s.getInt("A", "y"))
+					errors++;
+			}
+		});
+	}
+
+	for (int i = 1; i <= 50; i++)
+	{
+		replaceFile(filename, "[A]\nx=" + std::to_string(i) + "\ny=" + std::to_string(i) + "\n");
+		CHECK(store.reload());
+	}
+	finish = true;
+	for (auto&& t : readers)
+		t.join();
+	CHECK_EQUAL(0, errors.load());
+	CHECK_EQUAL(50, store.getSnapshot()->getInt("A", "x"));
+	std::remove(filename);
+}
+
+#if CZMUC_BENCHMARKS
+TEST(Benchmark)
+{
+	const char* filename = "TestConfigStore_Benchmark.ini";
+	std::string contents = "[Server]\n";
+	for (int i = 0; i < 1000; i++)
+		contents += "entry" + std::to_string(i) + "=" + std::to_string(i) + "\n";
+	replaceFile(filename, contents);
+	ConfigStore store(filename, false);
+	ConfigStore::Reader reader(store);
+
+	const int count = 1000000;
+	int64_t sum = 0;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		sum += reader.get().getInt("Server", "entry500");
+	double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	CHECK_EQUAL(int64_t(count) * 500, sum);
+	printf("ConfigStore: %.1f ns per lookup\n", secs * 1e9 / count);
+	std::remove(filename);
+}
+#endif
+
+}
@@ -0,0 +1,233 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/FileLogOutput.h"
+#include "crazygaze/muc/Gzip.h"
+
+using namespace cz;
+
+CZ_DECLARE_LOG_CATEGORY(logTestFileLogOutput, Log, Verbose)
+CZ_DEFINE_LOG_CATEGORY(logTestFileLogOutput)
+
+SUITE(FileLogOutput)
+{
+
+static std::string readFile(const std::string& name)
+{
+	std::ifstream f(name, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+static std::string readSegment(const std::string& name)
+{
+	std::string data = readFile(name);
+	if (name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0)
+	{
+		auto res = gzipDecompress(data.data(), data.size());
+		return std::string(res.begin(), res.end());
+	}
+	return data;
+}
+
+// Checks if "str" has all the lines "Line <first>" to "Line <last>", in order
+static bool hasLines(const std::string& str, int first, int last)
+{
+	size_t pos = 0;
+	for (int i = first; i <= last; i++)
+	{
+		std::string line = "logTestFileLogOutput: LOG: Line " + std::to_string(i) + "\n";
+		pos = str.find(line, pos);
+		if (pos == std::string::npos)
+			return false;
+		pos += line.size();
+	}
+	return true;
+}
+
+static void removeFiles(const char* filename)
+{
+	std::remove(filename);
+	for (int i = 1; i < 1000; i++)
+	{
+		std::string name = std::string(filename) + "." + std::to_string(i);
+		std::remove(name.c_str());
+		std::remove((name + ".gz").c_str());
+	}
+}
+
+TEST(Basic)
+{
+	const char* filename = "TestFileLogOutput_Basic.log";
+	removeFiles(filename);
+	{
+		FileLogOutput out(filename);
+		auto reader = out.createTailReader();
+		std::string tail;
+		CHECK_EQUAL(size_t(0), reader.read(tail));
+
+		CZ_LOG(logTestFileLogOutput, Log, "Line %d", 0);
+		LogOutput::flushAll();
+		CHECK(reader.read(tail) > 0);
+		CHECK(hasLines(tail, 0, 0));
+
+		CZ_LOG(logTestFileLogOutput, Log, "Line %d", 1);
+		LogOutput::flushAll();
+		auto fromEnd = out.createTailReader(true);
+		CZ_LOG(logTestFileLogOutput, Log, "Line %d", 2);
+		LogOutput::flushAll();
+
+		reader.read(tail);
+		CHECK(hasLines(tail, 0, 2));
+		std::string tail2;
+		fromEnd.read(tail2);
+		CHECK(!hasLines(tail2, 1, 1));
+		CHECK(hasLines(tail2, 2, 2));
+		CHECK(out.getSegments().empty());
+	}
+	CHECK(hasLines(readFile(filename), 0, 2));
+	removeFiles(filename);
+}
+
+TEST(SizeRotation)
+{
+	const char* filename = "TestFileLogOutput_SizeRotation.log";
+	removeFiles(filename);
+	const int count = 2000;
+	std::string all;
+	{
+		FileLogOutput::Rotation rotation;
+		rotation.maxSize = 4096;
+		rotation.compress = false;
+		FileLogOutput out(filename, rotation);
+		auto reader = out.createTailReader();
+		std::string tail;
+		for (int i = 0; i < count; i++)
+		{
+			CZ_LOG(logTestFileLogOutput, Log, "Line %d", i);
+			if (i % 50 == 0)
+			{
+				LogOutput::flushAll();
+				reader.read(tail);
+			}
+		}
+		LogOutput::flushAll();
+		reader.read(tail);
+		CHECK(hasLines(tail, 0, count - 1));
+		CHECK_EQUAL(0, reader.getSkippedSegments());
+
+		auto segments = out.getSegments();
+		CHECK(segments.size() > 1);
+		for (auto&& s : segments)
+		{
+			std::string data = readSegment(s);
+			// A batch bigger than maxSize is never split, but these are smaller
+			CHECK(data.size() <= rotation.maxSize);
+			all += data;
+		}
+	}
+	all += readFile(filename);
+	CHECK(hasLines(all, 0, count - 1));
+	removeFiles(filename);
+}
+
+TEST(ReadWhileRotating)
+{
+	const char* filename = "TestFileLogOutput_ReadWhileRotating.log";
+	removeFiles(filename);
+	const int count = 20000;
+	std::string all;
+	std::string tail;
+	{
+		FileLogOutput::Rotation rotation;
+		rotation.maxSize = 2048;
+		rotation.compress = false;
+		FileLogOutput out(filename, rotation);
+		auto reader = out.createTailReader();
+		std::atomic<bool> finished(false);
+		std::thread th([&] {
+			while (!finished)
+				reader.read(tail);
+		});
+		for (int i = 0; i < count; i++)
+		{
+			CZ_LOG(logTestFileLogOutput, Log, "Line %d", i);
+			if (i % 10 == 0)
+				LogOutput::flushAll();
+		}
+		LogOutput::flushAll();
+		finished = true;
+		th.join();
+		reader.read(tail);
+		CHECK_EQUAL(0, reader.getSkippedSegments());
+
+		for (auto&& s : out.getSegments())
+			all += readSegment(s);
+	}
+	all += readFile(filename);
+	// Must have read everything exactly once, even if the file was rotated in the middle of a read
+	CHECK(hasLines(tail, 0, count - 1));
+	CHECK(tail == all);
+	removeFiles(filename);
+}
+
+TEST(Compression)
+{
+	const char* filename = "TestFileLogOutput_Compression.log";
+	removeFiles(filename);
+	const int count = 2000;
+	{
+		FileLogOutput::Rotation rotation;
+		rotation.maxSize = 8192;
+		rotation.maxSegments = 2;
+		FileLogOutput out(filename, rotation);
+		for (int i = 0; i < count; i++)
+		{
+			CZ_LOG(logTestFileLogOutput, Log, "Line %d", i);
+			if (i % 100 == 0)
+				LogOutput::flushAll();
+		}
+		LogOutput::flushAll();
+		out.rotate();
+		out.waitForCompression();
+
+		auto segments = out.getSegments();
+		CHECK_EQUAL(size_t(2), segments.size());
+		std::string all;
+		for (auto&& s : segments)
+		{
+			CHECK(s.size() > 3 && s.compare(s.size() - 3, 3, ".gz") == 0);
+			all += readSegment(s);
+		}
+		// Only the last segments are kept
+		CHECK(!hasLines(all, 0, 0));
+		CHECK(hasLines(all, count - 10, count - 1));
+		CHECK_EQUAL(std::string(), readFile(filename));
+	}
+	removeFiles(filename);
+}
+
+TEST(TimeRotation)
+{
+	const char* filename = "TestFileLogOutput_TimeRotation.log";
+	removeFiles(filename);
+	{
+		FileLogOutput::Rotation rotation;
+		rotation.maxAge = std::chrono::milliseconds(50);
+		rotation.compress = false;
+		FileLogOutput out(filename, rotation);
+		CZ_LOG(logTestFileLogOutput, Log, "Line %d", 0);
+		LogOutput::flushAll();
+		CZ_LOG(logTestFileLogOutput, Log, "Line %d", 1);
+		LogOutput::flushAll();
+		CHECK(out.getSegments().empty());
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(60));
+		CZ_LOG(logTestFileLogOutput, Log, "Line %d", 2);
+		LogOutput::flushAll();
+		auto segments = out.getSegments();
+		CHECK_EQUAL(size_t(1), segments.size());
+		CHECK(hasLines(readSegment(segments[0]), 0, 1));
+	}
+	CHECK(hasLines(readFile(filename), 2, 2));
+	removeFiles(filename);
+}
+
+}
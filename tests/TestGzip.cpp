@@ -0,0 +1,119 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/Gzip.h"
+#include <fstream>
+
+using namespace cz;
+
+SUITE(Gzip)
+{
+
+static void checkRoundTrip(const std::string& str)
+{
+	auto compressed = gzipCompress(str.data(), str.size());
+	auto decompressed = gzipDecompress(compressed.data(), compressed.size());
+	CHECK_EQUAL(str, std::string(decompressed.begin(), decompressed.end()));
+}
+
+TEST(RoundTrip)
+{
+	checkRoundTrip("");
+	checkRoundTrip("a");
+	checkRoundTrip("Hello World");
+	checkRoundTrip(std::string(100000, 'x'));
+
+	// Random data, which doesn't compress
+	std::mt19937 rng(1);
+	std::string random;
+	for (int i = 0; i < 100000; i++)
+		random += static_cast<char>(rng());
+	checkRoundTrip(random);
+
+	// Something similar to a log file
+	std::string log;
+	for (int i = 0; i < 20000; i++)
+		log += "12:34:56.789: logNet: LOG: Connection " + std::to_string(i % 37) + " received " + std::to_string(i * 13) + " bytes\n";
+	auto compressed = gzipCompress(log.data(), log.size());
+	CHECK(compressed.size() < log.size() / 3);
+	checkRoundTrip(log);
+}
+
+TEST(CompressFile)
+{
+	// Big enough to be compressed in several chunks
+	std::string data;
+	std::mt19937 rng(2);
+	for (int i = 0; i < 30000; i++)
+	{
+		data += "12:34:56.789: logNet: LOG: Connection " + std::to_string(i % 37) + " received " + std::to_string(i * 13) + " bytes\n";
+		if (i % 1000 == 0)
+		{
+			for (int j = 0; j < 5000; j++)
+				data += static_cast<char>(rng());
+		}
+	}
+
+	const char* src = "TestGzip_CompressFile.txt";
+	const char* dst = "TestGzip_CompressFile.txt.gz";
+	{
+		std::ofstream f(src, std::ios::binary | std::ios::trunc);
+		f.write(data.data(), data.size());
+	}
+	CHECK(gzipCompressFile(src, dst));
+
+	std::ifstream f(dst, std::ios::binary);
+	std::string compressed((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+	f.close();
+	CHECK(compressed.size() < data.size() / 2);
+	auto decompressed = gzipDecompress(compressed.data(), compressed.size());
+	CHECK(data == std::string(decompressed.begin(), decompressed.end()));
+
+	CHECK(!gzipCompressFile("TestGzip_DoesNotExist.txt", dst));
+	std::remove(src);
+	std::remove(dst);
+}
+
+TEST(Decompress)
+{
+	// "Hello Hello Hello\n" compressed by gzip -9, with the file name set
+	const uint8_t data1[] = {0x1f, 0x8b, 0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x61, 0x00, 0xf3, 0x48, 0xcd, 0xc9,
+	                         0xc9, 0x57, 0xf0, 0x40, 0x90, 0x5c, 0x00, 0xc5, 0x1a, 0x51, 0x9d, 0x12, 0x00, 0x00, 0x00};
+	auto res = gzipDecompress(data1, sizeof(data1));
+	CHECK_EQUAL(std::string("Hello Hello Hello\n"), std::string(res.begin(), res.end()));
+
+	// Compressed by zlib, using a dynamic Huffman block
+	const uint8_t data2[] = {0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x1d, 0xc7, 0xc1, 0x0d, 0x00, 0x30,
+	                         0x0c, 0x83, 0xc0, 0x59, 0xc1, 0xc9, 0xfe, 0x2b, 0xc4, 0x2d, 0x8f, 0x93, 0x60, 0x20, 0x34, 0xe3,
+	                         0x5a, 0xf8, 0x03, 0x63, 0xd0, 0x47, 0x0a, 0x07, 0xba, 0x66, 0xbe, 0xf7, 0x28, 0x00, 0x00, 0x00};
+	res = gzipDecompress(data2, sizeof(data2));
+	CHECK_EQUAL(std::string("adaacaaaabcbebbcbaaaaabaadbcabbbcabcbcaa"), std::string(res.begin(), res.end()));
+
+	// Corrupted data
+	std::vector<uint8_t> bad(data1, data1 + sizeof(data1));
+	bad[sizeof(data1) - 5] ^= 1;
+	CHECK_THROW(gzipDecompress(bad.data(), bad.size()), std::runtime_error);
+	CHECK_THROW(gzipDecompress(data1, 5), std::runtime_error);
+}
+
+#if CZMUC_BENCHMARKS
+TEST(Benchmark)
+{
+	std::string log;
+	for (int i = 0; i < 200000; i++)
+		log += "12:34:56.789: logNet: LOG: Connection " + std::to_string(i % 37) + " received " + std::to_string(i * 13) + " bytes\n";
+	auto start = std::chrono::high_resolution_clock::now();
+	auto compressed = gzipCompress(log.data(), log.size());
+	double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("Gzip: log text compressed from %d to %d bytes, at %.0f MB/s\n", (int)log.size(), (int)compressed.size(),
+	       log.size() / secs / (1024 * 1024));
+	CHECK(compressed.size() < log.size() / 3);
+}
+#endif
+
+TEST(Crc32)
+{
+	CHECK_EQUAL(uint32_t(0xCBF43926), crc32("123456789", 9));
+	// Incremental
+	CHECK_EQUAL(uint32_t(0xCBF43926), crc32("6789", 4, crc32("12345", 5)));
+}
+
+}
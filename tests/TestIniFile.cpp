@@ -0,0 +1,148 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/IniFile.h"
+#include <fstream>
+
+using namespace cz;
+
+SUITE(IniFile)
+{
+
+static void writeFile(const char* filename, const std::string& contents)
+{
+	std::ofstream f(filename, std::ios::binary);
+	f << contents;
+}
+
+TEST(Parse)
+{
+	const char* filename = "TestIniFile_Parse.ini";
+	writeFile(filename, "\xEF\xBB\xBF"
+	                    "global = 1\r\n"
+	                    "; Comment\n"
+	                    "# Another comment\n"
+	                    "\n"
+	                    "[ Server ]\n"
+	                    "  port = 8080  \n"
+	                    "name=\"  quoted  \"\n"
+	                    "alt='single'\n"
+	                    "ratio = 0.25\n"
+	                    "enabled = True\n"
+	                    "empty =\n"
+	                    "dup = first\n"
+	                    "dup = second\n"
+	                    "[Client]\n"
+	                    "timeout=-30\n"
+	                    "[Server]\n"
+	                    "port = 9000");
+
+	IniFile ini;
+	CHECK(ini.open(filename));
+	CHECK_EQUAL(4, ini.getNumSections());
+	CHECK_EQUAL(1, ini.getSection("")->getEntry("global")->asInt());
+
+	IniFile::Section* server = ini.getSection("Server", false);
+	CHECK(server && server == ini.getSection(1));
+	CHECK_EQUAL(8, server->getNumEntries());
+	CHECK_EQUAL(8080, server->getEntry("port")->asInt());
+	CHECK_EQUAL("  quoted  ", server->getEntry("name")->asString());
+	CHECK_EQUAL("single", server->getEntry("alt")->asStringView());
+	CHECK_EQUAL(0.25f, server->getEntry("ratio")->asFloat());
+	CHECK(server->getEntry("enabled")->asBoolean());
+	CHECK_EQUAL("", server->getEntry("empty")->asStringView());
+	// Duplicates are kept, but lookups find the first
+	CHECK_EQUAL("first", server->getEntry("dup")->asStringView());
+	CHECK_EQUAL("second", server->getEntry(7)->asStringView());
+	CHECK(server->getEntry("nothing", false) == nullptr);
+	CHECK_EQUAL(-30, ini.getSection("Client")->getEntry("timeout")->as<int>());
+	CHECK(ini.getSection("Nothing", false) == nullptr);
+
+	int count = 0;
+	for (auto&& e : *server)
+		count += e.getName().size() ? 1 : 0;
+	CHECK_EQUAL(8, count);
+
+	std::remove(filename);
+}
+
+TEST(Values)
+{
+	const char* filename = "TestIniFile_Values.ini";
+	// The last line is invalid, and is logged as a warning
+	writeFile(filename, "[A]\nvalue=abc\nnumber=+12xyz\nbad=xyz\nnot a value");
+	IniFile ini;
+	CHECK(ini.open(filename));
+	// The values are copied, so the file isn't needed after opening
+	CHECK_EQUAL(0, std::remove(filename));
+	IniFile::Section* a = ini.getSection("A");
+	CHECK_EQUAL(12, a->getEntry("number")->asInt());
+	CHECK_EQUAL(0, a->getEntry("bad")->asInt());
+	CHECK_EQUAL(0.0f, a->getEntry("bad")->asFloat());
+
+	// Changing values
+	a->setValue("value", 10);
+	CHECK_EQUAL("10", a->getEntry("value")->asStringView());
+	a->setValue("value", 0.1f);
+	CHECK_EQUAL("0.1", a->getEntry("value")->asString());
+	CHECK_EQUAL(0.1f, a->getEntry("value")->asFloat());
+	a->setValue("value", "text");
+	CHECK_EQUAL(std::string("text"), a->getEntry("value")->as<const char*>());
+	a->add("value", -5);
+	CHECK_EQUAL("text", a->getEntry("value")->asStringView());
+
+	// Defaults are only used if the value is empty or new
+	CHECK_EQUAL(std::string("abc"), ini.getValue("A", "new", "abc"));
+	CHECK_EQUAL(std::string("abc"), ini.getValue("A", "new", "def"));
+	CHECK_EQUAL(true, ini.getValue("B", "flag", true));
+	CHECK_EQUAL(5, ini.getValue("B", "count", 5));
+	CHECK(ini.getSection("B", false) != nullptr);
+
+	CHECK(!ini.open("TestIniFile_DoesNotExist.ini"));
+}
+
+#if CZMUC_BENCHMARKS
+TEST(Benchmark)
+{
+	const char* filename = "TestIniFile_Benchmark.ini";
+	const int numSections = 100;
+	const int numEntries = 500;
+	{
+		std::string contents;
+		for (int s = 0; s < numSections; s++)
+		{
+			contents += "[Section" + std::to_string(s) + "]\n";
+			for (int e = 0; e < numEntries; e++)
+				contents += "entry" + std::to_string(e) + " = " + std::to_string(s * numEntries + e) + "\n";
+		}
+		writeFile(filename, contents);
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	IniFile ini;
+	CHECK(ini.open(filename));
+	double loadSecs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::vector<std::string> sectionNames, entryNames;
+	for (int s = 0; s < numSections; s++)
+		sectionNames.push_back("Section" + std::to_string(s));
+	for (int e = 0; e < numEntries; e++)
+		entryNames.push_back("entry" + std::to_string(e));
+
+	int64_t sum = 0;
+	start = std::chrono::high_resolution_clock::now();
+	for (int s = 0; s < numSections; s++)
+	{
+		IniFile::Section* section = ini.getSection(sectionNames[s].c_str(), false);
+		for (int e = 0; e < numEntries; e++)
+			sum += section->getEntry(entryNames[e].c_str(), false)->asInt();
+	}
+	double lookupSecs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	int total = numSections * numEntries;
+	CHECK_EQUAL(int64_t(total) * (total - 1) / 2, sum);
+	printf("IniFile: %d entries loaded in %.2f ms. Lookup and conversion: %.0f ns per entry\n", total,
+	       loadSecs * 1000, lookupSecs * 1e9 / total);
+	std::remove(filename);
+}
+#endif
+
+}
@@ -0,0 +1,89 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/InternedString.h"
+#include "crazygaze/muc/Logging.h"
+
+using namespace cz;
+
+SUITE(InternedString)
+{
+	TEST(Basic)
+	{
+		InternedString empty;
+		CHECK(empty.empty());
+		CHECK(empty == InternedString(""));
+		CHECK_EQUAL(std::string(""), empty.c_str());
+
+		InternedString a("Hello");
+		InternedString b(std::string("Hello"));
+		InternedString c("Hello World", 5);
+		InternedString d("World");
+		CHECK(a == b);
+		CHECK(a == c);
+		CHECK(a != d);
+		CHECK(a == "Hello");
+		CHECK(a != "World");
+		CHECK(a.c_str() == b.c_str()); // Same entry
+		CHECK_EQUAL(size_t(5), a.size());
+		CHECK_EQUAL(a.hash(), c.hash());
+		CHECK_EQUAL(size_t(a.hash()), std::hash<InternedString>()(b));
+		CHECK(a < d);
+		CHECK(!(d < a));
+		CHECK(!(a < b));
+
+		// Strings with embedded zeros are different strings
+		CHECK(InternedString("ab\0c", 4) != InternedString("ab"));
+
+		InternedString found;
+		CHECK(InternedString::find("Hello", found));
+		CHECK(found == a);
+		CHECK(!InternedString::find("This was never interned", found));
+		CHECK(found == a);
+	}
+
+	TEST(Threads)
+	{
+		const int numThreads = 8;
+		const int numStrings = 2000;
+		std::vector<std::vector<InternedString>> results(numThreads);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.emplace_back([&results, t]()
+			{
+				// Each thread interns the same strings, in a different order
+				for (int i = 0; i < numStrings; i++)
+				{
+					int idx = (i * (t + 1) * 7) % numStrings;
+					results[t].push_back(InternedString("ThreadsTest_" + std::to_string(idx)));
+				}
+			});
+		}
+		for (auto&& t : threads)
+			t.join();
+
+		std::vector<InternedString> expected;
+		for (int i = 0; i < numStrings; i++)
+		{
+			std::string str = "ThreadsTest_" + std::to_string(i);
+			expected.push_back(InternedString(str));
+			CHECK(expected.back() == str.c_str());
+		}
+
+		for (int t = 0; t < numThreads; t++)
+		{
+			for (int i = 0; i < numStrings; i++)
+			{
+				int idx = (i * (t + 1) * 7) % numStrings;
+				CHECK(results[t][i] == expected[idx]);
+			}
+		}
+	}
+
+	TEST(LogCategoryFind)
+	{
+		CHECK(LogCategoryBase::find("logDefault") == &logDefault);
+		CHECK(LogCategoryBase::find(std::string("logDefault")) == &logDefault);
+		CHECK(LogCategoryBase::find("logSomethingThatDoesntExist") == nullptr);
+	}
+}
+
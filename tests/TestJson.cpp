@@ -0,0 +1,249 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/Json.h"
+
+using namespace cz;
+
+SUITE(Json)
+{
+
+TEST(Writer)
+{
+	std::string out = "prefix:";
+	JsonWriter w(out);
+	w.beginObject()
+	    .field("id", 10)
+	    .field("name", "Bob")
+	    .key("tags").beginArray().value("a").value(std::string("b")).beginObject().endObject().endArray()
+	    .key("nested").beginObject().field("ok", true).key("nothing").null().endObject()
+	    .key("raw").raw("[1,2]", 5)
+	    .endObject();
+	CHECK_EQUAL("prefix:{\"id\":10,\"name\":\"Bob\",\"tags\":[\"a\",\"b\",{}],\"nested\":{\"ok\":true,\"nothing\":null},"
+	            "\"raw\":[1,2]}",
+	            out);
+
+	// Top level values in a sequence are separated by commas, the same as array elements
+	out.clear();
+	JsonWriter w2(out);
+	w2.value(1).value(2.5);
+	CHECK_EQUAL("1,2.5", out);
+}
+
+TEST(Numbers)
+{
+	CHECK_EQUAL("0", to_json(0));
+	CHECK_EQUAL("-123", to_json(-123));
+	CHECK_EQUAL("18446744073709551615", to_json(uint64_t(18446744073709551615ull)));
+	CHECK_EQUAL("-9223372036854775808", to_json(std::numeric_limits<int64_t>::min()));
+	CHECK_EQUAL("0.1", to_json(0.1));
+	CHECK_EQUAL("1e-10", to_json(1e-10));
+	CHECK_EQUAL("0.25", to_json(0.25f));
+	CHECK_EQUAL("null", to_json(std::numeric_limits<double>::quiet_NaN()));
+	CHECK_EQUAL("null", to_json(std::numeric_limits<double>::infinity()));
+	CHECK_EQUAL("true", to_json(true));
+	CHECK_EQUAL("false", to_json(false));
+
+	// Doubles are written with the shortest representation that reads back to the same value
+	double v = 1.0 / 3.0;
+	CHECK_EQUAL(v, strtod(to_json(v).c_str(), nullptr));
+}
+
+// Escapes a character at a time, to compare with the SIMD version
+static std::string escapeSlow(const std::string& str)
+{
+	std::string res = "\"";
+	for (unsigned char c : str)
+	{
+		char buf[8];
+		switch (c)
+		{
+		case '\b': res += "\\b"; break;
+		case '\f': res += "\\f"; break;
+		case '\n': res += "\\n"; break;
+		case '\r': res += "\\r"; break;
+		case '\t': res += "\\t"; break;
+		case '"': res += "\\\""; break;
+		case '\\': res += "\\\\"; break;
+		default:
+			if (c < 0x20)
+			{
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				res += buf;
+			}
+			else
+				res += static_cast<char>(c);
+		}
+	}
+	return res + "\"";
+}
+
+TEST(Strings)
+{
+	CHECK_EQUAL("\"\"", to_json(""));
+	CHECK_EQUAL("\"Hello World\"", to_json("Hello World"));
+	CHECK_EQUAL("\"a\\\"b\\\\c\\nd\\te\\u0001\\u001f\"", to_json("a\"b\\c\nd\te\x01\x1f"));
+	// UTF-8 is not escaped
+	CHECK_EQUAL("\"\xC3\xA9\xE2\x82\xAC\"", to_json("\xC3\xA9\xE2\x82\xAC"));
+	// Embedded nulls, with the std::string version
+	CHECK_EQUAL("\"a\\u0000b\"", to_json(std::string("a\0b", 3)));
+
+	// Escapes at every position, to test the boundaries of the SIMD blocks
+	for (size_t size = 0; size < 70; size++)
+	{
+		for (size_t pos = 0; pos < size; pos++)
+		{
+			for (char c : {'"', '\\', '\n', '\x1f', '\x7f', '\x80', ' '})
+			{
+				std::string str(size, 'x');
+				str[pos] = c;
+				CHECK_EQUAL(escapeSlow(str), to_json(str));
+			}
+		}
+	}
+}
+
+TEST(Containers)
+{
+	CHECK_EQUAL("[]", to_json(std::vector<int>()));
+	CHECK_EQUAL("[1,2,3]", to_json(std::vector<int>{1, 2, 3}));
+	CHECK_EQUAL("[[\"a\"],[]]", to_json(std::vector<std::vector<std::string>>{{"a"}, {}}));
+	CHECK_EQUAL("{\"first\":1,\"second\":[true]}", to_json(std::make_pair(1, std::vector<bool>{true})));
+	CHECK_EQUAL("[{\"first\":\"a\",\"second\":0.5}]", to_json(std::vector<std::pair<std::string, double>>{{"a", 0.5}}));
+
+	std::string out;
+	JsonWriter w(out);
+	w.beginObject().field("list", std::vector<int>{1, 2}).endObject();
+	CHECK_EQUAL("{\"list\":[1,2]}", out);
+}
+
+#if CZMUC_BENCHMARKS
+TEST(Benchmark)
+{
+	// Something similar to what logs and RPC payloads have
+	std::string text;
+	while (text.size() < 1000)
+		text += "Connection from 192.168.1.10:5000 accepted, \"session\" id 12345\t";
+
+	const int count = 20000;
+	std::string out;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+	{
+		out.clear();
+		JsonWriter::appendString(out, text.c_str(), text.size());
+	}
+	double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("JsonWriter string escaping: %.0f MB/s\n", count * text.size() / secs / (1024 * 1024));
+
+	std::vector<int> numbers;
+	for (int i = 0; i < 1000; i++)
+		numbers.push_back(i * 7919);
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count / 10; i++)
+	{
+		out.clear();
+		to_json(out, numbers);
+	}
+	secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("JsonWriter numbers: %.0f ns per number\n", secs * 1e9 / (count / 10 * numbers.size()));
+	CHECK(out.size() > numbers.size());
+}
+#endif
+
+struct ReflectedInner
+{
+	int x = 0;
+	double y = 0;
+};
+CZ_JSON_FIELDS(ReflectedInner, x, y)
+
+struct ReflectedOuter
+{
+	std::string name;
+	bool enabled = false;
+	uint8_t small = 0;
+	ReflectedInner inner;
+	std::vector<ReflectedInner> list;
+	std::vector<std::string> tags;
+};
+CZ_JSON_FIELDS(ReflectedOuter, name, enabled, small, inner, list, tags)
+
+TEST(Reflection)
+{
+	ReflectedOuter a;
+	a.name = "Some \"name\"";
+	a.enabled = true;
+	a.small = 200;
+	a.inner = {1, 0.5};
+	a.list = {{2, 1.5}, {3, -2}};
+	a.tags = {"a", "b"};
+
+	std::string json = to_json(a);
+	CHECK_EQUAL("{\"name\":\"Some \\\"name\\\"\",\"enabled\":true,\"small\":200,\"inner\":{\"x\":1,\"y\":0.5},"
+	            "\"list\":[{\"x\":2,\"y\":1.5},{\"x\":3,\"y\":-2}],\"tags\":[\"a\",\"b\"]}",
+	            json);
+
+	// Works as a value in the writer, and appends
+	std::string out = "[";
+	JsonWriter w(out);
+	w.value(a.inner).value(a.inner);
+	out += ']';
+	CHECK_EQUAL("[{\"x\":1,\"y\":0.5},{\"x\":1,\"y\":0.5}]", out);
+
+	JsonDocument doc;
+	CHECK(doc.parse(json));
+	ReflectedOuter b;
+	CHECK(from_json(doc.getRoot(), b));
+	CHECK_EQUAL(json, to_json(b));
+
+	// Unknown keys are ignored, and missing fields are left untouched
+	CHECK(doc.parse(std::string("{\"x\":7,\"unknown\":[1,2]}")));
+	ReflectedInner c{1, 2.5};
+	CHECK(from_json(doc.getRoot(), c));
+	CHECK_EQUAL(7, c.x);
+	CHECK_EQUAL(2.5, c.y);
+
+	// Type mismatches and out of range fail, but the rest is still read
+	CHECK(doc.parse(std::string("{\"name\":10,\"small\":256,\"enabled\":true}")));
+	ReflectedOuter d;
+	CHECK(!from_json(doc.getRoot(), d));
+	CHECK_EQUAL("", d.name);
+	CHECK_EQUAL(0, d.small);
+	CHECK(d.enabled);
+	CHECK(doc.parse(std::string("[]")));
+	CHECK(!from_json(doc.getRoot(), d));
+}
+
+#if CZMUC_BENCHMARKS
+TEST(ReflectionBenchmark)
+{
+	ReflectedOuter a;
+	a.name = "Some name";
+	a.enabled = true;
+	a.small = 1;
+	for (int i = 0; i < 10; i++)
+		a.list.push_back({i, i * 0.5});
+
+	const int count = 100000;
+	std::string out;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+	{
+		out.clear();
+		to_json(out, a);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("CZ_JSON_FIELDS to_json: %.0f ns per object (%zu bytes)\n", secs * 1e9 / count, out.size());
+
+	JsonDocument doc;
+	CHECK(doc.parse(out));
+	ReflectedOuter b;
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		from_json(doc.getRoot(), b);
+	secs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("CZ_JSON_FIELDS from_json: %.0f ns per object\n", secs * 1e9 / count);
+	CHECK_EQUAL(out, to_json(b));
+}
+#endif
+
+}
@@ -0,0 +1,58 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/JsonLinesLogOutput.h"
+
+using namespace cz;
+
+CZ_DECLARE_LOG_CATEGORY(logTestJsonLines, Log, Verbose)
+CZ_DEFINE_LOG_CATEGORY(logTestJsonLines)
+
+SUITE(JsonLinesLogOutput)
+{
+
+static std::vector<std::string> readLines(const char* filename, const char* category)
+{
+	std::ifstream f(filename, std::ios::binary);
+	std::vector<std::string> res;
+	std::string line;
+	std::string cat = std::string("\"category\":\"") + category + "\"";
+	while (std::getline(f, line))
+	{
+		if (line.find(cat) != std::string::npos)
+			res.push_back(line);
+	}
+	return res;
+}
+
+TEST(Basic)
+{
+	const char* filename = "TestJsonLinesLogOutput.jsonl";
+	{
+		JsonLinesLogOutput out(filename);
+		CZ_LOG_DEFERRED(logTestJsonLines, Warning, "Hello \"%s\"\n", "World", logField("port", 80),
+		                logField("host", "a\tb"), logField("ratio", 0.25), logField("ok", false),
+		                logField("big", uint64_t(18446744073709551615ull)));
+		CZ_LOG(logTestJsonLines, Log, "No fields");
+	}
+
+	auto lines = readLines(filename, "logTestJsonLines");
+	CHECK_EQUAL(size_t(2), lines.size());
+
+	// {"time":"2026-10-18T20:15:30.123Z",...
+	int year = 0, month = 0, day = 0, h = -1, m = -1, s = -1, ms = -1;
+	CHECK_EQUAL(7, sscanf(lines[0].c_str(), "{\"time\":\"%4d-%2d-%2dT%2d:%2d:%2d.%3dZ\",", &year, &month, &day, &h, &m,
+	                      &s, &ms));
+	CHECK(year >= 2020 && month >= 1 && month <= 12 && day >= 1 && day <= 31 && h >= 0 && h < 24 && ms >= 0);
+
+	std::string expected = "\"level\":\"Warning\",\"category\":\"logTestJsonLines\",\"file\":";
+	CHECK(lines[0].find(expected) == 35);
+	CHECK(lines[0].find(",\"msg\":\"Hello \\\"World\\\"\\n\",\"fields\":{\"port\":80,\"host\":\"a\\tb\",\"ratio\":0.25,"
+	                    "\"ok\":false,\"big\":18446744073709551615}}") != std::string::npos);
+	CHECK(lines[0].back() == '}');
+	CHECK(lines[1].find("\"level\":\"Log\"") != std::string::npos);
+	CHECK(lines[1].find(",\"msg\":\"No fields\"}") != std::string::npos);
+	CHECK(lines[1].find("\"fields\":") == std::string::npos);
+
+	std::remove(filename);
+}
+
+}
@@ -0,0 +1,302 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/JsonReader.h"
+#include "crazygaze/muc/Json.h"
+
+using namespace cz;
+
+SUITE(JsonReader)
+{
+
+// Writes a parsed value back to JSON, so the tests can compare whole documents
+static void writeValue(JsonWriter& w, const JsonValue& v)
+{
+	switch (v.getType())
+	{
+	case JsonValue::Type::Null: w.null(); break;
+	case JsonValue::Type::Bool: w.value(v.getBool()); break;
+	case JsonValue::Type::Int: w.value(v.getInt()); break;
+	case JsonValue::Type::Uint: w.value(v.getUint()); break;
+	case JsonValue::Type::Double: w.value(v.getDouble()); break;
+	case JsonValue::Type::String: w.value(v.getString().data(), v.getString().size()); break;
+	case JsonValue::Type::Array:
+		w.beginArray();
+		for (auto&& e : v.getElements())
+			writeValue(w, e);
+		w.endArray();
+		break;
+	case JsonValue::Type::Object:
+		w.beginObject();
+		for (auto&& m : v.getMembers())
+		{
+			w.key(m.key.data(), m.key.size());
+			writeValue(w, m.value);
+		}
+		w.endObject();
+		break;
+	}
+}
+
+static std::string reparse(const std::string& json)
+{
+	JsonDocument doc;
+	if (!doc.parse(json))
+		return std::string("error: ") + doc.getError().message;
+	std::string out;
+	JsonWriter w(out);
+	writeValue(w, doc.getRoot());
+	return out;
+}
+
+TEST(Document)
+{
+	std::string json = " { \"id\" : 10, \"name\":\"Bob\", \"ratio\":0.5, \"tags\":[\"a\", [], {}, null, true, false],\n"
+	                   "\t\"nested\":{\"big\":18446744073709551615, \"neg\":-9223372036854775808, \"huge\":1e300} } ";
+
+	JsonDocument doc;
+	CHECK(doc.parse(json));
+	const JsonValue& root = doc.getRoot();
+	CHECK(root.isObject());
+	CHECK_EQUAL(size_t(5), root.size());
+	CHECK_EQUAL(10, root["id"].getInt());
+	CHECK_EQUAL("Bob", root["name"].getString());
+	CHECK_EQUAL(std::string("Bob"), root["name"].c_str());
+	CHECK_EQUAL(0.5, root["ratio"].getDouble());
+	const JsonValue& tags = root["tags"];
+	CHECK_EQUAL(size_t(6), tags.size());
+	CHECK_EQUAL("a", tags[0].getString());
+	CHECK(tags[1].isArray() && tags[1].size() == 0);
+	CHECK(tags[2].isObject() && tags[2].size() == 0);
+	CHECK(tags[3].isNull());
+	CHECK(tags[4].getBool() == true);
+	CHECK(tags[5].getBool() == false);
+	CHECK(root["nested"]["big"].getType() == JsonValue::Type::Uint);
+	CHECK_EQUAL(18446744073709551615ull, root["nested"]["big"].getUint());
+	CHECK_EQUAL(std::numeric_limits<int64_t>::min(), root["nested"]["neg"].getInt());
+	CHECK_EQUAL(1e300, root["nested"]["huge"].getDouble());
+	// Missing members can be chained
+	CHECK(root["nothing"]["else"].isNull());
+	CHECK(root.find("nothing") == nullptr);
+
+	CHECK_EQUAL("[1,-2,0.25,\"x\",{\"a\":[true,null]}]", reparse("[1,-2,0.25,\"x\",{\"a\":[true,null]}]"));
+	CHECK_EQUAL("\"top\"", reparse("\"top\""));
+	CHECK_EQUAL("123", reparse(" 123 "));
+	// Too big for an integer
+	CHECK_EQUAL("18446744073709551616", reparse("18446744073709551616"));
+
+	// The document can be reused
+	CHECK(doc.parse("[]", 2));
+	CHECK(doc.getRoot().isArray() && doc.getRoot().size() == 0);
+}
+
+TEST(InSitu)
+{
+	char buf[] = "{\"key\":\"a\\nb\"}";
+	JsonDocument doc;
+	CHECK(doc.parseInSitu(buf, strlen(buf)));
+	std::string_view key = doc.getRoot().getMembers()[0].key;
+	std::string_view value = doc.getRoot()["key"].getString();
+	// Strings point into the buffer, and are null terminated
+	CHECK(key.data() == buf + 2);
+	CHECK(value.data() == buf + 8);
+	CHECK_EQUAL("a\nb", value);
+	CHECK_EQUAL(0, value.data()[value.size()]);
+}
+
+TEST(Escapes)
+{
+	CHECK_EQUAL("\"\\\"\\\\/\\b\\f\\n\\r\\t\"", reparse("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\""));
+	// \u escapes are converted to UTF-8, including surrogate pairs
+	JsonDocument doc;
+	CHECK(doc.parse(std::string("\"\\u0041\\u00e9\\u20AC\\ud83d\\ude00\"")));
+	CHECK_EQUAL("A\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80", doc.getRoot().getString());
+	CHECK(doc.parse(std::string("\"\\u0000\"")));
+	CHECK_EQUAL(std::string_view("\0", 1), doc.getRoot().getString());
+
+	// Runs of backslashes and quotes at every position around the 64 bytes blocks, to test the escape detection of the
+	// first pass
+	for (size_t prefix = 0; prefix < 140; prefix++)
+	{
+		for (size_t backslashes = 0; backslashes < 6; backslashes++)
+		{
+			std::string str = std::string(prefix, 'x') + std::string(backslashes, '\\') + "\"y[,]";
+			std::string json = "[";
+			to_json(json, str);
+			json += ",1]";
+			JsonDocument d;
+			CHECK(d.parse(json));
+			CHECK_EQUAL(str, d.getRoot()[0].getString());
+			CHECK_EQUAL(1, d.getRoot()[1].getInt());
+		}
+	}
+}
+
+static std::string errorOf(const char* json)
+{
+	JsonDocument doc;
+	if (doc.parse(json, strlen(json)))
+		return "";
+	return doc.getError().message;
+}
+
+TEST(Errors)
+{
+	CHECK_EQUAL("Empty document", errorOf(""));
+	CHECK_EQUAL("Empty document", errorOf("  \n"));
+	CHECK_EQUAL("Unterminated string", errorOf("[\"abc]"));
+	CHECK_EQUAL("Unterminated string", errorOf("\"abc\\\""));
+	CHECK_EQUAL("Control character in string", errorOf("\"a\nb\""));
+	CHECK_EQUAL("Invalid UTF-8", errorOf("\"\xC3\x28\""));
+	CHECK_EQUAL("Unexpected end of document", errorOf("[1,2"));
+	CHECK_EQUAL("Unexpected end of document", errorOf("{\"a\":"));
+	CHECK_EQUAL("Expected ',' or ']'", errorOf("[1 2]"));
+	CHECK_EQUAL("Expected ',' or '}'", errorOf("{\"a\":1 \"b\":2}"));
+	CHECK_EQUAL("Expected a key", errorOf("{1:2}"));
+	CHECK_EQUAL("Expected ':'", errorOf("{\"a\",2}"));
+	CHECK_EQUAL("Unexpected character", errorOf("[,]"));
+	CHECK_EQUAL("Unexpected character", errorOf("[1,]"));
+	CHECK_EQUAL("Unexpected content after the root value", errorOf("1 2"));
+	CHECK_EQUAL("Unexpected content after the root value", errorOf("{}}"));
+	CHECK_EQUAL("Unexpected content after the root value", errorOf("\"a\"x"));
+	CHECK_EQUAL("Invalid literal", errorOf("tru"));
+	CHECK_EQUAL("Invalid literal", errorOf("[nulls]"));
+	CHECK_EQUAL("Leading zeros are not allowed", errorOf("01"));
+	CHECK_EQUAL("Invalid number", errorOf("-"));
+	CHECK_EQUAL("Invalid number", errorOf("1."));
+	CHECK_EQUAL("Invalid number", errorOf("1e"));
+	CHECK_EQUAL("Invalid number", errorOf("[1x]"));
+	CHECK_EQUAL("Number out of range", errorOf("1e400"));
+	CHECK_EQUAL("Invalid escape sequence", errorOf("\"\\x\""));
+	CHECK_EQUAL("Invalid \\u escape", errorOf("\"\\u12G4\""));
+	CHECK_EQUAL("Invalid surrogate pair", errorOf("\"\\ud83d\""));
+	CHECK_EQUAL("Invalid surrogate pair", errorOf("\"\\ude00\""));
+
+	std::string deep = std::string(2000, '[') + std::string(2000, ']');
+	CHECK_EQUAL("Maximum depth exceeded", errorOf(deep.c_str()));
+	deep = std::string(1000, '[') + std::string(1000, ']');
+	CHECK_EQUAL("", errorOf(deep.c_str()));
+
+	JsonDocument doc;
+	CHECK(!doc.parse("[1, x]", 6));
+	CHECK_EQUAL(size_t(4), doc.getError().offset);
+}
+
+// Counts the events, and stops at a given count
+struct CountingHandler : public JsonHandler
+{
+	int events = 0;
+	int stopAt = -1;
+	std::string keys;
+	int64_t sum = 0;
+
+	bool event()
+	{
+		return ++events != stopAt;
+	}
+	bool onNull() override { return event(); }
+	bool onBool(bool) override { return event(); }
+	bool onInt(int64_t v) override { sum += v; return event(); }
+	bool onUint(uint64_t) override { return event(); }
+	bool onDouble(double) override { return event(); }
+	bool onString(std::string_view) override { return event(); }
+	bool onBeginObject() override { return event(); }
+	bool onKey(std::string_view key) override { keys += key; return event(); }
+	bool onEndObject(size_t) override { return event(); }
+	bool onBeginArray() override { return event(); }
+	bool onEndArray(size_t) override { return event(); }
+};
+
+TEST(Sax)
+{
+	std::string json = "{\"a\":[1,2,3],\"b\":{\"c\":null}}";
+	JsonReader reader;
+	CountingHandler h;
+	CHECK(reader.parse(&json[0], json.size(), h));
+	CHECK_EQUAL(13, h.events);
+	CHECK_EQUAL("abc", h.keys);
+	CHECK_EQUAL(6, h.sum);
+
+	json = "[1,2,3,4]";
+	CountingHandler h2;
+	h2.stopAt = 3;
+	CHECK(!reader.parse(&json[0], json.size(), h2));
+	CHECK_EQUAL("Stopped by the handler", std::string(reader.getError().message));
+	CHECK_EQUAL(3, h2.events);
+	CHECK_EQUAL(3, h2.sum);
+}
+
+#if CZMUC_BENCHMARKS
+// Something similar to a typical API response, of about 1KB
+static std::string createRecord(int id)
+{
+	std::string out;
+	JsonWriter w(out);
+	w.beginObject()
+	    .field("id", id)
+	    .field("guid", "5f1b2c3d-4e5f-6a7b-8c9d-0e1f2a3b4c5d")
+	    .field("active", id % 2 == 0)
+	    .field("balance", id * 13.37)
+	    .field("name", "Some \"quoted\" name")
+	    .field("email", "someone@example.com")
+	    .field("about", "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut "
+	                    "labore et dolore magna aliqua.\nUt enim ad minim veniam.")
+	    .field("latitude", -12.345678)
+	    .field("longitude", 123.456789)
+	    .field("tags", std::vector<std::string>{"alpha", "beta", "gamma", "delta", "epsilon"})
+	    .key("friends").beginArray();
+	for (int i = 0; i < 8; i++)
+		w.beginObject().field("id", i).field("name", "Friend \\ name").field("score", i * 0.25).endObject();
+	w.endArray().field("greeting", "Hello! You have 10 unread messages.").endObject();
+	return out;
+}
+
+static void benchmark(const char* name, const std::string& json, int count)
+{
+	std::vector<char> buf(json.size());
+	JsonDocument doc;
+	double secs = 0;
+	for (int i = 0; i < count; i++)
+	{
+		// In-situ parsing modifies the buffer, so it needs a fresh copy every time
+		memcpy(buf.data(), json.data(), json.size());
+		auto start = std::chrono::high_resolution_clock::now();
+		bool ok = doc.parseInSitu(buf.data(), buf.size());
+		secs += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		CHECK(ok);
+	}
+	double dom = count * json.size() / secs / (1024 * 1024);
+
+	// The default handler does nothing, so this measures just the parsing
+	JsonReader reader;
+	JsonHandler h;
+	secs = 0;
+	for (int i = 0; i < count; i++)
+	{
+		memcpy(buf.data(), json.data(), json.size());
+		auto start = std::chrono::high_resolution_clock::now();
+		bool ok = reader.parse(buf.data(), buf.size(), h);
+		secs += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		CHECK(ok);
+	}
+	double sax = count * json.size() / secs / (1024 * 1024);
+	printf("JsonReader %s (%zu bytes): DOM %.0f MB/s, SAX %.0f MB/s\n", name, json.size(), dom, sax);
+}
+
+TEST(Benchmark)
+{
+	std::string small = createRecord(1);
+	CHECK_EQUAL(small, reparse(small));
+	benchmark("1KB", small, 20000);
+
+	std::string big = "[";
+	for (int i = 0; big.size() < 10 * 1024 * 1024; i++)
+	{
+		if (i)
+			big += ",\n";
+		big += createRecord(i);
+	}
+	big += "]";
+	benchmark("10MB", big, 5);
+}
+#endif
+
+}
@@ -0,0 +1,705 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/Logging.h"
+
+using namespace cz;
+
+CZ_DECLARE_LOG_CATEGORY(logTestLogging, Log, Verbose)
+CZ_DEFINE_LOG_CATEGORY(logTestLogging)
+CZ_DECLARE_LOG_CATEGORY(logTestCategoryNetA, Log, Verbose)
+CZ_DEFINE_LOG_CATEGORY(logTestCategoryNetA)
+CZ_DECLARE_LOG_CATEGORY(logTestCategoryNetB, Log, Log)
+CZ_DEFINE_LOG_CATEGORY(logTestCategoryNetB)
+CZ_DECLARE_LOG_CATEGORY(logTestCategoryDisk, Log, Verbose)
+CZ_DEFINE_LOG_CATEGORY(logTestCategoryDisk)
+
+SUITE(Logging)
+{
+
+// Keeps the messages logged with logTestLogging
+class TestLogOutput : public LogOutput
+{
+public:
+	~TestLogOutput()
+	{
+		detach();
+	}
+
+	void log(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, const char* msg) override
+	{
+		if (category != &logTestLogging)
+			return;
+		std::unique_lock<std::mutex> lk(mtx);
+		msgs.push_back(msg);
+	}
+
+	void flush() override
+	{
+		flushes++;
+	}
+
+	std::vector<std::string> getMsgs()
+	{
+		std::unique_lock<std::mutex> lk(mtx);
+		return msgs;
+	}
+
+	std::mutex mtx;
+	std::vector<std::string> msgs;
+	std::atomic<int> flushes{0};
+};
+
+// Restores the default settings when going out of scope
+struct SettingsGuard
+{
+	SettingsGuard(const LogSettings& settings)
+	{
+		LogOutput::setSettings(settings);
+	}
+	~SettingsGuard()
+	{
+		LogOutput::setSettings(LogSettings());
+	}
+};
+
+static bool endsWith(const std::string& str, const std::string& ending)
+{
+	return str.size() >= ending.size() && str.compare(str.size() - ending.size(), ending.size(), ending) == 0;
+}
+
+TEST(DestroyWithPendingMessages)
+{
+	// Output that doesn't detach itself. Anything still pending when it's destroyed is lost, but it must never
+	// reach the half destroyed object
+	struct NonDetachingLogOutput : public LogOutput
+	{
+		void log(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, const char* msg) override
+		{
+			count++;
+		}
+		std::atomic<int> count{0};
+	};
+
+	std::atomic<bool> finish(false);
+	std::thread th([&finish]()
+	{
+		while (!finish)
+			CZ_LOG(logTestLogging, Log, "Pending");
+	});
+	for (int i = 0; i < 100; i++)
+	{
+		NonDetachingLogOutput out;
+		CZ_LOG(logTestLogging, Log, "Pending %d", i);
+	}
+	finish = true;
+	th.join();
+	LogOutput::flushAll();
+}
+
+TEST(Async)
+{
+	TestLogOutput out;
+	CZ_LOG(logTestLogging, Log, "Hello %d", 1);
+	CZ_LOG(logTestLogging, Warning, "Hello %s", "World");
+	LogOutput::flushAll();
+
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(2), msgs.size());
+	CHECK(endsWith(msgs[0], "logTestLogging: LOG: Hello 1"));
+	CHECK(endsWith(msgs[1], "logTestLogging: WRN: Hello World"));
+	CHECK(out.flushes > 0);
+}
+
+TEST(Prefix)
+{
+	TestLogOutput out;
+	CZ_LOG(logTestLogging, Log, "Hello");
+	LogOutput::flushAll();
+
+	// hh:mm:ss.mmm: category: verbosity: message
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(1), msgs.size());
+	int h = -1, m = -1, sec = -1, ms = -1;
+	CHECK(sscanf(msgs[0].c_str(), "%2d:%2d:%2d.%3d: ", &h, &m, &sec, &ms) == 4);
+	CHECK(h >= 0 && h < 24 && m >= 0 && m < 60 && sec >= 0 && sec < 61 && ms >= 0 && ms < 1000);
+	CHECK_EQUAL(std::string("logTestLogging: LOG: Hello"), msgs[0].substr(14));
+}
+
+TEST(LongMessages)
+{
+	TestLogOutput out;
+	std::string big(5000, 'a');
+	std::string huge(100000, 'b');
+
+	CZ_LOG(logTestLogging, Log, "%s", big.c_str());
+	LogOutput::logToAll(__FILE__, __LINE__, &logTestLogging, LogVerbosity::Log, "%s", big.c_str());
+	// Messages that don't fit in the thread's buffer are logged synchronously, keeping the order
+	{
+		LogSettings settings;
+		settings.threadBufferSize = 4096;
+		SettingsGuard guard(settings);
+		std::thread th([&]()
+		{
+			CZ_LOG(logTestLogging, Log, "First");
+			CZ_LOG(logTestLogging, Log, "%s", huge.c_str());
+			LogOutput::logToAll(__FILE__, __LINE__, &logTestLogging, LogVerbosity::Log, "%s", huge.c_str());
+			CZ_LOG(logTestLogging, Log, "Last");
+		});
+		th.join();
+	}
+	LogOutput::flushAll();
+
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(6), msgs.size());
+	CHECK(endsWith(msgs[0], ": " + big));
+	CHECK(endsWith(msgs[1], ": " + big));
+	CHECK(endsWith(msgs[2], ": First"));
+	CHECK(endsWith(msgs[3], ": " + huge));
+	CHECK(endsWith(msgs[4], ": " + huge));
+	CHECK(endsWith(msgs[5], ": Last"));
+}
+
+TEST(FlushInterval)
+{
+	LogSettings settings;
+	settings.flushInterval = std::chrono::milliseconds(5);
+	SettingsGuard guard(settings);
+
+	TestLogOutput out;
+	CZ_LOG(logTestLogging, Log, "Hello");
+	// The writer should pick up the message on its own
+	auto start = std::chrono::steady_clock::now();
+	while (out.getMsgs().size() == 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds(5))
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	CHECK_EQUAL(size_t(1), out.getMsgs().size());
+}
+
+TEST(Sync)
+{
+	LogSettings settings;
+	settings.async = false;
+	SettingsGuard guard(settings);
+
+	TestLogOutput out;
+	CZ_LOG(logTestLogging, Log, "Hello");
+	CHECK_EQUAL(size_t(1), out.msgs.size());
+	CHECK_EQUAL(1, out.flushes.load());
+}
+
+TEST(Threads)
+{
+	TestLogOutput out;
+	const int numThreads = 4;
+	const int numMsgs = 1000;
+	auto before = LogOutput::getStats();
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < numThreads; t++)
+	{
+		threads.emplace_back([t]()
+		{
+			for (int i = 0; i < numMsgs; i++)
+				CZ_LOG(logTestLogging, Log, "T%d:%d", t, i);
+		});
+	}
+	for (auto&& t : threads)
+		t.join();
+	LogOutput::flushAll();
+
+	// Messages from each thread must arrive in order
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(numThreads * numMsgs), msgs.size());
+	int next[numThreads] = {};
+	for (auto&& msg : msgs)
+	{
+		int t, i;
+		CHECK(sscanf(msg.c_str() + msg.rfind(' ') + 1, "T%d:%d", &t, &i) == 2);
+		CHECK_EQUAL(next[t], i);
+		next[t] = i + 1;
+	}
+
+	auto after = LogOutput::getStats();
+	CHECK(after.written - before.written >= uint64_t(numThreads * numMsgs));
+	CHECK_EQUAL(before.dropped, after.dropped);
+}
+
+static void testFullBuffer(bool block)
+{
+	LogSettings settings;
+	settings.threadBufferSize = 4096;
+	settings.flushInterval = std::chrono::milliseconds(1000);
+	settings.blockWhenFull = block;
+	SettingsGuard guard(settings);
+
+	TestLogOutput out;
+	const int numMsgs = 5000;
+	auto before = LogOutput::getStats();
+	// Using a new thread, so it creates a buffer with the new settings
+	std::thread th([]()
+	{
+		for (int i = 0; i < numMsgs; i++)
+			CZ_LOG(logTestLogging, Log, "Message %d, with some text to fill the buffer quickly", i);
+	});
+	th.join();
+	LogOutput::flushAll();
+
+	auto after = LogOutput::getStats();
+	auto dropped = after.dropped - before.dropped;
+	auto blocked = after.blocked - before.blocked;
+	CHECK_EQUAL(size_t(numMsgs - dropped), out.getMsgs().size());
+	if (block)
+		CHECK_EQUAL(uint64_t(0), dropped);
+	else
+	{
+		CHECK_EQUAL(uint64_t(0), blocked);
+		// The buffer is too small for all the messages, so some must have been dropped
+		CHECK(dropped > 0);
+	}
+}
+
+TEST(FullBuffer)
+{
+	testFullBuffer(false);
+	testFullBuffer(true);
+}
+
+template<typename... Args>
+static std::string formatDeferredImpl(const char* fmt, const Args&... args)
+{
+	std::vector<char> buf((size_t(0) + ... + detail::logArgSize(args)));
+	char* dst = buf.data();
+	(detail::writeLogArg(dst, args), ...);
+	std::string res;
+	formatLogArgs(res, fmt, buf.data(), buf.size());
+	return res;
+}
+
+template<typename... Args>
+static std::string formatDeferred(const char* fmt, const Args&... args)
+{
+	return formatDeferredImpl(fmt, detail::toLogArg(args)...);
+}
+
+template<typename... Args>
+static std::string formatNow(const char* fmt, const Args&... args)
+{
+	char buf[2048];
+	snprintf(buf, sizeof(buf), fmt, args...);
+	return buf;
+}
+
+#define CHECK_DEFERRED(fmt, ...) CHECK_EQUAL(formatNow(fmt, ##__VA_ARGS__), formatDeferred(fmt, ##__VA_ARGS__))
+
+TEST(Categories)
+{
+	CHECK(LogCategoryBase::find("logTestCategoryNetA") == &logTestCategoryNetA);
+	CHECK(LogCategoryBase::find("logTestCategoryDisk") == &logTestCategoryDisk);
+	CHECK(LogCategoryBase::find("logTestCategory") == nullptr);
+
+	// Iteration keeps the registration order
+	std::vector<LogCategoryBase*> all;
+	for (LogCategoryBase* c = LogCategoryBase::getFirst(); c; c = c->getNext())
+		all.push_back(c);
+	auto a = std::find(all.begin(), all.end(), &logTestCategoryNetA);
+	auto b = std::find(all.begin(), all.end(), &logTestCategoryNetB);
+	auto disk = std::find(all.begin(), all.end(), &logTestCategoryDisk);
+	CHECK(a != all.end() && b == a + 1 && disk == b + 1);
+
+	LogVerbosity v;
+	CHECK(logVerbosityFromString("warning", 7, v) && v == LogVerbosity::Warning);
+	CHECK(logVerbosityFromString("VER", 3, v) && v == LogVerbosity::Verbose);
+	CHECK(!logVerbosityFromString("Warn", 4, v));
+
+	CHECK_EQUAL(2, LogCategoryBase::setVerbosityFromSpec("logTestCategoryNet*=Verbose"));
+	CHECK(logTestCategoryNetA.getVerbosity() == LogVerbosity::Verbose);
+	// Limited by the compile time verbosity
+	CHECK(logTestCategoryNetB.getVerbosity() == LogVerbosity::Log);
+	CHECK(logTestCategoryDisk.getVerbosity() == LogVerbosity::Log);
+
+	// Last match wins
+	CHECK_EQUAL(3, LogCategoryBase::setVerbosityFromSpec(" logTestCategory*=Error; logTestCategoryNet?=WRN,\tlogTestCategoryNetB=Fatal "));
+	CHECK(logTestCategoryNetA.getVerbosity() == LogVerbosity::Warning);
+	CHECK(logTestCategoryNetB.getVerbosity() == LogVerbosity::Fatal);
+	CHECK(logTestCategoryDisk.getVerbosity() == LogVerbosity::Error);
+	CHECK(logTestCategoryDisk.isSuppressed(LogVerbosity::Warning));
+	CHECK(!logTestCategoryDisk.isSuppressed(LogVerbosity::Error));
+
+	// Invalid specs don't change anything
+	CHECK_EQUAL(-1, LogCategoryBase::setVerbosityFromSpec("logTestCategory*=Log,logTestCategoryDisk"));
+	CHECK_EQUAL(-1, LogCategoryBase::setVerbosityFromSpec("logTestCategory*=Something"));
+	CHECK_EQUAL(-1, LogCategoryBase::setVerbosityFromSpec("=Log"));
+	CHECK(logTestCategoryDisk.getVerbosity() == LogVerbosity::Error);
+
+	CHECK_EQUAL(0, LogCategoryBase::setVerbosityFromSpec(""));
+	CHECK_EQUAL(0, LogCategoryBase::setVerbosityFromSpec("nothing*=Log"));
+	CHECK_EQUAL(3, LogCategoryBase::setVerbosityFromSpec("*Net*=Log *Disk=Log"));
+}
+
+// Changing the verbosity while other threads are logging
+TEST(CategoriesThreads)
+{
+	std::atomic<bool> finish{false};
+	int notSuppressed = 0;
+	std::thread th([&] {
+		while (!finish)
+		{
+			if (!logTestCategoryDisk.isSuppressed(LogVerbosity::Log))
+				notSuppressed++;
+		}
+	});
+
+	for (int i = 0; i < 1000; i++)
+		LogCategoryBase::setVerbosityFromSpec(i % 2 ? "logTestCategoryDisk=Log" : "logTestCategoryDisk=Error");
+	finish = true;
+	th.join();
+	CHECK(logTestCategoryDisk.getVerbosity() == LogVerbosity::Log);
+}
+
+// Keeps the entries logged with logTestLogging, with the fields converted to text
+class TestEntryLogOutput : public LogOutput
+{
+public:
+	~TestEntryLogOutput()
+	{
+		detach();
+	}
+
+	void log(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, const char* msg) override
+	{
+		CHECK(false);
+	}
+
+	void logEntry(const LogEntry& entry) override
+	{
+		if (entry.category != &logTestLogging)
+			return;
+		std::string str(entry.msg, entry.msgSize);
+		LogFieldList fields = entry.fields;
+		LogFieldValue f;
+		while (fields.next(f))
+		{
+			str += std::string("|") + f.key + ":";
+			switch (f.type)
+			{
+			case LogFieldType::Integer: str += "i" + std::to_string(f.i); break;
+			case LogFieldType::Unsigned: str += "u" + std::to_string(f.u); break;
+			case LogFieldType::Double: str += "d" + std::to_string(f.d); break;
+			case LogFieldType::Bool: str += f.u ? "true" : "false"; break;
+			case LogFieldType::String: str += "s" + std::string(f.str, f.strSize); break;
+			case LogFieldType::Pointer: str += "p"; break;
+			}
+		}
+		std::unique_lock<std::mutex> lk(mtx);
+		entries.push_back(str);
+		texts.push_back(entry.text);
+	}
+
+	std::mutex mtx;
+	std::vector<std::string> entries;
+	std::vector<std::string> texts;
+};
+
+TEST(Fields)
+{
+	TestLogOutput out;
+	TestEntryLogOutput entryOut;
+	std::string name = "Bob";
+	CZ_LOG_DEFERRED(logTestLogging, Log, "Hello %s, %d", "World", logField("user", name), 5, logField("id", -3),
+	                logField("count", 7u), logField("ratio", 0.5), logField("ok", true), logField("tag", "abc"));
+	CZ_LOG(logTestLogging, Log, "No fields");
+	CZ_LOG_DEFERRED(logTestLogging, Log, "Only fields", logField("id", uint64_t(1) << 63));
+	LogOutput::flushAll();
+
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(3), msgs.size());
+	CHECK(endsWith(msgs[0], "LOG: Hello World, 5 user=\"Bob\" id=-3 count=7 ratio=0.5 ok=true tag=\"abc\""));
+	CHECK(endsWith(msgs[1], "LOG: No fields"));
+	CHECK(endsWith(msgs[2], "LOG: Only fields id=9223372036854775808"));
+
+	std::unique_lock<std::mutex> lk(entryOut.mtx);
+	CHECK_EQUAL(size_t(3), entryOut.entries.size());
+	CHECK_EQUAL("Hello World, 5|user:sBob|id:i-3|count:u7|ratio:d0.500000|ok:true|tag:sabc", entryOut.entries[0]);
+	CHECK_EQUAL("No fields", entryOut.entries[1]);
+	CHECK_EQUAL("Only fields|id:u9223372036854775808", entryOut.entries[2]);
+	CHECK_EQUAL(msgs[0], entryOut.texts[0]);
+	entryOut.entries.clear();
+	lk.unlock();
+
+	// Synchronous logging passes the fields too
+	{
+		LogSettings settings;
+		settings.async = false;
+		SettingsGuard guard(settings);
+		CZ_LOG_DEFERRED(logTestLogging, Log, "Sync", logField("id", 1));
+	}
+	lk.lock();
+	CHECK_EQUAL(size_t(1), entryOut.entries.size());
+	CHECK_EQUAL("Sync|id:i1", entryOut.entries[0]);
+}
+
+TEST(RateLimited)
+{
+	TestLogOutput out;
+	for (int i = 0; i < 10; i++)
+		CZ_LOG_EVERY_N(logTestLogging, Log, 3, "EveryN %d", i);
+	LogOutput::flushAll();
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(4), msgs.size());
+	CHECK(endsWith(msgs[0], "LOG: EveryN 0"));
+	CHECK(endsWith(msgs[1], "LOG: EveryN 3 (2 similar messages suppressed)"));
+	CHECK(endsWith(msgs[3], "LOG: EveryN 9 (2 similar messages suppressed)"));
+
+	// N of 0 logs everything
+	out.msgs.clear();
+	int n = 0;
+	for (int i = 0; i < 3; i++)
+		CZ_LOG_EVERY_N(logTestLogging, Log, n, "EveryN %d", i);
+	LogOutput::flushAll();
+	CHECK_EQUAL(size_t(3), out.getMsgs().size());
+
+	out.msgs.clear();
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 10; j++)
+			CZ_LOG_EVERY_MS(logTestLogging, Warning, 100, "EveryMs");
+		std::this_thread::sleep_for(std::chrono::milliseconds(110));
+	}
+	LogOutput::flushAll();
+	msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(3), msgs.size());
+	CHECK(endsWith(msgs[0], "WRN: EveryMs"));
+	CHECK(endsWith(msgs[1], "WRN: EveryMs (9 similar messages suppressed)"));
+	CHECK(endsWith(msgs[2], "WRN: EveryMs (9 similar messages suppressed)"));
+
+	// Every call is either logged or counted in the next logged message
+	out.msgs.clear();
+	const int count = 10000;
+	for (int i = 0; i < count; i++)
+	{
+		CZ_LOG_SAMPLED(logTestLogging, Log, 0.1, "Sampled");
+		CZ_LOG_SAMPLED(logTestLogging, Log, 0.0, "Never");
+		CZ_LOG_SAMPLED(logTestLogging, Log, 1.0, "Always");
+	}
+	LogOutput::flushAll();
+	msgs = out.getMsgs();
+	int sampled = 0, always = 0, accounted = 0;
+	for (auto&& m : msgs)
+	{
+		CHECK(m.find("Never") == std::string::npos);
+		if (m.find("Always") != std::string::npos)
+		{
+			CHECK(endsWith(m, "Always"));
+			always++;
+		}
+		else
+		{
+			unsigned suppressed = 0;
+			auto pos = m.find("Sampled (");
+			if (pos != std::string::npos)
+				sscanf(m.c_str() + pos, "Sampled (%u", &suppressed);
+			accounted += suppressed + 1;
+			sampled++;
+		}
+	}
+	CHECK_EQUAL(count, always);
+	CHECK(sampled > count / 20 && sampled < count / 5);
+	CHECK(accounted <= count && accounted > count - count / 5);
+
+	// Suppressed by the verbosity, so nothing is counted
+	out.msgs.clear();
+	for (int i = 0; i < 10; i++)
+		CZ_LOG_EVERY_N(logTestLogging, Verbose, 2, "Verbose");
+	LogOutput::flushAll();
+	CHECK_EQUAL(size_t(0), out.getMsgs().size());
+}
+
+#if CZMUC_BENCHMARKS
+TEST(RateLimitedBenchmark)
+{
+	TestLogOutput out;
+	const int count = 10000000;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		CZ_LOG_EVERY_N(logTestLogging, Warning, 1000000000, "Suppressed %d", i);
+	auto ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("Suppressed CZ_LOG_EVERY_N: %.2f ns per call\n", ns / count);
+
+	start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < count; i++)
+		CZ_LOG_SAMPLED(logTestLogging, Warning, 0.0, "Suppressed %d", i);
+	ns = std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+	printf("Suppressed CZ_LOG_SAMPLED: %.2f ns per call\n", ns / count);
+	LogOutput::flushAll();
+	CHECK_EQUAL(size_t(1), out.getMsgs().size());
+}
+#endif
+
+TEST(DeferredFormat)
+{
+	CHECK_DEFERRED("Hello");
+	CHECK_DEFERRED("%d %i %u %x %X %o", -5, 10, 4000000000u, 255, 255, 8);
+	CHECK_DEFERRED("%hhd %hd %hu %lld %llu", (char)-1, (short)-2, (unsigned short)65535, -1234567890123ll, 18446744073709551615ull);
+	CHECK_DEFERRED("%ld %lu %zu", -7l, 7ul, size_t(123456));
+	CHECK_DEFERRED("%5d|%-5d|%05d|%+d|% d|%#x", 1, 2, 3, 4, 5, 255);
+	CHECK_DEFERRED("%f %.2f %10.3e %g %G %a", 1.5, 3.14159, 12345.678, 0.0001, 1e20, 1.0);
+	CHECK_DEFERRED("%f", 2.5f);
+	CHECK_DEFERRED("%s|%10s|%-10s|%.3s", "abc", "right", "left", "truncated");
+	CHECK_DEFERRED("%c%c%c", 'a', 'b', 'c');
+	CHECK_DEFERRED("%*d|%-*d|%.*s", 6, 42, 6, 42, 2, "abcdef");
+	// Long flags with '*' width and precision (a negative precision is the same as no precision)
+	CHECK_DEFERRED("%-+ #0-+ #0-+ #0-+ #0-+ #0-+ #0-+ #0-+ #0*.*lld|", -12, -1000000000, 42ll);
+	CHECK_DEFERRED("100%% %d%%", 50);
+	CHECK_DEFERRED("%s", std::string(1000, 'x').c_str());
+	int dummy;
+	CHECK_DEFERRED("%p", (void*)&dummy);
+
+	bool b = true;
+	enum class Colour { Red, Green };
+	CHECK_EQUAL(std::string("1 1"), formatDeferred("%d %d", b, Colour::Green));
+	CHECK_EQUAL(std::string("(null)"), formatDeferred("%s", (const char*)nullptr));
+
+	// Mismatches are shown, instead of crashing
+	CHECK_EQUAL(std::string("<bad arg> <missing arg>"), formatDeferred("%s %d", 1));
+	CHECK_EQUAL(std::string("<bad arg>"), formatDeferred("%d", "str"));
+	CHECK_EQUAL(std::string("<bad arg>"), formatDeferred("%f", 1));
+}
+
+TEST(Deferred)
+{
+	TestLogOutput out;
+	char buf[32];
+	strcpy(buf, "Before");
+	CZ_LOG_DEFERRED(logTestLogging, Log, "%s %d %.1f", buf, 1, 2.0);
+	// Strings are copied, so changing the buffer doesn't change what was logged
+	strcpy(buf, "After");
+	LogOutput::flushAll();
+
+	auto msgs = out.getMsgs();
+	CHECK_EQUAL(size_t(1), msgs.size());
+	CHECK(endsWith(msgs[0], "logTestLogging: LOG: Before 1 2.0"));
+
+	{
+		LogSettings settings;
+		settings.async = false;
+		SettingsGuard guard(settings);
+		CZ_LOG_DEFERRED(logTestLogging, Warning, "Sync %s", buf);
+		CHECK_EQUAL(size_t(2), out.msgs.size());
+		CHECK(endsWith(out.msgs[1], "logTestLogging: WRN: Sync After"));
+	}
+}
+
+#if CZMUC_BENCHMARKS
+TEST(DeferredBenchmark)
+{
+	// Big enough buffer so the logging thread never waits for the writer, and we measure only the cost in the
+	// logging thread.
+	LogSettings settings;
+	settings.threadBufferSize = 32 * 1024 * 1024;
+	SettingsGuard guard(settings);
+
+	TestLogOutput out;
+	const int count = 200000;
+	auto test = [&](const char* name, auto&& f)
+	{
+		LogOutput::flushAll();
+		std::thread th([&]()
+		{
+			// Warm up, so the whole buffer is touched and we don't measure page faults
+			for (int pass = 0; pass < 2; pass++)
+			{
+				for (int i = 0; i < count; i++)
+					f(i);
+				LogOutput::flushAll();
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			for (int i = 0; i < count; i++)
+				f(i);
+			auto end = std::chrono::high_resolution_clock::now();
+			double ns = std::chrono::duration<double, std::nano>(end - start).count() / count;
+			printf("%s: %.1f ns per call\n", name, ns);
+		});
+		th.join();
+		LogOutput::flushAll();
+	};
+
+	test("Logging (formatting in the calling thread)", [](int i)
+	{
+		LogOutput::logToAll(__FILE__, __LINE__, &logTestLogging, LogVerbosity::Log, "Message %d, %s, %f", i, "some text", 1.5);
+	});
+	test("Logging (deferred formatting)", [](int i)
+	{
+		CZ_LOG_DEFERRED(logTestLogging, Log, "Message %d, %s, %f", i, "some text", 1.5);
+	});
+	CHECK_EQUAL(size_t(count * 2 * 3), out.getMsgs().size());
+}
+#endif
+
+#if CZMUC_BENCHMARKS
+// Only counts the messages, so the benchmark measures the logging itself
+class CountingLogOutput : public LogOutput
+{
+public:
+	~CountingLogOutput()
+	{
+		detach();
+	}
+	void log(const char* file, int line, const LogCategoryBase* category, LogVerbosity verbosity, const char* msg) override
+	{
+		count++;
+	}
+	std::atomic<int> count{0};
+};
+
+TEST(Benchmark)
+{
+	auto test = [](const char* name, bool async, bool deferred, int numThreads)
+	{
+		LogSettings settings;
+		settings.async = async;
+		settings.threadBufferSize = 1024 * 1024;
+		SettingsGuard guard(settings);
+		CountingLogOutput out;
+
+		const auto duration = std::chrono::milliseconds(300);
+		std::vector<std::thread> threads;
+		std::atomic<int64_t> total{0};
+		for (int t = 0; t < numThreads; t++)
+		{
+			threads.emplace_back([&]()
+			{
+				int64_t count = 0;
+				auto start = std::chrono::high_resolution_clock::now();
+				while (std::chrono::high_resolution_clock::now() - start < duration)
+				{
+					for (int i = 0; i < 100; i++)
+					{
+						if (deferred)
+							CZ_LOG_DEFERRED(logTestLogging, Log, "Message %d, %s, %f", i, "some text", 1.5)
+						else
+							LogOutput::logToAll(__FILE__, __LINE__, &logTestLogging, LogVerbosity::Log,
+							                    "Message %d, %s, %f", i, "some text", 1.5);
+					}
+					count += 100;
+				}
+				total += count;
+			});
+		}
+		for (auto&& t : threads)
+			t.join();
+		LogOutput::flushAll();
+
+		double perThread = total / (std::chrono::duration<double>(duration).count() * numThreads);
+		printf("%s, %d thread(s): %.0f log calls per second per thread\n", name, numThreads, perThread);
+		CHECK_EQUAL(total.load(), int64_t(out.count));
+	};
+
+	test("Synchronous logToAll", false, false, 1);
+	test("Synchronous logToAll", false, false, 4);
+	test("Asynchronous logToAll", true, false, 1);
+	test("Asynchronous logToAll", true, false, 4);
+	test("Asynchronous CZ_LOG_DEFERRED", true, true, 1);
+	test("Asynchronous CZ_LOG_DEFERRED", true, true, 4);
+}
+#endif
+
+}
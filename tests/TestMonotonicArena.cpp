@@ -0,0 +1,77 @@
+#include "UnitTestsPCH.h"
+
+using namespace cz;
+
+SUITE(MonotonicArena)
+{
+
+TEST(Allocate)
+{
+	MonotonicArena arena(64);
+	CHECK_EQUAL(0, arena.capacity());
+
+	auto a = arena.allocate<uint8_t>(1);
+	auto b = arena.allocate<uint64_t>(1);
+	CHECK(a != nullptr);
+	CHECK_EQUAL(0, reinterpret_cast<uintptr_t>(b) % alignof(uint64_t));
+	CHECK(reinterpret_cast<uint8_t*>(b) > a);
+	CHECK_EQUAL(64, arena.capacity());
+
+	// Doesn't fit in the current block
+	arena.allocate(60, 1);
+	CHECK_EQUAL(128, arena.capacity());
+
+	// Oversized allocation
+	auto c = arena.allocate(1000, 64);
+	CHECK_EQUAL(0, reinterpret_cast<uintptr_t>(c) % 64);
+	CHECK(arena.capacity() >= 128 + 1000);
+}
+
+TEST(Reset)
+{
+	MonotonicArena arena(64);
+	auto a = arena.allocate(8, 8);
+	arena.allocate(60, 1);
+	arena.allocate(200, 1);
+	auto capacity = arena.capacity();
+
+	arena.reset();
+	// Same memory is handed out again, without any new blocks
+	CHECK(arena.allocate(8, 8) == a);
+	arena.allocate(60, 1);
+	arena.allocate(200, 1);
+	CHECK_EQUAL(capacity, arena.capacity());
+}
+
+TEST(ArenaQuickVector)
+{
+	MonotonicArena arena(1024);
+	{
+		ArenaQuickVector<int, 2> v(arena);
+		for (int i = 0; i < 10; i++)
+			v.push_back(i);
+		CHECK_EQUAL(10, v.size());
+		for (int i = 0; i < 10; i++)
+			CHECK_EQUAL(i, v[i]);
+		CHECK_EQUAL(1024, arena.capacity());
+
+		// Moving between vectors using the same arena steals the buffer
+		auto ptr = v.data();
+		ArenaQuickVector<int, 2> v2(std::move(v));
+		CHECK(v2.data() == ptr);
+		CHECK_EQUAL(0, v.size());
+
+		ArenaQuickVector<std::string, 1> s(arena);
+		s.push_back("Hello");
+		s.push_back("World");
+		CHECK_EQUAL("World", s[1]);
+	}
+
+	arena.reset();
+	ArenaQuickVector<int, 2> v(arena);
+	for (int i = 0; i < 100; i++)
+		v.push_back(i);
+	CHECK_EQUAL(1024, arena.capacity());
+}
+
+}
@@ -0,0 +1,127 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/Parameters.h"
+
+using namespace cz;
+
+SUITE(Parameters)
+{
+
+struct Options
+{
+	int port = 8080;
+	int64_t maxSize = 0;
+	bool verbose = false;
+	bool color = true;
+	double ratio = 0.5;
+	float scale = 1;
+	std::string name;
+	std::vector<std::string> include = {"default"};
+};
+
+static ParameterSchema<Options> createSchema()
+{
+	ParameterSchema<Options> schema("Test program");
+	schema.add("port", &Options::port, "Port to listen on").setRange(1, 65535);
+	schema.add("maxSize", &Options::maxSize, "Maximum size").setValueName("bytes");
+	schema.add("verbose", &Options::verbose, "Verbose logging");
+	schema.add("color", &Options::color, "Colored output");
+	schema.add("ratio", &Options::ratio);
+	schema.add("scale", &Options::scale, "Scale");
+	schema.add("name", &Options::name, "Name").setRequired();
+	schema.add("include", &Options::include, "Extra folders");
+	return schema;
+}
+
+template<size_t N>
+static bool parse(ParameterSchema<Options>& schema, Options& opts, const char* (&args)[N])
+{
+	return schema.parse(static_cast<int>(N), const_cast<char**>(args), opts);
+}
+
+TEST(Schema)
+{
+	auto schema = createSchema();
+	Options opts;
+	const char* args[] = {"program", "-name=test", "-PORT=80", "maxsize=10000000000", "-verbose", "-color=off",
+	                      "-ratio=0.25", "-scale=+2", "-include=a", "-include=b="};
+	CHECK(parse(schema, opts, args));
+	CHECK_EQUAL("", schema.getError());
+	CHECK_EQUAL("test", opts.name);
+	CHECK_EQUAL(80, opts.port);
+	CHECK_EQUAL(10000000000ll, opts.maxSize);
+	CHECK(opts.verbose);
+	CHECK(!opts.color);
+	CHECK_EQUAL(0.25, opts.ratio);
+	CHECK_EQUAL(2.0f, opts.scale);
+	CHECK(opts.include == std::vector<std::string>({"a", "b="}));
+
+	// Defaults are kept for anything not specified
+	Options opts2;
+	const char* args2[] = {"program", "name=x"};
+	CHECK(parse(schema, opts2, args2));
+	CHECK_EQUAL(8080, opts2.port);
+	CHECK(opts2.include == std::vector<std::string>({"default"}));
+
+	// From already split parameters
+	Parameters params;
+	const char* args3[] = {"program", "-name=y", "-port=1"};
+	params.set(3, const_cast<char**>(args3));
+	Options opts3;
+	CHECK(schema.parse(params, opts3));
+	CHECK_EQUAL("y", opts3.name);
+	CHECK_EQUAL(1, opts3.port);
+}
+
+static std::string errorOf(std::initializer_list<const char*> list, bool allowUnknown = false)
+{
+	auto schema = createSchema();
+	schema.setAllowUnknown(allowUnknown);
+	std::vector<const char*> args = {"program"};
+	args.insert(args.end(), list.begin(), list.end());
+	Options opts;
+	bool ok = schema.parse(static_cast<int>(args.size()), const_cast<char**>(args.data()), opts);
+	CHECK(ok == schema.getError().empty());
+	return schema.getError();
+}
+
+TEST(Validation)
+{
+	CHECK_EQUAL("", errorOf({"-name="}));
+	CHECK_EQUAL("Missing required option 'name'", errorOf({}));
+	CHECK_EQUAL("Unknown option 'foo'", errorOf({"-name=a", "-foo=1"}));
+	CHECK_EQUAL("", errorOf({"-name=a", "-foo=1"}, true));
+	CHECK_EQUAL("Invalid value '12x' for option 'port'", errorOf({"-name=a", "-port=12x"}));
+	CHECK_EQUAL("Invalid value '' for option 'port'", errorOf({"-name=a", "-port"}));
+	CHECK_EQUAL("Invalid value '99999999999' for option 'port'", errorOf({"-name=a", "-port=99999999999"}));
+	CHECK_EQUAL("Value '0' for option 'port' is out of range [1, 65535]", errorOf({"-name=a", "-port=0"}));
+	CHECK_EQUAL("Invalid value 'maybe' for option 'verbose'", errorOf({"-name=a", "-verbose=maybe"}));
+	CHECK_EQUAL("Invalid value 'x' for option 'ratio'", errorOf({"-name=a", "-ratio=x"}));
+
+	// Case sensitive names
+	auto schema = createSchema();
+	schema.setCaseSensitive(true);
+	Options opts;
+	const char* args[] = {"program", "-name=a", "-maxsize=1"};
+	CHECK(!schema.parse(3, const_cast<char**>(args), opts));
+	CHECK_EQUAL("Unknown option 'maxsize'", schema.getError());
+}
+
+TEST(Help)
+{
+	auto schema = createSchema();
+	CHECK_EQUAL("Usage: program [options]\n"
+	            "Test program\n"
+	            "\n"
+	            "Options:\n"
+	            "  -port=<int>        Port to listen on (default: 8080, range: 1..65535)\n"
+	            "  -maxSize=<bytes>   Maximum size (default: 0)\n"
+	            "  -verbose           Verbose logging\n"
+	            "  -color             Colored output (default: true)\n"
+	            "  -ratio=<number>    (default: 0.5)\n"
+	            "  -scale=<number>    Scale (default: 1)\n"
+	            "  -name=<string>     Name (required)\n"
+	            "  -include=<string>  Extra folders (can be repeated)\n",
+	            schema.getHelp("program"));
+}
+
+}
@@ -860,6 +860,171 @@ TEST(Derp)
 		testEraseAll<QuickVector>();
 	}
 
+	// Non trivial type, but safe to relocate with memcpy
+	struct Relocatable
+	{
+		Relocatable(int n)
+			: ptr(std::make_unique<int>(n))
+		{
+		}
+		std::unique_ptr<int> ptr;
+	};
+
+	template<typename V>
+	std::vector<int> toInts(const V& v)
+	{
+		std::vector<int> res;
+		for (auto&& e : v)
+			res.push_back(*e.ptr);
+		return res;
+	}
+}
+
+namespace cz
+{
+	template<>
+	struct is_trivially_relocatable<SuiteQuickVector::Relocatable> : std::true_type
+	{
+	};
+}
+
+SUITE(QuickVector)
+{
+	TEST(TriviallyRelocatable)
+	{
+		static_assert(is_trivially_relocatable_v<int>);
+		static_assert(!is_trivially_relocatable_v<std::string>);
+		static_assert(is_trivially_relocatable_v<Relocatable>);
+
+		QuickVector<Relocatable, 2> v;
+		std::vector<int> exp;
+		for (int i = 0; i < 10; i++)
+		{
+			v.emplace_back(i);
+			exp.push_back(i);
+		}
+		CHECK_ARRAY_EQUAL(exp, toInts(v), exp.size());
+
+		// Insert at the front and in the middle, causing the tail to be relocated
+		v.emplace(v.begin(), 100);
+		exp.insert(exp.begin(), 100);
+		v.insert(v.begin() + 5, Relocatable(101));
+		exp.insert(exp.begin() + 5, 101);
+		CHECK_EQUAL(exp.size(), v.size());
+		CHECK_ARRAY_EQUAL(exp, toInts(v), exp.size());
+
+		// Force growing while inserting in the middle
+		while (v.size() != v.capacity())
+		{
+			v.emplace_back(200);
+			exp.push_back(200);
+		}
+		v.emplace(v.begin() + 3, 102);
+		exp.insert(exp.begin() + 3, 102);
+		CHECK_EQUAL(exp.size(), v.size());
+		CHECK_ARRAY_EQUAL(exp, toInts(v), exp.size());
+
+		v.erase(v.begin() + 1);
+		exp.erase(exp.begin() + 1);
+		v.erase(v.begin() + 2, v.begin() + 6);
+		exp.erase(exp.begin() + 2, exp.begin() + 6);
+		CHECK_EQUAL(exp.size(), v.size());
+		CHECK_ARRAY_EQUAL(exp, toInts(v), exp.size());
+
+		// Move into the quick buffer
+		v.erase(v.begin() + 2, v.end());
+		exp.erase(exp.begin() + 2, exp.end());
+		QuickVector<Relocatable, 2> v2(std::move(v));
+		CHECK_EQUAL(0, v.size());
+		CHECK_ARRAY_EQUAL(exp, toInts(v2), exp.size());
+	}
+
+	TEST(TrivialGrowth)
+	{
+		QuickVector<int, 4> v;
+		std::vector<int> exp;
+		for (int i = 0; i < 1000; i++)
+		{
+			v.push_back(i);
+			exp.push_back(i);
+			if ((i % 100) == 0)
+			{
+				v.insert(v.begin() + i / 2, -i);
+				exp.insert(exp.begin() + i / 2, -i);
+			}
+		}
+		CHECK_EQUAL(exp.size(), v.size());
+		CHECK_ARRAY_EQUAL(exp, v, exp.size());
+	}
+
+#if CZMUC_BENCHMARKS
+	// Same as Relocatable, but without the is_trivially_relocatable specialization, so QuickVector falls back to
+	// move constructing and destroying each element
+	struct NonRelocatable
+	{
+		NonRelocatable(int n)
+			: ptr(std::make_unique<int>(n))
+		{
+		}
+		std::unique_ptr<int> ptr;
+	};
+
+	// Same as int, but not trivially copyable
+	struct NonTrivialInt
+	{
+		NonTrivialInt(int n)
+			: n(n)
+		{
+		}
+		NonTrivialInt(const NonTrivialInt& other)
+			: n(other.n)
+		{
+		}
+		NonTrivialInt& operator=(const NonTrivialInt& other)
+		{
+			n = other.n;
+			return *this;
+		}
+		int n;
+	};
+
+	template<typename VT, typename Make>
+	double benchmarkVector(const char* name, Make make)
+	{
+		using Clock = std::chrono::high_resolution_clock;
+		const int count = 10000;
+		const int loops = 20;
+		auto start = Clock::now();
+		size_t total = 0;
+		for (int l = 0; l < loops; l++)
+		{
+			VT v;
+			for (int i = 0; i < count; i++)
+				v.push_back(make(i));
+			for (int i = 0; i < 100; i++)
+				v.insert(v.begin(), make(i));
+			for (int i = 0; i < 100; i++)
+				v.erase(v.begin());
+			VT v2(std::move(v));
+			total += v2.size();
+		}
+		double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		CHECK_EQUAL(size_t(count * loops), total);
+		printf("    %-36s: %8.3f ms\n", name, ms);
+		return ms;
+	}
+
+	TEST(Benchmark)
+	{
+		printf("QuickVector relocation benchmark (push_back, front insert/erase, move):\n");
+		auto makeInt = [](int i) { return i; };
+		benchmarkVector<QuickVector<int, 16>>("trivially copyable int", makeInt);
+		benchmarkVector<QuickVector<NonTrivialInt, 16>>("non trivially copyable int", makeInt);
+		benchmarkVector<QuickVector<Relocatable, 8>>("unique_ptr, trivially relocatable", makeInt);
+		benchmarkVector<QuickVector<NonRelocatable, 8>>("unique_ptr, not trivially relocatable", makeInt);
+	}
+#endif
+
 	TEST(dummyend)
 	{
 		CHECK(gFoos.size() == 0);
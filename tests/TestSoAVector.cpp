@@ -0,0 +1,171 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/SoAVector.h"
+
+using namespace cz;
+
+SUITE(SoAVector)
+{
+	TEST(EmptyVector)
+	{
+		SoAVector<int, float> v;
+		CHECK(v.empty());
+		CHECK_EQUAL(0, v.size());
+		CHECK_EQUAL(0, v.capacity());
+		CHECK(v.begin() == v.end());
+		CHECK_EQUAL(0, v.column<0>().size());
+	}
+
+	TEST(push_back)
+	{
+		SoAVector<int, std::string, double> v;
+		for (int i = 0; i < 100; i++)
+			v.push_back(i, std::to_string(i), i * 2.0);
+		v.push_back(std::make_tuple(100, std::string("100"), 200.0));
+
+		CHECK_EQUAL(101, v.size());
+		for (int i = 0; i <= 100; i++)
+		{
+			auto [n, s, d] = v[i];
+			CHECK_EQUAL(i, n);
+			CHECK_EQUAL(std::to_string(i), s);
+			CHECK_EQUAL(i * 2.0, d);
+		}
+
+		// Pushing one of our own elements, when growing
+		SoAVector<std::string> v2;
+		v2.push_back("Hello");
+		while (v2.size() != v2.capacity())
+			v2.push_back("World");
+		v2.push_back(v2.get<0>(0));
+		CHECK_EQUAL("Hello", std::get<0>(v2.back()));
+	}
+
+	TEST(Columns)
+	{
+		SoAVector<float, int, char> v;
+		for (int i = 0; i < 50; i++)
+			v.push_back(float(i), i, char('a' + (i % 26)));
+
+		CHECK_EQUAL(0, (size_t)v.data<0>() % SoAVector<float>::Alignment);
+		CHECK_EQUAL(0, (size_t)v.data<1>() % SoAVector<float>::Alignment);
+		CHECK_EQUAL(0, (size_t)v.data<2>() % SoAVector<float>::Alignment);
+
+		for (float& f : v.column<0>())
+			f *= 2;
+		const auto& cv = v;
+		ArrayView<const int> ints = cv.column<1>();
+		CHECK_EQUAL(50, ints.size());
+		for (int i = 0; i < 50; i++)
+		{
+			CHECK_EQUAL(float(i * 2), cv.get<0>(i));
+			CHECK_EQUAL(i, ints[i]);
+			CHECK_EQUAL(char('a' + (i % 26)), cv.get<2>(i));
+		}
+	}
+
+	TEST(ProxyReferences)
+	{
+		SoAVector<int, std::string> v;
+		v.push_back(1, "One");
+		v.push_back(2, "Two");
+
+		auto [n, s] = v[1];
+		n = 20;
+		s = "Twenty";
+		CHECK_EQUAL(20, v.get<0>(1));
+		CHECK_EQUAL("Twenty", v.get<1>(1));
+
+		// Assigning a whole element through the proxy
+		v[0] = std::make_tuple(10, std::string("Ten"));
+		CHECK(v.front() == std::make_tuple(10, std::string("Ten")));
+
+		int total = 0;
+		for (auto [a, b] : v)
+		{
+			total += a;
+			b += "!";
+		}
+		CHECK_EQUAL(30, total);
+		CHECK_EQUAL("Ten!", v.get<1>(0));
+		CHECK_EQUAL("Twenty!", v.get<1>(1));
+	}
+
+	template<typename V>
+	void checkElements(const V& v, const std::vector<int>& exp)
+	{
+		CHECK_EQUAL(exp.size(), v.size());
+		for (size_t i = 0; i < exp.size(); i++)
+		{
+			CHECK_EQUAL(exp[i], v.template get<0>(i));
+			CHECK_EQUAL(std::to_string(exp[i]), v.template get<1>(i));
+		}
+	}
+
+	TEST(erase)
+	{
+		SoAVector<int, std::string> v;
+		std::vector<int> exp;
+		for (int i = 0; i < 20; i++)
+		{
+			v.push_back(i, std::to_string(i));
+			exp.push_back(i);
+		}
+
+		CHECK_EQUAL(0, v.erase(0));
+		exp.erase(exp.begin());
+		checkElements(v, exp);
+
+		CHECK_EQUAL(5, v.erase(5, 10));
+		exp.erase(exp.begin() + 5, exp.begin() + 10);
+		checkElements(v, exp);
+
+		auto it = v.erase(v.end() - 1);
+		exp.erase(exp.end() - 1);
+		CHECK(it == v.end());
+		checkElements(v, exp);
+
+		v.erase_unordered(1);
+		exp[1] = exp.back();
+		exp.pop_back();
+		checkElements(v, exp);
+
+		v.pop_back();
+		exp.pop_back();
+		checkElements(v, exp);
+
+		v.erase(v.begin(), v.end());
+		CHECK(v.empty());
+	}
+
+	TEST(CopyMove)
+	{
+		SoAVector<int, std::string> v;
+		std::vector<int> exp;
+		for (int i = 0; i < 10; i++)
+		{
+			v.push_back(i, std::to_string(i));
+			exp.push_back(i);
+		}
+
+		SoAVector<int, std::string> v2(v);
+		checkElements(v, exp);
+		checkElements(v2, exp);
+
+		SoAVector<int, std::string> v3(std::move(v2));
+		CHECK(v2.empty());
+		checkElements(v3, exp);
+
+		v2 = v3;
+		checkElements(v2, exp);
+		v3 = std::move(v);
+		CHECK(v.empty());
+		checkElements(v3, exp);
+
+		v3.resize(5);
+		exp.resize(5);
+		checkElements(v3, exp);
+		v3.resize(7);
+		CHECK_EQUAL(0, v3.get<0>(6));
+		CHECK_EQUAL("", v3.get<1>(6));
+	}
+}
@@ -0,0 +1,147 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/UTF8Rope.h"
+#include <sstream>
+
+using namespace cz;
+
+SUITE(UTF8Rope)
+{
+	const char32_t gChars[] = {U'a', U'ç', U'你', U'😀', U'Z', U'é', U' '};
+
+	UTF8String makeText(std::mt19937& rnd, size_t count, std::u32string& expected)
+	{
+		UTF8String s;
+		for (size_t i = 0; i < count; i++)
+		{
+			char32_t c = gChars[rnd() % 7];
+			s += static_cast<uint32_t>(c);
+			expected += c;
+		}
+		return s;
+	}
+
+	void checkRope(const UTF8Rope& rope, const std::u32string& expected)
+	{
+		CHECK_EQUAL(expected.size(), rope.size());
+		CHECK(rope.toString().toUtf32() == expected);
+		CHECK_EQUAL(size_t(rope.toString().sizeBytes()), rope.sizeBytes());
+
+		// AVL trees are never deeper than ~1.44*log2(n)
+		size_t chunks = 0;
+		rope.forEachChunk([&chunks](const char*, size_t bytes) {
+			CHECK(bytes > 0 && bytes <= UTF8Rope::CHUNK_SIZE);
+			chunks++;
+		});
+		CHECK(rope.depth() <= 1.45 * std::log2(double(chunks) + 2) + 1);
+	}
+
+	TEST(Basic)
+	{
+		UTF8Rope rope;
+		CHECK(rope.empty());
+		CHECK(rope.begin() == rope.end());
+		CHECK_EQUAL(0, rope.size());
+
+		rope += "Hello";
+		rope += UTF8String(u8" 你好");
+		rope.insert(5, ",");
+		CHECK(rope.toString() == u8"Hello, 你好");
+		CHECK_EQUAL(9, rope.size());
+		CHECK_EQUAL(uint32_t(U'你'), rope.at(7));
+		CHECK_THROW(rope.at(9), std::out_of_range);
+		CHECK_THROW(rope.insert(10, "x"), std::out_of_range);
+
+		rope.erase(5, 1);
+		CHECK(rope.toString() == u8"Hello 你好");
+		CHECK(rope.substr(6).toString() == u8"你好");
+
+		std::ostringstream ss;
+		ss << rope;
+		CHECK(ss.str() == u8"Hello 你好");
+
+		// Appending to itself
+		rope += rope;
+		CHECK(rope.toString() == u8"Hello 你好Hello 你好");
+	}
+
+	TEST(Iterators)
+	{
+		std::mt19937 rnd(1);
+		std::u32string expected;
+		UTF8Rope rope(makeText(rnd, 10000, expected));
+
+		std::u32string forward;
+		for (uint32_t c : rope)
+			forward += c;
+		CHECK(forward == expected);
+
+		std::u32string backward;
+		for (auto it = rope.end(); it != rope.begin();)
+			backward += *(--it);
+		std::reverse(backward.begin(), backward.end());
+		CHECK(backward == expected);
+
+		auto it = rope.iteratorAt(5000);
+		CHECK_EQUAL(uint32_t(expected[5000]), *it);
+		CHECK(std::find(rope.begin(), rope.end(), uint32_t(U'😀')) != rope.end());
+
+		// Compatible with UTF8String's iterator based constructor
+		UTF8String str(rope.iteratorAt(100), rope.iteratorAt(200));
+		CHECK(str.toUtf32() == expected.substr(100, 100));
+
+		// Same nodes shared in different positions
+		UTF8Rope twice = rope;
+		twice += rope;
+		CHECK(twice.iteratorAt(10) != twice.iteratorAt(10 + rope.size()));
+		size_t count = 0;
+		for (auto i = twice.begin(); i != twice.end(); ++i)
+			count++;
+		CHECK_EQUAL(twice.size(), count);
+	}
+
+	TEST(RandomEdits)
+	{
+		std::mt19937 rnd(1234);
+		std::u32string expected;
+		UTF8Rope rope;
+		for (int i = 0; i < 3000; i++)
+		{
+			size_t pos = rnd() % (expected.size() + 1);
+			switch (rnd() % 4)
+			{
+			case 0:
+			case 1:
+			{
+				std::u32string text;
+				UTF8String s = makeText(rnd, rnd() % ((rnd() % 10) ? 20 : 3000), text);
+				rope.insert(pos, s);
+				expected.insert(pos, text);
+				break;
+			}
+			case 2:
+			{
+				size_t len = rnd() % 100;
+				rope.erase(pos, len);
+				expected.erase(pos, len);
+				break;
+			}
+			case 3:
+			{
+				size_t len = rnd() % 500;
+				UTF8Rope sub = rope.substr(pos, len);
+				CHECK(sub.toString().toUtf32() == expected.substr(pos, len));
+				break;
+			}
+			}
+
+			if (i % 100 == 0)
+				checkRope(rope, expected);
+			if (!expected.empty())
+			{
+				size_t idx = rnd() % expected.size();
+				CHECK_EQUAL(uint32_t(expected[idx]), rope.at(idx));
+			}
+		}
+		checkRope(rope, expected);
+	}
+}
@@ -0,0 +1,384 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/UTF8String.h"
+#include "crazygaze/muc/Filename.h"
+#include <sstream>
+#include <set>
+#include <thread>
+#include <functional>
+#include <cwctype>
+
+using namespace cz;
+
+SUITE(UTF8String)
+{
+	// Builds a string with mixed 1-4 bytes characters, and the expected code points
+	UTF8String makeMixed(int count, std::u32string& expected)
+	{
+		const char32_t chars[] = {U'a', U'ç', U'你', U'😀', U'Z', U'é'};
+		UTF8String s;
+		for (int i = 0; i < count; i++)
+		{
+			char32_t c = chars[(i * 7 + i / 3) % 6];
+			s += static_cast<uint32_t>(c);
+			expected += c;
+		}
+		return s;
+	}
+
+	TEST(at)
+	{
+		for (int count : {0, 1, 10, 63, 64, 65, 200, 5000})
+		{
+			std::u32string expected;
+			UTF8String s = makeMixed(count, expected);
+			CHECK_EQUAL(count, s.size());
+
+			// Random access, in both directions
+			for (int i = count - 1; i >= 0; i -= 3)
+				CHECK_EQUAL(uint32_t(expected[i]), s.at(i));
+			for (int i = 0; i < count; i += 5)
+				CHECK_EQUAL(uint32_t(expected[i]), s.at(i));
+			CHECK_THROW(s.at(count), std::out_of_range);
+		}
+
+		// ASCII
+		UTF8String ascii("Hello World");
+		CHECK_EQUAL(uint32_t('W'), ascii.at(6));
+	}
+
+	TEST(substr)
+	{
+		std::u32string expected;
+		UTF8String s = makeMixed(3000, expected);
+		for (size_t pos : {0, 1, 63, 64, 65, 1000, 2999, 3000})
+		{
+			for (size_t len : {size_t(0), size_t(1), size_t(64), size_t(100), UTF8String::npos})
+			{
+				UTF8String sub = s.substr(pos, len);
+				CHECK(sub.toUtf32() == expected.substr(pos, len));
+			}
+		}
+		CHECK_THROW(s.substr(3001), std::out_of_range);
+		CHECK(s.substr() == s);
+	}
+
+	TEST(IndexInvalidation)
+	{
+		std::u32string expected;
+		UTF8String s = makeMixed(1000, expected);
+		CHECK_EQUAL(uint32_t(expected[999]), s.at(999));
+
+		// Appending keeps the index valid, and it's extended as needed
+		std::u32string expected2;
+		UTF8String tail = makeMixed(500, expected2);
+		s += tail;
+		expected += expected2;
+		CHECK_EQUAL(uint32_t(expected[1499]), s.at(1499));
+		CHECK_EQUAL(uint32_t(expected[500]), s.at(500));
+		CHECK(s.iteratorAt(700) == s.begin() + 700);
+
+		// Replacing the contents invalidates the index
+		s = tail;
+		CHECK_EQUAL(uint32_t(expected2[499]), s.at(499));
+		UTF8String copy = s;
+		CHECK_EQUAL(uint32_t(expected2[250]), copy.at(250));
+		s.clear();
+		CHECK_THROW(s.at(0), std::out_of_range);
+
+		// find/replace use character positions too
+		s = tail;
+		s.replace(100, 1, UTF8String("X"));
+		CHECK_EQUAL(uint32_t('X'), s.at(100));
+		CHECK_EQUAL(size_t(100), s.find(uint32_t('X'), 50));
+		CHECK_EQUAL(uint32_t(expected2[101]), s.at(101));
+	}
+
+	TEST(IndexThreads)
+	{
+		// The index is built lazily from const methods, so concurrent reads need to be safe
+		std::u32string expected;
+		const UTF8String s = makeMixed(5000, expected);
+		const UTF8String copy = s;
+		std::vector<std::thread> threads;
+		std::atomic<int> errors(0);
+		for (int t = 0; t < 4; t++)
+		{
+			threads.emplace_back([&, t]()
+			{
+				const UTF8String& str = (t & 1) ? copy : s;
+				for (size_t i = t; i < expected.size(); i += 7)
+				{
+					if (str.at(i) != uint32_t(expected[i]))
+						errors++;
+				}
+			});
+		}
+		for (auto&& t : threads)
+			t.join();
+		CHECK_EQUAL(0, errors.load());
+	}
+
+	TEST(CopyOnWrite)
+	{
+		// Small strings are kept in the object itself
+		UTF8String small("Hello");
+		UTF8String smallCopy = small;
+		CHECK(small.c_str() != smallCopy.c_str());
+		CHECK(smallCopy == "Hello");
+
+		std::u32string expected;
+		UTF8String a = makeMixed(100, expected);
+		UTF8String b = a;
+		UTF8String c;
+		c = b;
+		// Copies share the buffer until changed
+		CHECK(a.c_str() == b.c_str());
+		CHECK(a.c_str() == c.c_str());
+
+		b += "!";
+		CHECK(a.c_str() != b.c_str());
+		CHECK(a.c_str() == c.c_str());
+		CHECK(a.toUtf32() == expected);
+		CHECK(b.toUtf32() == expected + U"!");
+		CHECK_EQUAL(101, b.size());
+
+		// Setting a shared string doesn't change the others
+		c = "Bye";
+		CHECK(c == "Bye");
+		CHECK(a.toUtf32() == expected);
+		c = a;
+		c.clear();
+		CHECK(c.empty());
+		CHECK(a.toUtf32() == expected);
+		c = a;
+		c.replace(0, 1, UTF8String("X"));
+		CHECK_EQUAL(uint32_t('X'), c.at(0));
+		CHECK_EQUAL(uint32_t(expected[0]), a.at(0));
+
+		// Appending a shared string to itself
+		c = a;
+		c += c;
+		CHECK(c.toUtf32() == expected + expected);
+		CHECK(a.toUtf32() == expected);
+
+		// Moving keeps the buffer
+		const char* ptr = a.c_str();
+		UTF8String d = std::move(a);
+		CHECK(d.c_str() == ptr);
+		CHECK(a.empty());
+
+		// Copies used from different threads
+		std::u32string expectedShared;
+		UTF8String shared = makeMixed(1000, expectedShared);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; t++)
+		{
+			threads.emplace_back([&shared, t]()
+			{
+				for (int i = 0; i < 1000; i++)
+				{
+					UTF8String tmp = shared;
+					if (i % 2)
+						tmp += uint32_t('a' + t);
+				}
+			});
+		}
+		for (auto&& t : threads)
+			t.join();
+		CHECK(shared.toUtf32() == expectedShared);
+	}
+
+	TEST(Capacity)
+	{
+		UTF8String s;
+		CHECK_EQUAL(UTF8String::QUICKBUF_SIZE - 1, s.capacityBytes());
+
+		// reserveBytes is in bytes, like std::string
+		s.reserveBytes(1000);
+		CHECK(s.capacityBytes() >= 1000 && s.capacityBytes() < 1100);
+		const char* ptr = s.c_str();
+		for (int i = 0; i < 1000; i++)
+			s += "a";
+		CHECK(s.c_str() == ptr);
+
+		// Growth is geometric
+		UTF8String g;
+		int reallocations = 0;
+		int capacity = g.capacityBytes();
+		for (int i = 0; i < 100000; i++)
+		{
+			g += uint32_t(U'é');
+			if (g.capacityBytes() != capacity)
+			{
+				CHECK(g.capacityBytes() >= capacity + capacity / 2);
+				capacity = g.capacityBytes();
+				reallocations++;
+			}
+		}
+		CHECK(reallocations < 30);
+		CHECK_EQUAL(200000, g.sizeBytes());
+
+		// reserve and capacity are in characters, assuming the worst case of 4 bytes per character
+		UTF8String c;
+		c.reserve(100);
+		CHECK(c.capacity() >= 100);
+		CHECK(c.capacityBytes() >= 400);
+		ptr = c.c_str();
+		for (int i = 0; i < 100; i++)
+			c += uint32_t(U'😀');
+		CHECK(c.c_str() == ptr);
+	}
+
+	TEST(Concatenation)
+	{
+		UTF8String a("Hello");
+		UTF8String b(" ");
+		UTF8String c(u8"Wörld");
+		CHECK(a + b + c == u8"Hello Wörld");
+		CHECK(a + " " + c + "!" == u8"Hello Wörld!");
+		CHECK_EQUAL(12, (a + " " + c + "!").size());
+		CHECK_EQUAL(13, (a + " " + c + "!").sizeBytes());
+		CHECK(a == "Hello");
+
+		// All combinations of operands
+		CHECK("<" + a + ">" == "<Hello>");
+		CHECK((a + b) + (b + c) == u8"Hello  Wörld");
+		CHECK("[" + (a + "]") == "[Hello]");
+		CHECK(a + (b + c) == u8"Hello Wörld");
+		CHECK(std::wstring(L"Hello Wörld") == (a + b + c).widen());
+		CHECK(std::string(u8"Hello Wörld") == (a + b + c).c_str());
+		std::ostringstream os;
+		os << a + b + c;
+		CHECK(os.str() == u8"Hello Wörld");
+
+		// operator+ returns a UTF8String, so the result can be kept with auto, even if the operands are temporaries
+		auto t = UTF8String("Hello") + " " + c;
+		static_assert(std::is_same_v<decltype(t), UTF8String>);
+		CHECK(t == u8"Hello Wörld");
+
+		// concat calculates the size first, so the result has the exact size
+		UTF8String big(std::string(100, 'x').c_str());
+		UTF8String r = UTF8String::concat(big, "/", big, ".txt");
+		CHECK_EQUAL(205, r.size());
+		CHECK_EQUAL(205, r.capacityBytes());
+		CHECK(r == big + "/" + big + ".txt");
+		CHECK(UTF8String::concat(u8"ö", c) == u8"öWörld");
+
+		// Expressions referencing the string being assigned/appended to
+		UTF8String d("ab");
+		d = d + "-" + d;
+		CHECK(d == "ab-ab");
+		d += "+" + d;
+		CHECK(d == "ab-ab+ab-ab");
+		d = c;
+		d = "<" + d + big + d;
+		CHECK(d.toUtf32() == U"<Wörld" + std::u32string(100, U'x') + U"Wörld");
+
+		// Works with Filename, and when the result type needs to be deduced
+		Filename dir("c:\\dir");
+		Filename file = dir + "\\" + c + ".txt";
+		CHECK(file.getFilename() == u8"Wörld.txt");
+		CHECK(file.getDirectory() == dir + "\\");
+		UTF8String e = a.empty() ? a : a + "!";
+		CHECK(e == "Hello!");
+	}
+
+	TEST(CompareAndCase)
+	{
+		// Byte order is the same as code point order
+		CHECK(UTF8String("a") < UTF8String(u8"é"));
+		CHECK(UTF8String(u8"é") < UTF8String(u8"你"));
+		CHECK(UTF8String(u8"你") < UTF8String(u8"😀"));
+		CHECK(UTF8String("ab") < UTF8String("abc"));
+		CHECK(UTF8String("abc") > "ab");
+		CHECK(UTF8String("abc").compare("abc") == 0);
+		CHECK(UTF8String("abd").compare("abc") > 0);
+		CHECK(UTF8String("") < "a");
+
+		UTF8String s(u8"Hello Wörld! ÇÃO");
+		CHECK(ansiToLower(s) == u8"hello wörld! ÇÃo");
+		CHECK(ansiToUpper(s) == u8"HELLO WöRLD! ÇÃO");
+		CHECK_EQUAL(s.size(), ansiToLower(s).size());
+		CHECK(s.startsWith("Hello"));
+		CHECK(!s.startsWith("hello"));
+		CHECK(s.startsWith(u8"HELLO wö", false));
+		CHECK(!s.startsWith(u8"HELLO wo", false));
+		CHECK(s.equalsNoCase(u8"hello wörld! çãO") == (std::towlower(L'\u00C7') == L'\u00E7'));
+		CHECK(s.equalsNoCase(ansiToUpper(s)));
+		CHECK(!s.equalsNoCase("Hello"));
+	}
+
+#if CZMUC_BENCHMARKS
+	size_t capacityBytes(const std::string& s)
+	{
+		return s.capacity();
+	}
+
+	size_t capacityBytes(const UTF8String& s)
+	{
+		return s.capacityBytes();
+	}
+
+	template<typename S>
+	size_t heapUsage(const std::vector<S>& v)
+	{
+		// Strings with the default capacity are inside the object itself, and shared buffers are counted only once
+		const size_t inlineCapacity = capacityBytes(S());
+		std::set<const char*> buffers;
+		size_t res = 0;
+		for (auto&& s : v)
+		{
+			if (capacityBytes(s) > inlineCapacity && buffers.insert(s.c_str()).second)
+				res += capacityBytes(s) + 1;
+		}
+		return res;
+	}
+
+	TEST(MemoryFootprint)
+	{
+		const int count = 100000;
+		std::u32string tmp;
+		UTF8String big = makeMixed(200, tmp);
+		struct
+		{
+			const char* name;
+			std::function<std::string(int)> make;
+			bool copies;
+		} cases[] = {
+			{"Short (8 bytes)", [](int i) { return "k_" + std::to_string(100000 + i); }, false},
+			{"Medium (40 bytes)", [](int i) { return std::string(32, 'x') + std::to_string(10000000 + i); }, false},
+			{"Copies of 1 string", [&big](int) { return std::string(big.c_str()); }, true}};
+
+		printf("UTF8String vs std::string memory footprint, %d strings (object size %d vs %d):\n", count,
+			   int(sizeof(UTF8String)), int(sizeof(std::string)));
+		for (auto&& c : cases)
+		{
+			std::vector<std::string> stds;
+			std::vector<UTF8String> utf8s;
+			stds.reserve(count);
+			utf8s.reserve(count);
+			std::string src = c.make(0);
+			UTF8String utf8src(src.c_str());
+			for (int i = 0; i < count; i++)
+			{
+				if (c.copies)
+				{
+					stds.push_back(src);
+					utf8s.push_back(utf8src);
+				}
+				else
+				{
+					stds.push_back(c.make(i));
+					utf8s.push_back(UTF8String(stds.back().c_str()));
+				}
+			}
+
+			size_t stdTotal = count * sizeof(std::string) + heapUsage(stds);
+			size_t utf8Total = count * sizeof(UTF8String) + heapUsage(utf8s);
+			printf("    %-20s: std::string %8.2f MB, UTF8String %8.2f MB\n", c.name, stdTotal / (1024.0 * 1024.0),
+				   utf8Total / (1024.0 * 1024.0));
+			CHECK(utf8s.back() == stds.back().c_str());
+		}
+	}
+#endif
+}
@@ -0,0 +1,345 @@
+#include "UnitTestsPCH.h"
+#include "crazygaze/muc/UTF8Utils.h"
+#include "crazygaze/muc/UTF8String.h"
+#include <cwctype>
+
+using namespace cz;
+
+SUITE(UTF8Utils)
+{
+	using detail::UTF8Kernel;
+
+	const UTF8Kernel gKernels[] = {UTF8Kernel::Scalar, UTF8Kernel::SSE, UTF8Kernel::AVX2};
+	const char* gKernelNames[] = {"Scalar", "SSE", "AVX2"};
+
+	// Some text with 1, 2, 3 and 4 bytes sequences
+	const char* gMixed = u8"Hello! Olá, ação. Привет. 你好，世界。 😀👍 The end.";
+
+	std::string makeText(const char* pattern, size_t size)
+	{
+		std::string res;
+		res.reserve(size + 64);
+		while (res.size() < size)
+			res += pattern;
+		return res;
+	}
+
+	TEST(Validate)
+	{
+		const std::vector<std::string> valid = {
+			"", "a", "Hello World", gMixed,
+			"\xC2\x80", "\xDF\xBF", // 2 bytes limits
+			"\xE0\xA0\x80", "\xEF\xBF\xBF", "\xED\x9F\xBF", "\xEE\x80\x80", // 3 bytes limits, around surrogates
+			"\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF" // 4 bytes limits
+		};
+
+		const std::vector<std::string> invalid = {
+			"\x80", "\xBF", "a\x80" "b", // Stray continuation
+			"\xC0\x80", "\xC1\xBF", // Overlong 2 bytes
+			"\xE0\x80\x80", "\xE0\x9F\xBF", // Overlong 3 bytes
+			"\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF", // Overlong 4 bytes
+			"\xED\xA0\x80", "\xED\xBF\xBF", // Surrogates
+			"\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", // Above U+10FFFF
+			"\xC2", "\xE0\xA0", "\xF0\x90\x80", // Truncated
+			"\xC2" "a", "\xE0\xA0" "a", "\xF0\x90\x80" "a", // Too short
+			"\xC2\x80\x80", "\xE0\xA0\x80\x80" // Too long
+		};
+
+		for (int k = 0; k < 3; k++)
+		{
+			if (!detail::isUTF8KernelSupported(gKernels[k]))
+				continue;
+
+			// Test at different positions in the input, so we cross SIMD blocks boundaries
+			for (size_t prefix = 0; prefix < 70; prefix++)
+			{
+				std::string pre(prefix, 'x');
+				for (auto&& s : valid)
+				{
+					std::string str = pre + s;
+					CHECK(detail::utf8Validate(gKernels[k], str.c_str(), str.size()));
+					str += pre;
+					CHECK(detail::utf8Validate(gKernels[k], str.c_str(), str.size()));
+				}
+				for (auto&& s : invalid)
+				{
+					std::string str = pre + s;
+					CHECK(!detail::utf8Validate(gKernels[k], str.c_str(), str.size()));
+					str += pre;
+					CHECK(!detail::utf8Validate(gKernels[k], str.c_str(), str.size()));
+				}
+			}
+		}
+	}
+
+	TEST(RandomValidateAndCount)
+	{
+		std::mt19937 rnd(1234);
+		std::string text = makeText(gMixed, 4096);
+		for (int i = 0; i < 2000; i++)
+		{
+			std::string str = text.substr(rnd() % 64, rnd() % 300);
+			// Randomly corrupt some of the strings
+			if (rnd() % 2)
+				str[rnd() % (str.size() + 1)] = static_cast<char>(rnd());
+
+			bool expectedValid = detail::utf8Validate(UTF8Kernel::Scalar, str.data(), str.size());
+			size_t expectedCount = detail::utf8CountCodePoints(UTF8Kernel::Scalar, str.data(), str.size());
+			for (int k = 1; k < 3; k++)
+			{
+				if (!detail::isUTF8KernelSupported(gKernels[k]))
+					continue;
+				CHECK_EQUAL(expectedValid, detail::utf8Validate(gKernels[k], str.data(), str.size()));
+				CHECK_EQUAL(expectedCount, detail::utf8CountCodePoints(gKernels[k], str.data(), str.size()));
+			}
+		}
+
+		std::string big = makeText(gMixed, 100000);
+		CHECK_EQUAL(UTF8String(big.c_str()).toUtf32().size(), utf8CountCodePoints(big.data(), big.size()));
+	}
+
+	TEST(Transcoding)
+	{
+		const std::u32string expected32 = U"Hello! Olá, ação. Привет. 你好，世界。 😀👍 The end.";
+		const std::u16string expected16 = u"Hello! Olá, ação. Привет. 你好，世界。 😀👍 The end.";
+
+		for (size_t prefix = 0; prefix < 40; prefix++)
+		{
+			std::string utf8 = std::string(prefix, 'x') + gMixed + std::string(prefix, 'y');
+			std::u32string utf32 = std::u32string(prefix, U'x') + expected32 + std::u32string(prefix, U'y');
+			std::u16string utf16 = std::u16string(prefix, u'x') + expected16 + std::u16string(prefix, u'y');
+
+			UTF8String s(utf8.c_str());
+			CHECK_EQUAL(utf32.size(), size_t(s.size()));
+			CHECK(s.toUtf32() == utf32);
+			CHECK(s.toUtf16() == utf16);
+			CHECK(UTF8String(utf16) == s);
+			CHECK_EQUAL(utf32.size(), size_t(UTF8String(utf16).size()));
+			CHECK(UTF8String(s.widen()) == s);
+			CHECK_EQUAL(utf8.size(), utf8LengthFromUtf16(utf16.data(), utf16.size()));
+			CHECK_EQUAL(utf8.size(), utf8LengthFromUtf32(utf32.data(), utf32.size()));
+			CHECK_EQUAL(utf16.size(), utf16LengthFromUtf8(utf8.data(), utf8.size()));
+
+			std::string back(utf8.size(), 0);
+			CHECK_EQUAL(utf8.size(), utf32ToUtf8(utf32.data(), utf32.size(), &back[0]));
+			CHECK(back == utf8);
+		}
+	}
+
+	TEST(InvalidTranscoding)
+	{
+		// Unpaired surrogates and invalid code points are replaced
+		const char16_t bad16[] = {u'a', 0xD800, u'b', 0xDC00, 0xD800};
+		std::string expected = "a\xEF\xBF\xBD" "b\xEF\xBF\xBD\xEF\xBF\xBD";
+		CHECK_EQUAL(expected.size(), utf8LengthFromUtf16(bad16, 5));
+		CHECK(UTF8String(std::u16string(bad16, 5)) == expected.c_str());
+
+		const char32_t bad32[] = {U'a', 0xD800, 0x110000, 0xFFFFFFFF};
+		expected = "a\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD";
+		CHECK_EQUAL(expected.size(), utf8LengthFromUtf32(bad32, 4));
+		std::string out(expected.size(), 0);
+		CHECK_EQUAL(expected.size(), utf32ToUtf8(bad32, 4, &out[0]));
+		CHECK(out == expected);
+
+		// Truncated UTF-8 never writes more than the calculated length
+		const char* truncated = "ab\xF0\x90\x80";
+		size_t len = utf16LengthFromUtf8(truncated, 5);
+		std::vector<char16_t> out16(len);
+		size_t written = utf8ToUtf16(truncated, 5, out16.data());
+		CHECK(written <= len);
+		CHECK_EQUAL(3, written);
+		CHECK_EQUAL(0xFFFD, out16[2]);
+
+		CHECK(UTF8String(gMixed).isValid());
+		CHECK(!UTF8String(truncated).isValid());
+
+		// Overlong encodings and invalid lead bytes never decode to a real code point (e.g: U+0000)
+		const char* overlong[] = {"\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xF0\x80\x80\x80", "\xF5\x80", "\xFF"};
+		for (auto&& s : overlong)
+		{
+			size_t size = strlen(s);
+			std::vector<char32_t> out32(utf32LengthFromUtf8(s, size));
+			size_t n = utf8ToUtf32(s, size, out32.data());
+			CHECK(n >= 1);
+			for (size_t i = 0; i < n; i++)
+				CHECK_EQUAL(0xFFFD, out32[i]);
+			std::vector<char16_t> out16(utf16LengthFromUtf8(s, size));
+			n = utf8ToUtf16(s, size, out16.data());
+			CHECK(n >= 1);
+			for (size_t i = 0; i < n; i++)
+				CHECK_EQUAL(0xFFFD, out16[i]);
+		}
+	}
+
+#if CZMUC_BENCHMARKS
+	template<typename F>
+	double measureGBs(size_t bytes, F&& f)
+	{
+		using Clock = std::chrono::high_resolution_clock;
+		const int loops = 10;
+		double best = 1e9;
+		for (int i = 0; i < loops; i++)
+		{
+			auto start = Clock::now();
+			f();
+			best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+		}
+		return (bytes / best) / (1024.0 * 1024.0 * 1024.0);
+	}
+
+	TEST(Benchmark)
+	{
+		const size_t size = 4 * 1024 * 1024;
+		struct
+		{
+			const char* name;
+			std::string text;
+		} inputs[] = {
+			{"ASCII", makeText("The quick brown fox jumps over the lazy dog. ", size)},
+			{"Mixed", makeText(gMixed, size)},
+			{"CJK", makeText(u8"你好，世界。我们的数据都是中文字符。", size)}
+		};
+
+		printf("UTF-8 throughput (GB/s):\n");
+		for (auto&& input : inputs)
+		{
+			const std::string& text = input.text;
+			CHECK(utf8Validate(text.data(), text.size()));
+			for (int k = 0; k < 3; k++)
+			{
+				if (!detail::isUTF8KernelSupported(gKernels[k]))
+					continue;
+				volatile bool valid = false;
+				volatile size_t count = 0;
+				double validateSpeed = measureGBs(text.size(), [&]() {
+					valid = detail::utf8Validate(gKernels[k], text.data(), text.size());
+				});
+				double countSpeed = measureGBs(text.size(), [&]() {
+					count = detail::utf8CountCodePoints(gKernels[k], text.data(), text.size());
+				});
+				CHECK(valid);
+				printf("    %-5s %-6s: validate %6.2f, count %6.2f\n", input.name, gKernelNames[k], validateSpeed,
+					   countSpeed);
+			}
+
+			std::u16string utf16(utf16LengthFromUtf8(text.data(), text.size()), 0);
+			std::string utf8(text.size(), 0);
+			double toUtf16Speed = measureGBs(text.size(), [&]() {
+				utf8ToUtf16(text.data(), text.size(), &utf16[0]);
+			});
+			double fromUtf16Speed = measureGBs(text.size(), [&]() {
+				utf16ToUtf8(utf16.data(), utf16.size(), &utf8[0]);
+			});
+			CHECK(utf8 == text);
+			printf("    %-5s UTF-8 -> UTF-16 %6.2f, UTF-16 -> UTF-8 %6.2f\n", input.name, toUtf16Speed,
+				   fromUtf16Speed);
+		}
+	}
+#endif
+
+	TEST(CaseFolding)
+	{
+		std::mt19937 rnd(4321);
+		const char* chars = "aZzA@[`{09 \x80\xFF";
+		for (int i = 0; i < 500; i++)
+		{
+			// Random bytes around the letters range boundaries, with random sizes and alignments
+			std::string str(rnd() % 100, ' ');
+			for (auto&& c : str)
+				c = (rnd() % 4) ? static_cast<char>(rnd()) : chars[rnd() % 12];
+			size_t offset = rnd() % 8;
+			std::string src = std::string(offset, 'x') + str;
+
+			std::string lower(src.size(), 0), upper(src.size(), 0);
+			asciiToLower(src.data() + offset, str.size(), &lower[0]);
+			asciiToUpper(src.data() + offset, str.size(), &upper[0]);
+			for (size_t j = 0; j < str.size(); j++)
+			{
+				uint8_t c = str[j];
+				CHECK_EQUAL(static_cast<char>((c >= 'A' && c <= 'Z') ? c + 32 : c), lower[j]);
+				CHECK_EQUAL(static_cast<char>((c >= 'a' && c <= 'z') ? c - 32 : c), upper[j]);
+			}
+
+			// Mismatch, with a difference that is only a case difference
+			CHECK_EQUAL(str.size(), asciiMismatchNoCase(src.data() + offset, upper.data(), str.size()));
+			if (str.size())
+			{
+				size_t pos = rnd() % str.size();
+				upper[pos] = (upper[pos] == '#') ? '$' : '#';
+				CHECK_EQUAL(pos, asciiMismatchNoCase(src.data() + offset, upper.data(), str.size()));
+			}
+		}
+
+		// In place
+		std::string inPlace = "Hello World! ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		asciiToLower(inPlace.data(), inPlace.size(), &inPlace[0]);
+		CHECK(inPlace == "hello world! abcdefghijklmnopqrstuvwxyz");
+	}
+
+	TEST(EqualsNoCase)
+	{
+		auto equals = [](const std::string& a, const std::string& b)
+		{
+			return utf8EqualsNoCase(a.data(), a.size(), b.data(), b.size());
+		};
+		auto startsWith = [](const std::string& a, const std::string& b)
+		{
+			return utf8StartsWithNoCase(a.data(), a.size(), b.data(), b.size());
+		};
+
+		std::string longStr = makeText("The Quick Brown Fox. ", 100);
+		std::string longUpper = longStr;
+		asciiToUpper(longStr.data(), longStr.size(), &longUpper[0]);
+		CHECK(equals(longStr, longUpper));
+		CHECK(!equals(longStr, longUpper + "X"));
+		CHECK(!equals(longStr, longUpper.substr(1)));
+		CHECK(startsWith(longStr, longUpper.substr(0, 50)));
+		CHECK(startsWith(longStr, ""));
+		CHECK(!startsWith(longStr.substr(0, 50), longUpper));
+		CHECK(equals("", ""));
+		CHECK(!equals("a", "b"));
+		CHECK(!equals("@", "`")); // Differ by 0x20, but are not letters
+
+		// Non-ASCII characters are compared exactly if they are equal, and by code point otherwise
+		std::string mixed = longStr + u8"ação" + longStr;
+		CHECK(equals(mixed, longUpper + u8"ação" + longUpper));
+		CHECK(!equals(mixed, longUpper + u8"acao" + longUpper));
+		CHECK(!equals(mixed, longUpper + u8"açã" + longUpper));
+		CHECK(startsWith(mixed, longUpper + u8"aç"));
+		CHECK(!startsWith(mixed, longUpper + u8"ac"));
+
+		// Non-ASCII case folding depends on the C library locale support
+		bool unicodeFolding = std::towlower(L'\u00C4') == L'\u00E4';
+		CHECK_EQUAL(unicodeFolding, equals(longStr + u8"ÄÇ", longUpper + u8"äç"));
+		CHECK_EQUAL(unicodeFolding, startsWith(u8"ÄÇÃO", u8"äç"));
+	}
+
+#if CZMUC_BENCHMARKS
+	TEST(CaseBenchmark)
+	{
+		std::string text = makeText("Some Argument=Value, AnotherArgument=Another Value. ", 1024 * 1024);
+		std::string upper = text;
+		std::string dst = text;
+		asciiToUpper(text.data(), text.size(), &upper[0]);
+
+		volatile bool res = false;
+		double simdLower = measureGBs(text.size(), [&]() { asciiToLower(text.data(), text.size(), &dst[0]); });
+		double scalarLower = measureGBs(text.size(), [&]() {
+			for (size_t i = 0; i < text.size(); i++)
+				dst[i] = static_cast<char>(tolower(static_cast<unsigned char>(text[i])));
+		});
+		double simdEquals = measureGBs(text.size(), [&]() {
+			res = utf8EqualsNoCase(text.data(), text.size(), upper.data(), upper.size());
+		});
+		double scalarEquals = measureGBs(text.size(), [&]() {
+			bool eq = true;
+			for (size_t i = 0; i < text.size() && eq; i++)
+				eq = tolower(static_cast<unsigned char>(text[i])) == tolower(static_cast<unsigned char>(upper[i]));
+			res = eq;
+		});
+		CHECK(res);
+		printf("ASCII case (GB/s): tolower %6.2f (scalar %6.2f), equals no case %6.2f (scalar %6.2f)\n", simdLower,
+			   scalarLower, simdEquals, scalarEquals);
+	}
+#endif
+}
@@ -17,6 +17,12 @@
 #include <inttypes.h>
 #include <map>
 
+// Benchmarks are slow and print their results, so they are only built if explicitly enabled with the
+// CZMUC_Benchmarks CMake option
+#ifndef CZMUC_BENCHMARKS
+	#define CZMUC_BENCHMARKS 0
+#endif
+
 //
 // UnitTest++
 //
@@ -37,6 +43,7 @@
 #include "crazygaze/muc/RingBuffer.h"
 #include "crazygaze/muc/TimerQueue.h"
 #include "crazygaze/muc/QuickVector.h"
+#include "crazygaze/muc/MonotonicArena.h"
 #include "crazygaze/muc/ArrayView.h"
 #include "crazygaze/muc/Logging.h"
 